@@ -0,0 +1,123 @@
+#! /bin/sh
+# A script to time FBP3DRP with different numbers of threads, and to check
+# that the result does not depend on timing.
+#
+#  Copyright (C) 2018, University College London
+#  This file is part of STIR.
+#
+#  This file is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU Lesser General Public License as published by
+#  the Free Software Foundation; either version 2.1 of the License, or
+#  (at your option) any later version.
+
+#  This file is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU Lesser General Public License for more details.
+#
+#  See STIR/LICENSE.txt for details
+#
+# This uses the simulated data of run_test_simulate_and_recon.sh, so run
+# that first. FBP3DRP has to be compiled with OpenMP support for the number
+# of threads to make a difference.
+
+# Scripts should exit with error code when a test fails:
+if [ -n "$TRAVIS" ]; then
+    # The code runs inside Travis
+    set -e
+fi
+
+#
+# Options
+#
+NUM_THREADS_LIST="1 2 4 8"
+
+while test `expr -- "$1" : "--.*"` -gt 0
+do
+
+  if test "$1" = "--threads"
+  then
+    NUM_THREADS_LIST="$2"
+    shift 1
+  elif test "$1" = "--help"
+  then
+    echo "Usage: `basename $0` [--threads \"1 2 4 8\"] [install_dir]"
+    echo "(where [] means that an argument is optional)"
+    echo "See README.txt for more info."
+    exit 1
+  else
+    echo Warning: Unknown option "$1"
+    echo rerun with --help for more info.
+    exit 1
+  fi
+
+  shift 1
+
+done
+
+if [ $# -eq 1 ]; then
+  echo "Prepending $1 to your PATH for the duration of this script."
+  PATH=$1:$PATH
+fi
+
+command -v FBP3DRP >/dev/null 2>&1 || { echo "FBP3DRP not found or not executable. Aborting." >&2; exit 1; }
+echo "Using `command -v FBP3DRP`"
+
+if [ ! -r my_precorrected_sino.hs ]; then
+  echo "my_precorrected_sino.hs not found. Run run_test_simulate_and_recon.sh first." >&2
+  exit 1
+fi
+
+# first need to set this to the C locale, as this is what the STIR utilities use
+# otherwise, awk might interpret floating point numbers incorrectly
+LC_ALL=C
+export LC_ALL
+
+error_log_files=""
+reference_image=""
+
+echo "threads  run  wall-clock time (s)"
+for num_threads in ${NUM_THREADS_LIST}; do
+  for run in 1 2; do
+    output_filename=my_FBP3DRP_scaling_t${num_threads}_r${run}
+    parfile=${output_filename}.par
+    sed -e "s/output filename prefix *:=.*/output filename prefix := ${output_filename}/" \
+      FBP3DRP_test_sim.par > ${parfile}
+
+    start_time=`date +%s.%N`
+    OMP_NUM_THREADS=${num_threads} FBP3DRP ${parfile} > ${output_filename}.log 2>&1
+    if [ $? -ne 0 ]; then
+      echo "Error running reconstruction. CHECK RECONSTRUCTION LOG ${output_filename}.log"
+      error_log_files="${error_log_files} ${output_filename}.log"
+      break
+    fi
+    end_time=`date +%s.%N`
+    echo ${num_threads} ${run} ${start_time} ${end_time} | awk '{ printf("%7d  %3d  %.2f\n", $1, $2, $4-$3) }'
+  done
+
+  # repeated runs with the same number of threads should give identical results
+  if cmp -s my_FBP3DRP_scaling_t${num_threads}_r1.v my_FBP3DRP_scaling_t${num_threads}_r2.v; then :; else
+    echo "RESULTS DIFFER BETWEEN RUNS WITH ${num_threads} THREADS"
+    error_log_files="${error_log_files} my_FBP3DRP_scaling_t${num_threads}_r2.log"
+  fi
+
+  # different numbers of threads add the partial images in a different order,
+  # so we can only expect results to be close
+  if [ -z "${reference_image}" ]; then
+    reference_image=my_FBP3DRP_scaling_t${num_threads}_r1.hv
+  else
+    compare_image ${reference_image} my_FBP3DRP_scaling_t${num_threads}_r1.hv > my_FBP3DRP_scaling_compare_t${num_threads}.log 2>&1
+    if [ $? -ne 0 ]; then
+      echo "RESULTS DIFFER TOO MUCH FROM ${reference_image}. CHECK my_FBP3DRP_scaling_compare_t${num_threads}.log"
+      error_log_files="${error_log_files} my_FBP3DRP_scaling_compare_t${num_threads}.log"
+    fi
+  fi
+done
+
+if [ -z "${error_log_files}" ]; then
+ echo "All tests OK!"
+ echo "You can remove all output using \"rm -f my_*\""
+else
+ echo "There were errors. Check ${error_log_files}"
+ exit 1
+fi
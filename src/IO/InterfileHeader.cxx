@@ -566,6 +566,11 @@ InterfilePDFSHeader::InterfilePDFSHeader()
   add_key("applied corrections",
     KeyArgument::LIST_OF_ASCII, &applied_corrections);
 
+  // STIR extension: read the data via ProjDataFromMemoryMappedFile
+  memory_mapped_data_access = false;
+  add_key("memory mapped data access",
+          &memory_mapped_data_access);
+
 }
 
 void InterfilePDFSHeader::resize_segments_and_set()
@@ -42,6 +42,7 @@
 #include "stir/CartesianCoordinate3D.h"
 #include "stir/VoxelsOnCartesianGrid.h"
 #include "stir/ProjDataFromStream.h"
+#include "stir/ProjDataFromMemoryMappedFile.h"
 #include "stir/ProjDataInfoCylindricalArcCorr.h"
 #include "stir/Scanner.h"
 #include "stir/Succeeded.h"
@@ -648,6 +649,18 @@ read_interfile_PDFS(istream& input,
        return 0;
      }
 
+   if (hdr.memory_mapped_data_access)
+     return new ProjDataFromMemoryMappedFile(hdr.get_exam_info_sptr(),
+                                             hdr.data_info_ptr->create_shared_clone(),
+                                             full_data_file_name,
+                                             data_in,
+                                             hdr.data_offset_each_dataset[0],
+                                             hdr.segment_sequence,
+                                             hdr.storage_order,
+                                             hdr.type_of_numbers,
+                                             hdr.file_byte_order,
+                                             static_cast<float>(hdr.image_scaling_factors[0][0]));
+
    return new ProjDataFromStream(hdr.get_exam_info_sptr(),
 				 hdr.data_info_ptr->create_shared_clone(),
 				 data_in,
@@ -43,6 +43,8 @@
 #include <algorithm>
 #include "stir/IO/interfile.h"
 #include "stir/info.h"
+#include "stir/is_null_ptr.h"
+#include <vector>
 
 #ifdef STIR_OPENMP
 #include <omp.h>
@@ -311,11 +313,15 @@ actual_reconstruct(shared_ptr<DiscretisedDensity<3,float> > const & density_ptr)
     
   set_num_threads();
 #ifdef STIR_OPENMP
-  shared_ptr<DiscretisedDensity<3,float> > empty_density_ptr(density_ptr->clone());
+  // one image per thread, allocated when the thread first needs it.
+  // Views are distributed statically and the images are added in a fixed order
+  // afterwards, such that the result does not depend on timing.
+  std::vector<shared_ptr<DiscretisedDensity<3,float> > >
+    omp_density_sptrs(get_max_num_threads());
 #endif
 
 #ifdef STIR_OPENMP
-#pragma omp parallel for shared(empty_density_ptr) schedule(dynamic)
+#pragma omp parallel for schedule(static)
 #endif
   for (int view_num=proj_data_ptr->get_min_view_num(); view_num <= proj_data_ptr->get_max_view_num(); ++view_num) 
   {         
@@ -361,29 +367,25 @@ actual_reconstruct(shared_ptr<DiscretisedDensity<3,float> > const & density_ptr)
     display( viewgrams,viewgrams.find_max(),"Ramp filter");
 
 #ifdef STIR_OPENMP 
-  //clone density_ptr and backproject    
-  shared_ptr<DiscretisedDensity<3,float> > omp_density_ptr(empty_density_ptr->clone());
+    // backproject into the image of this thread
+    shared_ptr<DiscretisedDensity<3,float> >& omp_density_sptr =
+      omp_density_sptrs[omp_get_thread_num()];
+    if (is_null_ptr(omp_density_sptr))
+      omp_density_sptr.reset(density_ptr->get_empty_copy());
            
-    back_projector_sptr->back_project(*omp_density_ptr, viewgrams);
-#pragma omp critical(FBP2D_REDUCTION)
-    {	//reduction
-      
-      DiscretisedDensity<3,float>::full_iterator density_iter = density_ptr->begin_all();
-      DiscretisedDensity<3,float>::full_iterator density_end = density_ptr->end_all();
-      DiscretisedDensity<3,float>::full_iterator omp_density_iter = omp_density_ptr->begin_all();
-      
-      while (density_iter!= density_end)
-	{
-	  *density_iter += (*omp_density_iter);
-	  ++density_iter;
-	  ++omp_density_iter;
-	}
-    }
+    back_projector_sptr->back_project(*omp_density_sptr, viewgrams);
 #else
     //  and backproject
     back_projector_sptr->back_project(*density_ptr, viewgrams);
 #endif
   } 
+
+#ifdef STIR_OPENMP
+  // reduction, adding the images in order of thread number
+  for (std::size_t i=0; i<omp_density_sptrs.size(); ++i)
+    if (!is_null_ptr(omp_density_sptrs[i]))
+      *density_ptr += *omp_density_sptrs[i];
+#endif
  
   // Normalise the image
   const ProjDataInfoCylindrical& proj_data_info_cyl =
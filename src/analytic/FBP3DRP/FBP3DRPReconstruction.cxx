@@ -98,7 +98,13 @@
 #include "stir/recon_buildblock/BackProjectorByBinUsingInterpolation.h"
 #include "stir/recon_buildblock/ForwardProjectorByBinUsingRayTracing.h"
 #include "stir/IO/read_from_file.h"
+#include "stir/is_null_ptr.h"
+#include "stir/num_threads.h"
 //#include "stir/mash_views.h"
+#include <boost/format.hpp>
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
 
 #include <algorithm>
 #include <fstream>
@@ -125,6 +131,33 @@ START_NAMESPACE_STIR
 // should be private member, TODO
 static ofstream full_log;
 
+// full_log is shared between the threads processing different views,
+// so we write to it in a critical section
+static void write_to_full_log(const std::string& line)
+{
+#ifdef STIR_OPENMP
+#pragma omp critical(FBP3DRP_FULL_LOG)
+#endif
+  full_log << line << endl;
+}
+
+#if defined(STIR_OPENMP) && !defined(NRFFT)
+// add the images back projected by the threads to image, and set them to 0 for the next segment
+static void add_and_clear_partial_images(VoxelsOnCartesianGrid<float>& image,
+                                         const std::vector<shared_ptr<VoxelsOnCartesianGrid<float> > >& partial_image_sptrs)
+{
+  // add in a fixed order, such that the result is reproducible
+#pragma omp parallel for schedule(static)
+  for (int z=image.get_min_z(); z<=image.get_max_z(); ++z)
+    for (std::size_t i=0; i<partial_image_sptrs.size(); ++i)
+      if (!is_null_ptr(partial_image_sptrs[i]))
+        {
+          image[z] += (*partial_image_sptrs[i])[z];
+          (*partial_image_sptrs[i])[z].fill(0);
+        }
+}
+#endif
+
 // terribly ugly. can be replaced using LORCoordinates stuff (TODO)
 static void find_rmin_rmax(int& rmin, int& rmax, 
                            const ProjDataInfoCylindrical& proj_data_info_cyl,
@@ -661,70 +694,98 @@ void FBP3DRPReconstruction::do_3D_Reconstruction(
   shared_ptr<DataSymmetriesForViewSegmentNumbers> symmetries_sptr(
 								  back_projector_sptr->get_symmetries_used()->clone());
 
+  set_num_threads();
+#if defined(STIR_OPENMP) && !defined(NRFFT)
+  // one image per thread, allocated when the thread needs it
+  std::vector<shared_ptr<VoxelsOnCartesianGrid<float> > > partial_image_sptrs(get_max_num_threads());
+#endif
+
   for (int seg_num= -max_segment_num_to_process; seg_num <= max_segment_num_to_process; seg_num++) 
   {
+    std::vector<ViewSegmentNumbers> vs_nums_to_process;
+    for (int view_num=proj_data_ptr->get_min_view_num(); view_num <= proj_data_ptr->get_max_view_num(); ++view_num)
+      {
+        const ViewSegmentNumbers vs_num(view_num, seg_num);
+        if (symmetries_sptr->is_basic(vs_num))
+          vs_nums_to_process.push_back(vs_num);
+      }
+    // some segment_nums might not need any processing because of the symmetries
+    if (vs_nums_to_process.empty())
+      continue;
 
-    // a bool value that will be used to determine if we are starting processing for this segment
-    bool first_view_in_segment = true;
-        
     const int orig_min_axial_pos_num = proj_data_ptr->get_min_axial_pos_num(seg_num);
     const int orig_max_axial_pos_num = proj_data_ptr->get_max_axial_pos_num(seg_num);
-            
-    for (int view_num=proj_data_ptr->get_min_view_num(); view_num <= proj_data_ptr->get_max_view_num(); ++view_num) {         
-      const ViewSegmentNumbers vs_num(view_num, seg_num);
-      if (!symmetries_sptr->is_basic(vs_num))
-	continue;
-
     const int new_min_axial_pos_num = 
       proj_data_info_with_missing_data_sptr->get_min_axial_pos_num(seg_num);
     const int new_max_axial_pos_num = 
       proj_data_info_with_missing_data_sptr->get_max_axial_pos_num(seg_num);
 
-      if (first_view_in_segment)
-	{
-	  full_log << "\n--------------------------------\n";
-	  full_log << "PROCESSING SEGMENT  No " << seg_num << endl ;
+    full_log << "\n--------------------------------\n";
+    full_log << "PROCESSING SEGMENT  No " << seg_num << endl ;
 	  
-	  full_log << "Average delta= " <<  input_proj_data_info_cyl().get_average_ring_difference(seg_num)
-		   << " with span= " << input_proj_data_info_cyl().get_max_ring_difference(seg_num) - input_proj_data_info_cyl().get_min_ring_difference(seg_num) +1
-		   << " and extended axial position numbers: min= " << new_min_axial_pos_num << " and max= " << new_max_axial_pos_num  <<endl;
-	  
-	  first_view_in_segment = false;
-	}
-
-      full_log << "\n*************************************************************";
-      full_log << "\n        Processing view " << vs_num.view_num()
-	       << " of segment " << vs_num.segment_num() << endl;
-	      
-      full_log << "\n  - Getting related viewgrams"  << endl;
- 
-      RelatedViewgrams<float> viewgrams = 
-	proj_data_ptr->get_related_viewgrams(vs_num, symmetries_sptr);
-        
-      do_process_viewgrams(
-			   viewgrams,
-			   new_min_axial_pos_num, new_max_axial_pos_num, orig_min_axial_pos_num, orig_max_axial_pos_num,
-			   image);
- 
-                 
-    }    
-    // do some logging etc, but only when this segment had any processing
-    // (some segment_nums might not because of the symmetries)
-    if (!first_view_in_segment)
+    full_log << "Average delta= " <<  input_proj_data_info_cyl().get_average_ring_difference(seg_num)
+             << " with span= " << input_proj_data_info_cyl().get_max_ring_difference(seg_num) - input_proj_data_info_cyl().get_min_ring_difference(seg_num) +1
+             << " and extended axial position numbers: min= " << new_min_axial_pos_num << " and max= " << new_max_axial_pos_num  <<endl;
+
+    // the viewgrams will be grown to this range in do_grow3D_viewgram
+    do_colsher_filter_set_up(seg_num,
+                             max(new_max_axial_pos_num, orig_max_axial_pos_num) -
+                             min(new_min_axial_pos_num, orig_min_axial_pos_num) + 1);
+
+    /* Views are processed in parallel. They are distributed over the threads
+       in a fixed way (static schedule) and every thread back projects into its
+       own image. These are added in a fixed order after the loop. The result
+       therefore does not depend on timing (but it can depend on the number of
+       threads due to rounding errors).
+    */
+#if defined(STIR_OPENMP) && !defined(NRFFT)
+#pragma omp parallel for schedule(static) shared(symmetries_sptr, vs_nums_to_process, partial_image_sptrs, image)
+#endif
+    // note: older versions of openmp need an int as loop
+    for (int i=0; i<static_cast<int>(vs_nums_to_process.size()); ++i)
       {
-	full_log << "\n*************************************************************";
-	full_log << "\nEnd of this segment. Current image values:\n"
-		 << "Min= " << image.find_min()
-		 << " Max = " << image.find_max()
-		 << " Sum = " << image.sum() << endl;
+        const ViewSegmentNumbers vs_num = vs_nums_to_process[i];
+        write_to_full_log(boost::str(boost::format("\n*************************************************************\n"
+                                                   "        Processing view %1% of segment %2%\n\n"
+                                                   "  - Getting related viewgrams")
+                                     % vs_num.view_num() % vs_num.segment_num()));
+
+        RelatedViewgrams<float> viewgrams;
+#ifdef STIR_OPENMP
+#pragma omp critical(FBP3DRP_GET_VIEWGRAMS)
+#endif
+        viewgrams = proj_data_ptr->get_related_viewgrams(vs_num, symmetries_sptr);
+
+#if defined(STIR_OPENMP) && !defined(NRFFT)
+        shared_ptr<VoxelsOnCartesianGrid<float> >& partial_image_sptr =
+          partial_image_sptrs[omp_get_thread_num()];
+        if (is_null_ptr(partial_image_sptr))
+          partial_image_sptr.reset(image.get_empty_voxels_on_cartesian_grid());
+        VoxelsOnCartesianGrid<float>& image_for_this_view = *partial_image_sptr;
+#else
+        VoxelsOnCartesianGrid<float>& image_for_this_view = image;
+#endif
+        do_process_viewgrams(
+                             viewgrams,
+                             new_min_axial_pos_num, new_max_axial_pos_num, orig_min_axial_pos_num, orig_max_axial_pos_num,
+                             image_for_this_view);
+      }
+#if defined(STIR_OPENMP) && !defined(NRFFT)
+    add_and_clear_partial_images(image, partial_image_sptrs);
+#endif
+
+    full_log << "\n*************************************************************";
+    full_log << "\nEnd of this segment. Current image values:\n"
+             << "Min= " << image.find_min()
+             << " Max = " << image.find_max()
+             << " Sum = " << image.sum() << endl;
 #ifndef PARALLEL
     if(save_intermediate_files && !_disable_output){
-	  char *file = new char[output_filename_prefix.size() + 20];
-	  sprintf(file,"%s_afterseg%d",output_filename_prefix.c_str(),seg_num);
-	  do_save_img(file, image);        
-	  delete[] file;
-	}
-      }
+      char *file = new char[output_filename_prefix.size() + 20];
+      sprintf(file,"%s_afterseg%d",output_filename_prefix.c_str(),seg_num);
+      do_save_img(file, image);        
+      delete[] file;
+    }
 #endif 
   }
   // Normalise the image
@@ -812,10 +873,8 @@ void FBP3DRPReconstruction::do_forward_project_view(RelatedViewgrams<float> & vi
   // do not forward project if we don't need to...
   if (new_min_axial_pos_num <= orig_min_axial_pos_num-1)
     {
-      full_log << "  - Forward projection of missing data first from ring No " 
-	       << new_min_axial_pos_num
-	       << " to "
-	       << orig_min_axial_pos_num-1 << endl;
+      write_to_full_log(boost::str(boost::format("  - Forward projection of missing data first from ring No %1% to %2%")
+                                   % new_min_axial_pos_num % (orig_min_axial_pos_num-1)));
 
       forward_projector_sptr->forward_project(viewgrams, estimated_image(),
 					     new_min_axial_pos_num ,orig_min_axial_pos_num-1);	    
@@ -824,9 +883,8 @@ void FBP3DRPReconstruction::do_forward_project_view(RelatedViewgrams<float> & vi
 
   if (orig_max_axial_pos_num+1 <= new_max_axial_pos_num)
     {
-      full_log << "  - Forward projection from ring No "
-	       << orig_max_axial_pos_num+1
-	       << " to " << new_max_axial_pos_num << endl;
+      write_to_full_log(boost::str(boost::format("  - Forward projection from ring No %1% to %2%")
+                                   % (orig_max_axial_pos_num+1) % new_max_axial_pos_num));
     
       forward_projector_sptr->forward_project(viewgrams, estimated_image(),
 					     orig_max_axial_pos_num+1, new_max_axial_pos_num);
@@ -854,62 +912,62 @@ void FBP3DRPReconstruction::do_forward_project_view(RelatedViewgrams<float> & vi
 }
                     
 	
-void FBP3DRPReconstruction::do_colsher_filter_view( RelatedViewgrams<float> & viewgrams)
-{ 
-
-  assert(dynamic_cast<ProjDataInfoCylindricalArcCorr const *>
-	 (viewgrams.get_proj_data_info_ptr()));
-
-  // TODO make into object member instead of static
-  static int prev_seg_num = viewgrams.get_proj_data_info_ptr()->get_min_segment_num()-1;  
 #ifdef NRFFT
-  static ColsherFilter colsher_filter(0,0,0,0,0,0,0,0,0,0);
+static ColsherFilter nr_colsher_filter(0,0,0,0,0,0,0,0,0,0);
 #endif
-  const int seg_num = viewgrams.get_basic_segment_num();
 
-  if (prev_seg_num != seg_num)
-  {
-    prev_seg_num = seg_num;
-    full_log << "  - Constructing Colsher filter for this segment\n";
-    const int nrings = viewgrams.get_num_axial_poss(); 
-    const int nprojs = viewgrams.get_num_tangential_poss();
+void FBP3DRPReconstruction::do_colsher_filter_set_up(const int seg_num, const int num_axial_poss)
+{
+  full_log << "  - Constructing Colsher filter for this segment\n";
+  // this has the same geometry as the (arc-corrected) viewgrams
+  const ProjDataInfo& proj_data_info = *proj_data_info_with_missing_data_sptr;
+  const int nrings = num_axial_poss; 
+  const int nprojs = proj_data_info.get_num_tangential_poss();
     
-    const int width = (int) pow(2., ((int) ceil(log((PadS + 1.) * nprojs) / log(2.))));
-    const int height = (int) pow(2., ((int) ceil(log((PadZ + 1.) * nrings) / log(2.))));	
+  const int width = (int) pow(2., ((int) ceil(log((PadS + 1.) * nprojs) / log(2.))));
+  const int height = (int) pow(2., ((int) ceil(log((PadZ + 1.) * nrings) / log(2.))));	
     
     
-    const float theta_max = atan(viewgrams.get_proj_data_info_ptr()->get_tantheta(Bin(max_segment_num_to_process,0,0,0)));
+  const float theta_max = atan(proj_data_info.get_tantheta(Bin(max_segment_num_to_process,0,0,0)));
     
-    const float theta = 
-      static_cast<float>(atan(viewgrams.get_proj_data_info_ptr()->get_tantheta(Bin(seg_num,0,0,0))));
+  const float theta = 
+    static_cast<float>(atan(proj_data_info.get_tantheta(Bin(seg_num,0,0,0))));
     
-    const float sampling_in_s =
-      viewgrams.get_proj_data_info_ptr()->get_sampling_in_s(Bin(seg_num,0,0,0));
-    const float sampling_in_t =
-      viewgrams.get_proj_data_info_ptr()->get_sampling_in_t(Bin(seg_num,0,0,0));
-    full_log << "Colsher filter theta_max = " << theta_max << " theta = " << theta
-      << " d_a = " << sampling_in_s
-	     << " d_b = " << sampling_in_t << endl;
+  const float sampling_in_s =
+    proj_data_info.get_sampling_in_s(Bin(seg_num,0,0,0));
+  const float sampling_in_t =
+    proj_data_info.get_sampling_in_t(Bin(seg_num,0,0,0));
+  full_log << "Colsher filter theta_max = " << theta_max << " theta = " << theta
+           << " d_a = " << sampling_in_s
+           << " d_b = " << sampling_in_t << endl;
     
     
 #ifdef NRFFT
-    colsher_filter = 
-      ColsherFilter(height, width, _PI/2 - theta, theta_max, 
-                    sampling_in_s, 
-                    sampling_in_t,
-                    alpha_colsher_axial, fc_colsher_axial,
-                    alpha_colsher_planar, fc_colsher_planar);
+  nr_colsher_filter = 
+    ColsherFilter(height, width, _PI/2 - theta, theta_max, 
+                  sampling_in_s, 
+                  sampling_in_t,
+                  alpha_colsher_axial, fc_colsher_axial,
+                  alpha_colsher_planar, fc_colsher_planar);
 #else
-    if (colsher_filter.set_up(height, width, 
-			      theta, 
-			      sampling_in_s, 
-			      sampling_in_t)
-	!= Succeeded::yes)
-      error("Exiting");
+  if (colsher_filter.set_up(height, width, 
+                            theta, 
+                            sampling_in_s, 
+                            sampling_in_t)
+      != Succeeded::yes)
+    error("Exiting");
 #endif
-  }
+}
+
+void FBP3DRPReconstruction::do_colsher_filter_view( RelatedViewgrams<float> & viewgrams)
+{ 
+
+  assert(dynamic_cast<ProjDataInfoCylindricalArcCorr const *>
+	 (viewgrams.get_proj_data_info_ptr()));
+
+  const int seg_num = viewgrams.get_basic_segment_num();
 
-  full_log << "  - Apply Colsher filter to complete oblique sinograms" << endl;
+  write_to_full_log("  - Apply Colsher filter to complete oblique sinograms");
 #ifdef NRFFT
 
   assert(viewgrams.get_num_viewgrams()%2 == 0);
@@ -918,7 +976,7 @@ void FBP3DRPReconstruction::do_colsher_filter_view( RelatedViewgrams<float> & vi
 
   for (; viewgram_iter != viewgrams.end(); viewgram_iter+=2) 
     Filter_proj_Colsher(*viewgram_iter, *(viewgram_iter+1),
-                        colsher_filter,
+                        nr_colsher_filter,
                         PadS, PadZ); 
 
 #else
@@ -943,7 +1001,7 @@ void FBP3DRPReconstruction::do_colsher_filter_view( RelatedViewgrams<float> & vi
 	const int num_ring_differences = 
 	  input_proj_data_info_cyl().get_max_ring_difference(seg_num) - 
 	  input_proj_data_info_cyl().get_min_ring_difference(seg_num) + 1;
-	full_log << "  - Multiplying filtered projections by " << num_ring_differences << endl;
+	write_to_full_log(boost::str(boost::format("  - Multiplying filtered projections by %1%") % num_ring_differences));
 	if (num_ring_differences != 1){
           viewgrams *= static_cast<float>(num_ring_differences);
 	}
@@ -959,7 +1017,7 @@ void FBP3DRPReconstruction::do_3D_backprojection_view(const RelatedViewgrams<flo
                                                         VoxelsOnCartesianGrid<float> &image,
                                                         int new_min_axial_pos_num, int new_max_axial_pos_num)
 { 
-    full_log << "  - Backproject the filtered Colsher complete sinograms" << endl;
+    write_to_full_log("  - Backproject the filtered Colsher complete sinograms");
 
     back_projector_sptr->back_project(image, viewgrams,new_min_axial_pos_num, new_max_axial_pos_num);
         
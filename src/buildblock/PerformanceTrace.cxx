@@ -0,0 +1,235 @@
+//
+//
+/*!
+  \file
+  \ingroup buildblock
+  \brief Implementation of class stir::PerformanceTrace
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#include "stir/PerformanceTrace.h"
+#include "stir/utilities.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
+#include <fstream>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <cctype>
+
+START_NAMESPACE_STIR
+
+namespace
+{
+  struct PerformanceTraceEvent
+  {
+    const char * stage;
+    int thread_num;
+    int subiteration_num;
+    PerformanceTrace::clock_type::time_point start_time;
+    PerformanceTrace::clock_type::time_point end_time;
+  };
+
+  std::mutex all_thread_events_mutex;
+  // buffers of the threads that are still running (protected by the mutex)
+  std::vector<std::vector<PerformanceTraceEvent> *> running_thread_events;
+  // events of threads that have finished (protected by the mutex)
+  std::vector<PerformanceTraceEvent> finished_thread_events;
+  int num_threads_seen = 0;
+
+  std::atomic<int> current_subiteration_num(0);
+  PerformanceTrace::clock_type::time_point start_of_trace = PerformanceTrace::clock_type::now();
+
+  /* Buffer for the events of one thread. It is registered when the thread records
+     its first event. When the thread finishes, its events are moved to
+     finished_thread_events and the buffer is removed, such that threads that
+     come and go (e.g. for prefetching) do not accumulate buffers.
+  */
+  class PerformanceTraceThreadEvents
+  {
+  public:
+    PerformanceTraceThreadEvents()
+    {
+      std::lock_guard<std::mutex> lock(all_thread_events_mutex);
+      thread_num = num_threads_seen++;
+      running_thread_events.push_back(&events);
+    }
+
+    ~PerformanceTraceThreadEvents()
+    {
+      std::lock_guard<std::mutex> lock(all_thread_events_mutex);
+      finished_thread_events.insert(finished_thread_events.end(), events.begin(), events.end());
+      running_thread_events.erase(std::find(running_thread_events.begin(), running_thread_events.end(), &events));
+    }
+
+    int thread_num;
+    std::vector<PerformanceTraceEvent> events;
+  };
+
+  PerformanceTraceThreadEvents&
+  get_thread_events()
+  {
+    static thread_local PerformanceTraceThreadEvents thread_events;
+    return thread_events;
+  }
+
+  // copy all events, ordered by thread number (the mutex has to be locked)
+  std::vector<PerformanceTraceEvent>
+  get_all_events()
+  {
+    std::vector<PerformanceTraceEvent> all_events(finished_thread_events);
+    for (std::size_t i=0; i<running_thread_events.size(); ++i)
+      all_events.insert(all_events.end(), running_thread_events[i]->begin(), running_thread_events[i]->end());
+    std::stable_sort(all_events.begin(), all_events.end(),
+                     [](const PerformanceTraceEvent& a, const PerformanceTraceEvent& b)
+                     { return a.thread_num < b.thread_num; });
+    return all_events;
+  }
+
+  double
+  microseconds_since_start_of_trace(const PerformanceTrace::clock_type::time_point& t)
+  {
+    return std::chrono::duration<double, std::micro>(t - start_of_trace).count();
+  }
+
+  double
+  duration_in_microseconds(const PerformanceTraceEvent& event)
+  {
+    return std::chrono::duration<double, std::micro>(event.end_time - event.start_time).count();
+  }
+
+  void
+  open_trace_file(std::ofstream& s, const std::string& filename)
+  {
+    s.open(filename.c_str());
+    if (!s)
+      error(boost::format("PerformanceTrace: error opening file %1%") % filename);
+  }
+}
+
+std::atomic<bool> PerformanceTrace::enabled(false);
+
+void
+PerformanceTrace::
+set_enabled(const bool enabled_v)
+{
+  enabled.store(enabled_v);
+}
+
+void
+PerformanceTrace::
+set_subiteration_num(const int subiteration_num)
+{
+  current_subiteration_num.store(subiteration_num, std::memory_order_relaxed);
+}
+
+void
+PerformanceTrace::
+clear()
+{
+  std::lock_guard<std::mutex> lock(all_thread_events_mutex);
+  for (std::size_t i=0; i<running_thread_events.size(); ++i)
+    running_thread_events[i]->clear();
+  finished_thread_events.clear();
+  start_of_trace = clock_type::now();
+}
+
+void
+PerformanceTrace::
+add_event(const char * const stage,
+          const clock_type::time_point& start_time,
+          const clock_type::time_point& end_time)
+{
+  PerformanceTraceThreadEvents& thread_events = get_thread_events();
+  PerformanceTraceEvent event;
+  event.stage = stage;
+  event.thread_num = thread_events.thread_num;
+  event.subiteration_num = current_subiteration_num.load(std::memory_order_relaxed);
+  event.start_time = start_time;
+  event.end_time = end_time;
+  thread_events.events.push_back(event);
+}
+
+std::size_t
+PerformanceTrace::
+get_num_thread_buffers()
+{
+  std::lock_guard<std::mutex> lock(all_thread_events_mutex);
+  return running_thread_events.size();
+}
+
+void
+PerformanceTrace::
+write_Chrome_trace(const std::string& filename)
+{
+  std::ofstream s;
+  open_trace_file(s, filename);
+  std::lock_guard<std::mutex> lock(all_thread_events_mutex);
+  const std::vector<PerformanceTraceEvent> all_events = get_all_events();
+  s << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (std::size_t e=0; e<all_events.size(); ++e)
+    {
+      const PerformanceTraceEvent& event = all_events[e];
+      s << (e==0 ? "\n" : ",\n")
+        << boost::format("{\"name\":\"%1%\",\"ph\":\"X\",\"pid\":0,\"tid\":%2%,"
+                         "\"ts\":%3$.3f,\"dur\":%4$.3f,\"args\":{\"subiteration\":%5%}}")
+        % event.stage % event.thread_num
+        % microseconds_since_start_of_trace(event.start_time)
+        % duration_in_microseconds(event)
+        % event.subiteration_num;
+    }
+  s << "\n]}\n";
+  if (!s)
+    error(boost::format("PerformanceTrace: error writing to file %1%") % filename);
+}
+
+void
+PerformanceTrace::
+write_CSV(const std::string& filename)
+{
+  std::ofstream s;
+  open_trace_file(s, filename);
+  std::lock_guard<std::mutex> lock(all_thread_events_mutex);
+  const std::vector<PerformanceTraceEvent> all_events = get_all_events();
+  s << "thread,subiteration,stage,start_us,duration_us\n";
+  for (std::size_t e=0; e<all_events.size(); ++e)
+    {
+      const PerformanceTraceEvent& event = all_events[e];
+      s << boost::format("%1%,%2%,%3%,%4$.3f,%5$.3f\n")
+        % event.thread_num % event.subiteration_num % event.stage
+        % microseconds_since_start_of_trace(event.start_time)
+        % duration_in_microseconds(event);
+    }
+  if (!s)
+    error(boost::format("PerformanceTrace: error writing to file %1%") % filename);
+}
+
+void
+PerformanceTrace::
+write_to_file(const std::string& filename)
+{
+  const std::string::size_type pos = find_pos_of_extension(filename);
+  std::string extension =
+    pos == std::string::npos ? std::string() : filename.substr(pos);
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  if (extension == ".csv")
+    write_CSV(filename);
+  else
+    write_Chrome_trace(filename);
+}
+
+END_NAMESPACE_STIR
@@ -0,0 +1,295 @@
+/*!
+  \file
+  \ingroup projdata
+  \brief Implementations for non-inline functions of class stir::ProjDataFromMemoryMappedFile
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/ProjDataFromMemoryMappedFile.h"
+#include "stir/Succeeded.h"
+#include "stir/Viewgram.h"
+#include "stir/Sinogram.h"
+#include "stir/SegmentBySinogram.h"
+#include "stir/SegmentByView.h"
+#include "stir/IndexRange2D.h"
+#include "stir/is_null_ptr.h"
+#include "stir/warning.h"
+#include <cstring>
+
+#ifdef HAVE_SYSTEM_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef STIR_NO_NAMESPACES
+using std::iostream;
+using std::streamoff;
+using std::string;
+using std::vector;
+using std::size_t;
+#endif
+
+START_NAMESPACE_STIR
+
+ProjDataFromMemoryMappedFile::
+ProjDataFromMemoryMappedFile(shared_ptr<ExamInfo> const& exam_info_sptr,
+                             shared_ptr<ProjDataInfo> const& proj_data_info_ptr,
+                             const string& data_filename,
+                             shared_ptr<iostream> const& s,
+                             const streamoff offs,
+                             const vector<int>& segment_sequence_in_stream,
+                             StorageOrder o,
+                             NumericType data_type,
+                             ByteOrder byte_order,
+                             float scale_factor)
+  : ProjDataFromStream(exam_info_sptr, proj_data_info_ptr, s, offs,
+                       segment_sequence_in_stream, o, data_type, byte_order, scale_factor),
+    mapped_data_ptr(0),
+    mapped_size(0)
+{
+  // only float data in native byte order can be copied straight from the mapping
+  if (!(data_type == NumericType(NumericType::FLOAT) && byte_order.is_native_order()))
+    return;
+
+#ifdef HAVE_SYSTEM_MMAP
+  const int fd = open(data_filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    {
+      warning("ProjDataFromMemoryMappedFile: cannot open %s for mapping. Using stream access.",
+              data_filename.c_str());
+      return;
+    }
+  struct stat file_info;
+  if (fstat(fd, &file_info) == 0 && file_info.st_size > 0)
+    {
+      void * const ptr =
+        mmap(0, static_cast<size_t>(file_info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+      if (ptr == MAP_FAILED)
+        warning("ProjDataFromMemoryMappedFile: mmap of %s failed. Using stream access.",
+                data_filename.c_str());
+      else
+        {
+          mapped_data_ptr = static_cast<const char *>(ptr);
+          mapped_size = static_cast<size_t>(file_info.st_size);
+        }
+    }
+  // the mapping stays valid after closing the file descriptor
+  close(fd);
+#else
+  warning("ProjDataFromMemoryMappedFile: memory mapping is not supported on this system. Using stream access.");
+#endif
+}
+
+ProjDataFromMemoryMappedFile::
+~ProjDataFromMemoryMappedFile()
+{
+#ifdef HAVE_SYSTEM_MMAP
+  if (mapped_data_ptr != 0)
+    munmap(const_cast<char *>(mapped_data_ptr), mapped_size);
+#endif
+}
+
+bool
+ProjDataFromMemoryMappedFile::
+is_memory_mapped() const
+{
+  return mapped_data_ptr != 0;
+}
+
+const char *
+ProjDataFromMemoryMappedFile::
+get_mapped_ptr(const streamoff offset_in_file, const size_t num_bytes) const
+{
+  if (mapped_data_ptr == 0 || offset_in_file < 0)
+    return 0;
+  // file might be shorter than expected (e.g. still being written). Let the stream handle it.
+  if (static_cast<size_t>(offset_in_file) + num_bytes > mapped_size)
+    return 0;
+  return mapped_data_ptr + offset_in_file;
+}
+
+/* Copy rows of floats from the mapping.
+   Rows are row_stride bytes apart in the file. When there are no gaps
+   between rows and the array is contiguous, a single memcpy is used.
+*/
+static void
+copy_rows_from_mapping(Array<2,float>& data, const char * src, const streamoff row_stride)
+{
+  const size_t row_size = data[data.get_min_index()].size() * sizeof(float);
+  if (row_stride == static_cast<streamoff>(row_size) && data.is_contiguous())
+    {
+      std::memcpy(data.get_full_data_ptr(), src, data.size_all() * sizeof(float));
+      data.release_full_data_ptr();
+      return;
+    }
+  for (int i = data.get_min_index(); i <= data.get_max_index(); ++i, src += row_stride)
+    {
+      std::memcpy(data[i].get_data_ptr(), src, row_size);
+      data[i].release_data_ptr();
+    }
+}
+
+Viewgram<float>
+ProjDataFromMemoryMappedFile::
+get_viewgram(const int view_num, const int segment_num,
+             const bool make_num_tangential_poss_odd) const
+{
+  const vector<streamoff> offsets = get_offsets(view_num, segment_num);
+  const streamoff row_size =
+    static_cast<streamoff>(get_num_tangential_poss() * sizeof(float));
+  const streamoff row_stride = row_size + offsets[2];
+  const char * const src =
+    get_mapped_ptr(offsets[0] + offsets[1],
+                   static_cast<size_t>((get_num_axial_poss(segment_num) - 1) * row_stride + row_size));
+  if (src == 0)
+    return ProjDataFromStream::get_viewgram(view_num, segment_num, make_num_tangential_poss_odd);
+
+  Viewgram<float> viewgram(proj_data_info_ptr, view_num, segment_num);
+  copy_rows_from_mapping(viewgram, src, row_stride);
+  if (get_scale_factor() != 1.F)
+    viewgram *= get_scale_factor();
+
+  if (make_num_tangential_poss_odd && (get_num_tangential_poss()%2==0))
+  {
+    const int new_max_tangential_pos = get_max_tangential_pos_num() + 1;
+
+    viewgram.grow(
+                  IndexRange2D(get_min_axial_pos_num(segment_num),
+                               get_max_axial_pos_num(segment_num),
+                               get_min_tangential_pos_num(),
+                               new_max_tangential_pos));
+  }
+  return viewgram;
+}
+
+Sinogram<float>
+ProjDataFromMemoryMappedFile::
+get_sinogram(const int ax_pos_num, const int segment_num,
+             const bool make_num_tangential_poss_odd) const
+{
+  const vector<streamoff> offsets = get_offsets_sino(ax_pos_num, segment_num);
+  const streamoff row_size =
+    static_cast<streamoff>(get_num_tangential_poss() * sizeof(float));
+  const streamoff row_stride = row_size + offsets[2];
+  const char * const src =
+    get_mapped_ptr(offsets[0] + offsets[1],
+                   static_cast<size_t>((get_num_views() - 1) * row_stride + row_size));
+  if (src == 0)
+    return ProjDataFromStream::get_sinogram(ax_pos_num, segment_num, make_num_tangential_poss_odd);
+
+  Sinogram<float> sinogram(proj_data_info_ptr, ax_pos_num, segment_num);
+  copy_rows_from_mapping(sinogram, src, row_stride);
+  if (get_scale_factor() != 1.F)
+    sinogram *= get_scale_factor();
+
+  if (make_num_tangential_poss_odd && (get_num_tangential_poss()%2==0))
+  {
+    const int new_max_tangential_pos = get_max_tangential_pos_num() + 1;
+
+    sinogram.grow(IndexRange2D(get_min_view_num(),
+                               get_max_view_num(),
+                               get_min_tangential_pos_num(),
+                               new_max_tangential_pos));
+  }
+  return sinogram;
+}
+
+SegmentBySinogram<float>
+ProjDataFromMemoryMappedFile::
+get_segment_by_sinogram(const int segment_num) const
+{
+  if (get_storage_order() == Segment_AxialPos_View_TangPos)
+    {
+      SegmentBySinogram<float> segment(proj_data_info_ptr, segment_num);
+      const char * const src =
+        get_mapped_ptr(get_offset_segment(segment_num), segment.size_all() * sizeof(float));
+      if (src != 0 && segment.is_contiguous())
+        {
+          std::memcpy(segment.get_full_data_ptr(), src, segment.size_all() * sizeof(float));
+          segment.release_full_data_ptr();
+          if (get_scale_factor() != 1.F)
+            segment *= get_scale_factor();
+          return segment;
+        }
+    }
+  return ProjDataFromStream::get_segment_by_sinogram(segment_num);
+}
+
+SegmentByView<float>
+ProjDataFromMemoryMappedFile::
+get_segment_by_view(const int segment_num) const
+{
+  if (get_storage_order() == Segment_View_AxialPos_TangPos)
+    {
+      SegmentByView<float> segment(proj_data_info_ptr, segment_num);
+      const char * const src =
+        get_mapped_ptr(get_offset_segment(segment_num), segment.size_all() * sizeof(float));
+      if (src != 0 && segment.is_contiguous())
+        {
+          std::memcpy(segment.get_full_data_ptr(), src, segment.size_all() * sizeof(float));
+          segment.release_full_data_ptr();
+          if (get_scale_factor() != 1.F)
+            segment *= get_scale_factor();
+          return segment;
+        }
+    }
+  return ProjDataFromStream::get_segment_by_view(segment_num);
+}
+
+Succeeded
+ProjDataFromMemoryMappedFile::
+flush_stream(const Succeeded success)
+{
+  // make sure the data are in the page cache such that the mapping sees them
+  if (success == Succeeded::yes && !is_null_ptr(sino_stream))
+    sino_stream->flush();
+  return success;
+}
+
+Succeeded
+ProjDataFromMemoryMappedFile::
+set_viewgram(const Viewgram<float>& v)
+{
+  return flush_stream(ProjDataFromStream::set_viewgram(v));
+}
+
+Succeeded
+ProjDataFromMemoryMappedFile::
+set_sinogram(const Sinogram<float>& s)
+{
+  return flush_stream(ProjDataFromStream::set_sinogram(s));
+}
+
+Succeeded
+ProjDataFromMemoryMappedFile::
+set_segment(const SegmentBySinogram<float>& segment)
+{
+  return flush_stream(ProjDataFromStream::set_segment(segment));
+}
+
+Succeeded
+ProjDataFromMemoryMappedFile::
+set_segment(const SegmentByView<float>& segment)
+{
+  return flush_stream(ProjDataFromStream::set_segment(segment));
+}
+
+END_NAMESPACE_STIR
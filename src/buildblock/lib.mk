@@ -68,7 +68,8 @@ $(dir)_LIB_SOURCES := \
         MaximalImageFilter3D.cxx \
         TimeGateDefinitions.cxx \
 	ML_norm.cxx \
-	num_threads.cxx
+	num_threads.cxx \
+	PerformanceTrace.cxx
 
 
 $(dir)_REGISTRY_SOURCES:= $(dir)_registries.cxx
@@ -72,6 +72,23 @@ Array inherits its numeric operators from NumericVectorWithOffset.
 In particular this means that operator+= etc. potentially grow
 the object. However, as grow() is a virtual function, Array::grow is
 called, which initialises new elements first to 0.
+
+\par Memory layout
+
+When an Array is constructed (or resized from an empty Array), all its 
+elements are stored in one contiguous block of memory (aligned to
+64 bytes), with the nested 
+Array<num_dimensions-1,elemT> objects pointing into that block. The order
+of the elements in memory is the same as the order of the full_iterator.
+This avoids one heap allocation per row, and allows
+passing the whole array to code that expects a pointer to the data (e.g. for 
+I/O or vectorised loops), see get_full_data_ptr(). It is also possible to let
+the Array use an existing block of memory, see init().
+
+Operations that change the index range of a nested array (e.g. 
+<code>a[1].resize(...)</code>) will let that element allocate its own memory, such 
+that the array will no longer be contiguous. This can be tested with 
+is_contiguous().
 */
 
 template <int num_dimensions, typename elemT>
@@ -129,22 +146,96 @@ public:
   inline Array();
 
   //! Construct an Array of given range of indices, elements are initialised to 0
+  /*! All elements are stored in one contiguous block of memory. */
   inline explicit Array(const IndexRange<num_dimensions>&);
+
+  //! Construct an Array of given range of indices using existing data
+  /*! \see init() */
+  inline Array(const IndexRange<num_dimensions>& range, 
+               elemT * const data_ptr, bool copy_data);
   
 #ifndef SWIG
   //! Construct an Array from an object of its base_type
+  /*! The data is copied into a contiguous block of memory. */
   inline Array(const base_type& t);
 #else
   // swig 2.0.4 gets confused by base_type (due to numeric template arguments)
-  // therefore, we declare this constructor using the "self" type, 
-  // i.e. it's just a copy-constructor.
+  // therefore, we only declare the copy-constructor.
   // This is less powerful as in C++, but swig-generated interfaces don't need to know about the base_type anyway
-  inline Array(const self& t);
 #endif
+  //! Copy constructor
+  /*! The data is copied into a contiguous block of memory (even if \a t is not contiguous). */
+  inline Array(const self& t);
   
   //! virtual destructor, frees up any allocated memory
   inline virtual ~Array();
 
+  //! assignment operator
+  /*! If the index ranges of \c *this and \a t are identical, the data is copied
+      into the existing memory. Otherwise, new memory is allocated. */
+  inline self& operator=(const self& t);
+
+  //! swap content/members of 2 objects
+  /*! No memory is allocated or copied. */
+  friend inline void swap(Array& first, Array& second)
+  {
+    // cast to VectorWithOffset to call its swap. Casting to base_type would
+    // select std::swap if elemT is in namespace std (e.g. std::complex)
+    // via argument dependent lookup, and that one copies the data.
+    typedef VectorWithOffset<Array<num_dimensions-1, elemT> > vector_type;
+    swap(static_cast<vector_type&>(first), static_cast<vector_type&>(second));
+    std::swap(first._allocated_full_data_ptr, second._allocated_full_data_ptr);
+    std::swap(first._allocated_raw_memory, second._allocated_raw_memory);
+    std::swap(first._allocated_full_size, second._allocated_full_size);
+  }
+
+  //! (re)initialise the array to the given index range using one contiguous block of memory
+  /*! Any data currently stored in the array is lost.
+      
+      If \a data_ptr is 0, a new block of memory is allocated (and owned by this object) 
+      and all elements are set to 0.
+      Otherwise, if \a copy_data is \c true, a new block of memory is allocated and the
+      first <code>range.size_all()</code> elements pointed to by \a data_ptr are copied 
+      into it. If \a copy_data is \c false, the array will use the memory pointed to by
+      \a data_ptr (which has to be large enough for <code>range.size_all()</code> elements,
+      and has to remain valid for the life-time of this object). That memory
+      will not be deallocated by the Array.
+
+      In all cases, the elements are stored in the order of the full_iterator.
+  */
+  void init(const IndexRange<num_dimensions>& range, 
+            elemT * const data_ptr, bool copy_data);
+
+  //! check if all elements are stored in one contiguous block of memory
+  /*! \see get_full_data_ptr() */
+  inline bool is_contiguous() const;
+
+  /*! \name access to the data via a pointer
+    These functions can be used for bulk I/O or for optimised loops over all elements.
+    Elements are stored in the order of the full_iterator. 
+    The Array has to be contiguous (see is_contiguous()), otherwise error() is called.
+
+    As for VectorWithOffset::get_data_ptr(), NO manipulation with the array is allowed
+    between calls to get_full_data_ptr() and release_full_data_ptr() (checked with 
+    assert() in DEBUG mode).
+
+    The const versions do not modify the object, so several threads can use them
+    on the same Array at the same time.
+  */
+  //@{
+  //! member function for access to the data via a elemT*
+  inline elemT* get_full_data_ptr();
+
+  //! member function for access to the data via a const elemT*
+  inline const elemT * get_const_full_data_ptr() const;
+
+  //! signal end of access to elemT*
+  inline void release_full_data_ptr();
+
+  //! signal end of access to const elemT*
+  inline void release_const_full_data_ptr() const;
+  //@}
+
   /*! @name functions returning full_iterators*/
   //@{
   //! start value for iterating through all elements in the array, see full_iterator
@@ -239,6 +330,21 @@ public:
   inline const elemT&
     at(const BasicCoordinate<num_dimensions,int> &c) const;
   //@}
+
+ private:
+  //! pointer to the (aligned) block of memory allocated by init() (if any)
+  elemT* _allocated_full_data_ptr;
+  //! memory as returned by new[], used for deallocation
+  char* _allocated_raw_memory;
+  //! number of elements in the allocated block
+  size_t _allocated_full_size;
+  //! boolean to test if get_full_data_ptr() is called
+  mutable bool _full_pointer_access;
+
+  //! allocate a new block for \a size elements
+  inline void _allocate_full_data(const size_t size);
+  //! call destructors of all elements in the allocated block and deallocate it
+  inline void _deallocate_full_data();
 };
 
 
@@ -302,12 +408,30 @@ public:
   //! constructor given first and last indices, initialising elements to 0
   inline Array(const int min_index, const int max_index);
 
+  //! constructor given an IndexRange<1> using existing data
+  /*! \see init() */
+  inline Array(const IndexRange<1>& range, elemT * const data_ptr, bool copy_data);
+
   //! constructor from basetype
   inline Array(const NumericVectorWithOffset<elemT,elemT> &il);
   
   //! virtual destructor
   inline virtual ~Array();
 
+  //! (re)initialise the array to the given range, see Array<num_dimensions,elemT>::init()
+  inline void init(const IndexRange<1>& range, elemT * const data_ptr, bool copy_data);
+
+  //! checks if the data is stored contiguously (always \c true as this is the 1D case)
+  inline bool is_contiguous() const;
+
+  //! \name access to the data via a pointer (identical to get_data_ptr() etc for the 1D case)
+  //@{
+  inline elemT* get_full_data_ptr();
+  inline const elemT * get_const_full_data_ptr() const;
+  inline void release_full_data_ptr();
+  inline void release_const_full_data_ptr() const;
+  //@}
+
   /*! @name functions returning full_iterators*/
   //@{
   //! start value for iterating through all elements in the array, see full_iterator
@@ -30,26 +30,152 @@
 */
 // include for min,max definitions
 #include <algorithm>
+#include <memory>
 #include "stir/assign.h"
+#include "stir/error.h"
 
 START_NAMESPACE_STIR
 
+namespace detail
+{
+  /* Helper functions to check if an Array is stored contiguously.
+     They walk through all 1D arrays, keeping track of the first element
+     and where the next element should be.
+  */
+  template <typename elemT>
+  inline bool
+  is_contiguous_help(const Array<1, elemT>& a,
+                     const elemT *& first_elem_ptr, const elemT *& next_elem_ptr)
+  {
+    if (a.size() == 0)
+      return true;
+    const elemT * const elem_ptr = &a[a.get_min_index()];
+    if (next_elem_ptr == 0)
+      first_elem_ptr = elem_ptr;
+    else if (elem_ptr != next_elem_ptr)
+      return false;
+    next_elem_ptr = elem_ptr + a.size();
+    return true;
+  }
+
+  template <int num_dimensions, typename elemT>
+  inline bool
+  is_contiguous_help(const Array<num_dimensions, elemT>& a,
+                     const elemT *& first_elem_ptr, const elemT *& next_elem_ptr)
+  {
+    for (int i=a.get_min_index(); i<=a.get_max_index(); ++i)
+      if (!is_contiguous_help(a[i], first_elem_ptr, next_elem_ptr))
+        return false;
+    return true;
+  }
+} // end of namespace detail
+
 /**********************************************
  inlines for Array<num_dimensions, elemT>
  **********************************************/
 
 template <int num_dimensions, typename elemT>
-void 
+void
 Array<num_dimensions, elemT>::
-resize(const IndexRange<num_dimensions>& range)
+_allocate_full_data(const size_t size)
+{
+  this->_deallocate_full_data();
+  if (size == 0)
+    return;
+  // align to 64 bytes (cache line size and large enough for AVX-512)
+  const size_t alignment = 64;
+  this->_allocated_raw_memory = new char[size*sizeof(elemT) + alignment];
+  const size_t misalignment =
+    reinterpret_cast<size_t>(this->_allocated_raw_memory) % alignment;
+  this->_allocated_full_data_ptr =
+    reinterpret_cast<elemT *>(this->_allocated_raw_memory + 
+                              (misalignment == 0 ? 0 : alignment - misalignment));
+  std::uninitialized_fill_n(this->_allocated_full_data_ptr, size, elemT());
+  this->_allocated_full_size = size;
+}
+
+template <int num_dimensions, typename elemT>
+void
+Array<num_dimensions, elemT>::
+_deallocate_full_data()
 {
+  if (this->_allocated_raw_memory == 0)
+    return;
+  for (size_t i=0; i<this->_allocated_full_size; ++i)
+    this->_allocated_full_data_ptr[i].~elemT();
+  delete[] this->_allocated_raw_memory;
+  this->_allocated_raw_memory = 0;
+  this->_allocated_full_data_ptr = 0;
+  this->_allocated_full_size = 0;
+}
+
+template <int num_dimensions, typename elemT>
+void
+Array<num_dimensions, elemT>::
+init(const IndexRange<num_dimensions>& range, 
+     elemT * const data_ptr, bool copy_data)
+{
+  assert(!this->_full_pointer_access);
+  // first make sure that the nested arrays no longer refer to our memory
+  base_type::recycle();
+  const size_t size = range.size_all();
+  elemT * mem_ptr = data_ptr;
+  if (data_ptr == 0 || copy_data)
+    {
+      this->_allocate_full_data(size);
+      if (data_ptr == 0)
+        {
+          for (size_t i=0; i<size; ++i)
+            assign(this->_allocated_full_data_ptr[i], 0);
+        }
+      else
+        std::copy(data_ptr, data_ptr + size, this->_allocated_full_data_ptr);
+      mem_ptr = this->_allocated_full_data_ptr;
+    }
+  else
+    this->_deallocate_full_data();
+
   base_type::resize(range.get_min_index(), range.get_max_index());
   typename base_type::iterator iter = this->begin();
   typename IndexRange<num_dimensions>::const_iterator range_iter = range.begin();
   for (;
        iter != this->end(); 
        ++iter, ++range_iter)
-    (*iter).resize(*range_iter);
+    {
+      (*iter).init(*range_iter, mem_ptr, false);
+      mem_ptr += range_iter->size_all();
+    }
+}
+
+/*! If the array is currently empty, this simply calls init(), i.e. a contiguous
+    block of memory is allocated. Otherwise, a new contiguous array is created and
+    the elements in the overlapping range are copied.
+*/
+template <int num_dimensions, typename elemT>
+void 
+Array<num_dimensions, elemT>::
+resize(const IndexRange<num_dimensions>& range)
+{
+  if (this->size() == 0)
+    {
+      this->init(range, 0, false);
+      return;
+    }
+  if (range == this->get_index_range())
+    return;
+
+  self new_array(range);
+  const int overlap_min_index = std::max(this->get_min_index(), range.get_min_index());
+  const int overlap_max_index = std::min(this->get_max_index(), range.get_max_index());
+  for (int i=overlap_min_index; i<=overlap_max_index; ++i)
+    {
+      // copy current element and resize it to the new range
+      Array<num_dimensions-1, elemT> elem((*this)[i]);
+      elem.resize(new_array[i].get_index_range());
+      // now copy into new_array (this does not reallocate as the ranges are the same)
+      new_array[i] = elem;
+    }
+  swap(*this, new_array);
 }
 
 template <int num_dimensions, typename elemT>
@@ -62,30 +188,95 @@ grow(const IndexRange<num_dimensions>& range)
 
 template <int num_dimensions, typename elemT>
 Array<num_dimensions, elemT>::Array()
-: base_type()
+: base_type(),
+  _allocated_full_data_ptr(0), _allocated_raw_memory(0), _allocated_full_size(0),
+  _full_pointer_access(false)
 {}
 
 template <int num_dimensions, typename elemT>
 Array<num_dimensions, elemT>::Array(const IndexRange<num_dimensions>& range)
-: base_type()
+: base_type(),
+  _allocated_full_data_ptr(0), _allocated_raw_memory(0), _allocated_full_size(0),
+  _full_pointer_access(false)
 {
-  grow(range);
+  this->init(range, 0, false);
 }
 
 template <int num_dimensions, typename elemT>
-#ifdef SWIG
-// swig-specific work-around (see Array.h)
-Array<num_dimensions, elemT>::Array(const self& t)
-#else
+Array<num_dimensions, elemT>::Array(const IndexRange<num_dimensions>& range,
+                                    elemT * const data_ptr, bool copy_data)
+: base_type(),
+  _allocated_full_data_ptr(0), _allocated_raw_memory(0), _allocated_full_size(0),
+  _full_pointer_access(false)
+{
+  this->init(range, data_ptr, copy_data);
+}
+
+#ifndef SWIG
+template <int num_dimensions, typename elemT>
 Array<num_dimensions, elemT>::Array(const base_type& t)
+: base_type(),
+  _allocated_full_data_ptr(0), _allocated_raw_memory(0), _allocated_full_size(0),
+  _full_pointer_access(false)
+{
+  VectorWithOffset<IndexRange<num_dimensions-1> > 
+    range(t.get_min_index(), t.get_max_index());
+  for (int i=t.get_min_index(); i<=t.get_max_index(); ++i)
+    range[i] = t[i].get_index_range();
+  this->init(IndexRange<num_dimensions>(range), 0, false);
+  for (int i=t.get_min_index(); i<=t.get_max_index(); ++i)
+    (*this)[i] = t[i];
+}
 #endif
-:  base_type(t)
-{}
+
+template <int num_dimensions, typename elemT>
+Array<num_dimensions, elemT>::Array(const self& t)
+: base_type(),
+  _allocated_full_data_ptr(0), _allocated_raw_memory(0), _allocated_full_size(0),
+  _full_pointer_access(false)
+{
+  // Find the data pointer directly, as opposed to using get_const_full_data_ptr(),
+  // as the latter calls error() for a non-contiguous array.
+  const elemT * first_elem_ptr = 0;
+  const elemT * next_elem_ptr = 0;
+  if (detail::is_contiguous_help(t, first_elem_ptr, next_elem_ptr) && first_elem_ptr != 0)
+    {
+      this->init(t.get_index_range(), const_cast<elemT *>(first_elem_ptr), true);
+    }
+  else
+    {
+      this->init(t.get_index_range(), 0, false);
+      for (int i=t.get_min_index(); i<=t.get_max_index(); ++i)
+        (*this)[i] = t[i];
+    }
+}
 
 template <int num_dimensions, typename elemT>
 Array<num_dimensions, elemT>::~Array()
-{}
+{
+  // Note: the nested arrays are destructed after this, but they never deallocate our block
+  this->_deallocate_full_data();
+}
 
+template <int num_dimensions, typename elemT>
+Array<num_dimensions, elemT>&
+Array<num_dimensions, elemT>::operator=(const self& t)
+{
+  if (this == &t)
+    return *this;
+  if (this->get_index_range() == t.get_index_range())
+    {
+      // copy element by element (this will not reallocate)
+      for (int i=t.get_min_index(); i<=t.get_max_index(); ++i)
+        (*this)[i] = t[i];
+    }
+  else
+    {
+      self tmp(t);
+      swap(*this, tmp);
+    }
+  return *this;
+}
 
 template <int num_dimensions, typename elemT>
 typename Array<num_dimensions, elemT>::full_iterator 
@@ -266,6 +457,59 @@ Array<num_dimensions, elemT>::is_regular() const
   return get_index_range().is_regular();
 }
 
+template <int num_dimensions, typename elemT>
+bool
+Array<num_dimensions, elemT>::is_contiguous() const
+{
+  const elemT * first_elem_ptr = 0;
+  const elemT * next_elem_ptr = 0;
+  return detail::is_contiguous_help(*this, first_elem_ptr, next_elem_ptr);
+}
+
+/*!
+  \warning Returns 0 for an array without elements.
+*/
+template <int num_dimensions, typename elemT>
+elemT*
+Array<num_dimensions, elemT>::get_full_data_ptr()
+{
+  assert(!this->_full_pointer_access);
+  elemT * const ptr = const_cast<elemT *>(this->get_const_full_data_ptr());
+  this->_full_pointer_access = true;
+  return ptr;
+}
+
+/*!
+  \warning Returns 0 for an array without elements.
+
+  This function does not modify the object (not even in DEBUG mode), such that
+  several threads can access the same (const) Array at the same time.
+*/
+template <int num_dimensions, typename elemT>
+const elemT*
+Array<num_dimensions, elemT>::get_const_full_data_ptr() const
+{
+  const elemT * first_elem_ptr = 0;
+  const elemT * next_elem_ptr = 0;
+  if (!detail::is_contiguous_help(*this, first_elem_ptr, next_elem_ptr))
+    error("Array::get_full_data_ptr() called for non-contiguous array");
+  return first_elem_ptr;
+}
+
+template <int num_dimensions, typename elemT>
+void
+Array<num_dimensions, elemT>::release_full_data_ptr()
+{
+  assert(this->_full_pointer_access);
+  this->_full_pointer_access = false;
+}
+
+template <int num_dimensions, typename elemT>
+void
+Array<num_dimensions, elemT>::release_const_full_data_ptr() const
+{
+}
+
 //TODO terribly inefficient at the moment
 template <int num_dimensions, typename elemT>
 bool
@@ -403,11 +647,68 @@ Array<1, elemT>::Array(const int min_index, const int max_index)
 }
 
 
+template <class elemT>
+Array<1, elemT>::Array(const IndexRange<1>& range, 
+                       elemT * const data_ptr, bool copy_data)
+: base_type()
+{
+  this->init(range, data_ptr, copy_data);
+}
+
 template <class elemT>
 Array<1, elemT>::Array(const base_type &il)
 : base_type(il)
 {}
 
+template <class elemT>
+void
+Array<1, elemT>::init(const IndexRange<1>& range, 
+                      elemT * const data_ptr, bool copy_data)
+{
+  if (data_ptr == 0)
+    {
+      this->recycle();
+      this->resize(range);
+    }
+  else
+    base_type::init(range.get_min_index(), range.get_max_index(), data_ptr, copy_data);
+}
+
+template <class elemT>
+bool
+Array<1, elemT>::is_contiguous() const
+{
+  return true;
+}
+
+template <class elemT>
+elemT*
+Array<1, elemT>::get_full_data_ptr()
+{
+  return this->get_data_ptr();
+}
+
+template <class elemT>
+const elemT*
+Array<1, elemT>::get_const_full_data_ptr() const
+{
+  // avoid get_const_data_ptr(), as that modifies the object in DEBUG mode
+  return this->size() == 0 ? 0 : &(*this)[this->get_min_index()];
+}
+
+template <class elemT>
+void
+Array<1, elemT>::release_full_data_ptr()
+{
+  this->release_data_ptr();
+}
+
+template <class elemT>
+void
+Array<1, elemT>::release_const_full_data_ptr() const
+{
+}
+
 template <typename elemT>
 Array<1, elemT>::~Array()
 {}
@@ -44,9 +44,9 @@ START_NAMESPACE_STIR
     the function to find out what the size of the record is. In that case, all IO
     handling is completely generic and is implemented in this class.
 
-    Current implementation needs a \c max_size_of_record to allocate enough memory 
-    (on the stack) before reading. This is efficient in many cases, but impractical 
-    in others.
+    Data are read from the stream in large blocks into an internal buffer, and records
+    are decoded from there. This avoids 2 stream reads (and a memory allocation) per record.
+    The buffer size has to be at least \c max_size_of_record.
 
     \par Requirements
     \c RecordT needs to have the following member functions
@@ -60,8 +60,8 @@ START_NAMESPACE_STIR
                          const std::size_t size_of_record, 
                          const OptionsT options);
     \endcode
-
-    \todo Allow choosing between allocation with \c new or on the stack.
+    In addition, get_next_records() needs a \c bool \c is_time() member of the
+    pointed-to type of its argument (e.g. CListRecord).
 */
 template <class RecordT, class OptionsT>
 class InputStreamWithRecords
@@ -94,6 +94,19 @@ public:
   virtual 
     Succeeded get_next_record(RecordT& record) const;
 
+  //! Read a batch of records
+  /*! Fills the records pointed to by the elements of \a records (e.g. \c shared_ptr<CListRecord>),
+      which have to be of type \c RecordT. Reading stops after a record for which \c is_time() is
+      \c true (see CListModeData::get_next_records()), or when there are no more records.
+
+      This function is not virtual, and reading a record therefore does not need a virtual
+      function call.
+      \return the number of records read
+  */
+  template <class RecordPtrT>
+  inline
+    std::size_t get_next_records(const std::vector<RecordPtrT>& records) const;
+
   //! go back to starting position
   inline
     Succeeded reset();
@@ -125,6 +138,14 @@ public:
   inline
     void set_saved_get_positions(const std::vector<std::streampos>& );
 
+  //! size of the buffer used for reading (default: 1 MB)
+  inline
+    std::size_t get_buffer_size() const;
+  //! set the size of the buffer used for reading
+  /*! This discards the data currently in the buffer, but the current "get" position is kept. */
+  inline
+    Succeeded set_buffer_size(const std::size_t);
+
 private:
 
   const std::string filename;
@@ -132,6 +153,27 @@ private:
   std::streampos starting_stream_position;
   std::vector<std::streampos> saved_get_positions;
 
+  //! buffer with data read from the stream
+  mutable std::vector<char> buffer;
+  //! index in \c buffer of the next record
+  mutable std::size_t buffer_pos;
+  //! number of valid bytes in \c buffer
+  mutable std::size_t buffer_end;
+  //! position in the stream corresponding to \c buffer[0]
+  mutable std::streampos buffer_stream_position;
+
+  //! read a record from the buffer (non-virtual version of get_next_record())
+  inline
+    Succeeded read_next_record(RecordT& record) const;
+
+  //! move remaining data to the start of the buffer and read more from the stream
+  inline
+    void fill_buffer() const;
+
+  //! empty the buffer and set the stream to \a pos
+  inline
+    Succeeded seek_and_clear_buffer(const std::streampos pos);
+
   const std::size_t size_of_record_signature;
   const std::size_t max_size_of_record;
 
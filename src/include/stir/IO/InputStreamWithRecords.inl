@@ -28,8 +28,10 @@
 #include "stir/Succeeded.h"
 #include "stir/is_null_ptr.h"
 #include "stir/shared_ptr.h"
-#include "boost/shared_array.hpp"
+#include "stir/warning.h"
+#include "stir/error.h"
 #include <fstream>
+#include <cstring>
 
 START_NAMESPACE_STIR
 template <class RecordT, class OptionsT>
@@ -39,16 +41,21 @@ InputStreamWithRecords(const shared_ptr<std::istream>& stream_ptr,
                        const std::size_t max_size_of_record, 
                        const OptionsT& options)
   : stream_ptr(stream_ptr),
+    buffer(1024*1024),
+    buffer_pos(0),
+    buffer_end(0),
     size_of_record_signature(size_of_record_signature),
     max_size_of_record(max_size_of_record),
     options(options)
 {
   assert(size_of_record_signature<=max_size_of_record);
+  assert(max_size_of_record<=buffer.size());
   if (is_null_ptr(stream_ptr))
     return;
   starting_stream_position = stream_ptr->tellg();
   if (!stream_ptr->good())
     error("InputStreamWithRecords: error in tellg()\n");
+  buffer_stream_position = starting_stream_position;
 }
 
 template <class RecordT, class OptionsT>
@@ -60,11 +67,16 @@ InputStreamWithRecords(const std::string& filename,
                        const std::streampos start_of_data)
   : filename(filename),
     starting_stream_position(start_of_data),
+    buffer(1024*1024),
+    buffer_pos(0),
+    buffer_end(0),
+    buffer_stream_position(start_of_data),
     size_of_record_signature(size_of_record_signature),
     max_size_of_record(max_size_of_record),
     options(options)
 {
   assert(size_of_record_signature<=max_size_of_record);
+  assert(max_size_of_record<=buffer.size());
   std::fstream* s_ptr = new std::fstream;
   open_read_binary(*s_ptr, filename.c_str());
   stream_ptr.reset(s_ptr);
@@ -74,54 +86,112 @@ InputStreamWithRecords(const std::string& filename,
 }
 
 template <class RecordT, class OptionsT>
-Succeeded
+void
 InputStreamWithRecords<RecordT, OptionsT>::
-get_next_record(RecordT& record) const
+fill_buffer() const
 {
-  if (is_null_ptr(stream_ptr))
-    return Succeeded::no;
+  const std::size_t remaining = this->buffer_end - this->buffer_pos;
+  if (remaining > 0 && this->buffer_pos > 0)
+    std::memmove(&this->buffer[0], &this->buffer[this->buffer_pos], remaining);
+  this->buffer_stream_position += static_cast<std::streamoff>(this->buffer_pos);
+  this->buffer_pos = 0;
+  this->buffer_end = remaining;
+  // nothing more to read if we are at EOF (or had an error)
+  if (!stream_ptr->good())
+    return;
+  stream_ptr->read(&this->buffer[remaining],
+                   static_cast<std::streamsize>(this->buffer.size() - remaining));
+  this->buffer_end += static_cast<std::size_t>(stream_ptr->gcount());
+  if (stream_ptr->bad())
+    warning("Error after reading from list mode stream in get_next_record");
+}
 
-  // rely on file caching by the C++ library or the OS
+template <class RecordT, class OptionsT>
+Succeeded
+InputStreamWithRecords<RecordT, OptionsT>::
+read_next_record(RecordT& record) const
+{
   assert(this->size_of_record_signature <= this->max_size_of_record);
-  boost::shared_array<char> data_sptr(new char[this->max_size_of_record]);
-  char * data_ptr = data_sptr.get();
-  stream_ptr->read(data_ptr, this->size_of_record_signature);
-  if (stream_ptr->gcount()<static_cast<std::streamsize>(this->size_of_record_signature))
+  if (this->buffer_end - this->buffer_pos < this->max_size_of_record)
+    fill_buffer();
+  const std::size_t size_available = this->buffer_end - this->buffer_pos;
+  if (size_available < this->size_of_record_signature)
     return Succeeded::no; 
+  const char * const data_ptr = &this->buffer[this->buffer_pos];
   const std::size_t size_of_record = record.size_of_record_at_ptr(data_ptr, this->size_of_record_signature,options);
   assert(size_of_record <= this->max_size_of_record);
-  if (size_of_record > this->size_of_record_signature)
-    stream_ptr->read(data_ptr + this->size_of_record_signature,
-                     size_of_record - this->size_of_record_signature);
-  if (stream_ptr->eof())
+  // check for an incomplete record at the end of the stream
+  if (size_of_record > size_available)
     return Succeeded::no; 
-  else if (stream_ptr->bad())
-    { 
-      warning("Error after reading from list mode stream in get_next_record");
-      return Succeeded::no; 
-    }
+  this->buffer_pos += size_of_record;
   return 
     record.init_from_data_ptr(data_ptr, size_of_record,options);
 }
 
-
-
 template <class RecordT, class OptionsT>
 Succeeded
 InputStreamWithRecords<RecordT, OptionsT>::
-reset()
+get_next_record(RecordT& record) const
 {
   if (is_null_ptr(stream_ptr))
     return Succeeded::no;
 
+  return read_next_record(record);
+}
+
+template <class RecordT, class OptionsT>
+template <class RecordPtrT>
+std::size_t
+InputStreamWithRecords<RecordT, OptionsT>::
+get_next_records(const std::vector<RecordPtrT>& records) const
+{
+  if (is_null_ptr(stream_ptr))
+    return 0;
+
+  std::size_t num_records = 0;
+  while (num_records < records.size())
+    {
+      RecordT& record = static_cast<RecordT&>(*records[num_records]);
+      if (read_next_record(record) == Succeeded::no)
+        break;
+      ++num_records;
+      // call is_time() via RecordPtrT as it might be private in RecordT
+      if (records[num_records-1]->is_time())
+        break;
+    }
+  return num_records;
+}
+
+template <class RecordT, class OptionsT>
+Succeeded
+InputStreamWithRecords<RecordT, OptionsT>::
+seek_and_clear_buffer(const std::streampos pos)
+{
+  this->buffer_pos = 0;
+  this->buffer_end = 0;
   // Strangely enough, once you read past EOF, even seekg(0) doesn't reset the eof flag
   if (stream_ptr->eof()) 
     stream_ptr->clear();
-  stream_ptr->seekg(starting_stream_position, std::ios::beg);
-  if (stream_ptr->bad())
-    return Succeeded::no;
+  if (pos == std::streampos(-1))
+    stream_ptr->seekg(0, std::ios::end); // go to eof
   else
-    return Succeeded::yes;
+    stream_ptr->seekg(pos, std::ios::beg);
+  if (!stream_ptr->good())
+    return Succeeded::no;
+  this->buffer_stream_position = 
+    pos == std::streampos(-1) ? stream_ptr->tellg() : pos;
+  return Succeeded::yes;
+}
+
+template <class RecordT, class OptionsT>
+Succeeded
+InputStreamWithRecords<RecordT, OptionsT>::
+reset()
+{
+  if (is_null_ptr(stream_ptr))
+    return Succeeded::no;
+
+  return seek_and_clear_buffer(starting_stream_position);
 }
 
 
@@ -131,19 +201,18 @@ InputStreamWithRecords<RecordT, OptionsT>::
 save_get_position() 
 {
   assert(!is_null_ptr(stream_ptr));
-  // TODO should somehow check if tellg() worked and return an error if it didn't
+  // the position of the next record is given by the position of the buffer in the stream
   std::streampos pos;
-  if (!stream_ptr->eof())
+  if (this->buffer_pos < this->buffer_end || !stream_ptr->eof())
     {
-      pos = stream_ptr->tellg();
-      if (!stream_ptr->good())
+      pos = this->buffer_stream_position + static_cast<std::streamoff>(this->buffer_pos);
+      if (this->buffer_stream_position == std::streampos(-1))
 	error("InputStreamWithRecords<RecordT, OptionsT>::save_get_position\n"
 	      "Error after getting position in file");
     }
   else
     {
       // use -1 to signify eof 
-      // (this is probably the behaviour of tellg anyway, but this way we're sure).
       pos = std::streampos(-1); 
     }
   saved_get_positions.push_back(pos);
@@ -159,15 +228,7 @@ set_get_position(const typename InputStreamWithRecords<RecordT, OptionsT>::Saved
     return Succeeded::no;
 
   assert(pos < saved_get_positions.size());
-  if (saved_get_positions[pos] == std::streampos(-1))
-    stream_ptr->seekg(0, std::ios::end); // go to eof
-  else
-    stream_ptr->seekg(saved_get_positions[pos]);
-    
-  if (!stream_ptr->good())
-    return Succeeded::no;
-  else
-    return Succeeded::yes;
+  return seek_and_clear_buffer(saved_get_positions[pos]);
 }
 
 template <class RecordT, class OptionsT>
@@ -186,4 +247,36 @@ set_saved_get_positions(const std::vector<std::streampos>& poss)
   saved_get_positions = poss;
 }
 
+template <class RecordT, class OptionsT>
+std::size_t
+InputStreamWithRecords<RecordT, OptionsT>::
+get_buffer_size() const
+{
+  return this->buffer.size();
+}
+
+template <class RecordT, class OptionsT>
+Succeeded
+InputStreamWithRecords<RecordT, OptionsT>::
+set_buffer_size(const std::size_t new_size)
+{
+  if (new_size < this->max_size_of_record)
+    {
+      warning("InputStreamWithRecords: buffer size has to be at least the maximum size of a record");
+      return Succeeded::no;
+    }
+  if (is_null_ptr(stream_ptr))
+    {
+      this->buffer.resize(new_size);
+      return Succeeded::yes;
+    }
+  // go back to the position of the next record, as we discard the buffer
+  const std::streampos pos = 
+    this->buffer_pos < this->buffer_end || !stream_ptr->eof()
+    ? this->buffer_stream_position + static_cast<std::streamoff>(this->buffer_pos)
+    : std::streampos(-1);
+  this->buffer.resize(new_size);
+  return seek_and_clear_buffer(pos);
+}
+
 END_NAMESPACE_STIR
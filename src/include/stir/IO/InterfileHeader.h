@@ -194,6 +194,9 @@ public:
   std::vector<int> num_rings_per_segment;
 
   std::vector<std::string> applied_corrections;
+
+  //! if true, read_interfile_PDFS() will use ProjDataFromMemoryMappedFile
+  bool memory_mapped_data_access;
  
   // derived values
   int num_segments;
@@ -31,6 +31,7 @@
 #include "stir/detail/test_if_1d.h"
 #include "stir/IO/read_data_1d.h"
 #include <typeinfo>
+#include <limits>
 
 START_NAMESPACE_STIR
 
@@ -70,6 +71,16 @@ namespace detail
 		 IStreamT& s, Array<num_dimensions,elemT>& data, 
 		 const ByteOrder byte_order)
   {
+    if (data.is_contiguous() &&
+        data.size_all() <= static_cast<std::size_t>(std::numeric_limits<int>::max()))
+      {
+        // read all data in one go via a 1D view on the data block
+        Array<1,elemT> data_1d(IndexRange<1>(static_cast<int>(data.size_all())),
+                               data.get_full_data_ptr(), false);
+        const Succeeded success = read_data_1d(s, data_1d, byte_order);
+        data.release_full_data_ptr();
+        return success;
+      }
     for (typename Array<num_dimensions,elemT>::iterator iter= data.begin();
 	 iter != data.end();
 	 ++iter)
@@ -31,6 +31,7 @@
 #include "stir/detail/test_if_1d.h"
 #include "stir/IO/write_data_1d.h"
 #include <typeinfo>
+#include <limits>
 
 START_NAMESPACE_STIR
 
@@ -101,6 +102,19 @@ namespace detail
 					  const ByteOrder byte_order,
 					  const bool can_corrupt_data)
   {
+    if (typeid(OutputType) == typeid(elemT) && scale_factor==1 &&
+        data.is_contiguous() &&
+        data.size_all() <= static_cast<std::size_t>(std::numeric_limits<int>::max()))
+      {
+        // write all data in one go via a 1D view on the data block
+        const Array<1,elemT> data_1d(IndexRange<1>(static_cast<int>(data.size_all())),
+                                     const_cast<elemT *>(data.get_const_full_data_ptr()), 
+                                     false);
+        const Succeeded success = 
+          write_data_1d(s, data_1d, byte_order, can_corrupt_data);
+        data.release_const_full_data_ptr();
+        return success;
+      }
     for (typename Array<num_dimensions,elemT>::const_iterator iter= data.begin();
 	 iter != data.end();
 	 ++iter)
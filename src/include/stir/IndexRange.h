@@ -114,6 +114,9 @@ public:
   inline bool operator==(const IndexRange<num_dimensions>&) const;
   inline bool operator!=(const IndexRange<num_dimensions>&) const;
 
+  //! return the total number of elements in this range
+  inline size_t size_all() const;
+
   //! checks if the range is 'regular'
   inline bool is_regular() const;
 
@@ -162,6 +165,9 @@ public:
   inline int get_max_index() const;
   inline int get_length() const;
 
+  //! return the total number of elements in this range (i.e. get_length())
+  inline size_t size_all() const;
+
   inline bool operator==(const IndexRange<1>& range2) const;
 
   //! checks if the range is 'regular' (always true for the 1d case)
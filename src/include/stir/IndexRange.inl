@@ -104,6 +104,18 @@ IndexRange<num_dimensions>::
   return !(*this==range2);
 }
 
+template <int num_dimensions>
+size_t
+IndexRange<num_dimensions>::
+  size_all() const
+{
+  this->check_state();
+  size_t acc=0;
+  for(int i=this->get_min_index(); i<=this->get_max_index(); i++)
+    acc += this->num[i].size_all();
+  return acc;
+}
+
 template <int num_dimensions>
 bool
 IndexRange<num_dimensions>::
@@ -192,6 +204,10 @@ int
 IndexRange<1>::get_length() const
 { return max-min+1; }
 
+size_t
+IndexRange<1>::size_all() const
+{ return max<min ? size_t(0) : static_cast<size_t>(max-min+1); }
+
 bool
 IndexRange<1>::operator==(const IndexRange<1>& range2) const
 {
@@ -0,0 +1,185 @@
+//
+//
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#ifndef __stir_PerformanceTrace_H__
+#define __stir_PerformanceTrace_H__
+/*!
+  \file
+  \ingroup buildblock
+
+  \brief Declaration of classes stir::PerformanceTrace, stir::PerformanceTraceScope
+  and stir::PerformanceTraceEnabledScope
+*/
+#include "stir/common.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstddef>
+
+START_NAMESPACE_STIR
+
+/*! \ingroup buildblock
+  \brief Records the time spent in different stages of a computation, per thread
+
+  This class collects events, where every event is the wall-clock interval
+  during which one thread was busy with a given stage (e.g. "forward projection").
+  Every event is tagged with the current "subiteration" number, as set by
+  set_subiteration_num(). Events can then be written to file to see where time
+  is spent, and how well threads are balanced.
+
+  Recording is disabled by default. In that case, the only overhead of a
+  PerformanceTraceScope is checking a flag.
+
+  Every thread appends to its own buffer, so recording events does not need
+  any locking. When a thread finishes, its events are moved to a common list
+  and its buffer is freed. Threads are numbered in the order in which they
+  record their first event.
+
+  \warning clear() and the write functions should not be called while other threads
+  are recording events.
+
+  \par Example
+  \code
+  {
+    PerformanceTraceEnabledScope enabled_scope;
+    PerformanceTraceScope scope("forward projection");
+    // do the forward projection
+  }
+  PerformanceTrace::write_to_file("trace.json");
+  \endcode
+*/
+class PerformanceTrace
+{
+public:
+  typedef std::chrono::steady_clock clock_type;
+
+  //! enable or disable recording of events
+  static void set_enabled(const bool enabled);
+
+  //! check if events are recorded
+  static bool is_enabled()
+  { return enabled.load(std::memory_order_relaxed); }
+
+  //! set the number that is stored with all events recorded from now on
+  static void set_subiteration_num(const int subiteration_num);
+
+  //! remove all recorded events
+  /*! Times in the output are relative to the last call of this function
+      (or the start of the program if it was never called). */
+  static void clear();
+
+  //! add an event for the current thread
+  /*! \a stage should point to a string that stays valid until the events are
+      written (normally a string literal). */
+  static void add_event(const char * const stage,
+                        const clock_type::time_point& start_time,
+                        const clock_type::time_point& end_time);
+
+  //! number of threads that currently have a buffer for their events
+  /*! These are the threads that have recorded an event and have not finished yet. */
+  static std::size_t get_num_thread_buffers();
+
+  //! write all events in JSON format
+  /*! The file uses the Trace Event Format of the Chromium project, such that it
+      can be inspected with <tt>chrome://tracing</tt> or similar viewers.
+      Times are in microseconds. Calls error() if the file cannot be written.
+  */
+  static void write_Chrome_trace(const std::string& filename);
+
+  //! write all events in CSV format
+  /*! Every line has the thread number, subiteration number, stage name,
+      start time and duration (in microseconds). Calls error() if the file
+      cannot be written.
+  */
+  static void write_CSV(const std::string& filename);
+
+  //! write all events, selecting the format from the extension
+  /*! Uses write_CSV() if the extension of \a filename is <tt>.csv</tt>, and
+      write_Chrome_trace() otherwise.
+  */
+  static void write_to_file(const std::string& filename);
+
+private:
+  static std::atomic<bool> enabled;
+};
+
+/*! \ingroup buildblock
+  \brief Records an event in PerformanceTrace for the lifetime of the object
+
+  The stage is recorded only if PerformanceTrace was enabled when the object
+  was constructed.
+*/
+class PerformanceTraceScope
+{
+public:
+  //! start the event
+  /*! \a stage should be a string literal, see PerformanceTrace::add_event(). */
+  explicit PerformanceTraceScope(const char * const stage)
+    : stage(PerformanceTrace::is_enabled() ? stage : 0)
+  {
+    if (this->stage != 0)
+      start_time = PerformanceTrace::clock_type::now();
+  }
+
+  //! end the event
+  ~PerformanceTraceScope()
+  {
+    if (stage != 0)
+      PerformanceTrace::add_event(stage, start_time, PerformanceTrace::clock_type::now());
+  }
+
+private:
+  const char * const stage;
+  PerformanceTrace::clock_type::time_point start_time;
+
+  PerformanceTraceScope(const PerformanceTraceScope&);            // Not defined
+  PerformanceTraceScope& operator=(const PerformanceTraceScope&); // Not defined
+};
+
+/*! \ingroup buildblock
+  \brief Enables recording of PerformanceTrace events for the lifetime of the object
+
+  The destructor restores the previous state, also when an exception is thrown.
+*/
+class PerformanceTraceEnabledScope
+{
+public:
+  //! enable recording if \a enable is \c true (otherwise, nothing is changed)
+  explicit PerformanceTraceEnabledScope(const bool enable = true)
+    : previously_enabled(PerformanceTrace::is_enabled())
+  {
+    if (enable)
+      PerformanceTrace::set_enabled(true);
+  }
+
+  //! restore the state from before the constructor
+  ~PerformanceTraceEnabledScope()
+  {
+    PerformanceTrace::set_enabled(previously_enabled);
+  }
+
+private:
+  const bool previously_enabled;
+
+  PerformanceTraceEnabledScope(const PerformanceTraceEnabledScope&);            // Not defined
+  PerformanceTraceEnabledScope& operator=(const PerformanceTraceEnabledScope&); // Not defined
+};
+
+END_NAMESPACE_STIR
+
+#endif
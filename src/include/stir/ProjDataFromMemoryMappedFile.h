@@ -0,0 +1,115 @@
+/*!
+
+  \file
+  \ingroup projdata
+  \brief Declaration of class stir::ProjDataFromMemoryMappedFile
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#ifndef __stir_ProjDataFromMemoryMappedFile_H__
+#define __stir_ProjDataFromMemoryMappedFile_H__
+
+#include "stir/ProjDataFromStream.h"
+#include <string>
+#include <cstddef>
+
+START_NAMESPACE_STIR
+
+
+/*!
+  \ingroup projdata
+  \brief A class which reads projection data from a memory-mapped file.
+
+  The data file is mapped read-only (and shared) into the address space.
+  Reading viewgrams, sinograms and segments then becomes a copy straight out of
+  the mapping, without going through the stream buffers, and the kernel page cache
+  is shared between all processes that read the same file (e.g. several
+  reconstructions running on the same node).
+
+  The fast path is only used when the data on disk are \c float in native byte order.
+  In all other cases (and on systems without \c mmap) the ProjDataFromStream
+  implementation is used. Writing always goes via the stream, which is flushed
+  after every \c set_ call such that the mapping sees the new data.
+
+  Note that the returned Viewgram (etc.) objects still own their memory, i.e. the
+  data are copied once from the mapping. Handing out views into the mapping
+  would be unsafe as callers modify returned viewgrams in place and these might
+  outlive the ProjData object.
+
+  This class is normally constructed by read_interfile_PDFS() when the Interfile
+  header contains
+  \verbatim
+  memory mapped data access := 1
+  \endverbatim
+*/
+class ProjDataFromMemoryMappedFile : public ProjDataFromStream
+{
+public:
+  //! constructor taking all necessary parameters
+  /*!
+    \param data_filename name of the file that \a s is connected to.
+    All other parameters are as for ProjDataFromStream.
+  */
+  ProjDataFromMemoryMappedFile (shared_ptr<ExamInfo> const& exam_info_sptr,
+                                shared_ptr<ProjDataInfo> const& proj_data_info_ptr,
+                                const std::string& data_filename,
+                                shared_ptr<std::iostream> const& s,
+                                const std::streamoff offs,
+                                const std::vector<int>& segment_sequence_in_stream,
+                                StorageOrder o = Segment_View_AxialPos_TangPos,
+                                NumericType data_type = NumericType::FLOAT,
+                                ByteOrder byte_order = ByteOrder::native,
+                                float scale_factor = 1 );
+
+  virtual ~ProjDataFromMemoryMappedFile();
+
+  //! Returns true if the data file could be mapped and the fast path will be used
+  bool is_memory_mapped() const;
+
+  Viewgram<float> get_viewgram(const int view_num, const int segment_num,const bool make_num_tangential_poss_odd=false) const;
+  Succeeded set_viewgram(const Viewgram<float>& v);
+
+  Sinogram<float> get_sinogram(const int ax_pos_num, const int segment_num,const bool make_num_tangential_poss_odd=false) const;
+  Succeeded set_sinogram(const Sinogram<float>& s);
+
+  SegmentBySinogram<float> get_segment_by_sinogram(const int segment_num) const;
+  SegmentByView<float> get_segment_by_view(const int segment_num) const;
+
+  Succeeded set_segment(const SegmentBySinogram<float>&);
+  Succeeded set_segment(const SegmentByView<float>&);
+
+private:
+  //! start of the mapping (i.e. of the file), or 0 if not mapped
+  const char * mapped_data_ptr;
+  //! size of the mapping in bytes
+  std::size_t mapped_size;
+
+  //! Returns a pointer into the mapping, or 0 if the fast path cannot be used
+  const char * get_mapped_ptr(const std::streamoff offset_in_file,
+                              const std::size_t num_bytes) const;
+
+  //! flush the stream after writing such that the mapping sees the new data
+  Succeeded flush_stream(const Succeeded);
+
+  // copying would lead to 2 objects unmapping the same memory
+  ProjDataFromMemoryMappedFile(const ProjDataFromMemoryMappedFile&);
+  ProjDataFromMemoryMappedFile& operator=(const ProjDataFromMemoryMappedFile&);
+};
+
+END_NAMESPACE_STIR
+
+#endif
@@ -143,6 +143,14 @@ protected:
   //! the stream with the data
   shared_ptr<std::iostream> sino_stream;
 
+  //! Calculate the offset for the given segmnet
+  std::streamoff get_offset_segment(const int segment_num) const;
+  
+  //! Calculate offsets for viewgram data  
+  std::vector<std::streamoff> get_offsets(const int view_num, const int segment_num) const;
+  //! Calculate offsets for sinogram data
+  std::vector<std::streamoff> get_offsets_sino(const int ax_pos_num, const int segment_num) const;
+
 private:
   //! offset of the whole 3d sinogram in the stream
   std::streamoff  offset;
@@ -163,15 +171,6 @@ private:
   // memory as float, with the scale factor multiplied out
   float scale_factor;
   
-  //! Calculate the offset for the given segmnet
-  std::streamoff get_offset_segment(const int segment_num) const;
-  
-  //! Calculate offsets for viewgram data  
-  std::vector<std::streamoff> get_offsets(const int view_num, const int segment_num) const;
-  //! Calculate offsets for sinogram data
-  std::vector<std::streamoff> get_offsets_sino(const int ax_pos_num, const int segment_num) const;
-    
-  
 };
 
 END_NAMESPACE_STIR
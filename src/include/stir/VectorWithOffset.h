@@ -34,6 +34,7 @@
 #include "stir/common.h"
 #include "boost/iterator/iterator_adaptor.hpp"
 #include "boost/iterator/reverse_iterator.hpp"
+#include <algorithm>
 
 START_NAMESPACE_STIR
 
@@ -158,6 +159,20 @@ public:
   //! copy constructor
   inline VectorWithOffset(const VectorWithOffset &il) ;
 
+  //! swap content/members of 2 objects
+  /*! No memory is allocated or copied. This is used by Array to avoid copies. */
+  friend inline void swap(VectorWithOffset& first, VectorWithOffset& second)
+  {
+    first.check_state();
+    second.check_state();
+    std::swap(first.num, second.num);
+    std::swap(first.length, second.length);
+    std::swap(first.start, second.start);
+    std::swap(first.begin_allocated_memory, second.begin_allocated_memory);
+    std::swap(first.end_allocated_memory, second.end_allocated_memory);
+    std::swap(first._owns_memory_for_data, second._owns_memory_for_data);
+  }
+
   //! Destructor 
   inline virtual ~VectorWithOffset();	
   
@@ -227,6 +242,21 @@ public:
   //! get allocated size
   inline size_t capacity() const;
 
+  //! (re)initialise the vector to the index range \a min_index to \a max_index using existing data
+  /*! Any memory owned by the object is deallocated first.
+
+      If \a copy_data is \c false, the vector will use the memory pointed to by \a data_ptr
+      (which has to hold at least <code>max_index-min_index+1</code> elements). It will
+      then not deallocate that memory. See also the constructors that take a data pointer.
+
+      If \a copy_data is \c true, new memory is allocated and the data is copied into it.
+
+      This function is used by Array to let all its rows point into one contiguous block
+      of memory.
+  */
+  inline void init(const int min_index, const int max_index,
+                   T * const data_ptr, bool copy_data);
+
   //! check if this object owns the memory for the data
   /*! Will be false if one of the constructors is used that passes in a data block.
    */
@@ -303,6 +303,35 @@ VectorWithOffset(const int min_index, const int max_index,
   this->check_state();
 }
 
+template <class T>
+void
+VectorWithOffset<T>::
+init(const int min_index, const int max_index,
+     T * const data_ptr, bool copy_data)
+{
+  this->check_state();
+  this->_destruct_and_deallocate();
+  this->init();
+  this->_owns_memory_for_data = true;
+  if (min_index > max_index)
+    return;
+  if (copy_data)
+    {
+      this->resize(min_index, max_index);
+      std::copy(data_ptr, data_ptr + this->length, this->begin());
+    }
+  else
+    {
+      this->length = static_cast<unsigned>(max_index - min_index) + 1;
+      this->start = min_index;
+      this->begin_allocated_memory = data_ptr;
+      this->end_allocated_memory = data_ptr + this->length;
+      this->num = this->begin_allocated_memory - this->start;
+      this->_owns_memory_for_data = false;
+    }
+  this->check_state();
+}
+
 template <class T>
 VectorWithOffset<T>::~VectorWithOffset()
 { 
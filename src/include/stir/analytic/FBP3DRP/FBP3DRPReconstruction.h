@@ -169,7 +169,12 @@ protected:
     void do_forward_project_view(RelatedViewgrams<float> & viewgrams,
                                  int rmin, int rmax,
                                  int orig_min_ring, int orig_max_ring) const; 
+//!  Construct the Colsher filter for a segment, given the number of axial positions of the (grown) viewgrams
+    void do_colsher_filter_set_up(const int seg_num, const int num_axial_poss);
 //!  Apply Colsher filter to 8 viewgrams.
+/*! do_colsher_filter_set_up() has to be called first for the segment of the viewgrams.
+    This function can be called by multiple threads at the same time.
+*/
     void do_colsher_filter_view( RelatedViewgrams<float> & viewgrams);
 //!  3D backprojection implentation for 8 viewgrams.
     void do_3D_backprojection_view(RelatedViewgrams<float> const & viewgrams,
@@ -187,6 +192,11 @@ protected:
     virtual void do_byview_finalise(VoxelsOnCartesianGrid<float>& image) {};
 public:
       // KT 230899 this has to be public to let the Para stuff access it (sadly)
+    //! process (and back project) one set of related viewgrams
+    /*! do_colsher_filter_set_up() has to be called first for the segment of the viewgrams.
+        This function is called by multiple threads at the same time (for different \a image arguments)
+        when using OpenMP.
+    */
 
     virtual void do_process_viewgrams(
                                   RelatedViewgrams<float> & viewgrams,
@@ -0,0 +1,59 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup buildblock
+  \brief Definition of stir::fnv1a_hash()
+*/
+
+#ifndef __stir_fnv1a_hash_H__
+#define __stir_fnv1a_hash_H__
+
+#include "stir/common.h"
+#include <cstddef>
+#include <cstdint>
+
+START_NAMESPACE_STIR
+
+//! initial value for fnv1a_hash()
+/*! \ingroup buildblock */
+const std::uint64_t fnv1a_hash_initial_value = 14695981039346656037ULL;
+
+//! 64-bit FNV-1a hash of \a num_bytes bytes at \a data
+/*! \ingroup buildblock
+  The hash of several blocks of data can be computed by passing the result for
+  the previous block as \a hash.
+
+  The result only depends on the bytes, so it is the same on all platforms for
+  strings, but not for e.g. \c float data (as the byte order can differ).
+*/
+inline std::uint64_t
+fnv1a_hash(const void * const data, const std::size_t num_bytes,
+           std::uint64_t hash = fnv1a_hash_initial_value)
+{
+  const unsigned char * const bytes = static_cast<const unsigned char *>(data);
+  for (std::size_t i=0; i<num_bytes; ++i)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+  return hash;
+}
+
+END_NAMESPACE_STIR
+
+#endif
@@ -30,6 +30,7 @@
 #include "stir/Succeeded.h"
 #include "stir/DetectionPositionPair.h"
 #include "stir/ProjDataInfoCylindricalNoArcCorr.h"
+#include "stir/listmode/ProjDataHistogramLUT.h"
 
 START_NAMESPACE_STIR
 
@@ -70,6 +71,18 @@ public:
   */
   inline virtual void get_bin(Bin& bin, const ProjDataInfo& proj_data_info) const;
 
+  //! find the segment number and the offset in the segment of the bin for this event
+  /*! This gives the same result as finding the bin with get_bin() (for the projection
+    data used to construct \a lut), followed by finding its offset, but it avoids
+    constructing a Bin, checking its range etc.
+
+    \return the offset, or -1 if the event does not correspond to a bin in the range
+    of the projection data.
+    \see ProjDataHistogramLUT
+  */
+  inline virtual std::ptrdiff_t
+    get_histogram_offset(int& segment_num, const ProjDataHistogramLUT& lut) const;
+
   //! This method checks if the template is valid for LmToProjData
   /*! Used before the actual processing of the data (see issue #61), before calling get_bin()
    *  Most scanners have listmode data that correspond to non arc-corrected data and
@@ -87,6 +87,15 @@ get_bin(Bin& bin, const ProjDataInfo& proj_data_info) const
     bin.set_bin_value(1);
 }
 
+std::ptrdiff_t
+CListEventCylindricalScannerWithDiscreteDetectors::
+get_histogram_offset(int& segment_num, const ProjDataHistogramLUT& lut) const
+{
+  DetectionPositionPair<> det_pos;
+  this->get_detection_position(det_pos);
+  return lut.get_offset_for_det_pos_pair(segment_num, det_pos);
+}
+
 bool
 CListEventCylindricalScannerWithDiscreteDetectors::
 is_valid_template(const ProjDataInfo& proj_data_info) const
@@ -86,6 +86,12 @@ public CListEventCylindricalScannerWithDiscreteDetectors
     void 
     get_bin(Bin&, const ProjDataInfo&) const;
 
+  //! find the segment number and the offset in the segment of the bin for this event
+  /*! Uses the sinogram and ring coordinates directly, avoiding the conversion to detectors. */
+  inline virtual
+    std::ptrdiff_t
+    get_histogram_offset(int& segment_num, const ProjDataHistogramLUT&) const;
+
   //! This method checks if the template is valid for LmToProjData
   /*! Used before the actual processing of the data (see issue #61), before calling get_bin()
    *  Most scanners have listmode data that correspond to non arc-corrected data and
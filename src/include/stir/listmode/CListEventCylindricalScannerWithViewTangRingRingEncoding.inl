@@ -112,6 +112,24 @@ get_bin(Bin& bin, const ProjDataInfo& proj_data_info) const
 			      static_cast<const ProjDataInfoCylindrical&>(proj_data_info));
 }
 
+template <class Derived>
+std::ptrdiff_t
+CListEventCylindricalScannerWithViewTangRingRingEncoding<Derived>::
+get_histogram_offset(int& segment_num, const ProjDataHistogramLUT& lut) const
+{
+  int tangential_pos_num;
+  int view_num;
+  unsigned int ring_a;
+  unsigned int ring_b;
+  static_cast<const Derived *>(this)->get_data().
+    get_sinogram_and_ring_coordinates(view_num, tangential_pos_num, ring_a, ring_b);
+  return
+    lut.get_offset_for_uncompressed_view_tangential_pos_num_ring_pair(segment_num,
+                                                                      view_num, tangential_pos_num,
+                                                                      static_cast<int>(ring_a),
+                                                                      static_cast<int>(ring_b));
+}
+
 template <class Derived>
 bool
 CListEventCylindricalScannerWithViewTangRingRingEncoding<Derived>::
@@ -29,6 +29,8 @@
 #include "stir/Scanner.h"
 #include "stir/shared_ptr.h"
 #include <string>
+#include <vector>
+#include <cstddef>
 #include <ctime>
 
 #include "stir/IO/ExamData.h"
@@ -96,6 +98,23 @@ class ExamInfo;
     }
   \endcode
 
+  When going through a lot of data, it is faster to read records in batches
+  with get_next_records(), as this avoids a (virtual) function call per record.
+  \code
+  std::vector<shared_ptr<CListRecord> > records(10000);
+  for (std::size_t i=0; i<records.size(); ++i)
+    records[i] = lm_data_sptr->get_empty_record_sptr();
+  std::size_t num_records;
+  while ((num_records = lm_data_sptr->get_next_records(records)) > 0)
+    {
+      for (std::size_t i=0; i<num_records; ++i)
+        {
+          CListRecord& record = *records[i];
+          // as above
+        }
+    }
+  \endcode
+
   In addition, there is a facility to 'remember' positions in the list,
   and go back to one of these positions. This could be useful to
   mark time frames. This goes as follows.
@@ -185,6 +204,23 @@ public:
   virtual 
     Succeeded get_next_record(CListRecord& event) const = 0;
 
+  //! Gets a batch of records from the listmode sequence
+  /*! Reads records into <tt>*records[0]</tt>, <tt>*records[1]</tt>, etc. The records 
+      have to be obtained via get_empty_record_sptr().
+
+      Reading stops when all records are filled, when a time record has been read
+      (which is then the last record of the batch), or when there are no more records.
+      A batch therefore never extends past a time record, such that save_get_position()
+      can be called after a batch that ends with a time record to mark the start of a time frame.
+
+      \return the number of records read. 0 means that there are no more records.
+
+      The default implementation calls get_next_record(). Derived classes should
+      override this if they can avoid a virtual function call per record.
+  */
+  virtual
+    std::size_t get_next_records(const std::vector<shared_ptr<CListRecord> >& records) const;
+
   //! Call this function if you want to re-start reading at the beginning.
   virtual 
     Succeeded reset() = 0;
@@ -63,6 +63,10 @@ public:
   virtual 
     Succeeded get_next_record(CListRecord& record) const;
 
+  //! Reads records without a virtual function call per record
+  virtual
+    std::size_t get_next_records(const std::vector<shared_ptr<CListRecord> >& records) const;
+
   virtual 
     Succeeded reset();
 
@@ -67,6 +67,8 @@ public:
 	virtual std::string get_name() const;
 	virtual shared_ptr <CListRecord> get_empty_record_sptr() const;
 	virtual Succeeded get_next_record(CListRecord& record_of_general_type) const;
+	//! Reads records without a virtual function call per record
+	virtual std::size_t get_next_records(const std::vector<shared_ptr<CListRecord> >& records) const;
 	virtual Succeeded reset();
 	
 	/*!
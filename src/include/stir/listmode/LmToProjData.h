@@ -108,6 +108,14 @@ class CListTime;
     ; if you're short of RAM (i.e. a single projdata does not fit into memory),
     ; you can use this to process the list mode data in multiple passes.
     num_segments_in_memory := -1
+    ; alternatively, give the amount of memory (in MB) that can be used for projection data
+    ; (see below). If larger than 0, num_segments_in_memory will be ignored.
+    ; If more than 1 frame fits, frames are written to disk in the background.
+    maximum memory in MB for projection data := 0
+
+    ; number of threads used to process the events (see below).
+    ; 1 (default) processes all events sequentially, 0 uses the default number of threads
+    number of threads := 1
 
   End := 
   \endverbatim
@@ -143,12 +151,59 @@ class CListTime;
   </li>
   </ul>
 
+  \par Memory usage
+
+  When <tt>maximum memory in MB for projection data</tt> is set, it determines
+  how the data are processed:
+  <ul>
+  <li> If a single time frame does not fit, the segments are processed in
+       batches that fit. The list mode data are read only once: while the first
+       batch is filled, the events in the other segments are written to temporary
+       files next to the output (one per batch of segments). The other batches are
+       then filled from these files, which are removed afterwards. (With
+       \c num_segments_in_memory, the list mode data are read once per batch instead.)
+  </li>
+  <li> If \a n frames fit (with \a n larger than 1), a finished frame is written
+       to disk in a separate thread while the next frame is being processed.
+       At most \a n-1 frames are written at the same time.
+  </li>
+  </ul>
+  The temporary files need 12 bytes per stored event that is not in the first
+  batch of segments, and small buffers for every batch (not counted in the budget).
+
+  \par Multi-threading
+
+  When \c number \c of \c threads is not 1 (and STIR is compiled with OpenMP),
+  the list mode data are read in batches that end at a time event, and
+  get_bin_from_event() and do_post_normalisation() are called for all events in a batch
+  in parallel. When storing time frames, the (normalised) values are added to the
+  projection data in the same parallel loop, using atomic updates. The order of the
+  floating point additions then depends on the number of threads (and on scheduling).
+  Without post-normalisation all values are integers, and the output is identical to
+  the sequential case. With post-normalisation, the output can differ by rounding
+  errors from run to run. When using \c num_events_to_store (without time frames),
+  the bins are added by a single thread in the order of the events in the list mode
+  data, as processing has to stop at a particular event. The output is then
+  identical to the sequential case.
+
+  For scanners with discrete detectors (see CListEventCylindricalScannerWithDiscreteDetectors),
+  events are normally added directly to the projection data via a ProjDataHistogramLUT,
+  which is much faster than finding the Bin for every event. This is only done when
+  no normalisation is used, see can_use_histogram_LUT(). In this case, the events in a batch
+  are added to the projection data in parallel as well. As all increments
+  are integers, the output is again identical to the sequential case. Again, this is not
+  done when using \c num_events_to_store.
+
   \par Notes for developers
 
   The class provides several
   virtual functions. If a derived class overloads these, the default behaviour
   might change. For example, get_bin_from_event() might do motion correction.
 
+  When using multiple threads, get_bin_from_event() (and the normalisation objects)
+  has to be thread-safe. It can use state set by process_new_time_event(), but it
+  should not modify any state itself (e.g. use a random number generator).
+
   \todo Currently, there is no support for gating or energy windows. This
   could in principle be added by a derived class, but it would be better
   to do it here.
@@ -206,6 +261,17 @@ protected:
   */
   void do_post_normalisation(Bin& bin) const;
 
+  //! Checks if events can be added to the projection data via a ProjDataHistogramLUT
+  /*! This is the case if the events are for a scanner with discrete detectors with the
+      same number of rings and detectors as the template projection data (which has to
+      be ProjDataInfoCylindricalNoArcCorr), and no (pre- or post-)normalisation
+      or interactive output is used.
+
+      As derived classes might change get_bin_from_event() (e.g. for motion correction),
+      this returns \c false for any derived class.
+  */
+  bool can_use_histogram_LUT() const;
+
   //! \name parsing functions
   //@{
   virtual void set_defaults();
@@ -228,6 +294,10 @@ protected:
   // TODO make long (or even unsigned long) but can't do this yet because we can't parse longs yet
   unsigned long int num_events_to_store;
   int max_segment_num_to_process;
+  //! number of threads used to compute bins (1 means no multi-threading, 0 uses the default)
+  int num_threads;
+  //! memory budget for the projection data (0 means use num_segments_in_memory)
+  int max_memory_in_MB;
 
   //! Toggle readable output on stdout or actual projdata
   /*! corresponds to key "list event coordinates" */
@@ -264,6 +334,8 @@ protected:
   bool do_time_frame;
   //! A variable that will be set to 1,0 or -1, according to store_prompts and store_delayeds
   int delayed_increment;
+  //! Number of complete frames that fit in memory (set from max_memory_in_MB, 1 otherwise)
+  unsigned int num_frames_in_memory;
 
 };
 
@@ -0,0 +1,120 @@
+//
+//
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup listmode
+  \brief Declaration of class stir::ProjDataHistogramLUT
+
+*/
+#ifndef __stir_listmode_ProjDataHistogramLUT_H__
+#define __stir_listmode_ProjDataHistogramLUT_H__
+
+#include "stir/ProjDataInfoCylindricalNoArcCorr.h"
+#include "stir/DetectionPositionPair.h"
+#include <vector>
+#include <cstddef>
+
+START_NAMESPACE_STIR
+
+//! Look-up tables to find the position of a detector pair in a histogram of projection data
+/*! \ingroup listmode
+  When histogramming list mode data, finding the Bin for every event (and then indexing the
+  segments) is relatively expensive. This class precomputes for every detector pair the
+  segment number and the offset in a contiguous array that stores all bins of that segment
+  ordered by view, axial position and tangential position (i.e. as in SegmentByView,
+  see Array::get_full_data_ptr()).
+
+  The offset is the sum of a term that depends only on the detector numbers in the ring
+  (i.e. view and tangential position) and a term that depends only on the ring pair
+  (i.e. segment and axial position), so the tables have size
+  <tt>num_detectors_per_ring^2</tt> and <tt>num_rings^2</tt>.
+
+  The results are the same as those of ProjDataInfoCylindricalNoArcCorr::get_bin_for_det_pair(),
+  followed by a check if the bin is in the range of the projection data.
+*/
+class ProjDataHistogramLUT
+{
+public:
+  //! Construct the tables for all bins of \a proj_data_info
+  explicit ProjDataHistogramLUT(const ProjDataInfoCylindricalNoArcCorr& proj_data_info);
+
+  //! Find the segment number and the offset in the segment for a detector pair
+  /*! \return the offset, or -1 if the detector pair does not correspond to a bin in the range
+      of the projection data (in which case \a segment_num is undefined).
+  */
+  inline std::ptrdiff_t
+    get_offset_for_det_pair(int& segment_num,
+                            const int det1_num, const int ring1_num,
+                            const int det2_num, const int ring2_num) const;
+
+  //! Find the segment number and the offset in the segment for a detector pair
+  inline std::ptrdiff_t
+    get_offset_for_det_pos_pair(int& segment_num, const DetectionPositionPair<>&) const;
+
+  //! Find the segment number and the offset in the segment for coordinates in an (uncompressed) sinogram and a ring pair
+  /*! This is intended for list mode formats that store events in terms of view, tangential
+      position and the 2 rings, see CListEventCylindricalScannerWithViewTangRingRingEncoding.
+      \a uncompressed_view_num is the view number without mashing. The ring pair
+      is not swapped.
+      \return -1 if the coordinates do not correspond to a bin in the range
+      of the projection data.
+  */
+  inline std::ptrdiff_t
+    get_offset_for_uncompressed_view_tangential_pos_num_ring_pair(int& segment_num,
+                                                                  const int uncompressed_view_num,
+                                                                  const int tang_pos_num,
+                                                                  const int ring_a,
+                                                                  const int ring_b) const;
+
+private:
+  struct DetPairInfo
+  {
+    //! index of the view (i.e. starting from 0)
+    int view_index;
+    //! index of the tangential position (i.e. starting from 0), or -1 if out of range
+    int tang_pos_index;
+    //! if false, the rings have to be swapped
+    bool keep_ring_order;
+  };
+  struct RingPairInfo
+  {
+    //! segment number for this ring pair
+    int segment_num;
+    //! offset in the segment of the first bin for this axial position, or -1 if out of range
+    std::ptrdiff_t offset;
+    //! distance between consecutive views in this segment
+    int view_stride;
+  };
+
+  int num_detectors_per_ring;
+  int num_rings;
+  int view_mashing_factor;
+  int min_tang_pos_num;
+  int max_tang_pos_num;
+  //! indexed by <tt>det1_num*num_detectors_per_ring + det2_num</tt>
+  std::vector<DetPairInfo> det_pair_info;
+  //! indexed by <tt>ring1_num*num_rings + ring2_num</tt>
+  std::vector<RingPairInfo> ring_pair_info;
+};
+
+END_NAMESPACE_STIR
+
+#include "stir/listmode/ProjDataHistogramLUT.inl"
+
+#endif
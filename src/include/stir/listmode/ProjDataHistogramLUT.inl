@@ -0,0 +1,90 @@
+//
+//
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup listmode
+  \brief Implementation of inline functions of class stir::ProjDataHistogramLUT
+
+*/
+#include <cassert>
+
+START_NAMESPACE_STIR
+
+std::ptrdiff_t
+ProjDataHistogramLUT::
+get_offset_for_det_pair(int& segment_num,
+                        const int det1_num, const int ring1_num,
+                        const int det2_num, const int ring2_num) const
+{
+  assert(0<=det1_num && det1_num<num_detectors_per_ring);
+  assert(0<=det2_num && det2_num<num_detectors_per_ring);
+  assert(0<=ring1_num && ring1_num<num_rings);
+  assert(0<=ring2_num && ring2_num<num_rings);
+  const DetPairInfo& det_pair = det_pair_info[det1_num*num_detectors_per_ring + det2_num];
+  if (det_pair.tang_pos_index < 0)
+    return -1;
+  const RingPairInfo& ring_pair =
+    det_pair.keep_ring_order
+    ? ring_pair_info[ring1_num*num_rings + ring2_num]
+    : ring_pair_info[ring2_num*num_rings + ring1_num];
+  if (ring_pair.offset < 0)
+    return -1;
+  segment_num = ring_pair.segment_num;
+  return
+    ring_pair.offset +
+    static_cast<std::ptrdiff_t>(det_pair.view_index)*ring_pair.view_stride +
+    det_pair.tang_pos_index;
+}
+
+std::ptrdiff_t
+ProjDataHistogramLUT::
+get_offset_for_det_pos_pair(int& segment_num, const DetectionPositionPair<>& det_pos) const
+{
+  return
+    get_offset_for_det_pair(segment_num,
+                            det_pos.pos1().tangential_coord(),
+                            det_pos.pos1().axial_coord(),
+                            det_pos.pos2().tangential_coord(),
+                            det_pos.pos2().axial_coord());
+}
+
+std::ptrdiff_t
+ProjDataHistogramLUT::
+get_offset_for_uncompressed_view_tangential_pos_num_ring_pair(int& segment_num,
+                                                              const int uncompressed_view_num,
+                                                              const int tang_pos_num,
+                                                              const int ring_a,
+                                                              const int ring_b) const
+{
+  assert(0<=uncompressed_view_num && uncompressed_view_num<num_detectors_per_ring/2);
+  assert(0<=ring_a && ring_a<num_rings);
+  assert(0<=ring_b && ring_b<num_rings);
+  if (tang_pos_num < min_tang_pos_num || tang_pos_num > max_tang_pos_num)
+    return -1;
+  const RingPairInfo& ring_pair = ring_pair_info[ring_a*num_rings + ring_b];
+  if (ring_pair.offset < 0)
+    return -1;
+  segment_num = ring_pair.segment_num;
+  return
+    ring_pair.offset +
+    static_cast<std::ptrdiff_t>(uncompressed_view_num/view_mashing_factor)*ring_pair.view_stride +
+    (tang_pos_num - min_tang_pos_num);
+}
+
+END_NAMESPACE_STIR
@@ -26,6 +26,7 @@
 */
 
 #include <algorithm>
+#include <vector>
 START_NAMESPACE_STIR
 
 //! default constructor
@@ -251,24 +252,39 @@ multiply_dynamic_image_with_model_and_add_to_input(ParametricVoxelsOnCartesianGr
   assert(dynamic_image.get_time_frame_definitions().get_num_frames()==static_cast<unsigned int> (model_array_max[2]));
   assert(model_array_max[1]-model_array_min[1]+1==num_param);
 
+  // Sums over frames are accumulated frame by frame for a whole image row at a time (in the same
+  // order as for a single voxel), such that the inner loop runs over contiguous data.
   const int min_k_index = dynamic_image[1].get_min_index(); 
   const int max_k_index = dynamic_image[1].get_max_index();
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
   for ( int k = min_k_index; k<= max_k_index; ++k)
     {
+      std::vector<float> sums_over_frames;
       const int min_j_index = dynamic_image[1][k].get_min_index(); 
       const int max_j_index = dynamic_image[1][k].get_max_index();
       for ( int j = min_j_index; j<= max_j_index; ++j)
         {
           const int min_i_index = dynamic_image[1][k][j].get_min_index(); 
-          const int max_i_index = dynamic_image[1][k][j].get_max_index();
-          for ( int i = min_i_index; i<= max_i_index; ++i)
-            for(int param_num = model_array_min[1];param_num<=model_array_max[1] ; ++param_num)
-              {
-                float sum_over_frames=0.F;
-                for(int frame_num = model_array_min[2];frame_num<=model_array_max[2] ; ++frame_num)
-                  sum_over_frames+=this->_model_array[param_num][frame_num]*dynamic_image[frame_num][k][j][i]; 
-                parametric_image[k][j][i][param_num]+=sum_over_frames;
-              }
+          const int num_i = dynamic_image[1][k][j].get_length();
+          for(int param_num = model_array_min[1];param_num<=model_array_max[1] ; ++param_num)
+            {
+              sums_over_frames.assign(num_i, 0.F);
+              float * const sums_ptr = &sums_over_frames[0];
+              for(int frame_num = model_array_min[2];frame_num<=model_array_max[2] ; ++frame_num)
+                {
+                  const float model_value = this->_model_array[param_num][frame_num];
+                  const float * const row_ptr = &dynamic_image[frame_num][k][j][min_i_index];
+#if defined(STIR_OPENMP) && (_OPENMP >= 201307)
+#pragma omp simd
+#endif
+                  for (int i=0; i<num_i; ++i)
+                    sums_ptr[i]+=model_value*row_ptr[i];
+                }
+              for (int i=0; i<num_i; ++i)
+                parametric_image[k][j][min_i_index+i][param_num]+=sums_over_frames[i];
+            }
         }
     }
 }
@@ -128,6 +128,10 @@ class PatlakPlot : public RegisteredParsingObject<PatlakPlot, KineticModel>
 					      const ParametricVoxelsOnCartesianGrid & par_image) const;
 
     //! This is the common method used to estimate the parametric images from the dynamic images. 
+    /*! The result is the same as calling linear_regression() (with unit weights) for every voxel
+      (apart from rounding), but the frames are processed a whole image row at a time, and planes are
+      processed in parallel when using OpenMP.
+    */
     void 
       apply_linear_regression(ParametricVoxelsOnCartesianGrid & par_image, const DynamicDiscretisedDensity & dyn_image) const;
 
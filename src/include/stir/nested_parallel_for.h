@@ -0,0 +1,116 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup threads
+
+  \brief Implementation of function stir::nested_parallel_for()
+*/
+#ifndef __stir_nested_parallel_for_H__
+#define __stir_nested_parallel_for_H__
+
+#include "stir/num_threads.h"
+#include "stir/info.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <exception>
+#include <string>
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
+
+START_NAMESPACE_STIR
+
+//! Calls \a f(i) for every \a i from \a min_index to \a max_index, running several calls at the same time
+/*! \ingroup threads
+  This is intended for loops over independent items (such as time frames or gates) where
+  every call uses OpenMP itself (e.g. via distributable_computation()). Up to
+  \a num_in_parallel calls run at the same time, each with its own team of
+  \a num_threads_per_call threads (using nested parallelism). If \a num_threads_per_call is 0,
+  the threads given by get_max_num_threads() are divided between the calls.
+
+  \a f should therefore only modify data for its own index. If \a f throws, the
+  remaining calls are still made, after which error() is called with the message of
+  the first exception.
+
+  Without OpenMP support, or if \a num_in_parallel is 1, this is a normal loop.
+  \a description (e.g. "frames") is only used in messages.
+*/
+template <class Function>
+inline void
+nested_parallel_for(const int min_index, const int max_index,
+                    const int num_in_parallel, const int num_threads_per_call,
+                    Function f, const std::string& description)
+{
+#ifdef STIR_OPENMP
+  const int num_calls_in_parallel = std::min(num_in_parallel, max_index - min_index + 1);
+  if (num_calls_in_parallel > 1)
+    {
+      const int num_threads_per_nested_call =
+        num_threads_per_call > 0
+        ? num_threads_per_call
+        : std::max(1, get_max_num_threads()/num_calls_in_parallel);
+      info(boost::format("Processing %1% %2% in parallel with %3% threads each")
+           % num_calls_in_parallel % description % num_threads_per_nested_call);
+      const int old_max_active_levels = omp_get_max_active_levels();
+      omp_set_max_active_levels(std::max(old_max_active_levels, 2));
+      // error() throws, but exceptions cannot leave the parallel region
+      bool failed = false;
+      std::string error_message;
+#pragma omp parallel for schedule(dynamic) num_threads(num_calls_in_parallel)
+      for (int i=min_index; i<=max_index; ++i)
+        {
+          // only changes the number of threads of nested parallel regions started by this thread
+          omp_set_num_threads(num_threads_per_nested_call);
+          try
+            {
+              f(i);
+            }
+          catch (const std::string& message)
+            {
+              // thrown by error()
+#pragma omp critical(NESTED_PARALLEL_FOR_ERROR)
+              if (!failed)
+                { failed = true; error_message = message; }
+            }
+          catch (const std::exception& e)
+            {
+#pragma omp critical(NESTED_PARALLEL_FOR_ERROR)
+              if (!failed)
+                { failed = true; error_message = e.what(); }
+            }
+          catch (...)
+            {
+#pragma omp critical(NESTED_PARALLEL_FOR_ERROR)
+              if (!failed)
+                { failed = true; error_message = "unknown exception"; }
+            }
+        }
+      omp_set_max_active_levels(old_max_active_levels);
+      if (failed)
+        error(boost::format("Processing %1% in parallel failed: %2%") % description % error_message);
+      return;
+    }
+#endif
+  for (int i=min_index; i<=max_index; ++i)
+    f(i);
+}
+
+END_NAMESPACE_STIR
+
+#endif
@@ -0,0 +1,88 @@
+//
+//
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#ifndef __stir_numerics_FourierPlan_H__
+#define __stir_numerics_FourierPlan_H__
+/*!
+  \file
+  \ingroup DFT
+
+  \brief Declaration of class stir::FourierPlan and function stir::get_fourier_plan()
+*/
+#include "stir/shared_ptr.h"
+#include <complex>
+#include <vector>
+
+START_NAMESPACE_STIR
+
+/*! \ingroup DFT
+  \brief Precomputed data for one-dimensional FFTs of a given length
+
+  The length is factorised in radices 4, 2, 3 and any remaining prime factors,
+  and all twiddle factors are computed on construction. The transform is then
+  computed with a (mixed-radix) Stockham algorithm, which does not need a
+  bit-reversal step. Butterflies for radices 2, 3 and 4 are specialised,
+  other prime factors use a generic (and slower) butterfly, so lengths with
+  only small prime factors are most efficient.
+
+  A plan is not modified after construction, so the same plan can be used
+  by multiple threads at the same time. Normally, you would get a plan via
+  get_fourier_plan(), such that plans are shared.
+
+  The convention is the same as for fourier_1d().
+*/
+class FourierPlan
+{
+public:
+  //! construct the plan
+  /*! \a length has to be at least 1. */
+  explicit FourierPlan(const int length);
+
+  int get_length() const
+  { return length; }
+
+  //! returns <code>exp(2 pi i k/length)</code> for \a k from 0 to <code>length-1</code>
+  const std::complex<float>& get_twiddle_factor(const int k) const
+  { return twiddle_factors[k]; }
+
+  //! compute the DFT of \a data in place
+  /*! \a data has to point to \c get_length() contiguous elements. */
+  void transform(std::complex<float>* data, const int sign) const;
+
+  //! compute the DFT of \a data in place, using \a work as scratch space
+  /*! \a work has to point to \c get_length() elements. Its contents will be overwritten.
+      This avoids allocating memory for every transform.
+  */
+  void transform(std::complex<float>* data, const int sign, std::complex<float>* work) const;
+
+private:
+  int length;
+  std::vector<int> radices;
+  std::vector<std::complex<float> > twiddle_factors;
+};
+
+//! Get a plan for 1D FFTs of length \a length
+/*! \ingroup DFT
+  Plans are constructed when first asked for, and then kept in a cache. This function
+  can be called from multiple threads at the same time.
+*/
+shared_ptr<const FourierPlan> get_fourier_plan(const int length);
+
+END_NAMESPACE_STIR
+
+#endif
@@ -85,7 +85,12 @@ inline void inverse_fourier(T& c, const int sign=1)
   \param[in] sign This can be used to implement a different convention for the DFT
 
   \warning Currently, the array has to be indexed from 0.
-  \warning Currently, the length of the array has to be a power of 2.
+
+  Any length is supported, but the transform is fastest when the length
+  has only small prime factors (2, 3 and 4 have specialised code).
+  The work is done by a FourierPlan, which is shared between all calls
+  with the same length. This function can therefore be called from multiple
+  threads at the same time (for different arrays of course).
    
   The convention used is as follows.
   For a vector of length \a n, the result is
@@ -96,12 +101,9 @@ inline void inverse_fourier(T& c, const int sign=1)
    
   This function can be used with more general type of \a c (if instantiated in fourier.cxx).
   The type \a T has to be such that \a T::value_type, \a T::reference and 
-  <tt> T::reference T::operator[](const int)</tt> exist. Moreover, numerical
-  operations
-  <tt>operator*=(T::reference, std::complex\<float\>)</tt>,
-  <tt>operator+=(T::reference, T::value_type)</tt> and
-  <tt>operator*=(T::reference, int)</tt>,
-   have to be defined as well.
+  <tt> T::reference T::operator[](const int)</tt> exist.
+  If \a T::value_type is not <tt>std::complex\<float\></tt>, it has to provide
+  \c begin_all() and \c size_all() (like an Array), and all elements have to be of the same size.
 */
 template <typename T>
 void fourier_1d(T& c, const int sign);
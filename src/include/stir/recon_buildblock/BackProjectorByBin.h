@@ -83,9 +83,14 @@ public:
 
  
   //! project whole proj_data into the volume
-  /*! it overwrites the data already present in the volume */
+  /*! it overwrites the data already present in the volume
+
+      With OpenMP, threads back project into partial images, which are added at the end.
+      Their number can be limited with \a max_num_partial_images (see ParallelImageAccumulator).
+  */
   void back_project(DiscretisedDensity<3,float>&,
-	            const ProjData&);
+	            const ProjData&,
+                    const int max_num_partial_images = 0);
 
   /*! \brief projects the viewgrams into the volume
    it adds to the data already present in the volume.*/
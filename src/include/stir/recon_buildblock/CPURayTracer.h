@@ -0,0 +1,58 @@
+//
+//
+/*!
+
+  \file
+  \ingroup projection
+  \brief Declaration of class stir::CPURayTracer
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#ifndef __stir_recon_buildblock_CPURayTracer_H__
+#define __stir_recon_buildblock_CPURayTracer_H__
+
+#include "stir/recon_buildblock/RayTracerBackend.h"
+#include <vector>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup projection
+  \brief RayTracerBackend that does the computations of the TFRayMarching graph on the CPU
+
+  Points are stored as a structure of arrays (one array per coordinate), such that
+  the loop over all points in trace() can be vectorised by the compiler. With OpenMP,
+  the loop is also distributed over threads. The instruction set that is used depends on
+  the compiler flags (e.g. \c -march=native enables AVX2 or AVX-512 when available).
+
+  The loop uses only local variables, such that batches can be traced in parallel
+  (see RayTracerBackend).
+*/
+class CPURayTracer : public RayTracerBackend
+{
+public:
+  explicit CPURayTracer(const int chunk_size, const int max_num_batches_in_flight = 0);
+
+  virtual ~CPURayTracer();
+
+protected:
+  virtual void trace(const Points& points, std::vector<ProjMatrixElemsForOneBinValue>& result);
+};
+
+END_NAMESPACE_STIR
+
+#endif
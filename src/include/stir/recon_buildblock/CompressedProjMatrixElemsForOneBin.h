@@ -0,0 +1,86 @@
+//
+//
+/*!
+
+  \file
+  \ingroup projection
+
+  \brief Declaration of class stir::CompressedProjMatrixElemsForOneBin
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#ifndef __stir_recon_buildblock_CompressedProjMatrixElemsForOneBin_H__
+#define __stir_recon_buildblock_CompressedProjMatrixElemsForOneBin_H__
+
+#include "stir/common.h"
+#include <cstddef>
+
+START_NAMESPACE_STIR
+
+class ProjMatrixElemsForOneBin;
+
+/*!
+  \ingroup projection
+  \brief A compact (read-only) copy of a ProjMatrixElemsForOneBin, used by the
+  ProjMatrixByBin cache.
+
+  Voxel coordinates are stored as differences with the previous element. As
+  elements are added in (nearly) sorted order, these differences are small and are
+  stored as variable-length integers, usually taking 1 byte per coordinate.
+
+  Values are stored either as \c float, or (when \c quantise_values is \c true) as
+  16-bit integers relative to the maximum absolute value in the row. The latter
+  gives a relative error of at most 1/65534 of that maximum.
+
+  A typical element then takes 5 or 7 bytes, compared to 12 bytes for a
+  ProjMatrixElemsForOneBinValue.
+
+  The bin coordinates are not stored.
+*/
+class CompressedProjMatrixElemsForOneBin
+{
+public:
+  //! Compress the elements of \a lor
+  CompressedProjMatrixElemsForOneBin(const ProjMatrixElemsForOneBin& lor,
+                                     const bool quantise_values = false);
+
+  ~CompressedProjMatrixElemsForOneBin();
+
+  //! Overwrite the elements of \a lor with the stored ones (its bin is not changed)
+  void decompress(ProjMatrixElemsForOneBin& lor) const;
+
+  //! number of elements
+  std::size_t size() const;
+
+  //! number of bytes used by this object (including the object itself)
+  std::size_t get_memory_size() const;
+
+private:
+  unsigned char * data;
+  std::size_t data_size;
+  std::size_t num_elements;
+  //! if 0, values are stored as floats, otherwise as shorts, multiplied by \c value_scale
+  float value_scale;
+
+  // not implemented
+  CompressedProjMatrixElemsForOneBin(const CompressedProjMatrixElemsForOneBin&);
+  CompressedProjMatrixElemsForOneBin& operator=(const CompressedProjMatrixElemsForOneBin&);
+};
+
+END_NAMESPACE_STIR
+
+#endif
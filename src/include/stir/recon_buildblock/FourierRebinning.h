@@ -65,6 +65,7 @@ class PETCount_rebinned
 #ifdef PARALLEL
     friend PMessage& operator<<(PMessage&, PETCount_rebinned&);
     friend PMessage& operator>>(PMessage&, PETCount_rebinned&);
+#endif
 
     PETCount_rebinned & operator+= (const PETCount_rebinned &rebin)
         {
@@ -73,7 +74,6 @@ class PETCount_rebinned
             ssrb += rebin.ssrb;
             return *this;
         }
-#endif
 // Default constructor by initialising all the elements conter to null
     explicit PETCount_rebinned(int total_v=0, int miss_v =0, int ssrb_v = 0)
         :total(total_v), miss(miss_v), ssrb(ssrb_v)
@@ -116,6 +116,12 @@ class PETCount_rebinned
   Therefore the rebinned data are estimated using only the oblique sinograms with 
   a small value of d : dlim. Owing to the small value of d, the axial shift can be 
   neglected as in the SSRB approximation.
+
+  The rebinned data have the same number of views and tangential positions as the
+  input data. (Previous versions of STIR interpolated the views to a power of 2,
+  such that the rebinned data could have more views than the input data.)
+  The FFT handles any number of views, so only the tangential positions are still
+  zero-padded to a power of 2 internally.
 */
 
 class FourierRebinning : public   RegisteredParsingObject<
@@ -173,21 +179,24 @@ class FourierRebinning : public   RegisteredParsingObject<
   \brief Fourier rebinning
 
   This method takes as input the 3D data set (Array3D) in Fourier space of one sinogram
-  for a given delta as the data dimension are (1,fft_size,nviews_pow2), the scanner informations
+  for a given delta as the data dimension are (1,fft_size,num_views_extended), the scanner informations
   and returns the updated stack of 2D rebinned sinograms still in Fourier space,
   the updated weigthing factors as well as  the new rebinned elements counter.
 
- 
+  Only the angular frequency indices (k) from \a min_k_index to \a max_k_index are handled.
+  Calls for different ranges of k update different elements of \a FT_rebinned_data and 
+  \a Weights_for_FT_rebinned_data, so they can be made by different threads at the same time.
 */
     void rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weights_for_FT_rebinned_data,
        PETCount_rebinned &num_rebinned, const Array<2,std::complex<float> > &FT_current_sinogram, const float z, 
-       const float average_ring_difference_in_segment, const int num_views_pow2, const int num_tang_poss_pow2,
+       const float average_ring_difference_in_segment, const int num_views_extended, const int num_tang_poss_pow2,
        const float half_distance_between_rings, const float sampling_distance_in_s, const float radial_sampling_freq_w,
-       const float R_field_of_view_mm, const float ratio_ring_spacing_to_ring_radius);
+       const float R_field_of_view_mm, const float ratio_ring_spacing_to_ring_radius,
+       const int min_k_index, const int max_k_index);
 
 /*!
   \brief This method takes as input the real 3D data set
-  (in which the number of views have been extended to a number of power of 2)
+  (in which the views have been extended to 360 degrees)
   and  returns the rebinned sinograms in Fourier space, their weighting factors
   as well as the counter rebinned elements
 
@@ -195,11 +204,15 @@ class FourierRebinning : public   RegisteredParsingObject<
   Assign each frequency component (w,k) to the rebinned sinogram of the slice lying closest axially to
   z - (tk/w) with t=((ring0 -ring1)*ring_spacing/(2*R) with R=ring_radius, 
   Pm(w,k) = Pm(w,k) + Pij(w,k) (i=ring0 and j=ring1), and m is the nearest integer to (i+j) -k(i-j)/(Rw)).
+
+  When compiled with OpenMP, the 2D FFTs of the sinograms are computed in parallel. The 
+  frequency components are then assigned by multiple threads, each handling a range of k for all sinograms
+  in the same order as the serial version. The result is therefore identical to the serial version.
 */
 
     void do_rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weights_for_FT_rebinned_data,
                       PETCount_rebinned &count_rebinned, const SegmentBySinogram<float> &segment, const int num_tang_poss_pow2,
-                      const int num_views_pow2, const int num_planes, const float average_ring_difference_in_segment,
+                      const int num_views_extended, const int num_planes, const float average_ring_difference_in_segment,
                       const float half_distance_between_rings, const float sampling_distance_in_s, 
                       const float radial_sampling_freq_w, const float R_field_of_view_mm,
                       const float ratio_ring_spacing_to_ring_radius);
@@ -217,11 +230,8 @@ class FourierRebinning : public   RegisteredParsingObject<
     void do_display_count(PETCount_rebinned &num_rebinned_total);
 
 
-//! This is a function to adjust the number of views of a segment to the next power of 2
-    void do_adjust_nb_views_to_pow2(SegmentBySinogram<float> &segment) ;
-
 //! This function checks if the steering and input paramters for FORE are inside the possible range of parameters
-    Succeeded fore_check_parameters(int num_tang_poss_pow2, int num_views_pow2, int max_segment_num_to_process);
+    Succeeded fore_check_parameters(int num_tang_poss_pow2, int num_views_extended, int max_segment_num_to_process);
 
     
  protected:
@@ -78,6 +78,13 @@ START_NAMESPACE_STIR
   ; write objective function value to stderr at certain subiterations
   ; default value of 0 means: do not write it at all.
   report_objective_function_values_interval:=0
+
+  ; write the time spent in the different stages of the reconstruction
+  ; (e.g. forward projection, prior, image update) for every thread and subiteration.
+  ; The file is in CSV format if its extension is .csv, and in the Chrome
+  ; trace (JSON) format otherwise. See PerformanceTrace.
+  ; default value (empty) means: do not record anything.
+  performance trace filename:=
   \endverbatim
 
   \todo move subset things somewhere else
@@ -197,6 +204,9 @@ public:
 
   //! subiteration interval at which to report the values of the objective function
   const int get_report_objective_function_values_interval() const;
+
+  //! name of the file to which a PerformanceTrace is written (empty if none)
+  const std::string& get_performance_trace_filename() const;
   //@}
 
   /*! \name Functions to set parameters
@@ -239,6 +249,9 @@ public:
   //! subiteration interval at which to report the values of the objective function
   void set_report_objective_function_values_interval(const int);
 
+  //! name of the file to which a PerformanceTrace is written (empty if none)
+  void set_performance_trace_filename(const std::string&);
+
   //!
   //! \brief set_input_data
   //! \author Nikos Efthimiou
@@ -325,6 +338,9 @@ protected:
    */
   int report_objective_function_values_interval;
 
+  //! name of the file to which a PerformanceTrace is written (empty if none)
+  std::string performance_trace_filename;
+
   //! prompts the user to enter parameter values manually
   virtual void ask_parameters();
 
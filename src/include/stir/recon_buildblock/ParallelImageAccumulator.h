@@ -0,0 +1,94 @@
+//
+//
+/*!
+  \file
+  \ingroup projection
+
+  \brief Declaration of class stir::ParallelImageAccumulator and related functions
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#ifndef __stir_recon_buildblock_ParallelImageAccumulator_H__
+#define __stir_recon_buildblock_ParallelImageAccumulator_H__
+
+#include "stir/shared_ptr.h"
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+START_NAMESPACE_STIR
+
+template <int num_dimensions, class elemT> class DiscretisedDensity;
+
+/*!
+  \ingroup projection
+  \brief A pool of partial images for accumulating in parallel, e.g. when back projecting
+
+  Threads that need to add something to an image get a partial image with acquire()
+  for their exclusive use, and give it back with release(). At the end, add_to() adds
+  all partial images to the output image.
+
+  If the maximum number of partial images is smaller than the number of threads, threads
+  wait in acquire() until another thread releases a partial image. This reduces
+  memory use (each partial image has the size of the output image), but also the number
+  of threads that can work at the same time.
+
+  Partial images are only allocated when needed. add_to() is parallelised over the first
+  index of the image (i.e. planes), such that the reduction does not run in a single thread.
+  The partial images are added in a fixed order, so the result does not depend on the
+  number of threads used by add_to().
+*/
+class ParallelImageAccumulator
+{
+public:
+  /*!
+    \param template_image used to construct partial images (via get_empty_copy())
+    \param max_num_partial_images if 0, get_max_num_threads() is used
+  */
+  ParallelImageAccumulator(const DiscretisedDensity<3,float>& template_image,
+                           const int max_num_partial_images = 0);
+
+  //! get a partial image for exclusive use
+  /*! Returns an index to be used for get_partial_image() and release(). */
+  int acquire();
+
+  DiscretisedDensity<3,float>& get_partial_image(const int index);
+
+  //! give back a partial image, such that it can be used by another thread
+  void release(const int index);
+
+  //! add all partial images to \a image
+  /*! Must not be called while partial images are in use. */
+  void add_to(DiscretisedDensity<3,float>& image) const;
+
+  //! number of partial images that have been allocated
+  int get_num_partial_images() const;
+
+private:
+  const DiscretisedDensity<3,float>& template_image;
+  std::vector<shared_ptr<DiscretisedDensity<3,float> > > partial_image_sptrs;
+  //! indices of allocated partial images that are not in use
+  std::vector<int> free_indices;
+  int num_allocated;
+
+  std::mutex mutex;
+  std::condition_variable released;
+};
+
+END_NAMESPACE_STIR
+
+#endif
@@ -49,6 +49,20 @@ START_NAMESPACE_STIR
 
   \par Parameters for parsing
 
+  \verbatim
+  ; number of frames that are processed at the same time (only used with OpenMP)
+  number of frames to process in parallel := 1
+  ; number of threads used for every frame (only used with OpenMP),
+  ; 0 means the maximum number of threads divided by the number of frames in parallel
+  number of threads per frame := 0
+  \endverbatim
+
+  \par Multi-threading
+  The value and gradient are computed by calling the objective function of every frame.
+  With OpenMP, several frames can be processed at the same time, each by its own team
+  of threads (using nested parallelism). This is more efficient than using all threads
+  for one frame when the frames are small. All frames use the same projector pair, so
+  (for instance) the cache of a projection matrix is shared between frames.
 */
 
 template <typename TargetT>
@@ -114,6 +128,8 @@ public  RegisteredParsingObject<PoissonLogLikelihoodWithLinearKineticModelAndDyn
   const shared_ptr<ProjectorByBinPair>& get_projector_pair_sptr() const;
   const BinNormalisation& get_normalisation() const;
   const shared_ptr<BinNormalisation>& get_normalisation_sptr() const;
+  int get_num_frames_in_parallel() const;
+  int get_num_threads_per_frame() const;
   //@}
 
   /*! \name Functions to set parameters
@@ -126,6 +142,10 @@ public  RegisteredParsingObject<PoissonLogLikelihoodWithLinearKineticModelAndDyn
   void set_recompute_sensitivity(const bool);
   void set_sensitivity_sptr(const shared_ptr<TargetT>&);
   virtual int set_num_subsets(const int num_subsets);
+  //! Set the number of frames that are processed at the same time
+  void set_num_frames_in_parallel(const int);
+  //! Set the number of threads used for every frame (0 means automatic)
+  void set_num_threads_per_frame(const int);
 
   virtual void set_normalisation_sptr(const shared_ptr<BinNormalisation>&);
   virtual void set_additive_proj_data_sptr(const shared_ptr<ExamData>&);
@@ -186,6 +206,17 @@ public  RegisteredParsingObject<PoissonLogLikelihoodWithLinearKineticModelAndDyn
   shared_ptr<PatlakPlot> _patlak_plot_sptr;
   //! dynamic image template
   DynamicDiscretisedDensity _dyn_image_template;
+  //! number of frames that are processed at the same time
+  int _num_frames_in_parallel;
+  //! number of threads for every frame when processing frames in parallel (0 means automatic)
+  int _num_threads_per_frame;
+
+  //! Calls \a frame_function(frame_num) for every frame used in the model
+  /*! Frames are processed in parallel according to \c _num_frames_in_parallel.
+      \a frame_function should therefore only modify data for its own frame.
+  */
+  template <class FrameFunction>
+    void process_frames(FrameFunction frame_function) const;
 
   bool actual_subsets_are_approximately_balanced(std::string& warning_message) const;
 
@@ -36,6 +36,7 @@
 #include "stir/Succeeded.h"
 #include "stir/recon_buildblock/ProjectorByBinPair.h"
 #include "stir/info.h"
+#include "stir/nested_parallel_for.h"
 
 // include the following to set defaults
 #ifndef USE_PMRT
@@ -105,6 +106,9 @@ set_defaults()
 
   // Modelling Stuff
   this->_patlak_plot_sptr.reset();
+
+  this->_num_frames_in_parallel=1;
+  this->_num_threads_per_frame=0;
 }
 
 template<typename TargetT>
@@ -142,6 +146,9 @@ initialise_keymap()
 
   // Regularization Information
   //  this->parser.add_parsing_key("prior type", &this->_prior_sptr);
+
+  this->parser.add_key("number of frames to process in parallel", &this->_num_frames_in_parallel);
+  this->parser.add_key("number of threads per frame", &this->_num_threads_per_frame);
 }
 
 template<typename TargetT>
@@ -170,6 +177,10 @@ post_processing()
     { warning("output image size xy must be positive (or -1 as default)"); return true; }
   if (this->_output_image_size_z!=-1 && this->_output_image_size_z<1) // KT 10122001 new
     { warning("output image size z must be positive (or -1 as default)"); return true; }
+  if (this->_num_frames_in_parallel<1)
+    { warning("number of frames to process in parallel must be at least 1"); return true; }
+  if (this->_num_threads_per_frame<0)
+    { warning("number of threads per frame must be positive (or 0 as default)"); return true; }
 
 
   if (this->_additive_dyn_proj_data_filename != "0")
@@ -295,6 +306,18 @@ PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData<TargetT>::
 get_normalisation_sptr() const
 { return this->_normalisation_sptr; }
 
+template <typename TargetT>
+int
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData<TargetT>::
+get_num_frames_in_parallel() const
+{ return this->_num_frames_in_parallel; }
+
+template <typename TargetT>
+int
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData<TargetT>::
+get_num_threads_per_frame() const
+{ return this->_num_threads_per_frame; }
+
 
 /***************************************************************
   set_ functions
@@ -314,6 +337,26 @@ set_num_subsets(const int num_subsets)
   return this->num_subsets;
 }
 
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData<TargetT>::
+set_num_frames_in_parallel(const int arg)
+{
+  if (arg<1)
+    error("PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData: number of frames to process in parallel must be at least 1");
+  this->_num_frames_in_parallel = arg;
+}
+
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData<TargetT>::
+set_num_threads_per_frame(const int arg)
+{
+  if (arg<0)
+    error("PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData: number of threads per frame must be positive (or 0 for automatic)");
+  this->_num_threads_per_frame = arg;
+}
+
 /***************************************************************
   set_up()
 ***************************************************************/
@@ -431,6 +474,18 @@ set_normalisation_sptr(const shared_ptr<BinNormalisation>& arg)
   functions that compute the value/gradient of the objective function etc
 *************************************************************************/
 
+template<typename TargetT>
+template <class FrameFunction>
+void
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData<TargetT>::
+process_frames(FrameFunction frame_function) const
+{
+  nested_parallel_for(static_cast<int>(this->_patlak_plot_sptr->get_starting_frame()),
+                      static_cast<int>(this->_patlak_plot_sptr->get_time_frame_definitions().get_num_frames()),
+                      this->_num_frames_in_parallel, this->_num_threads_per_frame,
+                      frame_function, "frames");
+}
+
 template<typename TargetT>
 void
 PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData<TargetT>::
@@ -452,7 +507,7 @@ compute_sub_gradient_without_penalty_plus_sensitivity(TargetT& gradient,
   this->_patlak_plot_sptr->get_dynamic_image_from_parametric_image(dyn_image_estimate,current_estimate) ; 
  
   // loop over single_frame and use model_matrix
-  for(unsigned int frame_num=this->_patlak_plot_sptr->get_starting_frame();frame_num<=this->_patlak_plot_sptr->get_time_frame_definitions().get_num_frames();++frame_num)
+  this->process_frames([&](const int frame_num)
     {
       std::fill(dyn_gradient[frame_num].begin_all(),
                 dyn_gradient[frame_num].end_all(),
@@ -463,7 +518,7 @@ compute_sub_gradient_without_penalty_plus_sensitivity(TargetT& gradient,
         compute_sub_gradient_without_penalty_plus_sensitivity(dyn_gradient[frame_num], 
                                                               dyn_image_estimate[frame_num], 
                                                               subset_num);
-    }
+    });
 
   this->_patlak_plot_sptr->multiply_dynamic_image_with_model_gradient(gradient,
                                                                      dyn_gradient) ; 
@@ -489,15 +544,18 @@ actual_compute_objective_function_without_penalty(const TargetT& current_estimat
   this->_patlak_plot_sptr->get_dynamic_image_from_parametric_image(dyn_image_estimate,current_estimate) ; 
  
   // loop over single_frame
-  for(unsigned int frame_num=this->_patlak_plot_sptr->get_starting_frame();
-      frame_num<=this->_patlak_plot_sptr->get_time_frame_definitions().get_num_frames();
-      ++frame_num)
+  // values are summed afterwards in the order of the frames, such that the result does not depend on the number of threads
+  VectorWithOffset<double> frame_results(this->_patlak_plot_sptr->get_starting_frame(),
+                                         this->_patlak_plot_sptr->get_time_frame_definitions().get_num_frames());
+  this->process_frames([&](const int frame_num)
     {
-      result +=
+      frame_results[frame_num] =
         this->_single_frame_obj_funcs[frame_num].
         compute_objective_function_without_penalty(dyn_image_estimate[frame_num], 
                                                    subset_num);
-    }
+    });
+  for(int frame_num=frame_results.get_min_index(); frame_num<=frame_results.get_max_index(); ++frame_num)
+    result += frame_results[frame_num];
   return result;
 }
 
@@ -111,8 +111,31 @@ START_NAMESPACE_STIR
   ; e.g. subsens_%d.hv
   ; boost::format is used with the pattern (which means you can use it like sprintf)
   subset sensitivity filenames:=
+  ; directory for caching computed sensitivities between runs (see below)
+  ; if empty, no cache is used
+  sensitivity cache directory:=
   \endverbatim
 
+  \par Sensitivity cache
+  If <tt>sensitivity cache directory</tt> is set to an existing directory, computed
+  (subset) sensitivities are stored there, and looked up before recomputing them. 
+  Entries are identified by a key constructed by get_sensitivity_cache_key()
+  from all parameters that influence the sensitivity (e.g. scanner geometry,
+  projectors, normalisation, image characteristics and subset scheme). The directory
+  contains a file <tt>sensitivity_HASH.txt</tt> for every entry, where \c HASH is a hash of
+  the key. This file lists the names of the images and the full key, such that
+  hash collisions are detected. The images have names that are unique to the
+  process that wrote them, and this file is written to a temporary name and renamed
+  when complete, such that runs that share the cache directory never read
+  incomplete entries.
+
+  Derived classes that do not override get_sensitivity_cache_key() do not use the cache.
+  PoissonLogLikelihoodWithLinearModelForMeanAndProjData adds a hash of the normalisation
+  factors (including attenuation) to the key, such that a changed normalisation is detected.
+  \warning Other parameters in the key might be filenames (e.g. of a projection matrix),
+  not their content. If these files change, you have to remove the cache entries (or use
+  another directory).
+
   \par Terminology
   We currently use \c sub_gradient for the gradient of the likelihood of the subset (not 
   the mathematical subgradient).
@@ -204,6 +227,9 @@ public  GeneralisedObjectiveFunction<TargetT>
   boost::format is used with the pattern (which means you can use it like sprintf)
  */
   std::string get_subsensitivity_filenames() const;
+  //! get directory used for caching sensitivities
+  /*! will be a zero string if not set, in which case no cache is used */
+  std::string get_sensitivity_cache_directory() const;
 
   /*! \name Functions to set parameters
     This can be used as alternative to the parsing mechanism.
@@ -229,6 +255,9 @@ public  GeneralisedObjectiveFunction<TargetT>
   Calls error() if the pattern is invalid.
  */
   void set_subsensitivity_filenames(const std::string&);
+  //! set directory used for caching sensitivities
+  /*! set to a zero-length string to disable the cache. The directory has to exist. */
+  void set_sensitivity_cache_directory(const std::string&);
   //@}
 
   /*! The implementation checks if the sensitivity of a voxel is zero. If so,
@@ -243,6 +272,7 @@ public  GeneralisedObjectiveFunction<TargetT>
   std::string subsensitivity_filenames;
   bool recompute_sensitivity;
   bool use_subset_sensitivities;
+  std::string sensitivity_cache_directory;
 
   VectorWithOffset<shared_ptr<TargetT> > subsensitivity_sptrs;
   shared_ptr<TargetT> sensitivity_sptr;
@@ -260,6 +290,12 @@ public  GeneralisedObjectiveFunction<TargetT>
   */
   void set_total_or_subset_sensitivities();
 
+  //! read sensitivities from the cache if an entry for \a key exists
+  /*! \return \c true if successful. */
+  bool read_sensitivities_from_cache(const TargetT& target, const std::string& key);
+  //! store the sensitivities in the cache
+  void write_sensitivities_to_cache(const std::string& key) const;
+
 protected:
   //! set-up specifics for the derived class 
   virtual Succeeded 
@@ -272,6 +308,23 @@ protected:
   */
   void compute_sensitivities();
 
+  //! construct the key for the sensitivity cache
+  /*! This should describe all parameters (other than the subset scheme) that
+      influence the sensitivity, e.g. by using parameter_info() of the objects involved.
+      It is called after set_up_before_sensitivity().
+
+      The default returns an empty string, which means that the sensitivity is not cached.
+  */
+  virtual std::string get_sensitivity_cache_key(const TargetT& target);
+
+  //! key for the sensitivity cache, including the subset scheme
+  /*! Returns an empty string if get_sensitivity_cache_key() does. */
+  std::string get_full_sensitivity_cache_key(const TargetT& target);
+
+  //! name of the cache entry for \a key, without extension
+  /*! The entry consists of <tt>NAME.txt</tt>, which lists the images. */
+  std::string get_sensitivity_cache_entry_name(const std::string& key) const;
+
   //! Sets defaults for parsing 
   /*! Resets \c sensitivity_filename, \c subset_sensitivity_filenames to empty,
      \c recompute_sensitivity to \c false, and \c use_subset_sensitivities to false.
@@ -51,6 +51,26 @@ START_NAMESPACE_STIR
  \end{array}
 \f] 
   \par Parameters for parsing
+
+  \verbatim
+  ; number of gates that are processed at the same time (only used with OpenMP)
+  number of gates to process in parallel := 1
+  ; number of threads used for every gate (only used with OpenMP),
+  ; 0 means the maximum number of threads divided by the number of gates in parallel
+  number of threads per gate := 0
+  ; store the interpolation weights for the (reverse) motion of every gate (see WarpImageStencil)
+  ; this makes warping faster, but needs about 100 bytes per voxel and per gate
+  cache motion interpolation weights := 0
+  \endverbatim
+
+  \par Multi-threading
+  The value and gradient are computed gate by gate: the current estimate is warped to the
+  gate, the objective function of the gate is used, and (for the gradient) the result
+  is warped back. With OpenMP, several gates can be processed at the same time, each by
+  its own team of threads (see nested_parallel_for()). All gates use the same projector
+  pair and motion vectors, which are only read during these computations. The warped
+  gradients are added in the order of the gates, such that the result does not depend on
+  the number of gates processed in parallel.
  
  For more information: Tsoumpas et al (2013) Physics in Medicine and Biology
 
@@ -122,6 +142,9 @@ public  RegisteredParsingObject<PoissonLogLikelihoodWithLinearModelForMeanAndGat
   const shared_ptr<GatedProjData>& get_normalisation_gated_proj_data_sptr() const;
   const ProjectorByBinPair& get_projector_pair() const;
   const shared_ptr<ProjectorByBinPair>& get_projector_pair_sptr() const;
+  int get_num_gates_in_parallel() const;
+  int get_num_threads_per_gate() const;
+  bool get_cache_motion_interpolation_weights() const;
   //@}
 
   /*! \name Functions to set parameters
@@ -134,6 +157,12 @@ public  RegisteredParsingObject<PoissonLogLikelihoodWithLinearModelForMeanAndGat
   void set_recompute_sensitivity(const bool);
   void set_sensitivity_sptr(const shared_ptr<TargetT>&);
   virtual int set_num_subsets(const int num_subsets);
+  //! Set the number of gates that are processed at the same time
+  void set_num_gates_in_parallel(const int);
+  //! Set the number of threads used for every gate (0 means automatic)
+  void set_num_threads_per_gate(const int);
+  //! Keep the interpolation weights of the motion vectors (see GatedSpatialTransformation::set_cache_interpolation_weights())
+  void set_cache_motion_interpolation_weights(const bool);
 
   virtual void set_normalisation_sptr(const shared_ptr<BinNormalisation>&);
   virtual void set_additive_proj_data_sptr(const shared_ptr<ExamData>&);
@@ -207,6 +236,19 @@ public  RegisteredParsingObject<PoissonLogLikelihoodWithLinearModelForMeanAndGat
 
   //! gated image template
   GatedDiscretisedDensity _gated_image_template;
+  //! number of gates that are processed at the same time
+  int _num_gates_in_parallel;
+  //! number of threads for every gate when processing gates in parallel (0 means automatic)
+  int _num_threads_per_gate;
+  //! if true, interpolation weights for the motion vectors are stored after the first warp
+  bool _cache_motion_interpolation_weights;
+
+  //! Calls \a gate_function(gate_num) for every gate
+  /*! Gates are processed in parallel according to \c _num_gates_in_parallel.
+      \a gate_function should therefore only modify data for its own gate.
+  */
+  template <class GateFunction>
+    void process_gates(GateFunction gate_function) const;
   bool actual_subsets_are_approximately_balanced(std::string& warning_message) const;
 
   //! Sets defaults before parsing 
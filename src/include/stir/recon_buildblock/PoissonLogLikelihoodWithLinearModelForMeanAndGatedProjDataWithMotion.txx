@@ -31,6 +31,7 @@
 #include "stir/Succeeded.h"
 #include "stir/recon_buildblock/ProjectorByBinPair.h"
 #include "stir/info.h"
+#include "stir/nested_parallel_for.h"
 
 // include the following to set defaults
 #ifndef USE_PMRT
@@ -106,6 +107,10 @@ set_defaults()
   this->_Xoffset=0.F;
   this->_Yoffset=0.F;
   this->_Zoffset=0.F;   // KT 20/06/2001 new
+
+  this->_num_gates_in_parallel=1;
+  this->_num_threads_per_gate=0;
+  this->_cache_motion_interpolation_weights=false;
 }
 
 template<typename TargetT>
@@ -142,6 +147,10 @@ initialise_keymap()
   this->parser.add_key("Gate Definitions filename", &this->_gate_definitions_filename);
   this->parser.add_key("Motion Vectors filename prefix", &this->_motion_vectors_filename_prefix);
   this->parser.add_key("Reverse Motion Vectors filename prefix", &this->_reverse_motion_vectors_filename_prefix); 
+
+  this->parser.add_key("number of gates to process in parallel", &this->_num_gates_in_parallel);
+  this->parser.add_key("number of threads per gate", &this->_num_threads_per_gate);
+  this->parser.add_key("cache motion interpolation weights", &this->_cache_motion_interpolation_weights);
 }
 
 template<typename TargetT>
@@ -164,6 +173,10 @@ post_processing()
     { warning("output image size xy must be positive (or -1 as default)"); return true; }
   if (this->_output_image_size_z!=-1 && this->_output_image_size_z<1) // KT 10122001 new
     { warning("output image size z must be positive (or -1 as default)"); return true; }
+  if (this->_num_gates_in_parallel<1)
+    { warning("number of gates to process in parallel must be at least 1"); return true; }
+  if (this->_num_threads_per_gate<0)
+    { warning("number of threads per gate must be positive (or 0 as default)"); return true; }
 
   if (this->_additive_gated_proj_data_filename != "0")
     {
@@ -184,6 +197,7 @@ post_processing()
     this->_reverse_motion_vectors.read_from_files(this->_reverse_motion_vectors_filename_prefix);
   if (this->_motion_vectors_filename_prefix != "0")
     this->_motion_vectors.read_from_files(this->_motion_vectors_filename_prefix);
+  this->set_cache_motion_interpolation_weights(this->_cache_motion_interpolation_weights);
   return false;
 }
 
@@ -305,6 +319,24 @@ PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
 get_projector_pair_sptr() const
 { return this->_projector_pair_ptr; }
 
+template <typename TargetT>
+int
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
+get_num_gates_in_parallel() const
+{ return this->_num_gates_in_parallel; }
+
+template <typename TargetT>
+int
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
+get_num_threads_per_gate() const
+{ return this->_num_threads_per_gate; }
+
+template <typename TargetT>
+bool
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
+get_cache_motion_interpolation_weights() const
+{ return this->_cache_motion_interpolation_weights; }
+
 /***************************************************************
   set_ functions
 ***************************************************************/
@@ -323,6 +355,36 @@ set_num_subsets(const int num_subsets)
   return this->num_subsets;
 }
 
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
+set_num_gates_in_parallel(const int arg)
+{
+  if (arg<1)
+    error("PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion: number of gates to process in parallel must be at least 1");
+  this->_num_gates_in_parallel = arg;
+}
+
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
+set_num_threads_per_gate(const int arg)
+{
+  if (arg<0)
+    error("PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion: number of threads per gate must be positive (or 0 for automatic)");
+  this->_num_threads_per_gate = arg;
+}
+
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
+set_cache_motion_interpolation_weights(const bool arg)
+{
+  this->_cache_motion_interpolation_weights = arg;
+  this->_motion_vectors.set_cache_interpolation_weights(arg);
+  this->_reverse_motion_vectors.set_cache_interpolation_weights(arg);
+}
+
 template<typename TargetT>
 void
 PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
@@ -437,6 +499,17 @@ set_up_before_sensitivity(shared_ptr<TargetT > const& target_sptr)
   functions that compute the value/gradient of the objective function etc
 *************************************************************************/
 
+template<typename TargetT>
+template <class GateFunction>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
+process_gates(GateFunction gate_function) const
+{
+  nested_parallel_for(1, static_cast<int>(this->get_time_gate_definitions().get_num_gates()),
+                      this->_num_gates_in_parallel, this->_num_threads_per_gate,
+                      gate_function, "gates");
+}
+
 template<typename TargetT>
 void
 PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<TargetT>::
@@ -447,27 +520,26 @@ compute_sub_gradient_without_penalty_plus_sensitivity(TargetT& gradient,
   assert(subset_num>=0);
   assert(subset_num<this->num_subsets);
 
-  GatedDiscretisedDensity gated_gradient=this->_gated_image_template;
-  GatedDiscretisedDensity gated_image_estimate=this->_gated_image_template;
-  // The following initialization doesn't stabilize reconstruction.
-  for(unsigned int gate_num=1;gate_num<=this->get_time_gate_definitions().get_num_gates();++gate_num)
-    std::fill(gated_image_estimate[gate_num].begin_all(),
-	      gated_image_estimate[gate_num].end_all(),
-	      0.F);		  
-  this->_motion_vectors.warp_image(gated_image_estimate,current_estimate); 
-  for(unsigned int gate_num=1;gate_num<=this->get_time_gate_definitions().get_num_gates();++gate_num)	{
-    std::fill(gated_gradient[gate_num].begin_all(),
-              gated_gradient[gate_num].end_all(),
-              0.F);
-    this->_single_gate_obj_funcs[gate_num].
-      compute_sub_gradient_without_penalty_plus_sensitivity(gated_gradient[gate_num], 
-                                                            gated_image_estimate[gate_num], 
-                                                            subset_num);
-  }	
-  //	if(this->_motion_correction_type==-1)
-  this->_reverse_motion_vectors.warp_image(gradient,gated_gradient) ; 
-  //	else
-  //		  this->_motion_vectors.warp_image(gradient,gated_gradient) ; 
+  const unsigned int num_gates = this->get_time_gate_definitions().get_num_gates();
+  const shared_ptr<DiscretisedDensity<3,float> > current_estimate_sptr(current_estimate.clone());
+  VectorWithOffset<shared_ptr<DiscretisedDensity<3,float> > > warped_gated_gradients(1, num_gates);
+  // warp the estimate to the gate, compute the gradient for the gate and warp it back
+  this->process_gates([&](const int gate_num)
+    {
+      const shared_ptr<DiscretisedDensity<3,float> >
+        gate_image_estimate_sptr(this->_motion_vectors.warp_image(current_estimate_sptr, gate_num).clone());
+      const shared_ptr<DiscretisedDensity<3,float> >
+        gate_gradient_sptr(gate_image_estimate_sptr->get_empty_copy());
+      this->_single_gate_obj_funcs[gate_num].
+        compute_sub_gradient_without_penalty_plus_sensitivity(*gate_gradient_sptr, 
+                                                              *gate_image_estimate_sptr, 
+                                                              subset_num);
+      warped_gated_gradients[gate_num].
+        reset(this->_reverse_motion_vectors.warp_image(gate_gradient_sptr, gate_num).clone());
+    });
+  gradient.fill(0.F);
+  for(unsigned int gate_num=1;gate_num<=num_gates;++gate_num)
+    gradient += *warped_gated_gradients[gate_num];
 }
 
 template<typename TargetT>
@@ -480,22 +552,21 @@ actual_compute_objective_function_without_penalty(const TargetT& current_estimat
   assert(subset_num<this->num_subsets);
 
   double result = 0.;
-  GatedDiscretisedDensity gated_image_estimate=this->_gated_image_template;
-  // The following initialization doesn't stabilize reconstruction.
-  for(unsigned int gate_num=1; gate_num<=this->get_time_gate_definitions().get_num_gates(); ++gate_num)
-    std::fill(gated_image_estimate[gate_num].begin_all(),
-	      gated_image_estimate[gate_num].end_all(),
-	      0.F);
-  this->_motion_vectors.warp_image(gated_image_estimate,current_estimate) ;  
-  // loop over single_gate
-  for(unsigned int gate_num=1 ;
-      gate_num<=this->get_time_gate_definitions().get_num_gates();
-      ++gate_num)
+  const unsigned int num_gates = this->get_time_gate_definitions().get_num_gates();
+  const shared_ptr<DiscretisedDensity<3,float> > current_estimate_sptr(current_estimate.clone());
+  // values are summed afterwards in the order of the gates, such that the result does not depend on the number of threads
+  VectorWithOffset<double> gate_results(1, num_gates);
+  this->process_gates([&](const int gate_num)
     {
-      result +=	this->_single_gate_obj_funcs[gate_num].
-        compute_objective_function_without_penalty(gated_image_estimate[gate_num], 
+      const shared_ptr<DiscretisedDensity<3,float> >
+        gate_image_estimate_sptr(this->_motion_vectors.warp_image(current_estimate_sptr, gate_num).clone());
+      gate_results[gate_num] =
+        this->_single_gate_obj_funcs[gate_num].
+        compute_objective_function_without_penalty(*gate_image_estimate_sptr, 
 						   subset_num);
-    }
+    });
+  for(unsigned int gate_num=1; gate_num<=num_gates; ++gate_num)
+    result += gate_results[gate_num];
   return result;
 }
 
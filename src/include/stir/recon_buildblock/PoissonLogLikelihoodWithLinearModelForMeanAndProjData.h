@@ -122,6 +122,14 @@ class DistributedCachingInformation;
   ; see BinNormalisation hierarchy for possible values
   Bin Normalisation type :=
 
+  ; if larger than 0, data are read ahead by separate threads
+  ; (see stir::distributable_computation())
+  number of viewgrams to prefetch := 0
+  number of prefetch threads := 1
+  ; maximum number of images used by threads to accumulate the back projection
+  ; 0 means one per thread (see ParallelImageAccumulator)
+  maximum number of partial images := 0
+
   End PoissonLogLikelihoodWithLinearModelForMeanAndProjData Parameters :=
   \endverbatim
 */
@@ -226,6 +234,10 @@ public:
   // currently not used
   float sum_projection_data() const;
 #endif
+  //! Add subset sensitivity to existing data
+  /*! Uses distributable_computation(), such that it is parallelised in the same way
+      as the gradient computation (except when STIR_MPI is defined).
+  */
   virtual void
     add_subset_sensitivity(TargetT& sensitivity, const int subset_num) const;
 
@@ -233,6 +245,12 @@ public:
   virtual Succeeded 
     set_up_before_sensitivity(shared_ptr <TargetT > const& target_sptr);
 
+  //! Describes the projectors, normalisation, projection data geometry, frame and \a target
+  /*! The normalisation is described by its parameters and a hash of the normalisation
+      factors for all bins (as its parameters might only give filenames). */
+  virtual std::string
+    get_sensitivity_cache_key(const TargetT& target);
+
   virtual double
     actual_compute_objective_function_without_penalty(const TargetT& current_estimate,
                                                       const int subset_num);
@@ -313,6 +331,13 @@ protected:
   //! signals whether to zero the data in the end planes of the projection data
   bool zero_seg0_end_planes;
 
+  //! number of RelatedViewgrams that are read ahead (see distributable_computation())
+  int prefetch_depth;
+  //! number of threads used for reading ahead
+  int num_prefetch_threads;
+  //! maximum number of partial images used for back projection (see distributable_computation())
+  int max_num_partial_images;
+
   //! name of file in which additive projection data are stored
   std::string additive_projection_data_filename;
 
@@ -38,12 +38,9 @@
 #include "stir/shared_ptr.h"
 #include "stir/VectorWithOffset.h"
 #include "stir/TimedObject.h"
-#include <boost/cstdint.hpp>
-//#include <map>
-#include <boost/unordered_map.hpp>
-#ifdef STIR_OPENMP
-#include <omp.h>
-#endif
+#include <vector>
+#include <atomic>
+#include <cstddef>
 
 // define a local preprocessor symbol to keep code relatively clean
 #ifdef STIR_NO_MUTABLE
@@ -60,6 +57,7 @@ class SubsetInfo;
 */
 	    
 class Bin;	    
+class CompressedProjMatrixElemsForOneBin;
 	    
 /*!
 \ingroup projection
@@ -74,16 +72,51 @@ class Bin;
   This functionality will probably be moved to a new class 
   ProjMatrixByBinWithCache. (TODO)
 
+  \par Caching and multi-threading
+
+  The cache has one slot per bin. The slots for a given view and segment
+  are allocated on first use. Reading from the cache and inserting into
+  it do not need locks: a slot is filled with an atomic compare-and-swap,
+  and a slot is never changed after that until clear_cache() is called. If 2 threads
+  compute the same row at the same time, the 2nd result is discarded (this is
+  counted as a collision). Hence, threads that work on related viewgrams of the
+  same view do not serialise on the cache.
+
+  The number of hits, misses and collisions is counted per thread, and can be
+  obtained with get_num_cache_hits() etc. These counts are reset by
+  reset_cache_counters(), in the same way as reset_timers() resets the timers.
+
+  \par Memory usage
+
+  Rows are stored in the cache as CompressedProjMatrixElemsForOneBin objects,
+  optionally with quantised values.
+
+  When a maximum cache size is set, rows are evicted when the cache grows larger.
+  All rows for one view are evicted together, starting with the least recently used
+  view. With the usual subset schemes (where each subset is a set of views), this
+  means that rows of the subsets that were used longest ago are dropped first, while
+  the rows of a view are either all available or all recomputed.
+  With a maximum size, every access to the cache also updates a counter for its
+  view. This needs an atomic operation (but no lock) on memory shared by the
+  threads working on that view, so the cache is a bit slower than without limit.
+
   \par Parsing parameters
 
   The following parameters can be set (default values are indicated):
   \verbatim
   disable caching := false
   store only basic bins in cache := true
+  ; size in bytes (0 means no limit)
+  maximum cache size := 0
+  quantise values in cache := false
   \endverbatim
   The 2nd option allows to cache the whole matrix. This results in the fastest
   behaviour IF your system does not start swapping. The default choice caches 
   only the 'basic' bins, and computes symmetry related bins from the 'basic' ones.
+
+  Quantising stores the values as 16-bit integers (relative to the maximum value
+  in the row) instead of floats. This saves about 30% of the memory, at
+  the expense of a relative error of at most 1/65534 of the maximum value in a row.
 */
 class ProjMatrixByBin :  
   public RegisteredObject<ProjMatrixByBin>,  
@@ -92,7 +125,7 @@ class ProjMatrixByBin :
 {
 public:
   
-  virtual ~ProjMatrixByBin() {}
+  virtual ~ProjMatrixByBin();
 
   //! To be called before any calculation is performed
   /*! Note that get_proj_matrix_elems_for_one_bin() will expect objects of
@@ -139,7 +172,16 @@ public:
   const char * const file_name_without_extension);
   */
   
-  //void set_maximum_cache_size(const unsigned long size){;}        
+  //! set the maximum size of the cache in bytes (0 means no limit)
+  /*! If the cache is currently larger, rows will be evicted on the next insertion. */
+  void set_maximum_cache_size(const std::size_t size);
+  std::size_t get_maximum_cache_size() const;
+  //! store values in the cache as 16-bit integers
+  /*! Only affects rows that are inserted afterwards. */
+  void quantise_values_in_cache(const bool v = true);
+  //! current amount of memory used by the cache (in bytes)
+  std::size_t get_cache_memory_size() const;
+
   /* TODO
   void set_subset_usage(const SubsetInfo&, const int num_access_times);
   */
@@ -151,8 +193,19 @@ public:
 
   // void reserve_num_elements_in_cache(const std::size_t);
   //! Remove all elements from the cache
+  /*! \warning This should not be called while other threads are using the cache.
+  */
   void clear_cache() STIR_MUTABLE_CONST;
 
+  //! number of times a row was found in the cache (summed over all threads)
+  unsigned long get_num_cache_hits() const;
+  //! number of times a row was not found in the cache (summed over all threads)
+  unsigned long get_num_cache_misses() const;
+  //! number of times a row was computed by more than 1 thread at the same time
+  unsigned long get_num_cache_collisions() const;
+  //! set all cache counters to zero
+  void reset_cache_counters() STIR_MUTABLE_CONST;
+
   
 protected:
   shared_ptr<DataSymmetriesForBins> symmetries_ptr;
@@ -191,6 +244,10 @@ protected:
 
   bool cache_disabled;  
   bool cache_stores_only_basic_bins;
+  //! maximum size of the cache in bytes, 0 means no limit
+  /*! A double for parsing, such that large values can be given in exponential notation. */
+  double max_cache_size;
+  bool cache_quantises_values;
 
   /*! \brief The method that tries to get data from the cache.
   
@@ -208,29 +265,90 @@ protected:
 
 private:
   
-  typedef boost::uint32_t CacheKey;
+  //! a cached row, or 0 if not computed yet
+  typedef std::atomic<CompressedProjMatrixElemsForOneBin *> CacheSlot;
 
-	//  typedef std::map<CacheKey, ProjMatrixElemsForOneBin>   MapProjMatrixElemsForOneBin;
-  typedef boost::unordered_map<CacheKey, ProjMatrixElemsForOneBin>   MapProjMatrixElemsForOneBin;
-  typedef MapProjMatrixElemsForOneBin::iterator MapProjMatrixElemsForOneBinIterator;
-  typedef MapProjMatrixElemsForOneBin::const_iterator const_MapProjMatrixElemsForOneBinIterator;
- 
-  //! collection of  ProjMatrixElemsForOneBin (internal cache )   
+  //! collection of ProjMatrixElemsForOneBin (internal cache)
+  /*! There is one entry for every (view_num, segment_num). It points to an array with
+      a slot for every (axial_pos_num, tangential_pos_num), or is 0 when not used yet.
+  */
+#ifndef STIR_NO_MUTABLE
+  mutable
+#endif
+    std::vector<std::atomic<CacheSlot *> > cache_collection;
+
+  // info on the projection data needed to find the cache slot for a bin
+  int cache_min_view_num;
+  int cache_num_views;
+  int cache_min_segment_num;
+  int cache_num_segments;
+  int cache_min_tangential_pos_num;
+  int cache_num_tangential_poss;
+  VectorWithOffset<int> cache_min_axial_pos_num;
+  VectorWithOffset<int> cache_num_axial_poss;
+
+  //! find the cache slot for a bin, allocating the slots for its view and segment if requested
+  /*! returns 0 if the bin is not in the range set by set_up(), or if the slots
+      are not allocated yet and \a allocate is false.
+  */
+  CacheSlot * find_cache_slot(const Bin& bin, const bool allocate) const;
+
+  //! info per view used to enforce the maximum cache size
+  struct ViewCacheInfo
+  {
+    ViewCacheInfo() : num_users(0), last_access(0) {}
+    //! number of threads currently accessing the slots of this view
+    std::atomic<int> num_users;
+    //! value of cache_access_clock at the last access
+    std::atomic<unsigned long> last_access;
+  };
 #ifndef STIR_NO_MUTABLE
   mutable
 #endif
-    VectorWithOffset<VectorWithOffset<MapProjMatrixElemsForOneBin> > cache_collection;
-#ifdef STIR_OPENMP
+    std::vector<ViewCacheInfo> view_cache_info;
+  //! incremented for every insertion when there is a maximum cache size
 #ifndef STIR_NO_MUTABLE
   mutable
 #endif
-  VectorWithOffset<VectorWithOffset<omp_lock_t> > cachelocks;
+    std::atomic<unsigned long> cache_access_clock;
+#ifndef STIR_NO_MUTABLE
+  mutable
 #endif
+    std::atomic<std::size_t> cache_memory_size;
+  //! true while a thread is evicting rows
+#ifndef STIR_NO_MUTABLE
+  mutable
+#endif
+    std::atomic<bool> cache_eviction_in_progress;
+
+  //! tell other threads that we are using the slots of a view (only done with a maximum cache size)
+  void start_using_view_cache(const int view_num) const;
+  void stop_using_view_cache(const int view_num) const;
+  //! evict least recently used views until the cache is smaller than the maximum size
+  /*! Does nothing if another thread is already evicting. */
+  void evict_from_cache(const int view_num_to_keep) const;
+  //! remove all rows for 1 view from the cache
+  /*! If \a wait_for_users is true, this will wait until no thread is using the view. */
+  void delete_view_from_cache(const int view_num, const bool wait_for_users) const;
+
+  //! counters for cache statistics
+  /*! There is one of these for every thread, padded to avoid false sharing.
+   */
+  struct CacheCounters
+  {
+    CacheCounters() : num_hits(0), num_misses(0), num_collisions(0) {}
+    std::atomic<unsigned long> num_hits;
+    std::atomic<unsigned long> num_misses;
+    std::atomic<unsigned long> num_collisions;
+    char padding[64];
+  };
+#ifndef STIR_NO_MUTABLE
+  mutable
+#endif
+    std::vector<CacheCounters> cache_counters;
 
-  //! create the key for caching
-  // KT 15/05/2002 not static anymore as it uses cache_stores_only_basic_bins
-  CacheKey cache_key(const Bin& bin) const;
-
+  //! get the counters for the current thread
+  CacheCounters& get_cache_counters() const;
    
 };
 
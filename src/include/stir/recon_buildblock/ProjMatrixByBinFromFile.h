@@ -2,6 +2,7 @@
 //
 /*
     Copyright (C) 2004- 2008, Hammersmith Imanet Ltd
+    Copyright (C) 2018, University College London
     This file is part of STIR.
 
     This file is free software; you can redistribute it and/or modify
@@ -34,7 +35,11 @@
 #include "stir/CartesianCoordinate3D.h"
 #include "stir/IndexRange.h"
 #include "stir/shared_ptr.h"
+#include "boost/cstdint.hpp"
 #include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstddef>
 
  
 
@@ -46,10 +51,42 @@ class Bin;
   \ingroup projection
   \brief Reads/writes a projection matrix from/to file
 
-  The only supported file format consists of an Interfile-type header
+  The file format consists of an Interfile-type header
   and a binary file which stores the 'basic' elements in a sparse form, 
   i.e. only the elements that cannot by constructed via symmetries.
 
+  Two versions of the binary file are supported:
+  - Version 1.0 is a plain sequence of LORs. The whole file is read into the
+  cache by set_up(), which is slow for large matrices and needs enough memory
+  to hold the complete matrix.
+  - Version 2.0 starts with an index giving the location of the LORs
+  for every (segment,view) of the basic bins. Within each (segment,view),
+  there is a table of the LORs sorted on (axial_pos_num,tangential_pos_num).
+  The file is memory-mapped (when the system supports it) and rows are only
+  read when they are needed, by calculate_proj_matrix_elems_for_one_bin().
+  They then end up in the cache as for any other ProjMatrixByBin. This means
+  that set_up() is fast and that the maximum cache size can be smaller than
+  the size of the matrix.
+
+  Both versions store the data in native byte order. Version 2.0 files
+  contain a byte order mark, such that reading them on a machine with a
+  different byte order gives an error.
+
+  Layout of a Version 2.0 file (all offsets are in bytes from the start of the file,
+  offsets of the LOR elements are relative to the start of the block of their
+  (segment,view)):
+  \verbatim
+  header: char[8] "STIRPM20", uint32 0x01020304,
+          int32 min_segment_num, max_segment_num, min_view_num, max_view_num,
+          uint32 0 (reserved)
+  index:  for every segment (outer loop) and view: uint64 offset, uint64 num_lors
+  blocks: num_lors entries of
+            int32 axial_pos_num, int32 tangential_pos_num, uint32 num_elements,
+            uint32 0 (reserved), uint64 offset
+          followed by the elements of all LORs, each as
+            int16 coord1, int16 coord2, int16 coord3, float value
+  \endverbatim
+
   \todo this class currently only works with VoxelsOnCartesianGrid. 
   To fix this, we would need a DiscretisedDensityInfo class, and be able
   to have constructed the appropriate symmetries object by parsing the
@@ -58,7 +95,8 @@ class Bin;
   \par Example .par file
   \verbatim
     ProjMatrixByBinFromFile Parameters:=
-      Version := 1.0
+      ; 1.0 or 2.0, see above
+      Version := 2.0
       symmetries type := PET_CartesianGrid
         PET_CartesianGrid symmetries parameters:=
 	  do_symmetry_90degrees_min_phi:= <bool>
@@ -92,16 +130,28 @@ public :
   /*! Currently this will write an interfile-type header, a file with the binary data,
       a template image and template sinogram. You will need all 4 to be able to read the
       matrix back in.
+
+      \a version has to be "1.0" or "2.0". The latter is the indexed format that
+      can be read lazily, but cannot be read by older versions of STIR. The default
+      is therefore still "1.0".
+
+      Rows of the matrix are computed in parallel when OpenMP is enabled (\a proj_matrix
+      therefore has to be safe to use from multiple threads). Each thread computes all
+      basic LORs of one (segment,view), which are then written in order.
   */
 static Succeeded
   write_to_file(const std::string& output_filename_prefix, 
 		const ProjMatrixByBin& proj_matrix,
 		const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
-		const DiscretisedDensity<3,float>& template_density);
+		const DiscretisedDensity<3,float>& template_density,
+		const std::string& version = "1.0");
  
   //! Default constructor (calls set_defaults())
   ProjMatrixByBinFromFile();
 
+  //! Destructor (unmaps the data file if necessary)
+  virtual ~ProjMatrixByBinFromFile();
+
   //! Checks all necessary geometric info
   virtual void set_up(		 
 		      const shared_ptr<ProjDataInfo>& proj_data_info_ptr,
@@ -132,6 +182,20 @@ private:
 
   shared_ptr<ProjDataInfo> proj_data_info_ptr;
 
+  // members used for Version 2.0 files
+  //! start of the memory-mapped data file, or 0 if not mapped
+  const char * mapped_data_ptr;
+  //! size of the mapping (or file) in bytes
+  std::size_t mapped_size;
+  //! stream used when the data file cannot be mapped
+  shared_ptr<std::ifstream> data_stream_sptr;
+  //! range of the index in the file
+  int index_min_segment_num, index_max_segment_num;
+  int index_min_view_num, index_max_view_num;
+  //! offsets of the blocks, (segment,view) stored as in the file
+  std::vector<boost::uint64_t> block_offsets;
+  //! number of LORs in each block
+  std::vector<boost::uint64_t> block_num_lors;
 
   virtual void 
     calculate_proj_matrix_elems_for_one_bin(
@@ -141,8 +205,24 @@ private:
   virtual void initialise_keymap();
   virtual bool post_processing();
 
+  //! read all LORs of a Version 1.0 file into the cache
   Succeeded read_data();
-    
+
+  //! open (and map) a Version 2.0 file and read its index
+  Succeeded open_indexed_data();
+  //! unmap and close a Version 2.0 file
+  void close_indexed_data();
+
+  //! Returns a pointer to \a num_bytes starting at \a offset in the data file
+  /*! This points into the mapping if the file is mapped. Otherwise, the data are read into \a buffer.
+      Calls error() if the data are not in the file.
+  */
+  const char * get_data_ptr(const boost::uint64_t offset, const std::size_t num_bytes,
+                            std::vector<char>& buffer) const;
+
+  // not implemented (the mapping would be unmapped twice)
+  ProjMatrixByBinFromFile(const ProjMatrixByBinFromFile&);
+  ProjMatrixByBinFromFile& operator=(const ProjMatrixByBinFromFile&);
 };
 
 END_NAMESPACE_STIR
@@ -34,9 +34,12 @@
 #include "stir/IndexRange.h"
 #include "stir/shared_ptr.h"
 #include <iostream>
+#include <vector>
+#include <mutex>
 
 
 #include "stir/recon_buildblock/SPECTUB_Tools.h"
+#include "stir/recon_buildblock/SPECTUB_Weight3d.h"
 
 START_NAMESPACE_STIR
 
@@ -82,6 +85,20 @@ class Bin;
 
 End Projection Matrix By Bin SPECT UB Parameters:=
 \endverbatim
+
+  \par Multi-threading
+
+  All information needed to compute the matrix is stored in the object, so several
+  objects can be used at the same time. When all views are kept in the cache,
+  different views can be computed by different threads at the same time. Otherwise,
+  views are computed one at a time, but the weights of a view are computed in parallel
+  over the image rows (with the number of threads that was set when calling set_up()).
+
+  \par Caching
+
+  All rows of a view are computed at once and stored in the cache. Caching can therefore
+  not be disabled, as every row would then need the computation of its whole view.
+  set_up() calls error() in that case.
 */
 
 class ProjMatrixByBinSPECTUB : 
@@ -161,12 +178,27 @@ class ProjMatrixByBinSPECTUB :
 
   SPECTUB::discrf_type gaussdens; //!< structure with gaussian density function 
 
+  SPECTUB::wmh_type wmh;          //!< information to construct the matrix
+  SPECTUB::wm_da_type wm;         //!< matrix information shared by all subsets (weights are computed per subset)
+  float * Rrad;                   //!< radii per view
+
   int maxszb;
 
-	
-  void compute_one_subset(const int kOS) const;
+  //! scratch memory for the weight calculation (one workspace per thread)
+  mutable SPECTUB::weight3d_workspace_pool workspace_pool;
+  //! number of threads used to compute the weights of one view
+  int num_threads_for_weights;
+
+  //! Computes all rows of subset \a kOS and stores them in the cache
+  /*! If \a lor_ptr is not null, the row for its bin is also copied into \a *lor_ptr
+      (such that it is available even if the cache has dropped it).
+  */
+  void compute_one_subset(const int kOS, ProjMatrixElemsForOneBin * const lor_ptr = 0) const;
   void delete_UB_SPECT_arrays();
-  mutable std::vector<bool> subset_already_processed;
+  //! not \c std::vector<bool>, as different elements are set by different threads
+  mutable std::vector<unsigned char> subset_already_processed;
+  //! used when keeping all views, such that every view is computed only once
+  mutable std::vector<std::mutex> subset_mutexes;
 };
 
 END_NAMESPACE_STIR
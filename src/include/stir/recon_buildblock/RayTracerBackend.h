@@ -0,0 +1,172 @@
+//
+//
+/*!
+
+  \file
+  \ingroup projection
+  \brief Declaration of class stir::RayTracerBackend
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#ifndef __stir_recon_buildblock_RayTracerBackend_H__
+#define __stir_recon_buildblock_RayTracerBackend_H__
+
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBinValue.h"
+#include "stir/CartesianCoordinate3D.h"
+#include "stir/HighResWallClockTimer.h"
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup projection
+  \brief Abstract base class for the point-based ray tracers used by
+  ProjMatrixByBinUsingRayTracingTF
+
+  Points on a LOR are put in a queue with schedulePoint(). execute() then
+  finds for every point the voxel it lies in and the length of the
+  intersection of the LOR with that voxel, multiplied with the normalisation
+  constant of the point. The results are returned in the order in which
+  the points were scheduled.
+
+  The length of intersection is found by 2 steps of sphere tracing of
+  the signed distance function of the voxel, starting from the point,
+  in both directions along the (normalised) ray vector.
+
+  \par Batches
+
+  Points are collected in batches of (at most) \c chunk_size points. Derived
+  classes only need to implement trace(), which handles one batch.
+
+  If the maximum number of batches in flight is zero, a batch is traced by the
+  calling thread as soon as it is full. Otherwise, a full batch is handed to a
+  separate thread, and the caller fills the next batch while the previous one(s)
+  are traced. The caller only waits when the maximum number of batches is in
+  flight. Results are always returned in the order in which the points were
+  scheduled. Note that every batch in flight needs its own memory.
+
+  \par Timing
+
+  The time spent in the different stages is accumulated, and can be reported with
+  get_timing_report(). This is intended to help choosing the chunk size and the
+  number of batches in flight. The trace time is summed over all batches, so it
+  can be larger than the wall-clock time when batches overlap.
+*/
+class RayTracerBackend
+{
+public:
+  //! A batch of points, stored as a structure of arrays
+  struct Points
+  {
+    std::vector<float> x, y, z;
+    std::vector<float> ray_x, ray_y, ray_z;
+    std::vector<float> norm_const;
+
+    std::size_t size() const { return x.size(); }
+    void reserve(const std::size_t n);
+    void clear();
+  };
+
+  /*!
+    \param chunk_size maximum number of points in one batch
+    \param max_num_batches_in_flight maximum number of batches that are traced
+      while the next batch is filled (0 means no pipelining)
+  */
+  RayTracerBackend(const int chunk_size, const int max_num_batches_in_flight = 0);
+
+  //! waits for all batches in flight
+  virtual ~RayTracerBackend();
+
+  //! number of points that have been scheduled since the last call to execute()
+  int getQueueLength();
+
+  void setVoxelSize(CartesianCoordinate3D<float>& voxel_size);
+
+  //! puts a new point in the queue
+  void schedulePoint(float px, float py, float pz, float rx, float ry, float rz, float norm_const);
+
+  void schedulePoint(CartesianCoordinate3D<float>& point, CartesianCoordinate3D<float>& ray_vec, float norm_const)
+  {
+    schedulePoint(point.x(), point.y(), point.z(), ray_vec.x(), ray_vec.y(), ray_vec.z(), norm_const);
+  }
+
+  //! ray traces all points in the queue and appends the results to \a retval
+  /*! Returns the number of points that have been traced. */
+  int execute(std::vector<ProjMatrixElemsForOneBinValue>& retval);
+
+  int get_chunk_size() const;
+  int get_max_num_batches_in_flight() const;
+
+  //! \name Timing of the different stages (in seconds, accumulated since construction or reset_timers())
+  //@{
+  //! time spent by the caller filling batches
+  double get_fill_time() const;
+  //! time spent tracing batches and converting the results (summed over all batches)
+  double get_trace_time() const;
+  //! time that the caller was waiting for batches in flight
+  double get_wait_time() const;
+  //! a one-line summary of the above, including numbers of points and batches
+  std::string get_timing_report() const;
+  void reset_timers();
+  //@}
+
+protected:
+  //! traces the points in \a points and appends the results to \a result
+  /*! When batches are pipelined, this can be called from several threads at
+      once (for different batches), and has to be thread-safe.
+  */
+  virtual void trace(const Points& points, std::vector<ProjMatrixElemsForOneBinValue>& result) = 0;
+
+  //! waits until all batches in flight are traced (their results are kept for execute())
+  /*! Derived classes that own resources used by trace() need to call this in their destructor. */
+  void wait_for_batches_in_flight();
+
+  int chunk_size;
+  CartesianCoordinate3D<float> voxel_size;
+
+private:
+  class Batch;
+
+  int max_num_batches_in_flight;
+
+  //! batch that is being filled
+  Points current_points;
+  //! batches that are being traced, in the order in which they were filled
+  std::deque<std::unique_ptr<Batch> > batches_in_flight;
+  //! results of the batches that are finished, but not returned yet by execute()
+  std::vector<ProjMatrixElemsForOneBinValue> temp_storage;
+
+  int num_points_since_execute;
+
+  mutable HighResWallClockTimer fill_timer;
+  mutable HighResWallClockTimer wait_timer;
+  double trace_time;
+  long long num_points_traced;
+  long num_batches_traced;
+
+  //! traces \a current_points (possibly in another thread), and clears it
+  void submit_current_batch();
+  //! waits for the oldest batch in flight, and moves its results to temp_storage
+  void finish_oldest_batch();
+};
+
+END_NAMESPACE_STIR
+
+#endif
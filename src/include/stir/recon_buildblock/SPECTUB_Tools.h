@@ -327,16 +327,16 @@ typedef struct
 //... functions from wmtools_SPECT.cpp .........................................
 
 
-void write_wm_FC ();                               // to write double array weight matrix 
+void write_wm_FC ( const wm_da_type& wm );         // to write double array weight matrix 
 
-void write_wm_hdr ();                              // to write header of a matrix
+void write_wm_hdr ( const wm_da_type& wm, const wmh_type& wmh ); // to write header of a matrix
 
-void write_wm_STIR ();                             // to write matrix in STIR format
+void write_wm_STIR ( const wm_da_type& wm );       // to write matrix in STIR format
 
 
-void index_calc ( int *indexs );                   // to calculate projection index order in subsets 
+void index_calc ( int *indexs, const wmh_type& wmh ); // to calculate projection index order in subsets 
 
-void read_Rrad ();								   // to read variable rotation radius from a text file (1 radius per line)
+void read_Rrad ( float *Rrad, const wmh_type& wmh ); // to read variable rotation radius from a text file (1 radius per line)
 
 //
 //void col_params ( collim_type *COL );              // to fill collimator structure
@@ -344,17 +344,17 @@ void read_Rrad ();								   // to read variable rotation radius from a text fil
 //void read_col_params ( collim_type *COL);          // to read collimator parameters from a file
 
 
-void fill_ang ( angle_type *ang );				   // to fill angle structure
+void fill_ang ( angle_type *ang, const float *Rrad, const wmh_type& wmh ); // to fill angle structure
 
-void generate_msk ( bool *msk_3d, bool *msk_2d, float *att, volume_type *vol); // to create a boolean mask for wm (no weights outside the msk)
+void generate_msk ( bool *msk_3d, bool *msk_2d, float *att, volume_type *vol, const wmh_type& wmh); // to create a boolean mask for wm (no weights outside the msk)
 
-void read_msk_file ( bool * msk );                 // to read mask from a file
+void read_msk_file ( bool * msk, const wmh_type& wmh ); // to read mask from a file
 
 
-void read_att_map ( float *attmap );               // to read attenuation map from a file
+void read_att_map ( float *attmap, const wmh_type& wmh ); // to read attenuation map from a file
 
 
-int  max_psf_szb ( angle_type *ang );
+int  max_psf_szb ( const angle_type *ang, const wmh_type& wmh );
 
 float calc_sigma_h ( voxel_type vox, collim_type COL);
 
@@ -32,22 +32,87 @@
   <i>Integration of advanced 3D SPECT modeling into the open-source STIR framework</i>,
   Med. Phys. 40, 092502 (2013); http://dx.doi.org/10.1118/1.4816676
 
-  \todo Variables wm, wmh and Rrad are currently global variables. This means that this code would be very dangerous
-  in a parallel setting.
+  The state of the matrix (see wm_da_type and wmh_type) and the rotation radii are stored by the
+  caller (see stir::ProjMatrixByBinSPECTUB) and passed to the functions below, such that
+  several matrices can be used at the same time.
 */
 
-namespace SPECTUB {
+#include "stir/recon_buildblock/SPECTUB_Tools.h"
+#include "stir/shared_ptr.h"
+#include <vector>
+#include <mutex>
 
-/* Global variables: the matrix etc TODO 
-   Need to be defined elsewhere
+namespace SPECTUB {
 
-   A lot of the functions below modify these variables.
-*/
-  extern wm_da_type wm; //! weight (or probability) matrix
-  extern wmh_type wmh;  //! information to construct wm 
-  extern float * Rrad;  //! radii per view
+//! one weight computed by wm_calculation(), before it is stored in the matrix
+typedef struct
+{
+	int jp;       // row index of the weight matrix (projection element in the subset)
+	int iv;       // column index of the weight matrix (volume index of the voxel)
+	float val;    // weight
 
+} wm_elem_type;
 
+//! Scratch buffers needed by wm_calculation() and wm_size_estimation()
+/*! The buffers are allocated once and re-used for all voxels (and all subsets).
+    A workspace can only be used by one thread at a time, see weight3d_workspace_pool.
+*/
+class weight3d_workspace
+{
+public:
+	weight3d_workspace( const int maxszb, const wmh_type& wmh );
+
+	psf1d_type psf1d_h;               //!< horizontal component of the PSF
+	psf1d_type psf1d_v;               //!< vertical component of the PSF (only used for 3D PSF)
+	psf2da_type psf;                  //!< PSF for one voxel
+	std::vector<attpth_type> attpth;  //!< attenuation paths (only allocated for attenuation correction or masking)
+
+	//! weights computed by the thread using this workspace (for the current block of image rows in wm_calculation())
+	std::vector<wm_elem_type> elems;
+
+private:
+	std::vector<float> psf1d_h_val, psf1d_v_val, psf_val;
+	std::vector<int> psf1d_h_ind, psf1d_v_ind, psf_ib, psf_jb;
+	std::vector<std::vector<float> > attpth_dl;
+	std::vector<std::vector<int> > attpth_iv;
+
+	// not implemented, as the structures above point into the vectors
+	weight3d_workspace( const weight3d_workspace& );
+	weight3d_workspace& operator=( const weight3d_workspace& );
+};
+
+//! A pool of workspaces, such that every thread can get its own
+/*! Workspaces are allocated when needed, and kept until set_up() is called again
+    (or the pool is destroyed). This is thread-safe.
+*/
+class weight3d_workspace_pool
+{
+public:
+	weight3d_workspace_pool();
+
+	//! Sets the parameters for new workspaces, and deletes all existing ones
+	void set_up( const int maxszb, const wmh_type& wmh );
+
+	//! Returns a workspace that is not used by any other thread
+	weight3d_workspace * get_workspace();
+
+	//! Makes a workspace available again (it should not be used by the caller anymore)
+	void release_workspace( weight3d_workspace * workspace_ptr );
+
+private:
+	int maxszb;
+	wmh_type wmh;
+	std::vector<stir::shared_ptr<weight3d_workspace> > all_workspaces;
+	std::vector<weight3d_workspace *> free_workspaces;
+	std::mutex mutex;
+};
+
+//! Computes the weights for subset \a kOS
+/*! The image rows are distributed over \a num_threads threads (when using OpenMP). Every
+    thread stores its weights in its own workspace, after which they are copied
+    into \a wm in the order of the image rows. The result is therefore independent of the
+    number of threads.
+*/
 void wm_calculation( const int kOS,
 					const angle_type *const ang, 
 					voxel_type vox, 
@@ -57,11 +122,16 @@ void wm_calculation( const int kOS,
 					const float *attmap,
 					const bool *msk_3d,
 					const bool *msk_2d,
-					const int maxszb,
 					const discrf_type *const gaussdens,
-					const int *const  NITEMS
+					const int *const  NITEMS,
+					const wmh_type& wmh,
+					wm_da_type& wm,
+					weight3d_workspace_pool& workspace_pool,
+					const int num_threads
 					);
 
+//! Adds the number of weights in every row for subset \a kOS to \a NITEMS
+/*! Different subsets can be processed by different threads at the same time. */
 void wm_size_estimation (int kOS,
 						 const angle_type * const ang, 
 						 voxel_type vox, 
@@ -70,9 +140,10 @@ void wm_size_estimation (int kOS,
 						 const proj_type& prj, 
 						 const bool * const msk_3d,
 						 const bool *const msk_2d,
-						 const int maxszb,
 						 const discrf_type * const gaussdens,
-						 int *NITEMS);
+						 int *NITEMS,
+						 const wmh_type& wmh,
+						 weight3d_workspace_pool& workspace_pool);
 
 
 //... geometric component ............................................
@@ -81,18 +152,19 @@ void calc_gauss ( discrf_type *gaussdens );
 
 void calc_vxprj ( angle_type *ang );
 
-void voxel_projection ( voxel_type *vox, float * eff, float lngcmd2 );
+void voxel_projection ( voxel_type *vox, float * eff, float lngcmd2, const wmh_type& wmh );
 
-void fill_psf_no( psf2da_type *psf, psf1d_type *psf1d_h, const voxel_type& vox, const angle_type * const ang, float szdx );
+void fill_psf_no( psf2da_type *psf, psf1d_type *psf1d_h, const voxel_type& vox, const angle_type * const ang, float szdx, const wmh_type& wmh );
 
-void fill_psf_2d( psf2da_type *psf, psf1d_type *psf1d_h, const voxel_type& vox, discrf_type const*const gaussdens, float szdx );
+void fill_psf_2d( psf2da_type *psf, psf1d_type *psf1d_h, const voxel_type& vox, discrf_type const*const gaussdens, float szdx, const wmh_type& wmh );
 
 void fill_psf_3d(psf2da_type *psf,
                  psf1d_type *psf1d_h,
                  psf1d_type *psf1d_v,
-                 const voxel_type& vox, discrf_type const * const gaussdens, float szdx, float thdx, float thcmd2 );
+                 const voxel_type& vox, discrf_type const * const gaussdens, float szdx, float thdx, float thcmd2,
+                 const wmh_type& wmh );
 
-void calc_psf_bin ( float center_psf, float binszcm, discrf_type const * const vxprj, psf1d_type *psf );
+void calc_psf_bin ( float center_psf, float binszcm, discrf_type const * const vxprj, psf1d_type *psf, const wmh_type& wmh );
 
 
 //... attenuation...................................................
@@ -104,7 +176,7 @@ void calc_psf_bin ( float center_psf, float binszcm, discrf_type const * const v
 
 void calc_att_path ( const bin_type& bin, const voxel_type& vox, const volume_type& vol, attpth_type *attpth );
 
-float calc_att ( const attpth_type *const attpth, const float *const attmap, int islc );
+float calc_att ( const attpth_type *const attpth, const float *const attmap, int islc, const wmh_type& wmh );
 
 int comp_dist ( float dx, float dy, float dz, float dlast );
 
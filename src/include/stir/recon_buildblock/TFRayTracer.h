@@ -4,7 +4,7 @@
 
   \file
   \ingroup recon_buildblock
-  \brief Declaration of stir::RayTraceVoxelsOnCartesianGrid
+  \brief Declaration of class stir::TFRayTracer
 
   \author Kris Thielemans
   \author PARAPET project
@@ -32,7 +32,7 @@
 
 #include "stir/common.h"
 
-#include "stir/recon_buildblock/ProjMatrixElemsForOneBinValue.h"
+#include "stir/recon_buildblock/RayTracerBackend.h"
 #include "stir/Succeeded.h"
 
 #include "tensorflow/core/public/session.h"
@@ -41,7 +41,6 @@
 #include "tensorflow/cc/framework/ops.h"
 #include "tensorflow/core/framework/tensor.h"
 
-#include <time.h>
 
 #undef ENABLE_POINTGEN
 #define TF_GRAPH "/TFRayMarching.pb"
@@ -55,50 +54,34 @@ class ProjMatrixElemsForOneBin;
 class Succeeded;
 template <typename elemT> class CartesianCoordinate3D;
 
-class TFRayTracer 
+//! RayTracerBackend that runs the TensorFlow graph TFRayMarching.pb
+/*! The graph has inputs of fixed size, so \a chunksize has to be the number of points
+    that the graph was generated with. Batches with fewer points are zero-padded.
+
+    Every batch uses its own input tensors, such that several batches can be run at
+    the same time (tensorflow::Session::Run() is thread-safe).
+*/
+class TFRayTracer : public RayTracerBackend
 {
   private:
   std::unique_ptr<tensorflow::Session> session;
 
-  // the tensors needed as inputs to the voxel-based raytracing: these act as queues that are filled element-by-element every time that "schedule_point" is called
-  tensorflow::Tensor points_in;
-  tensorflow::Tensor ray_vec_in;
-  tensorflow::Tensor voxel_size_in;
-  tensorflow::Tensor norm_const_in;
-  tensorflow::TTypes<float, 2>::Tensor points_in_tensor;
-  tensorflow::TTypes<float, 2>::Tensor ray_vec_in_tensor;
-  tensorflow::TTypes<float, 1>::Tensor voxel_size_in_tensor;
-  tensorflow::TTypes<float, 1>::Tensor norm_const_in_tensor;
-  
-  int chunksize;
   int chunksize_pointgen;
-  int cur_pos;
-
-  std::vector<ProjMatrixElemsForOneBinValue> temp_storage;
-  void executeInternal();
 
   public:
-  TFRayTracer(int chunksize, int chunksize_pointgen);
+  TFRayTracer(int chunksize, int chunksize_pointgen, int max_num_batches_in_flight = 0);
   ~TFRayTracer();
   TFRayTracer(const TFRayTracer&) = delete;
   TFRayTracer& operator=(const TFRayTracer&) = delete;
 
-  int getQueueLength();
-
-  void setVoxelSize(CartesianCoordinate3D<float>& voxel_size);
-
-  // puts a new point into place
-  void schedulePoint(float px, float py, float pz, float rx, float ry, float rz, float norm_const);
-
-  void schedulePoint(CartesianCoordinate3D<float>& point, CartesianCoordinate3D<float>& ray_vec, float norm_const);
-
-  // acts on all elements at once with the ray tracer and put the result into "retval". Returns the total number of points that have been operated on
-  int execute(std::vector<ProjMatrixElemsForOneBinValue>& retval);
-
 #ifdef ENABLE_POINTGEN
   // second functionality that uses TF to generate points along a LOR and then automatically schedules them for ray tracing
   int scheduleLOR(std::vector<CartesianCoordinate3D<float>>& start_point, std::vector<CartesianCoordinate3D<float>>& stop_point, std::vector<CartesianCoordinate3D<float>>& ray_vec, std::vector<float>& norm_const);
 #endif
+
+  protected:
+  // runs the graph on all points in the batch, and appends the results to "result"
+  virtual void trace(const Points& points, std::vector<ProjMatrixElemsForOneBinValue>& result);
 };
 
 END_NAMESPACE_STIR
@@ -134,7 +134,8 @@ typedef  void RPC_process_related_viewgrams_type (
   \param proj_data_ptr input projection data
   \param read_from_proj_data if true, the \a measured_viewgrams_ptr argument of the call_back function 
          will be constructed using ProjData::get_related_viewgrams, otherwise 
-         ProjData::get_empty_related_viewgrams is used.
+         ProjData::get_empty_related_viewgrams is used and the viewgrams are filled with 1
+         (e.g. for computing the sensitivity).
   \param subset_num the number of the current subset (see above). Should be between 0 and num_subsets-1.
   \param num_subsets the number of subsets to consider. 1 will process all data.
   \param min_segment_num Minimum segment_num to process.
@@ -150,6 +151,28 @@ typedef  void RPC_process_related_viewgrams_type (
   \param end_time_of_frame is passed to normalise_sptr
   \param RPC_process_related_viewgrams function that does the actual work.
   \param caching_info_ptr ignored unless STIR_MPI=1, in which case it enables caching of viewgrams at the slave side  
+  \param prefetch_depth number of RelatedViewgrams that are read ahead (see below)
+  \param num_prefetch_threads number of I/O threads used when \a prefetch_depth is larger than 0
+  \param max_num_partial_images maximum number of images used by the threads to accumulate
+         the output image, 0 means one per thread (see ParallelImageAccumulator)
+
+  \par Prefetching
+
+  If \a prefetch_depth is larger than 0, dedicated I/O threads read the data (including
+  additive and multiplicative viewgrams) for the next views into a queue
+  of at most \a prefetch_depth elements, while the other threads do the computations.
+  This avoids that computation threads wait for each other to read data, which
+  is useful when reading is slow (e.g. over a network file system). The queue uses
+  memory for \a prefetch_depth sets of RelatedViewgrams. The time that the computation
+  threads had to wait for data is then reported at the end. Errors while reading
+  are thrown from this function after the I/O threads have stopped.
+
+  Reading from a ProjData object is serialised, but with more than 1 I/O thread,
+  reading of additive data and normalisation factors can overlap with it.
+  Without OpenMP, only 1 I/O thread is used, as the serialisation relies on it.
+
+  If \a prefetch_depth is 0 (the default), data are read by the computation threads.
+
   \warning There is NO check that the resulting subsets are balanced.
 
   \warning The function assumes that \a min_segment_num, \a max_segment_num are such that
@@ -181,7 +204,10 @@ void distributable_computation(
                                const double start_time_of_frame,
                                const double end_time_of_frame,
                                RPC_process_related_viewgrams_type * RPC_process_related_viewgrams,
-                               DistributedCachingInformation* caching_info_ptr);
+                               DistributedCachingInformation* caching_info_ptr,
+                               const int prefetch_depth = 0,
+                               const int num_prefetch_threads = 1,
+                               const int max_num_partial_images = 0);
 
 
   /*! \name Tag-names currently used by stir::distributable_computation and related functions0
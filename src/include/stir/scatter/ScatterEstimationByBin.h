@@ -34,6 +34,7 @@
 #include "stir/ParsingObject.h"
 #include "stir/numerics/BSplines.h"
 #include <vector>
+#include <cmath>
 #include "stir/CartesianCoordinate3D.h"
 
 START_NAMESPACE_STIR
@@ -122,7 +123,9 @@ class ScatterEstimationByBin : public ParsingObject
   ScatterEstimationByBin();
 
   /*! \name functions to (re)set images or projection data
-      These functions also invalidate cached activity integrals such that the cache will be recomputed.
+      These functions also invalidate cached integrals such that the cache will be recomputed.
+      The exception is set_activity_image_sptr(): the cached activity integrals are updated
+      incrementally (see initialise_cache_for_scattpoint_det_integrals_over_activity()).
 
       The functions that read a file call error() if the reading failed.
   */
@@ -227,7 +230,8 @@ class ScatterEstimationByBin : public ParsingObject
   float scatter_volume;
 
   //! find scatter points
-  /*! This function sets scatt_points_vector and scatter_volume. It will also
+  /*! This function sets scatt_points_vector, the corresponding scatter point arrays
+      used by single_scatter_estimate() and scatter_volume. It will also
       remove any cached integrals as they would be incorrect otherwise.
   */
   void 
@@ -239,9 +243,25 @@ class ScatterEstimationByBin : public ParsingObject
   //! \name detection related functions
   //@{
   //! energy-dependent detection efficiency (Gaussian model)
+  /*! Calls the static detection_efficiency() with the energy thresholds of this object. */
   float 
     detection_efficiency(const float energy) const;
 
+  //! energy-dependent detection efficiency (Gaussian model) for given thresholds
+  /*! \a sigma_times_sqrt2_factor is the value returned by 
+      get_detection_efficiency_sigma_times_sqrt2_factor(). This function does not access any
+      members, such that it can be used in a loop that the compiler vectorises.
+  */
+  static
+    inline float
+    detection_efficiency(const float energy,
+                         const float lower_energy_threshold, const float upper_energy_threshold,
+                         const float sigma_times_sqrt2_factor);
+
+  //! factor such that the Gaussian energy resolution model has <code>sigma*sqrt(2) = factor*sqrt(energy)</code>
+  float
+    get_detection_efficiency_sigma_times_sqrt2_factor() const;
+
 	
   //! maximum angle to consider above which detection after Compton scatter is considered too small
   static
@@ -253,12 +273,17 @@ class ScatterEstimationByBin : public ParsingObject
     float 
     energy_lower_limit(const float low, const float approx, const float resolution_at_511keV);
 
+  //! find the indices in detection_points_vector of the detectors of a bin
   virtual 
     void
     find_detectors(unsigned& det_num_A, unsigned& det_num_B, const Bin& bin) const; 
 
-  unsigned 
-    find_in_detection_points_vector(const CartesianCoordinate3D<float>& coord) const;
+  //! compute the coordinates of all detectors
+  /*! Sets \c shift_detector_coordinates_to_origin and \c detection_points_vector, where
+      the detector \c det on ring \c ring has index <code>ring*num_detectors_per_ring + det</code>.
+  */
+  void
+    initialise_detection_points();
   // private:
   const ProjDataInfoCylindricalNoArcCorr * proj_data_info_ptr;
   CartesianCoordinate3D<float>  shift_detector_coordinates_to_origin;
@@ -268,8 +293,7 @@ class ScatterEstimationByBin : public ParsingObject
     detection_efficiency_no_scatter(const unsigned det_num_A, 
 				    const unsigned det_num_B) const;
 
-  // next needs to be mutable because find_in_detection_points_vector is const
-  mutable std::vector<CartesianCoordinate3D<float> > detection_points_vector;
+  std::vector<CartesianCoordinate3D<float> > detection_points_vector;
  private:
   int total_detectors;
 
@@ -299,6 +323,13 @@ class ScatterEstimationByBin : public ParsingObject
   float 
     integral_over_activity_image_between_scattpoint_det (const CartesianCoordinate3D<float>& scatter_point,
 							 const CartesianCoordinate3D<float>& detector_coord);
+
+  //! as above, but for an arbitrary image
+  static
+    float 
+    integral_over_activity_image_between_scattpoint_det (const DiscretisedDensity<3,float>& activity_image,
+							 const CartesianCoordinate3D<float>& scatter_point,
+							 const CartesianCoordinate3D<float>& detector_coord);
   
  
     
@@ -313,12 +344,19 @@ class ScatterEstimationByBin : public ParsingObject
   
   /************************************************************************/
 	
+  //! single scatter estimate for one scatter point, without the constant factor of the differential cross section
+  /*! The result has to be multiplied with dif_Compton_cross_section_constant_factor(). This factor is
+      very small, such that multiplying with it for every scatter point in \c float could underflow.
+  */
   float 
     single_scatter_estimate_for_one_scatter_point(const std::size_t scatter_point_num,
 					   const unsigned det_num_A, 
 					   const unsigned det_num_B);
 
 
+  //! sum of single_scatter_estimate_for_one_scatter_point() over all scatter points, normalised
+  /*! When the integrals are cached, this uses the cache directly and a loop over the scatter
+      points that the compiler can vectorise. */
   void
     single_scatter_estimate(double& scatter_ratio_singles,
 			    const unsigned det_num_A, 
@@ -339,6 +377,16 @@ class ScatterEstimationByBin : public ParsingObject
   static
     inline float 
     dif_Compton_cross_section(const float cos_theta, float energy);
+
+  //! dif_Compton_cross_section() divided by dif_Compton_cross_section_constant_factor()
+  static
+    inline float
+    dif_Compton_cross_section_without_constant_factor(const float cos_theta, float energy);
+
+  //! constant factor <code>Re*Re/2</code> in dif_Compton_cross_section()
+  static
+    inline double
+    dif_Compton_cross_section_constant_factor();
 	
 	
   static
@@ -375,18 +423,41 @@ class ScatterEstimationByBin : public ParsingObject
   virtual void remove_cache_for_integrals_over_activity();
 
  private:
+  //! cached integrals, indexed as <code>[det_num][scatter_point_num]</code>
+  /*! This way, the integrals for one detector are contiguous in memory. */
   Array<2,float> cached_activity_integral_scattpoint_det;
   Array<2,float> cached_attenuation_integral_scattpoint_det;
+  //! copy of the activity image used to compute \c cached_activity_integral_scattpoint_det
+  shared_ptr<DiscretisedDensity<3,float> > activity_image_for_cache_sptr;
+  //! false if the cached integrals have not been computed (by process_data()) for the current images
+  bool cached_integrals_are_up_to_date;
 
+  //! calls error() if \c use_cache is true but the cached integrals are not up-to-date
+  /*! The caches are only filled by process_data(). */
+  void check_cached_integrals_are_up_to_date() const;
+
+  //! \name coordinates and attenuation values of the scatter points, as separate arrays
+  //@{
+  std::vector<float> scatt_points_x;
+  std::vector<float> scatt_points_y;
+  std::vector<float> scatt_points_z;
+  std::vector<float> scatt_points_mu;
+  //@}
 
   //! set-up cache for attenuation integrals
-  /*! \warning This will not remove existing cached data (if the sizes match). If you need this,
-      call remove_cache_for_scattpoint_det_integrals_over_attenuation() first. 
+  /*! Computes the integrals for all scatter points and detectors (in parallel when using OpenMP).
+
+      \warning This will not remove existing cached data (if the sizes match). If you need this,
+      call remove_cache_for_integrals_over_attenuation() first. 
   */
   void initialise_cache_for_scattpoint_det_integrals_over_attenuation();
   //! set-up cache for activity integrals
-  /*! \warning This will not remove existing cached data (if the sizes match). If you need this,
-      call remove_cache_for_scattpoint_det_integrals_over_activity() first. 
+  /*! Computes the integrals for all scatter points and detectors (in parallel when using OpenMP).
+
+      If the cache has the correct size and was computed for an image with the same 
+      characteristics as the current activity image, the cache is updated instead by 
+      adding the integrals over the difference between the images. Only lines that 
+      intersect the region where the images differ are ray-traced.
   */
   void initialise_cache_for_scattpoint_det_integrals_over_activity();
 };
@@ -29,14 +29,29 @@
 START_NAMESPACE_STIR
 
 
+double
+ScatterEstimationByBin::
+dif_Compton_cross_section_constant_factor()
+{
+  const double Re = 2.818E-13;   // aktina peristrofis electroniou gia to atomo tou H
+  return Re*Re/2;
+}
+
+float
+ScatterEstimationByBin::
+dif_Compton_cross_section_without_constant_factor(const float cos_theta, float energy)
+{
+  const float sin_theta_2= 1-cos_theta*cos_theta ;
+  const float P= 1/(1+(energy/511.F)*(1-cos_theta));
+  return P * (1 - P * sin_theta_2 + P * P);
+}
+
 float
 ScatterEstimationByBin::
 dif_Compton_cross_section(const float cos_theta, float energy)
 { 
-  const double Re = 2.818E-13;   // aktina peristrofis electroniou gia to atomo tou H
-  const double sin_theta_2= 1-cos_theta*cos_theta ;
-  const double P= 1/(1+(energy/511.0)*(1-cos_theta)); 
-  return static_cast<float>( (Re*Re/2) * P * (1 - P * sin_theta_2 + P * P));
+  return static_cast<float>(dif_Compton_cross_section_constant_factor() *
+                            dif_Compton_cross_section_without_constant_factor(cos_theta, energy));
 }
 
 float
@@ -68,15 +83,28 @@ float
 ScatterEstimationByBin::
 total_Compton_cross_section_relative_to_511keV(const float energy)
 {
-  const double a= energy/511.0;
-  static const double prefactor = 9/(-40 + 27*log(3.)); //Klein-Nishina formula for a=1 & devided with 0.75 == (40 - 27*log(3)) / 9
+  // computed in float (and without static variables) such that it can be used in vectorised loops
+  const float a= energy/511.F;
+  const float prefactor = static_cast<float>(9/(-40 + 27*log(3.))); //Klein-Nishina formula for a=1 & devided with 0.75 == (40 - 27*log(3)) / 9
 
   return //checked this in Mathematica
-    static_cast<float>
-	(prefactor*
+    prefactor*
     (((-4 - a*(16 + a*(18 + 2*a)))/square(1 + 2*a) +       
-      ((2 + (2 - a)*a)*log(1 + 2*a))/a)/square(a)
-     ));
+      ((2 + (2 - a)*a)*std::log(1 + 2*a))/a)/square(a)
+     );
+}
+
+float
+ScatterEstimationByBin::
+detection_efficiency(const float energy,
+                     const float lower_energy_threshold, const float upper_energy_threshold,
+                     const float sigma_times_sqrt2_factor)
+{
+  const float sigma_times_sqrt2 = sigma_times_sqrt2_factor*std::sqrt(energy);
+  /* Maximum efficiency is 1.*/
+  return
+    .5F*(std::erf((upper_energy_threshold - energy)/sigma_times_sqrt2)
+         - std::erf((lower_energy_threshold - energy)/sigma_times_sqrt2));
 }
 
 
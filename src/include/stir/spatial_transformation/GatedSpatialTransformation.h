@@ -28,18 +28,31 @@
 
 #include "stir/GatedDiscretisedDensity.h"
 #include "stir/DiscretisedDensity.h"
+#include "stir/VoxelsOnCartesianGrid.h"
 #include "stir/spatial_transformation/SpatialTransformation.h"
+#include "stir/spatial_transformation/WarpImageStencil.h"
 #include "stir/numerics/BSplinesRegularGrid.h"
 #include "stir/RegisteredParsingObject.h"
 #include "stir/Succeeded.h"
 #include <fstream>
 #include <iostream>
+#include <vector>
 
 START_NAMESPACE_STIR
 
 //! Class for spatial transformations for gated images
 /*!
  \ingroup spatial_transformation
+
+ \par Parameters for parsing
+ \verbatim
+ Gated Spatial Transformation Parameters:=
+ Gated Spatial Transformation Filenames Prefix := prefix
+ ; store the interpolation weights of every gate after the first warp (see WarpImageStencil)
+ ; this is faster when warping many times, but uses a lot of memory
+ cache interpolation weights := 0
+ end Gated Spatial Transformation Parameters:=
+ \endverbatim
 */
 class GatedSpatialTransformation: public RegisteredParsingObject<GatedSpatialTransformation,SpatialTransformation>
 { 
@@ -66,6 +79,9 @@ class GatedSpatialTransformation: public RegisteredParsingObject<GatedSpatialTra
                           const GatedDiscretisedDensity & motion_y, 
                           const GatedDiscretisedDensity & motion_x);
   void set_gate_defs(const TimeGateDefinitions & gate_defs); 
+  //! Keep the interpolation weights of every gate after the first warp
+  void set_cache_interpolation_weights(const bool);
+  bool get_cache_interpolation_weights() const;
   //!@}
 
   //! Warping functions from to gated images. @{
@@ -81,6 +97,14 @@ class GatedSpatialTransformation: public RegisteredParsingObject<GatedSpatialTra
   void 
     accumulate_warp_image(DiscretisedDensity<3, float> & new_reference_image,
                           const GatedDiscretisedDensity & gated_image) const ;
+  //! Warp an image with the transformation of gate \a gate_num
+  /*! Different gates can be warped at the same time. If interpolation weights are cached,
+      the weights for the gate are computed by the first call (for images with the same
+      index range and voxel sizes).
+  */
+  VoxelsOnCartesianGrid<float>
+    warp_image(const shared_ptr<DiscretisedDensity<3, float> > & density_sptr,
+               const unsigned int gate_num) const;
   void set_defaults();
   Succeeded set_up(); 
   //@}
@@ -97,6 +121,9 @@ class GatedSpatialTransformation: public RegisteredParsingObject<GatedSpatialTra
   BSpline::BSplineType _spline_type;
   std::string _time_gate_definition_filename;
   TimeGateDefinitions _gate_defs;
+  bool _cache_interpolation_weights;
+  //! interpolation weights for every gate (only used when \c _cache_interpolation_weights is true)
+  mutable std::vector<shared_ptr<WarpImageStencil> > _warp_stencils;
 };
 
 END_NAMESPACE_STIR
@@ -0,0 +1,105 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup spatial_transformation
+  \brief Declaration of class stir::WarpImageStencil
+*/
+
+#ifndef __stir_spatial_transformation_WarpImageStencil_H__
+#define __stir_spatial_transformation_WarpImageStencil_H__
+
+#include "stir/DiscretisedDensity.h"
+#include "stir/DiscretisedDensityOnCartesianGrid.h"
+#include "stir/BasicCoordinate.h"
+#include "stir/numerics/BSplines.h"
+#include <vector>
+#include <cstddef>
+
+START_NAMESPACE_STIR
+
+//! Precomputed interpolation weights for warping images with a given motion field
+/*!
+  \ingroup spatial_transformation
+
+  warp_image() interpolates the image at the displaced location of every voxel, which means
+  computing the B-spline weights again for every warp. This class computes the weights
+  (and the location of the voxels they apply to) once for a given motion field.
+  Warping an image is then a (sparse) matrix-vector multiplication, which is done
+  in parallel when using OpenMP.
+
+  apply() gives exactly the same result as warp_image() with the same motion field and
+  spline type. apply_transpose() multiplies with the transpose of this matrix (i.e. it is the
+  adjoint of apply()). The transpose is computed when first needed.
+
+  Only nearest neighbour and linear interpolation are supported, as the B-spline
+  coefficients are then the image values.
+
+  \warning Storing the weights takes about 50 bytes per voxel for linear interpolation (plus
+  about twice that if apply_transpose() is used), i.e. a lot more than the image itself.
+*/
+class WarpImageStencil
+{
+public:
+  //! Compute the weights for warping images with the same characteristics as \a density_template
+  /*! The motion images give the displacement (in mm) of every voxel, see warp_image().
+      They need to have the same index range as \a density_template.
+  */
+  WarpImageStencil(const DiscretisedDensityOnCartesianGrid<3,float>& density_template,
+                   const DiscretisedDensity<3,float>& motion_x,
+                   const DiscretisedDensity<3,float>& motion_y,
+                   const DiscretisedDensity<3,float>& motion_z,
+                   const BSpline::BSplineType spline_type);
+
+  //! Warp \a in_density and store the result in \a out_density
+  /*! Both images need to have the same index range as the template used for construction. */
+  void apply(DiscretisedDensity<3,float>& out_density,
+             const DiscretisedDensity<3,float>& in_density) const;
+
+  //! Multiply \a in_density with the transpose of the warp and store the result in \a out_density
+  void apply_transpose(DiscretisedDensity<3,float>& out_density,
+                       const DiscretisedDensity<3,float>& in_density) const;
+
+  //! Check if the stencil can be applied to \a density (i.e. if the index range and voxel sizes are the same)
+  bool is_compatible(const DiscretisedDensity<3,float>& density) const;
+
+private:
+  BasicCoordinate<3,int> _min_indices;
+  BasicCoordinate<3,int> _max_indices;
+  BasicCoordinate<3,float> _grid_spacing;
+  //! number of weights per voxel in every dimension
+  int _kernel_length;
+  //! offset (in an image stored as one vector) of the first voxel used, or -1 if the output is zero
+  std::vector<int> _first_offsets;
+  //! weights for every voxel, stored as 3 times \c _kernel_length values (z, y then x)
+  std::vector<double> _weights;
+
+  //! \name transpose in compressed row format, computed by apply_transpose() @{
+  mutable std::vector<std::size_t> _transpose_row_starts;
+  mutable std::vector<int> _transpose_columns;
+  mutable std::vector<double> _transpose_values;
+  //!@}
+
+  void set_up_transpose() const;
+  bool has_same_index_range(const DiscretisedDensity<3,float>& density) const;
+  void check_compatible(const DiscretisedDensity<3,float>& density) const;
+  std::size_t get_num_voxels() const;
+};
+
+END_NAMESPACE_STIR
+
+#endif
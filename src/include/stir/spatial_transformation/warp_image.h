@@ -31,7 +31,14 @@
 
 START_NAMESPACE_STIR
 
-VoxelsOnCartesianGrid<float> 
+//! Warp an image with the given motion images (in mm)
+/*! \ingroup spatial_transformation
+  The image is interpolated at the displaced location of every voxel (with OpenMP, planes
+  are processed in parallel). Voxels which are displaced to (or outside) the border are set to 0.
+
+  \see WarpImageStencil when warping several images with the same motion.
+*/
+VoxelsOnCartesianGrid<float>
 warp_image(const shared_ptr<DiscretisedDensity<3,float> > & density_sptr, 
            const shared_ptr<DiscretisedDensity<3,float> > & motion_x_sptr, 
            const shared_ptr<DiscretisedDensity<3,float> > & motion_y_sptr, 
@@ -48,6 +48,7 @@
 #include "stir/DataSymmetriesForViewSegmentNumbers.h"
 #include "stir/ViewSegmentNumbers.h"
 #include "stir/info.h"
+#include "stir/PerformanceTrace.h"
 
 #include "stir/modelling/ParametricDiscretisedDensity.h"
 #include "stir/modelling/KineticParameters.h"
@@ -425,6 +426,8 @@ update_estimate(TargetT &current_image_estimate)
                                                           subset_num); 
 
   std::cout << "after sub_gradient_without penalty\n";
+
+  PerformanceTraceScope update_trace_scope("image update");
   
   // divide by subset sensitivity  
   {
@@ -450,8 +453,11 @@ update_estimate(TargetT &current_image_estimate)
         auto_ptr< TargetT >(current_image_estimate.get_empty_copy());
       
       
-      this->objective_function_sptr->
-        get_prior_ptr()->compute_gradient(*denominator_ptr, current_image_estimate); 
+      {
+        PerformanceTraceScope prior_trace_scope("prior");
+        this->objective_function_sptr->
+          get_prior_ptr()->compute_gradient(*denominator_ptr, current_image_estimate); 
+      }
       
       typename TargetT::full_iterator denominator_iter = denominator_ptr->begin_all();
       const typename TargetT::full_iterator denominator_end = denominator_ptr->end_all();
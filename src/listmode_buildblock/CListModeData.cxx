@@ -24,7 +24,9 @@
 */
 
 #include "stir/listmode/CListModeData.h"
+#include "stir/listmode/CListRecord.h"
 #include "stir/ExamInfo.h"
+#include "stir/Succeeded.h"
 #include "stir/is_null_ptr.h"
 
 START_NAMESPACE_STIR
@@ -59,6 +61,23 @@ get_scanner_ptr() const
   return this->scanner_sptr.get();
 }
 
+std::size_t
+CListModeData::
+get_next_records(const std::vector<shared_ptr<CListRecord> >& records) const
+{
+  std::size_t num_records = 0;
+  while (num_records < records.size())
+    {
+      CListRecord& record = *records[num_records];
+      if (this->get_next_record(record) == Succeeded::no)
+        break;
+      ++num_records;
+      if (record.is_time())
+        break;
+    }
+  return num_records;
+}
+
 #if 0
 std::time_t 
 CListModeData::
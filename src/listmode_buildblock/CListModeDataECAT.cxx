@@ -226,6 +226,18 @@ get_next_record(CListRecord& record_of_general_type) const
   }
 }
 
+template <class CListRecordT>
+std::size_t
+CListModeDataECAT<CListRecordT>::
+get_next_records(const std::vector<shared_ptr<CListRecord> >& records) const
+{
+  const std::size_t num_records = current_lm_data_ptr->get_next_records(records);
+  if (num_records > 0 || records.empty())
+    return num_records;
+  // end of the current file: get_next_record() will go to the next one (if any)
+  return get_next_record(*records[0]) == Succeeded::yes ? 1 : 0;
+}
+
 
 
 template <class CListRecordT>
@@ -139,6 +139,13 @@ get_next_record(CListRecord& record_of_general_type) const
   return current_lm_data_ptr->get_next_record(record);
  }
 
+std::size_t
+CListModeDataECAT8_32bit::
+get_next_records(const std::vector<shared_ptr<CListRecord> >& records) const
+{
+  return current_lm_data_ptr->get_next_records(records);
+}
+
 
 Succeeded
 CListModeDataECAT8_32bit::
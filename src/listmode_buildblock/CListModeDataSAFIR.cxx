@@ -97,6 +97,17 @@ get_next_record(CListRecord& record_of_general_type) const
 	
 }
 
+template <class CListRecordT>
+std::size_t
+CListModeDataSAFIR<CListRecordT>::
+get_next_records(const std::vector<shared_ptr<CListRecord> >& records) const
+{
+	const std::size_t num_records = current_lm_data_ptr->get_next_records(records);
+	for (std::size_t i=0; i<num_records; ++i)
+		static_cast<CListRecordT&>(*records[i]).event_SAFIR().set_map(map);
+	return num_records;
+}
+
 template <class CListRecordT>
 Succeeded
 CListModeDataSAFIR<CListRecordT>::
@@ -63,6 +63,8 @@ FRAME_BASED_DT_CORR:
 #include "stir/listmode/LmToProjData.h"
 #include "stir/listmode/CListRecord.h"
 #include "stir/listmode/CListModeData.h"
+#include "stir/listmode/CListEventCylindricalScannerWithDiscreteDetectors.h"
+#include "stir/listmode/ProjDataHistogramLUT.h"
 #include "stir/ExamInfo.h"
 #include "stir/ProjDataInfoCylindricalNoArcCorr.h"
 
@@ -82,10 +84,19 @@ FRAME_BASED_DT_CORR:
 #include "stir/CPUTimer.h"
 #include "stir/recon_buildblock/TrivialBinNormalisation.h"
 #include "stir/is_null_ptr.h"
+#include "stir/num_threads.h"
+#include "stir/info.h"
 
+#include "boost/cstdint.hpp"
 #include <fstream>
 #include <iostream>
 #include <vector>
+#include <string>
+#include <cstdio>
+#include <deque>
+#include <thread>
+#include <exception>
+#include <typeinfo>
 
 #ifndef STIR_NO_NAMESPACES
 using std::string;
@@ -140,6 +151,294 @@ construct_proj_data(shared_ptr<iostream>& output,
 		    const ExamInfo& exam_info,
                     const shared_ptr<ProjDataInfo>& proj_data_info_ptr);
 
+// checks if the bin has a positive value and is inside the range of proj_data
+static bool
+is_in_range(const Bin& bin, const ProjData& proj_data);
+
+namespace {
+  /* Helper class that reads records in batches via CListModeData::get_next_records(),
+     but returns them one by one.
+     As batches end with a time record, the position in the list mode data is at the
+     end of the batch when a time frame starts. clear() has to be called after 
+     CListModeData::set_get_position() and reset().
+  */
+  class CListRecordBatch
+  {
+  public:
+    CListRecordBatch(const CListModeData& lm_data, const std::size_t batch_size)
+      : lm_data(lm_data), records(batch_size), num_records(0), current_record_num(0)
+    {
+      for (std::size_t i=0; i<batch_size; ++i)
+        records[i] = lm_data.get_empty_record_sptr();
+    }
+
+    // reads the next batch (discarding any remaining records), returns false if there are no more records
+    bool fill()
+    {
+      num_records = lm_data.get_next_records(records);
+      current_record_num = 0;
+      return num_records > 0;
+    }
+
+    // returns 0 if there are no more records
+    CListRecord * get_next_record()
+    {
+      if (current_record_num == num_records)
+        {
+          if (!fill())
+            return 0;
+        }
+      return records[current_record_num++].get();
+    }
+
+    bool empty() const
+    { return current_record_num == num_records; }
+
+    // number of records in the current batch
+    std::size_t size() const
+    { return num_records; }
+
+    // index in the current batch of the record returned by the last call to get_next_record()
+    std::size_t get_last_record_num() const
+    { return current_record_num - 1; }
+
+    const CListRecord& operator[](const std::size_t i) const
+    { return *records[i]; }
+
+    void clear()
+    { num_records = current_record_num = 0; }
+
+  private:
+    const CListModeData& lm_data;
+    vector<shared_ptr<CListRecord> > records;
+    std::size_t num_records;
+    std::size_t current_record_num;
+  };
+
+  /* Helper class that calls save_and_delete_segments() in a separate thread, such that
+     the next frame can be processed while the previous one(s) are written to disk.
+     At most max_num_frames_being_written frames are written at the same time (the oldest
+     one is waited for if necessary). If this is 0, segments are written immediately.
+  */
+  class AsynchronousSegmentWriter
+  {
+  public:
+    explicit AsynchronousSegmentWriter(const unsigned int max_num_frames_being_written)
+      : max_num_frames_being_written(max_num_frames_being_written)
+    {}
+
+    ~AsynchronousSegmentWriter()
+    {
+      // only get here without calling wait_for_all() when an exception was thrown
+      for (std::size_t i=0; i<jobs.size(); ++i)
+        jobs[i]->thread.join();
+    }
+
+    // takes ownership of the segments (the entries in segments can be reallocated afterwards)
+    void save_and_delete_segments(const shared_ptr<ProjData>& proj_data_sptr,
+                                  const VectorWithOffset<segment_type *>& segments,
+                                  const int start_segment_index,
+                                  const int end_segment_index)
+    {
+      if (max_num_frames_being_written == 0)
+        {
+          shared_ptr<iostream> output;
+          VectorWithOffset<segment_type *> segments_to_save(segments);
+          stir::save_and_delete_segments(output, segments_to_save,
+                                         start_segment_index, end_segment_index,
+                                         *proj_data_sptr);
+          return;
+        }
+      if (jobs.size() == max_num_frames_being_written)
+        wait_for_oldest();
+      shared_ptr<Job> job_sptr(new Job);
+      job_sptr->proj_data_sptr = proj_data_sptr;
+      job_sptr->segments = segments;
+      job_sptr->start_segment_index = start_segment_index;
+      job_sptr->end_segment_index = end_segment_index;
+      job_sptr->thread = std::thread(&Job::run, job_sptr.get());
+      jobs.push_back(job_sptr);
+    }
+
+    // waits until all segments are written, calls error() if this failed
+    void wait_for_all()
+    {
+      while (!jobs.empty())
+        wait_for_oldest();
+    }
+
+  private:
+    struct Job
+    {
+      shared_ptr<ProjData> proj_data_sptr;
+      VectorWithOffset<segment_type *> segments;
+      int start_segment_index;
+      int end_segment_index;
+      std::thread thread;
+      std::string error_message;
+
+      void run()
+      {
+        try
+          {
+            shared_ptr<iostream> output;
+            stir::save_and_delete_segments(output, segments,
+                                           start_segment_index, end_segment_index,
+                                           *proj_data_sptr);
+          }
+        catch (const std::string& message)
+          {
+            error_message = message;
+          }
+        catch (const std::exception& e)
+          {
+            error_message = e.what();
+          }
+        // close the file in this thread
+        proj_data_sptr.reset();
+      }
+    };
+
+    void wait_for_oldest()
+    {
+      shared_ptr<Job> job_sptr = jobs.front();
+      jobs.pop_front();
+      job_sptr->thread.join();
+      if (!job_sptr->error_message.empty())
+        error("LmToProjData: writing projection data failed: %s", job_sptr->error_message.c_str());
+    }
+
+    const unsigned int max_num_frames_being_written;
+    std::deque<shared_ptr<Job> > jobs;
+  };
+
+  /* Helper class for a time frame that does not fit in the memory budget.
+     While the list mode data are read for the first batch of segments, the events in the
+     other segments are written to a temporary file for their batch of segments (as the
+     offset in the segment and the value to add). The other batches are then filled from
+     these files, such that the list mode data are read only once.
+     Events are buffered and written in blocks. A file is removed when it has been read,
+     or by the destructor (if an exception was thrown).
+  */
+  class SpilledEvents
+  {
+  public:
+    struct Event
+    {
+      boost::int32_t segment_num;
+      boost::uint32_t offset;
+      float value;
+    };
+
+    SpilledEvents(const string& filename_prefix, const ProjDataInfo& proj_data_info,
+                  const int num_segments_in_memory)
+      : proj_data_info(proj_data_info), num_segments_in_memory(num_segments_in_memory)
+    {
+      const int num_batches =
+        (proj_data_info.get_num_segments() + num_segments_in_memory - 1) / num_segments_in_memory;
+      filenames.resize(num_batches);
+      files.resize(num_batches);
+      buffers.resize(num_batches);
+      // the first batch is in memory
+      for (int batch_num=1; batch_num<num_batches; ++batch_num)
+        {
+          char rest[50];
+          sprintf(rest, "_spilled_events_%d.tmp", batch_num);
+          filenames[batch_num] = filename_prefix + rest;
+          files[batch_num].reset(new ofstream(filenames[batch_num].c_str(), ios::out | ios::binary | ios::trunc));
+          if (!*files[batch_num])
+            error("LmToProjData: error opening temporary file %s", filenames[batch_num].c_str());
+          buffers[batch_num].reserve(buffer_size);
+        }
+    }
+
+    ~SpilledEvents()
+    {
+      for (std::size_t batch_num=1; batch_num<filenames.size(); ++batch_num)
+        if (!filenames[batch_num].empty())
+          {
+            files[batch_num].reset();
+            std::remove(filenames[batch_num].c_str());
+          }
+    }
+
+    void add(const int segment_num, const std::ptrdiff_t offset, const float value)
+    {
+      const int batch_num = get_batch_num(segment_num);
+      assert(batch_num > 0);
+      Event event;
+      event.segment_num = segment_num;
+      event.offset = static_cast<boost::uint32_t>(offset);
+      event.value = value;
+      buffers[batch_num].push_back(event);
+      if (buffers[batch_num].size() == buffer_size)
+        write_buffer(batch_num);
+    }
+
+    // as above, but finds the offset in a SegmentByView from the bin
+    void add(const Bin& bin, const float value)
+    {
+      const int segment_num = bin.segment_num();
+      const std::ptrdiff_t offset =
+        (static_cast<std::ptrdiff_t>(bin.view_num() - proj_data_info.get_min_view_num()) *
+         proj_data_info.get_num_axial_poss(segment_num) +
+         bin.axial_pos_num() - proj_data_info.get_min_axial_pos_num(segment_num)) *
+        proj_data_info.get_num_tangential_poss() +
+        bin.tangential_pos_num() - proj_data_info.get_min_tangential_pos_num();
+      add(segment_num, offset, value);
+    }
+
+    // adds the events of the batch starting at start_segment_index to the segment data, and removes the file
+    void add_to_segments(const VectorWithOffset<elem_type *>& segment_data_ptrs, const int start_segment_index)
+    {
+      const int batch_num = get_batch_num(start_segment_index);
+      write_buffer(batch_num);
+      files[batch_num].reset();
+      vector<Event>& events = buffers[batch_num];
+      events.resize(buffer_size);
+      ifstream file(filenames[batch_num].c_str(), ios::in | ios::binary);
+      if (!file)
+        error("LmToProjData: error opening temporary file %s", filenames[batch_num].c_str());
+      do
+        {
+          file.read(reinterpret_cast<char *>(&events[0]), buffer_size * sizeof(Event));
+          const std::size_t num_events = static_cast<std::size_t>(file.gcount()) / sizeof(Event);
+          for (std::size_t i=0; i<num_events; ++i)
+            segment_data_ptrs[events[i].segment_num][events[i].offset] += events[i].value;
+        }
+      while (file);
+      if (!file.eof())
+        error("LmToProjData: error reading temporary file %s", filenames[batch_num].c_str());
+      file.close();
+      vector<Event>().swap(events);
+      std::remove(filenames[batch_num].c_str());
+      filenames[batch_num].clear();
+    }
+
+  private:
+    static const std::size_t buffer_size = 8192;
+    const ProjDataInfo& proj_data_info;
+    const int num_segments_in_memory;
+    vector<string> filenames;
+    vector<shared_ptr<ofstream> > files;
+    vector<vector<Event> > buffers;
+
+    int get_batch_num(const int segment_num) const
+    { return (segment_num - proj_data_info.get_min_segment_num()) / num_segments_in_memory; }
+
+    void write_buffer(const int batch_num)
+    {
+      if (buffers[batch_num].empty())
+        return;
+      files[batch_num]->write(reinterpret_cast<const char *>(&buffers[batch_num][0]),
+                              buffers[batch_num].size() * sizeof(Event));
+      if (!*files[batch_num])
+        error("LmToProjData: error writing to temporary file %s", filenames[batch_num].c_str());
+      buffers[batch_num].clear();
+    }
+  };
+}
+
 /**************************************************************
  The 3 parsing functions
 ***************************************************************/
@@ -156,7 +455,8 @@ set_defaults()
   post_normalisation_ptr.reset(new TrivialBinNormalisation);
   do_pre_normalisation =0;
   num_events_to_store = 0;
-
+  num_threads = 1;
+  max_memory_in_MB = 0;
 }
 
 void 
@@ -174,6 +474,8 @@ initialise_keymap()
   parser.add_key("maximum absolute segment number to process", &max_segment_num_to_process); 
   parser.add_key("do pre normalisation ", &do_pre_normalisation);
   parser.add_key("num_segments_in_memory", &num_segments_in_memory);
+  parser.add_key("number of threads", &num_threads);
+  parser.add_key("maximum memory in MB for projection data", &max_memory_in_MB);
 
   //if (lm_data_ptr->has_delayeds()) TODO we haven't read the CListModeData yet, so cannot access has_delayeds() yet
   // one could add the next 2 keywords as part of a callback function for the 'input file' keyword.
@@ -244,6 +546,46 @@ post_processing()
       warning("LmToProjData: num_segments_in_memory cannot be 0");
       return true;
     }
+  if (num_threads < 0)
+    {
+      warning("LmToProjData: number of threads should be 0 or larger");
+      return true;
+    }
+
+  // use the memory budget (if any) to decide how many frames or segments we can store
+  num_frames_in_memory = 1;
+  if (max_memory_in_MB > 0 && !interactive)
+    {
+      std::size_t frame_size = 0;
+      std::size_t max_segment_size = 0;
+      for (int segment_num = template_proj_data_info_ptr->get_min_segment_num();
+           segment_num <= template_proj_data_info_ptr->get_max_segment_num();
+           ++segment_num)
+        {
+          const std::size_t segment_size =
+            static_cast<std::size_t>(template_proj_data_info_ptr->get_num_views()) *
+            template_proj_data_info_ptr->get_num_axial_poss(segment_num) *
+            template_proj_data_info_ptr->get_num_tangential_poss() *
+            sizeof(elem_type);
+          frame_size += segment_size;
+          max_segment_size = max(max_segment_size, segment_size);
+        }
+      const std::size_t max_memory = static_cast<std::size_t>(max_memory_in_MB) * 1024 * 1024;
+      if (max_memory >= frame_size)
+        {
+          num_segments_in_memory = num_segments;
+          num_frames_in_memory = static_cast<unsigned int>(max_memory / frame_size);
+        }
+      else
+        {
+          num_segments_in_memory =
+            std::max(static_cast<int>(max_memory / max_segment_size), 1);
+          warning("LmToProjData: a single time frame does not fit in %d MB. Going through the\n"
+                  "list mode data once, keeping %d segments at a time in memory and storing the\n"
+                  "events in the other segments in temporary files.",
+                  max_memory_in_MB, num_segments_in_memory);
+        }
+    }
   
 
 
@@ -490,6 +832,33 @@ get_compression_count(const Bin& bin) const
 
 }
 
+bool
+LmToProjData::
+can_use_histogram_LUT() const
+{
+  // derived classes might find the bin in a different way
+  if (typeid(*this) != typeid(LmToProjData))
+    return false;
+  if (interactive || do_pre_normalisation || !post_normalisation_ptr->is_trivial())
+    return false;
+
+  const ProjDataInfoCylindricalNoArcCorr * const proj_data_info_ptr =
+    dynamic_cast<const ProjDataInfoCylindricalNoArcCorr *>(template_proj_data_info_ptr.get());
+  if (proj_data_info_ptr == 0)
+    return false;
+  shared_ptr<CListRecord> record_sptr = lm_data_ptr->get_empty_record_sptr();
+  const CListEventCylindricalScannerWithDiscreteDetectors * const event_ptr =
+    dynamic_cast<const CListEventCylindricalScannerWithDiscreteDetectors *>(&record_sptr->event());
+  if (event_ptr == 0)
+    return false;
+  // detector and ring numbers of the events are used as indices in the look-up table
+  const Scanner& event_scanner = *event_ptr->get_scanner_ptr();
+  const Scanner& template_scanner = *proj_data_info_ptr->get_scanner_ptr();
+  return
+    event_scanner.get_num_rings() == template_scanner.get_num_rings() &&
+    event_scanner.get_num_detectors_per_ring() == template_scanner.get_num_detectors_per_ring();
+}
+
 /**************************************************************
  Empty functions for new time events and new time frames.
 ***************************************************************/
@@ -517,6 +886,9 @@ process_data()
   CPUTimer timer;
   timer.start();
 
+  // write previous frames while the next one is processed if they fit in memory
+  AsynchronousSegmentWriter segment_writer(num_frames_in_memory - 1);
+
   // assume list mode data starts at time 0
   // we have to do this because the first time tag might occur only after a
   // few coincidence events (as happens with ECAT scanners)
@@ -530,11 +902,69 @@ process_data()
   
   VectorWithOffset<CListModeData::SavedPosition> 
     frame_start_positions(1, static_cast<int>(frame_defs.get_num_frames()));
-  shared_ptr <CListRecord> record_sptr = lm_data_ptr->get_empty_record_sptr();
-  CListRecord& record = *record_sptr;
-
-  if (!record.event().is_valid_template(*template_proj_data_info_ptr))
-	  error("The scanner template is not valid for LmToProjData. This might be because of unsupported arc correction.");
+  {
+    shared_ptr <CListRecord> record_sptr = lm_data_ptr->get_empty_record_sptr();
+    if (!record_sptr->event().is_valid_template(*template_proj_data_info_ptr))
+      error("The scanner template is not valid for LmToProjData. This might be because of unsupported arc correction.");
+  }
+  // records are read in batches to avoid a stream read and virtual function call per record
+  const std::size_t batch_size = 10000;
+  CListRecordBatch record_batch(*lm_data_ptr, batch_size);
+
+  /* When using multiple threads, the bins (and post-normalisation factors) for all
+     events in a batch are computed in parallel when the batch is read. As a batch
+     ends with a time record (if any), current_time and the state set by
+     process_new_time_event() are the same for all events in the batch, so this gives
+     the same bins as computing them one by one. When storing time frames, the events
+     are then added to the segments in the same parallel loop (with atomic updates).
+     The order of the floating point additions therefore depends on the threads, such
+     that the result can differ by rounding errors between runs when the post-normalised
+     values are not integers. When storing a number of events, we have to stop at a
+     particular event, so the bins are added to the segments afterwards in the order
+     of the list mode data.
+  */
+  /* If possible, we find the offset of each event in its segment via a look-up table,
+     and increment the segment data directly. When using multiple threads, the events
+     in a batch are then added to the segments in parallel (with atomic updates). The
+     increments are integers, so the result does not depend on the order in which they
+     are added. This is only done when storing time frames, as otherwise we have to
+     stop at a particular event.
+  */
+  shared_ptr<ProjDataHistogramLUT> histogram_lut_sptr;
+  if (can_use_histogram_LUT())
+    {
+      info("LmToProjData: using a look-up table to add events to the projection data");
+      histogram_lut_sptr.reset
+        (new ProjDataHistogramLUT(dynamic_cast<const ProjDataInfoCylindricalNoArcCorr&>(*template_proj_data_info_ptr)));
+    }
+  const bool use_histogram_lut = !is_null_ptr(histogram_lut_sptr);
+
+  const bool compute_bins_in_parallel = num_threads != 1 && !interactive && !use_histogram_lut;
+  const bool add_bins_in_parallel = compute_bins_in_parallel && do_time_frame;
+  const bool add_events_in_parallel = num_threads != 1 && use_histogram_lut && do_time_frame;
+  vector<Bin> bins_in_batch;
+  vector<float> post_normalised_values_in_batch;
+  if (compute_bins_in_parallel)
+    {
+      bins_in_batch.resize(batch_size);
+      post_normalised_values_in_batch.resize(batch_size);
+    }
+  if (compute_bins_in_parallel || add_events_in_parallel)
+    set_num_threads(num_threads);
+
+  // when a frame does not fit in the memory budget, events in segments that are not in memory
+  // are stored in temporary files (see SpilledEvents), such that the list mode data are read once
+  const bool spill_events =
+    max_memory_in_MB > 0 && !interactive &&
+    num_segments_in_memory < template_proj_data_info_ptr->get_num_segments();
+  // entries for events in a batch that have to be spilled (only used when adding them in parallel)
+  vector<unsigned char> is_spilled_in_batch;
+  vector<SpilledEvents::Event> spilled_events_in_batch;
+  if (spill_events && (add_bins_in_parallel || add_events_in_parallel))
+    {
+      is_spilled_in_batch.resize(batch_size);
+      spilled_events_in_batch.resize(batch_size);
+    }
 
 
   /* Here starts the main loop which will store the listmode data. */
@@ -554,6 +984,7 @@ process_data()
       // *********** open output file
       shared_ptr<iostream> output;
       shared_ptr<ProjData> proj_data_ptr;
+      shared_ptr<SpilledEvents> spilled_events_sptr;
 
       {
         char rest[50];
@@ -562,6 +993,9 @@ process_data()
       
         proj_data_ptr = 
           construct_proj_data(output, output_filename, this_frame_exam_info, template_proj_data_info_ptr);
+        if (spill_events)
+          spilled_events_sptr.reset
+            (new SpilledEvents(output_filename, *template_proj_data_info_ptr, num_segments_in_memory));
       }
 
       long num_prompts_in_frame = 0;
@@ -586,6 +1020,13 @@ process_data()
 	   if (!interactive)
 	     allocate_segments(segments, start_segment_index, end_segment_index, proj_data_ptr->get_proj_data_info_ptr());
 
+	   // data of the segments in memory, when using histogram_lut_sptr or spilled events
+	   const bool use_segment_data_ptrs = use_histogram_lut || spill_events;
+	   VectorWithOffset<elem_type *> segment_data_ptrs(start_segment_index, end_segment_index);
+	   if (use_segment_data_ptrs)
+	     for (int seg=start_segment_index; seg<=end_segment_index; ++seg)
+	       segment_data_ptrs[seg] = segments[seg]->get_full_data_ptr();
+
 	   // the next variable is used to see if there are more events to store for the current segments
 	   // num_events_to_store-more_events will be the number of allowed coincidence events currently seen in the file
 	   // ('allowed' independent on the fact of we have its segment in memory or not)
@@ -594,12 +1035,21 @@ process_data()
 	   long more_events = 
          do_time_frame? 1 : static_cast<long>(num_events_to_store);
 
-	   if (start_segment_index != proj_data_ptr->get_min_segment_num())
+	   // with spilled events, the list mode data are only read for the first batch of segments
+	   const bool read_list_mode_data =
+	     !spill_events || start_segment_index == proj_data_ptr->get_min_segment_num();
+	   if (!read_list_mode_data)
+	     {
+	       cerr << "\nAdding stored events for next batch of segments\n";
+	       spilled_events_sptr->add_to_segments(segment_data_ptrs, start_segment_index);
+	     }
+	   else if (start_segment_index != proj_data_ptr->get_min_segment_num())
 	     {
 	       // we're going once more through the data (for the next batch of segments)
 	       cerr << "\nProcessing next batch of segments\n";
 	       // go to the beginning of the listmode data for this frame
 	       lm_data_ptr->set_get_position(frame_start_positions[current_frame_num]);
+	       record_batch.clear();
 	       current_time = start_time;
 	     }
 	   else
@@ -610,25 +1060,167 @@ process_data()
 	       // need to set it. In fact, setting it to start_time would be wrong
 	       // as we first might have to skip some events before we get to start_time.
 	       // So, let's do that now.
+	       CListRecord * record_ptr;
 	       while (current_time < start_time && 
-		      lm_data_ptr->get_next_record(record) == Succeeded::yes) 
+		      (record_ptr = record_batch.get_next_record()) != 0) 
 		 {
-		   if (record.is_time())
-		     current_time = record.time().get_time_in_secs();
+		   if (record_ptr->is_time())
+		     current_time = record_ptr->time().get_time_in_secs();
 		 }
 	       // now save position such that we can go back
+	       // (this is the position of the next record as we are at the end of a batch)
+	       assert(record_batch.empty());
 	       frame_start_positions[current_frame_num] = 
 		 lm_data_ptr->save_get_position();
 	     }
+	   if (read_list_mode_data)
 	   {      
 	     // loop over all events in the listmode file
 	     while (more_events)
 	       {
-		 if (lm_data_ptr->get_next_record(record) == Succeeded::no) 
+		 if (compute_bins_in_parallel && record_batch.empty())
+		   {
+		     if (!record_batch.fill())
+		       break; // no more events in file
+		     // compute what the code below would otherwise compute for every event.
+		     // Entries for records that are not events, or for events
+		     // that are not going to be stored, are not used.
+		     // When storing time frames, also add the events, as the code below would do.
+		     const int num_records = static_cast<int>(record_batch.size());
+		     long num_stored_events_in_batch = 0;
+		     long num_prompts_in_batch = 0;
+		     long num_delayeds_in_batch = 0;
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static) reduction(+:num_stored_events_in_batch,num_prompts_in_batch,num_delayeds_in_batch)
+#endif
+		     for (int i=0; i<num_records; ++i)
+		       {
+			 const CListRecord& record = record_batch[i];
+			 if (add_bins_in_parallel && spill_events)
+			   is_spilled_in_batch[i] = 0;
+			 if (!record.is_event())
+			   continue;
+			 Bin& bin = bins_in_batch[i];
+			 bin.set_bin_value(1);
+			 get_bin_from_event(bin, record.event());
+			 const bool is_in_memory =
+			   bin.segment_num() >= start_segment_index && bin.segment_num() <= end_segment_index;
+			 if (!is_in_range(bin, *proj_data_ptr) || (!is_in_memory && !spill_events))
+			   continue;
+			 const int event_increment =
+			   record.event().is_prompt() ? ( store_prompts ? 1 : 0 ) : delayed_increment;
+			 if (event_increment==0)
+			   continue;
+			 Bin normalised_bin = bin;
+			 do_post_normalisation(normalised_bin);
+			 post_normalised_values_in_batch[i] = normalised_bin.get_bin_value();
+			 if (!add_bins_in_parallel)
+			   continue;
+			 num_stored_events_in_batch += event_increment;
+			 if (record.event().is_prompt())
+			   ++num_prompts_in_batch;
+			 else
+			   ++num_delayeds_in_batch;
+			 const elem_type increment = normalised_bin.get_bin_value() * event_increment;
+			 if (!is_in_memory)
+			   {
+			     // spilled after the loop
+			     is_spilled_in_batch[i] = 1;
+			     spilled_events_in_batch[i].value = increment;
+			     continue;
+			   }
+			 elem_type& elem =
+			   (*segments[bin.segment_num()])[bin.view_num()][bin.axial_pos_num()][bin.tangential_pos_num()];
+#ifdef STIR_OPENMP
+#pragma omp atomic
+#endif
+			 elem += increment;
+		       }
+		     if (add_bins_in_parallel)
+		       {
+			 if (spill_events)
+			   for (int i=0; i<num_records; ++i)
+			     if (is_spilled_in_batch[i])
+			       spilled_events_sptr->add(bins_in_batch[i], spilled_events_in_batch[i].value);
+			 if ((num_stored_events + num_stored_events_in_batch)/500000L != num_stored_events/500000L)
+			   cout << "\r" << num_stored_events + num_stored_events_in_batch << " events stored" << flush;
+			 num_stored_events += num_stored_events_in_batch;
+			 num_prompts_in_frame += num_prompts_in_batch;
+			 num_delayeds_in_frame += num_delayeds_in_batch;
+		       }
+		   }
+		 if (add_events_in_parallel && record_batch.empty())
+		   {
+		     if (!record_batch.fill())
+		       break; // no more events in file
+		     // add all events in the batch, as the code below would do.
+		     // They all occur before the time record at the end of the batch (if any),
+		     // so are all in the current frame.
+		     const int num_records = static_cast<int>(record_batch.size());
+		     long num_stored_events_in_batch = 0;
+		     long num_prompts_in_batch = 0;
+		     long num_delayeds_in_batch = 0;
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static) reduction(+:num_stored_events_in_batch,num_prompts_in_batch,num_delayeds_in_batch)
+#endif
+		     for (int i=0; i<num_records; ++i)
+		       {
+			 const CListRecord& record = record_batch[i];
+			 if (spill_events)
+			   is_spilled_in_batch[i] = 0;
+			 if (!record.is_event())
+			   continue;
+			 int segment_num;
+			 const std::ptrdiff_t offset =
+			   static_cast<const CListEventCylindricalScannerWithDiscreteDetectors&>(record.event()).
+			   get_histogram_offset(segment_num, *histogram_lut_sptr);
+			 if (offset < 0)
+			   continue;
+			 const int event_increment =
+			   record.event().is_prompt() ? ( store_prompts ? 1 : 0 ) : delayed_increment;
+			 const bool is_in_memory =
+			   segment_num >= start_segment_index && segment_num <= end_segment_index;
+			 if (event_increment==0 || (!is_in_memory && !spill_events))
+			   continue;
+			 num_stored_events_in_batch += event_increment;
+			 if (record.event().is_prompt())
+			   ++num_prompts_in_batch;
+			 else
+			   ++num_delayeds_in_batch;
+			 if (!is_in_memory)
+			   {
+			     // spilled after the loop
+			     is_spilled_in_batch[i] = 1;
+			     spilled_events_in_batch[i].segment_num = segment_num;
+			     spilled_events_in_batch[i].offset = static_cast<boost::uint32_t>(offset);
+			     spilled_events_in_batch[i].value = static_cast<float>(event_increment);
+			     continue;
+			   }
+			 elem_type& elem = segment_data_ptrs[segment_num][offset];
+#ifdef STIR_OPENMP
+#pragma omp atomic
+#endif
+			 elem += event_increment;
+		       }
+		     if (spill_events)
+		       for (int i=0; i<num_records; ++i)
+			 if (is_spilled_in_batch[i])
+			   spilled_events_sptr->add(spilled_events_in_batch[i].segment_num,
+						    spilled_events_in_batch[i].offset,
+						    spilled_events_in_batch[i].value);
+		     if ((num_stored_events + num_stored_events_in_batch)/500000L != num_stored_events/500000L)
+		       cout << "\r" << num_stored_events + num_stored_events_in_batch << " events stored" << flush;
+		     num_stored_events += num_stored_events_in_batch;
+		     num_prompts_in_frame += num_prompts_in_batch;
+		     num_delayeds_in_frame += num_delayeds_in_batch;
+		   }
+		 CListRecord * const record_ptr = record_batch.get_next_record();
+		 if (record_ptr == 0) 
 		   {
 		     // no more events in file for some reason
 		     break; //get out of while loop
 		   }
+		 CListRecord& record = *record_ptr;
          if (record.is_time() && end_time > 0.01) // Direct comparison within doubles is unsafe.
 		   {
 		     current_time = record.time().get_time_in_secs();
@@ -640,22 +1232,66 @@ process_data()
 		 // note: could do "else if" here if we would be sure that
 		 // a record can never be both timing and coincidence event
 		 // and there might be a scanner around that has them both combined.
-		 if (record.is_event())
+		 if (record.is_event() && use_histogram_lut)
+		   {
+		     if (add_events_in_parallel)
+		       continue; // already added above
+		     // same as below, but without constructing a Bin (and without normalisation)
+		     int segment_num;
+		     const std::ptrdiff_t offset =
+		       static_cast<const CListEventCylindricalScannerWithDiscreteDetectors&>(record.event()).
+		       get_histogram_offset(segment_num, *histogram_lut_sptr);
+		     if (offset < 0)
+		       continue; // event is rejected
+
+		     const int event_increment =
+		       record.event().is_prompt() 
+		       ? ( store_prompts ? 1 : 0 ) // it's a prompt
+		       :  delayed_increment;//it is a delayed-coincidence event
+		     if (event_increment==0)
+		       continue;
+
+		     if (!do_time_frame)
+		       more_events-= event_increment;
+
+		     const bool is_in_memory =
+		       segment_num >= start_segment_index && segment_num<=end_segment_index;
+		     if (is_in_memory || spill_events)
+		       {
+			 num_stored_events += event_increment;
+			 if (record.event().is_prompt())
+			   ++num_prompts_in_frame;
+			 else
+			   ++num_delayeds_in_frame;
+
+			 if (num_stored_events%500000L==0) cout << "\r" << num_stored_events << " events stored" << flush;
+
+			 if (is_in_memory)
+			   segment_data_ptrs[segment_num][offset] += event_increment;
+			 else
+			   spilled_events_sptr->add(segment_num, offset, static_cast<float>(event_increment));
+		       }
+		   }
+		 else if (record.is_event())
 		   {
+		     if (add_bins_in_parallel)
+		       continue; // already added above
 		     assert(start_time <= current_time);
 		     Bin bin;
-		     // set value in case the event decoder doesn't touch it
-		     // otherwise it would be 0 and all events will be ignored
-		     bin.set_bin_value(1);
-                     get_bin_from_event(bin, record.event());
+		     if (compute_bins_in_parallel)
+		       {
+			 bin = bins_in_batch[record_batch.get_last_record_num()];
+		       }
+		     else
+		       {
+			 // set value in case the event decoder doesn't touch it
+			 // otherwise it would be 0 and all events will be ignored
+			 bin.set_bin_value(1);
+			 get_bin_from_event(bin, record.event());
+		       }
 		     		       
 		     // check if it's inside the range we want to store
-		     if (bin.get_bin_value()>0
-			 && bin.tangential_pos_num()>= proj_data_ptr->get_min_tangential_pos_num()
-			 && bin.tangential_pos_num()<= proj_data_ptr->get_max_tangential_pos_num()
-			 && bin.axial_pos_num()>=proj_data_ptr->get_min_axial_pos_num(bin.segment_num())
-			 && bin.axial_pos_num()<=proj_data_ptr->get_max_axial_pos_num(bin.segment_num())
-			 ) 
+		     if (is_in_range(bin, *proj_data_ptr))
 		       {
 			 assert(bin.view_num()>=proj_data_ptr->get_min_view_num());
 			 assert(bin.view_num()<=proj_data_ptr->get_max_view_num());
@@ -672,10 +1308,15 @@ process_data()
 			 if (!do_time_frame)
 			   more_events-= event_increment;
             
-			 // now check if we have its segment in memory
-			 if (bin.segment_num() >= start_segment_index && bin.segment_num()<=end_segment_index)
+			 // now check if we have its segment in memory (or store it for later)
+			 const bool is_in_memory =
+			   bin.segment_num() >= start_segment_index && bin.segment_num()<=end_segment_index;
+			 if (is_in_memory || spill_events)
 			   {
-			     do_post_normalisation(bin);
+			     if (compute_bins_in_parallel)
+			       bin.set_bin_value(post_normalised_values_in_batch[record_batch.get_last_record_num()]);
+			     else
+			       do_post_normalisation(bin);
 			 
 			     num_stored_events += event_increment;
 			     if (record.event().is_prompt())
@@ -689,10 +1330,12 @@ process_data()
 			       printf("Seg %4d view %4d ax_pos %4d tang_pos %4d time %8g stored with incr %d \n", 
 				      bin.segment_num(), bin.view_num(), bin.axial_pos_num(), bin.tangential_pos_num(),
 				      current_time, event_increment);
-			     else
+			     else if (is_in_memory)
 			       (*segments[bin.segment_num()])[bin.view_num()][bin.axial_pos_num()][bin.tangential_pos_num()] += 
 			       bin.get_bin_value() * 
 			       event_increment;
+			     else
+			       spilled_events_sptr->add(bin, bin.get_bin_value() * event_increment);
 			   }
 		       }
 		     else 	// event is rejected for some reason
@@ -708,16 +1351,19 @@ process_data()
 	       max(time_of_last_stored_event,current_time); 
 	   } 
 
+	   if (use_segment_data_ptrs)
+	     for (int seg=start_segment_index; seg<=end_segment_index; ++seg)
+	       segments[seg]->release_full_data_ptr();
 	   if (!interactive)
-	   save_and_delete_segments(output, segments, 
-				    start_segment_index, end_segment_index, 
-				    *proj_data_ptr);  
+	     segment_writer.save_and_delete_segments(proj_data_ptr, segments,
+						     start_segment_index, end_segment_index);
 	 } // end of for loop for segment range
        cerr <<  "\nNumber of prompts stored in this time period : " << num_prompts_in_frame
 	    <<  "\nNumber of delayeds stored in this time period: " << num_delayeds_in_frame
 	    << '\n';
    } // end of loop over frames
 
+ segment_writer.wait_for_all();
  timer.stop();
 
  cerr << "Last stored event was recorded before time-tick at " << time_of_last_stored_event << " secs\n";
@@ -735,6 +1381,17 @@ process_data()
 
 /************************* Local helper routines *************************/
 
+static bool
+is_in_range(const Bin& bin, const ProjData& proj_data)
+{
+  return
+    bin.get_bin_value()>0
+    && bin.tangential_pos_num()>= proj_data.get_min_tangential_pos_num()
+    && bin.tangential_pos_num()<= proj_data.get_max_tangential_pos_num()
+    && bin.axial_pos_num()>=proj_data.get_min_axial_pos_num(bin.segment_num())
+    && bin.axial_pos_num()<=proj_data.get_max_axial_pos_num(bin.segment_num());
+}
+
 
 void 
 allocate_segments( VectorWithOffset<segment_type *>& segments,
@@ -108,6 +108,13 @@ post_processing()
   if (seed == 0)
     return true;
 
+  // get_bin_from_event() depends on the order in which it is called
+  if (this->num_threads != 1)
+    {
+      warning("Multi-threading is not supported by this class. Using 1 thread.");
+      this->num_threads = 1;
+    }
+
   return false;
 }
 
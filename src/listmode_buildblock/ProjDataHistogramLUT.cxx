@@ -0,0 +1,85 @@
+//
+//
+/*!
+  \file
+  \ingroup listmode
+  \brief Implementation of class stir::ProjDataHistogramLUT
+
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#include "stir/listmode/ProjDataHistogramLUT.h"
+#include "stir/Scanner.h"
+#include "stir/Succeeded.h"
+
+START_NAMESPACE_STIR
+
+ProjDataHistogramLUT::
+ProjDataHistogramLUT(const ProjDataInfoCylindricalNoArcCorr& proj_data_info)
+  : num_detectors_per_ring(proj_data_info.get_scanner_ptr()->get_num_detectors_per_ring()),
+    num_rings(proj_data_info.get_scanner_ptr()->get_num_rings()),
+    view_mashing_factor(proj_data_info.get_view_mashing_factor()),
+    min_tang_pos_num(proj_data_info.get_min_tangential_pos_num()),
+    max_tang_pos_num(proj_data_info.get_max_tangential_pos_num())
+{
+  const int num_tang_poss = proj_data_info.get_num_tangential_poss();
+
+  det_pair_info.resize(num_detectors_per_ring*num_detectors_per_ring);
+  for (int det1_num=0; det1_num<num_detectors_per_ring; ++det1_num)
+    for (int det2_num=0; det2_num<num_detectors_per_ring; ++det2_num)
+      {
+        DetPairInfo& det_pair = det_pair_info[det1_num*num_detectors_per_ring + det2_num];
+        if (det1_num == det2_num)
+          {
+            det_pair.view_index = 0;
+            det_pair.tang_pos_index = -1;
+            det_pair.keep_ring_order = true;
+            continue;
+          }
+        int view_num, tang_pos_num;
+        det_pair.keep_ring_order =
+          proj_data_info.get_view_tangential_pos_num_for_det_num_pair(view_num, tang_pos_num,
+                                                                      det1_num, det2_num);
+        det_pair.view_index = view_num - proj_data_info.get_min_view_num();
+        det_pair.tang_pos_index =
+          tang_pos_num < min_tang_pos_num || tang_pos_num > max_tang_pos_num
+          ? -1 : tang_pos_num - min_tang_pos_num;
+      }
+
+  ring_pair_info.resize(num_rings*num_rings);
+  for (int ring1_num=0; ring1_num<num_rings; ++ring1_num)
+    for (int ring2_num=0; ring2_num<num_rings; ++ring2_num)
+      {
+        RingPairInfo& ring_pair = ring_pair_info[ring1_num*num_rings + ring2_num];
+        ring_pair.segment_num = 0;
+        ring_pair.offset = -1;
+        ring_pair.view_stride = 0;
+        int segment_num, axial_pos_num;
+        if (proj_data_info.get_segment_axial_pos_num_for_ring_pair(segment_num, axial_pos_num,
+                                                                   ring1_num, ring2_num) == Succeeded::no ||
+            axial_pos_num < proj_data_info.get_min_axial_pos_num(segment_num) ||
+            axial_pos_num > proj_data_info.get_max_axial_pos_num(segment_num))
+          continue;
+        // bins are stored by view, axial position and tangential position
+        ring_pair.segment_num = segment_num;
+        ring_pair.view_stride = proj_data_info.get_num_axial_poss(segment_num) * num_tang_poss;
+        ring_pair.offset =
+          static_cast<std::ptrdiff_t>(axial_pos_num - proj_data_info.get_min_axial_pos_num(segment_num)) * num_tang_poss;
+      }
+}
+
+END_NAMESPACE_STIR
@@ -107,6 +107,13 @@ post_processing()
       warning("reject_if_above needs to be between 0 and 1"); return true;
     }
 
+  // get_bin_from_event() depends on the order in which it is called
+  if (this->num_threads != 1)
+    {
+      warning("Multi-threading is not supported by this class. Using 1 thread.");
+      this->num_threads = 1;
+    }
+
   return false;
 }
 
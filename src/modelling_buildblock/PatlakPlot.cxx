@@ -27,7 +27,7 @@
 
 
 #include "stir/modelling/PatlakPlot.h"
-#include "stir/linear_regression.h"
+#include <vector>
 
 START_NAMESPACE_STIR
 
@@ -227,55 +227,78 @@ PatlakPlot::apply_linear_regression(ParametricVoxelsOnCartesianGrid & par_image,
     }
   //  const DynamicDiscretisedDensity & dyn_image=this->_dyn_image;
   const unsigned int num_frames=(this->_frame_defs).get_num_frames();
-  unsigned int frame_num;
-  unsigned int starting_frame= this->_starting_frame; 
-  Array<2,float> brain_patlak_model_array=this->_model_matrix.get_model_array();
-  VectorWithOffset<float> patlak_x(starting_frame-1,num_frames-1);
-  VectorWithOffset<float> patlak_y(starting_frame-1,num_frames-1); 
-  VectorWithOffset<float> weights(starting_frame-1,num_frames-1);
+  const unsigned int starting_frame= this->_starting_frame; 
+  const Array<2,float> brain_patlak_model_array=this->_model_matrix.get_model_array();
+  VectorWithOffset<float> patlak_x(starting_frame,num_frames);
   for(unsigned int frame_num = starting_frame; 
       frame_num<=num_frames ; ++frame_num )
-    {      
-      patlak_x[frame_num-1]=brain_patlak_model_array[1][frame_num]/brain_patlak_model_array[2][frame_num];
-      weights[frame_num-1]=1;                    
-    }   
-  {  // Do linear_regression for each voxel // for k j i 
-    float slope=0.F;
-    float y_intersection=0.F;
-    float variance_of_slope=0.F;
-    float variance_of_y_intersection=0.F;
-    float covariance_of_y_intersection_with_slope=0.F;
-    float chi_square = 0.F;  
-     
-    const int min_k_index = dyn_image[1].get_min_index(); 
-    const int max_k_index = dyn_image[1].get_max_index();
-    for ( int k = min_k_index; k<= max_k_index; ++k)
-      {
-        const int min_j_index = dyn_image[1][k].get_min_index(); 
-        const int max_j_index = dyn_image[1][k].get_max_index();
-        for ( int j = min_j_index; j<= max_j_index; ++j)
-          {
-            const int min_i_index = dyn_image[1][k][j].get_min_index(); 
-            const int max_i_index = dyn_image[1][k][j].get_max_index();
-            for ( int i = min_i_index; i<= max_i_index; ++i)
-              { 
-                for ( frame_num = starting_frame; 
-                      frame_num<=num_frames ; ++frame_num )
-                  patlak_y[frame_num-1]=dyn_image[frame_num][k][j][i]/brain_patlak_model_array[2][frame_num];
-                linear_regression(y_intersection, slope,
-                                  chi_square,
-                                  variance_of_y_intersection,
-                                  variance_of_slope,
-                                  covariance_of_y_intersection_with_slope,
-                                  patlak_y,
-                                  patlak_x,                   
-                                  weights);     
-                par_image[k][j][i][2]=y_intersection;
-                par_image[k][j][i][1]=slope;
-              }
-          }
-      }    
-  }
+    patlak_x[frame_num]=brain_patlak_model_array[1][frame_num]/brain_patlak_model_array[2][frame_num];
+
+  /* All voxels use the same coordinates and (unit) weights, so the sums in linear_regression()
+     that only depend on these are computed once. The remaining sums are linear in the data,
+     and are accumulated frame by frame for a whole image row at a time, which avoids gathering
+     the time-activity curve of every voxel and can be vectorised.
+     Sums are computed in the same order as linear_regression(), such that the result is the same
+     (unless the compiler reorders floating point operations).
+  */
+  double S=0., Sx=0., Stt=0.;
+  const float weight=1.F;
+  for(unsigned int frame_num = starting_frame; frame_num<=num_frames ; ++frame_num )
+    {
+      S += static_cast<double>(weight);
+      Sx += static_cast<double>(weight) * patlak_x[frame_num];
+    }
+  VectorWithOffset<double> wt(starting_frame,num_frames);
+  for(unsigned int frame_num = starting_frame; frame_num<=num_frames ; ++frame_num )
+    {
+      wt[frame_num] = (patlak_x[frame_num] - Sx/S);
+      Stt += weight * wt[frame_num] * wt[frame_num];
+    }
+
+  // Do linear_regression for each voxel, processing planes in parallel
+  const int min_k_index = dyn_image[1].get_min_index(); 
+  const int max_k_index = dyn_image[1].get_max_index();
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for ( int k = min_k_index; k<= max_k_index; ++k)
+    {
+      std::vector<double> Sy, Sty;
+      const int min_j_index = dyn_image[1][k].get_min_index(); 
+      const int max_j_index = dyn_image[1][k].get_max_index();
+      for ( int j = min_j_index; j<= max_j_index; ++j)
+        {
+          const int min_i_index = dyn_image[1][k][j].get_min_index(); 
+          const int num_i = dyn_image[1][k][j].get_length();
+          Sy.assign(num_i, 0.);
+          Sty.assign(num_i, 0.);
+          double * const Sy_ptr = &Sy[0];
+          double * const Sty_ptr = &Sty[0];
+          for (unsigned int frame_num = starting_frame; frame_num<=num_frames ; ++frame_num )
+            {
+              const float * const row_ptr = &dyn_image[frame_num][k][j][min_i_index];
+              const float plasma = brain_patlak_model_array[2][frame_num];
+              const double wt_frame = weight * wt[frame_num];
+#if defined(STIR_OPENMP) && (_OPENMP >= 201307)
+#pragma omp simd
+#endif
+              for (int i=0; i<num_i; ++i)
+                {
+                  const float patlak_y = row_ptr[i]/plasma;
+                  Sy_ptr[i] += static_cast<double>(weight) * patlak_y;
+                  Sty_ptr[i] += wt_frame * patlak_y;
+                }
+            }
+          for (int i=0; i<num_i; ++i)
+            {
+              // as in linear_regression_compute_fit_from_S
+              const float slope = static_cast<float>(Sty[i] / Stt);
+              const float y_intersection = static_cast<float>((Sy[i] - Sx * slope) / S);
+              par_image[k][j][min_i_index+i][2]=y_intersection;
+              par_image[k][j][min_i_index+i][1]=slope;
+            }
+        }
+    }
 }
 
 void
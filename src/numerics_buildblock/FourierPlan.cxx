@@ -0,0 +1,305 @@
+//
+//
+/*!
+  \file
+  \ingroup DFT
+  \brief Implementation of class stir::FourierPlan and function stir::get_fourier_plan()
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#include "stir/numerics/FourierPlan.h"
+#include "stir/common.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+/* The butterflies loop over the interleaved sequences of a stage, which are
+   contiguous in memory. Input and output are different buffers, so the
+   compiler can vectorise these loops.
+*/
+#if defined(STIR_OPENMP) && (_OPENMP >= 201307)
+#  define STIR_FOURIER_VECTORISE _Pragma("omp simd")
+#elif defined(__GNUC__)
+#  define STIR_FOURIER_VECTORISE _Pragma("GCC ivdep")
+#else
+#  define STIR_FOURIER_VECTORISE
+#endif
+
+START_NAMESPACE_STIR
+
+namespace detail
+{
+  /* One stage of the Stockham algorithm for radix r and current length n=r*m,
+     where s sequences are interleaved (i.e. s*n is the total length).
+     With x the input and y the output, and w_n=exp(sign*2 pi i/n), it computes
+       y[q + s*(r*p + k)] = w_n^(p*k) sum_j x[q + s*(p + j*m)] w_r^(j*k)
+     for 0<=p<m, 0<=q<s and 0<=k<r.
+     All data are complex numbers stored as interleaved real and imaginary parts.
+     The twiddle factors tw are those of the full length s*n, such that
+     w_n^(p*k) = tw[s*p*k], and sgn is used to take the complex conjugate.
+  */
+
+  inline void
+  radix2_butterfly(const float * const x, float * const y, const int s, const int m,
+                   const float * const tw, const float sgn, const int p, const int q)
+  {
+    const int in0 = 2*(q + s*p);
+    const int in1 = 2*(q + s*(p + m));
+    const int out0 = 2*(q + s*(2*p));
+    const int out1 = 2*(q + s*(2*p + 1));
+    const float wr = tw[2*s*p];
+    const float wi = sgn*tw[2*s*p + 1];
+    const float ar = x[in0], ai = x[in0+1];
+    const float br = x[in1], bi = x[in1+1];
+    y[out0] = ar + br;
+    y[out0+1] = ai + bi;
+    const float dr = ar - br, di = ai - bi;
+    y[out1] = dr*wr - di*wi;
+    y[out1+1] = dr*wi + di*wr;
+  }
+
+  inline void
+  radix4_butterfly(const float * const x, float * const y, const int s, const int m,
+                   const float * const tw, const float sgn, const int p, const int q)
+  {
+    const float a0r = x[2*(q + s*p)],         a0i = x[2*(q + s*p) + 1];
+    const float a1r = x[2*(q + s*(p + m))],   a1i = x[2*(q + s*(p + m)) + 1];
+    const float a2r = x[2*(q + s*(p + 2*m))], a2i = x[2*(q + s*(p + 2*m)) + 1];
+    const float a3r = x[2*(q + s*(p + 3*m))], a3i = x[2*(q + s*(p + 3*m)) + 1];
+    const float t0r = a0r + a2r, t0i = a0i + a2i;
+    const float t1r = a0r - a2r, t1i = a0i - a2i;
+    const float t2r = a1r + a3r, t2i = a1i + a3i;
+    // (a1-a3) * w_4, with w_4 = sgn*i
+    const float t3r = -sgn*(a1i - a3i), t3i = sgn*(a1r - a3r);
+    const float b0r = t0r + t2r, b0i = t0i + t2i;
+    const float b1r = t1r + t3r, b1i = t1i + t3i;
+    const float b2r = t0r - t2r, b2i = t0i - t2i;
+    const float b3r = t1r - t3r, b3i = t1i - t3i;
+    const float w1r = tw[2*s*p],   w1i = sgn*tw[2*s*p + 1];
+    const float w2r = tw[4*s*p],   w2i = sgn*tw[4*s*p + 1];
+    const float w3r = tw[6*s*p],   w3i = sgn*tw[6*s*p + 1];
+    const int out = 2*(q + s*4*p);
+    y[out] = b0r;
+    y[out + 1] = b0i;
+    y[out + 2*s] = b1r*w1r - b1i*w1i;
+    y[out + 2*s + 1] = b1r*w1i + b1i*w1r;
+    y[out + 4*s] = b2r*w2r - b2i*w2i;
+    y[out + 4*s + 1] = b2r*w2i + b2i*w2r;
+    y[out + 6*s] = b3r*w3r - b3i*w3i;
+    y[out + 6*s + 1] = b3r*w3i + b3i*w3r;
+  }
+
+  inline void
+  radix3_butterfly(const float * const x, float * const y, const int s, const int m,
+                   const float * const tw, const float sgn, const int p, const int q)
+  {
+    // imaginary part of w_3, without sign
+    const float sin_2pi_3 = 0.86602540378443864676F;
+    const float a0r = x[2*(q + s*p)],         a0i = x[2*(q + s*p) + 1];
+    const float a1r = x[2*(q + s*(p + m))],   a1i = x[2*(q + s*(p + m)) + 1];
+    const float a2r = x[2*(q + s*(p + 2*m))], a2i = x[2*(q + s*(p + 2*m)) + 1];
+    const float tr = a1r + a2r, ti = a1i + a2i;
+    const float mr = a0r - tr/2, mi = a0i - ti/2;
+    // (a1-a3) * sgn*i*sin(2pi/3)
+    const float dr = -sgn*sin_2pi_3*(a1i - a2i), di = sgn*sin_2pi_3*(a1r - a2r);
+    const float b1r = mr + dr, b1i = mi + di;
+    const float b2r = mr - dr, b2i = mi - di;
+    const float w1r = tw[2*s*p],   w1i = sgn*tw[2*s*p + 1];
+    const float w2r = tw[4*s*p],   w2i = sgn*tw[4*s*p + 1];
+    const int out = 2*(q + s*3*p);
+    y[out] = a0r + tr;
+    y[out + 1] = a0i + ti;
+    y[out + 2*s] = b1r*w1r - b1i*w1i;
+    y[out + 2*s + 1] = b1r*w1i + b1i*w1r;
+    y[out + 4*s] = b2r*w2r - b2i*w2i;
+    y[out + 4*s + 1] = b2r*w2i + b2i*w2r;
+  }
+
+  // any radix r, using w_r^(j*k) = tw[(s*n/r)*(j*k mod r)]
+  inline void
+  generic_butterfly(const float * const x, float * const y, const int s, const int m, const int r,
+                    const float * const tw, const float sgn, const int p, const int q)
+  {
+    const int full_length = s*m*r;
+    const int step = full_length/r;
+    for (int k=0; k<r; ++k)
+      {
+        float sum_r = 0.F, sum_i = 0.F;
+        for (int j=0; j<r; ++j)
+          {
+            const int t = step*((j*k) % r);
+            const float wr = tw[2*t], wi = sgn*tw[2*t + 1];
+            const float ar = x[2*(q + s*(p + j*m))], ai = x[2*(q + s*(p + j*m)) + 1];
+            sum_r += ar*wr - ai*wi;
+            sum_i += ar*wi + ai*wr;
+          }
+        const float wr = tw[2*s*p*k], wi = sgn*tw[2*s*p*k + 1];
+        const int out = 2*(q + s*(r*p + k));
+        y[out] = sum_r*wr - sum_i*wi;
+        y[out + 1] = sum_r*wi + sum_i*wr;
+      }
+  }
+
+  /* Loop over all butterflies of a stage. The innermost loop is over the
+     longest dimension, such that there is enough work to vectorise.
+  */
+#define STIR_FOURIER_STAGE(butterfly_call)                              \
+  if (s >= m)                                                           \
+    {                                                                   \
+      for (int p=0; p<m; ++p)                                           \
+        {                                                               \
+          STIR_FOURIER_VECTORISE                                        \
+          for (int q=0; q<s; ++q)                                       \
+            butterfly_call;                                             \
+        }                                                               \
+    }                                                                   \
+  else                                                                  \
+    {                                                                   \
+      for (int q=0; q<s; ++q)                                           \
+        {                                                               \
+          STIR_FOURIER_VECTORISE                                        \
+          for (int p=0; p<m; ++p)                                       \
+            butterfly_call;                                             \
+        }                                                               \
+    }
+
+  static void
+  fourier_stage(const float * const x, float * const y, const int s, const int m, const int r,
+                const float * const tw, const float sgn)
+  {
+    switch (r)
+      {
+      case 2:
+        STIR_FOURIER_STAGE(radix2_butterfly(x, y, s, m, tw, sgn, p, q));
+        break;
+      case 3:
+        STIR_FOURIER_STAGE(radix3_butterfly(x, y, s, m, tw, sgn, p, q));
+        break;
+      case 4:
+        STIR_FOURIER_STAGE(radix4_butterfly(x, y, s, m, tw, sgn, p, q));
+        break;
+      default:
+        for (int p=0; p<m; ++p)
+          for (int q=0; q<s; ++q)
+            generic_butterfly(x, y, s, m, r, tw, sgn, p, q);
+        break;
+      }
+  }
+#undef STIR_FOURIER_STAGE
+
+} // end of namespace detail
+
+FourierPlan::
+FourierPlan(const int length_v)
+  : length(length_v)
+{
+  if (length < 1)
+    error(boost::format("FourierPlan: length should be at least 1, but is %1%") % length);
+
+  // factorise, preferring radix 4
+  int remaining = length;
+  while (remaining % 4 == 0)
+    {
+      radices.push_back(4);
+      remaining /= 4;
+    }
+  if (remaining % 2 == 0)
+    {
+      radices.push_back(2);
+      remaining /= 2;
+    }
+  for (int factor = 3; remaining > 1; factor += 2)
+    {
+      if (factor*factor > remaining)
+        factor = remaining;
+      while (remaining % factor == 0)
+        {
+          radices.push_back(factor);
+          remaining /= factor;
+        }
+    }
+
+  // compute in double precision for accuracy
+  twiddle_factors.resize(length);
+  for (int k=0; k<length; ++k)
+    {
+      const double angle = (2*_PI*k)/length;
+      twiddle_factors[k] = std::complex<float>(static_cast<float>(std::cos(angle)),
+                                               static_cast<float>(std::sin(angle)));
+    }
+}
+
+void
+FourierPlan::
+transform(std::complex<float>* data, const int sign) const
+{
+  if (length <= 1)
+    return;
+  std::vector<std::complex<float> > work(length);
+  this->transform(data, sign, &work[0]);
+}
+
+void
+FourierPlan::
+transform(std::complex<float>* data, const int sign, std::complex<float>* work) const
+{
+  assert(sign==1 || sign==-1);
+  if (length <= 1)
+    return;
+
+  // std::complex<float> is guaranteed to be stored as 2 floats
+  float * x = reinterpret_cast<float *>(data);
+  float * y = reinterpret_cast<float *>(work);
+  const float * const tw = reinterpret_cast<const float *>(&twiddle_factors[0]);
+  const float sgn = static_cast<float>(sign);
+
+  int s = 1;
+  int n = length;
+  for (std::vector<int>::const_iterator radix_iter = radices.begin();
+       radix_iter != radices.end();
+       ++radix_iter)
+    {
+      const int r = *radix_iter;
+      const int m = n/r;
+      detail::fourier_stage(x, y, s, m, r, tw, sgn);
+      std::swap(x, y);
+      s *= r;
+      n = m;
+    }
+  // the result is in x, which might be the work array
+  if (x != reinterpret_cast<float *>(data))
+    std::copy(work, work + length, data);
+}
+
+shared_ptr<const FourierPlan>
+get_fourier_plan(const int length)
+{
+  static std::map<int, shared_ptr<const FourierPlan> > plans;
+  static std::mutex plans_mutex;
+
+  std::lock_guard<std::mutex> lock(plans_mutex);
+  shared_ptr<const FourierPlan>& plan_sptr = plans[length];
+  if (!plan_sptr)
+    plan_sptr.reset(new FourierPlan(length));
+  return plan_sptr;
+}
+
+END_NAMESPACE_STIR
@@ -23,72 +23,85 @@
     See STIR/LICENSE.txt for details
 */
 #include "stir/numerics/fourier.h"
-#include "stir/round.h"
 #include "stir/modulo.h"
 #include "stir/array_index_functions.h"
+#include "stir/numerics/FourierPlan.h"
+#include "stir/error.h"
+#include <vector>
+#include <algorithm>
 START_NAMESPACE_STIR
 
 
-template <typename T>
-static void bitreversal(VectorWithOffset<T>& data)
-{
-  const int n=data.get_length();
-  int   j=1;
-  for (int i=0;i<n;++i) {
-    if (j/2 > i) {
-      std::swap(data[j/2],data[i]);
-    }
-    int m=n;
-    while (m >= 2 && j > m) {
-      j -= m;
-      m >>= 1;
-    }
-    j += m;
-  }
-}
-
-/* We cache factors exp(i*_PI/pow(2,k)). They will be computed during the first
-   call of the Fourier functions, and then stored in static arrays.
+/* First we define 1D fourier transforms of vectors with almost arbitrary
+   element types.
+   All the work is done by a FourierPlan (which is shared between threads).
+   For vectors of complex numbers, the data are passed to the plan directly.
+   When the element type is an array again, we transform the "columns"
+   (i.e. all elements c[i][j] for fixed j) one at a time. We do this in
+   blocks of columns, such that we can run through each c[i] sequentially.
 */
-// exparray[k][i] = exp(i*_PI/pow(2,k))
-typedef VectorWithOffset<VectorWithOffset<std::complex<float> > > exparray_t;
-static   exparray_t exparray;
 
-static void init_exparray(const int k, const int pow2k)
+namespace detail {
+
+template <typename elemT>
+struct fourier_1d_auxiliary
 {
-  if (exparray.get_max_index() >= k && exparray[k].size()>0)
-    return;
-
-  if (exparray.get_max_index() <k)
-    exparray.grow(0, k);
-  exparray[k].grow(0,pow2k-1);
-  for (int i=0; i< pow2k; ++i)
-    exparray[k][i]= std::exp(std::complex<float>(0, static_cast<float>((i*_PI)/pow2k)));
-}
+  template <typename T>
+  static void
+  do_fourier_1d(T& c, const int sign)
+  {
+    typedef typename elemT::full_iterator full_iterator;
+    const int length = c.get_length();
+    const shared_ptr<const FourierPlan> plan_sptr = get_fourier_plan(length);
+    const std::size_t num_columns = c[0].size_all();
+    std::vector<full_iterator> iters;
+    iters.reserve(length);
+    for (int i=0; i<length; ++i)
+      {
+        if (c[i].size_all() != num_columns)
+          error("fourier_1d called with array elements of different sizes");
+        iters.push_back(c[i].begin_all());
+      }
 
-// expminarray[k][i] = exp(-i*_PI/pow(2,k))
-// obviously just the complex conjugate of exparray
-static   exparray_t expminarray;
+    const std::size_t block_size = 16;
+    std::vector<std::complex<float> > columns(block_size*length);
+    std::vector<std::complex<float> > work(length);
+    for (std::size_t first_column=0; first_column<num_columns; first_column+=block_size)
+      {
+        const std::size_t this_block_size = std::min(block_size, num_columns - first_column);
+        // copy c[i][first_column..] to columns[b*length + i]
+        for (int i=0; i<length; ++i)
+          {
+            full_iterator iter = iters[i];
+            for (std::size_t b=0; b<this_block_size; ++b, ++iter)
+              columns[b*length + i] = *iter;
+          }
+        for (std::size_t b=0; b<this_block_size; ++b)
+          plan_sptr->transform(&columns[b*length], sign, &work[0]);
+        // copy back and advance iterators to the next block
+        for (int i=0; i<length; ++i)
+          {
+            full_iterator& iter = iters[i];
+            for (std::size_t b=0; b<this_block_size; ++b, ++iter)
+              *iter = columns[b*length + i];
+          }
+      }
+  }
+};
 
-static void init_expminarray(const int k, const int pow2k)
+// specialisation for the one-dimensional case, where the data are contiguous
+template <>
+struct fourier_1d_auxiliary<std::complex<float> >
 {
-  if (expminarray.get_max_index() >= k && expminarray[k].size()>0)
-    return;
-
-  if (expminarray.get_max_index() <k)
-    expminarray.grow(0, k);
-  expminarray[k].grow(0,pow2k-1);
-  for (int i=0; i< pow2k; ++i)
-    expminarray[k][i]= std::exp(std::complex<float>(0, static_cast<float>(-(i*_PI)/pow2k)));
-}
-
+  template <typename T>
+  static void
+  do_fourier_1d(T& c, const int sign)
+  {
+    get_fourier_plan(c.get_length())->transform(&c[0], sign);
+  }
+};
 
-/* First we define 1D fourier transforms of vectors with almost arbitrary
-   element types.
-   This is almost a straightforward 1D FFT implementation. The only tricky bit
-   is to make sure that all operations are written in a way that is defined
-   (and efficient) in the case that the element type is a vector again.
-*/
+} // end of namespace detail
 
 template <typename T>
 void fourier_1d(T& c, const int sign)
@@ -96,48 +109,7 @@ void fourier_1d(T& c, const int sign)
   if (c.size()==0) return;
   assert(c.get_min_index()==0);
   assert(sign==1 || sign ==-1);
-  bitreversal(c);
-  // find 'nn' which is such that length==2^nn
-  const int nn=round(log(static_cast<double>(c.size()))/log(2.));
-  if (c.get_length()!= round(pow(2.,nn)))
-    error ("fourier_1d called with array length %d which is not 2^%d\n", c.size(), nn);
-
-  int k=0;
-  int pow2k = 1; // will be updated to be round(pow(2,k))
-  const int pow2nn=c.get_length(); // ==round(pow(2,nn)); 
-  for (; k<nn; ++k, pow2k*=2)
-  {
-    if (sign==1)
-      init_exparray(k,pow2k);
-    else
-      init_expminarray(k,pow2k);
-    const exparray_t& cur_exparray =
-      sign==1? exparray : expminarray;      
-    for (int j=0; j< pow2nn;j+= pow2k*2) 
-      for (int i=0; i< pow2k; ++i)
-      {
-        typename T::reference c1= c[i + j];
-        typename T::reference c2= c[i + j + pow2k];
-        
-        typename T::value_type const t1 = c1; 
-	/* here is what we have to do:
-            typename T::value_type const t2 = 
-              c2*cur_exparray[k][i];
-            c1 = t1+t2; c2 = t1-t2;
-	 however, this would create an unnecessary copy of t2, which is 
-	 potentially large.
-	 So, we rewrite it without t2, and using operations that also 
-	 work when using multi-dim arrays.
-	 Note that for multi-dimensional arrays, this code involves 4 
-	 loops over the same data.
-	 Using expression templates would speed this up.
-	*/
-        c2 *= cur_exparray[k][i];
-        c1 += c2;
-        c2 *= -1;
-        c2 += t1;
-      }
-  }
+  detail::fourier_1d_auxiliary<typename T::value_type>::do_fourier_1d(c, sign);
 }
 
 namespace detail {
@@ -249,15 +221,16 @@ fourier_1d_for_real_data(const Array<1,T>& v, const int sign)
 
   //cout << "C: " << c;
   c.resize(n+1);
+  // twiddle factors exp(i*_PI*k/n)
+  const shared_ptr<const FourierPlan> plan_sptr = get_fourier_plan(2*n);
   for (unsigned int i=1; i<=n/2; ++i)
     {
       const complex_t t1 = 
 	(c[i]+std::conj(c[n-i]));
-      // TODO could get exp() from static exparray
-      // the nice thing about this code that it works even when the length is not a power of 2
-      // (but of course, the call to fourier_1d would currently abort in that case)
+      // multiply with exp(i*(sign*i*_PI/n - _PI/2))
+      const complex_t twiddle_factor = plan_sptr->get_twiddle_factor(i);
       const complex_t t2 = 			   
-	std::exp(complex_t(0, static_cast<T>(sign*(i*_PI)/n-_PI/2)))*
+	complex_t(0, -1) * (sign==1 ? twiddle_factor : std::conj(twiddle_factor)) *
 	(c[i]-std::conj(c[n-i]));
 
       c[i] = (t1 + t2);
@@ -281,8 +254,8 @@ inverse_fourier_1d_for_real_data_corrupting_input(Array<1,std::complex<T> >& c,
   assert(c.get_min_index()==0);
   assert(sign==1 || sign ==-1);
   const int n = c.get_length()-1;
-  if (n%2!=0)
-    error("inverse_fourier_1d_of_real_data can only handle arrays of even length.\n");
+  if (n<1)
+    error("inverse_fourier_1d_of_real_data needs at least 2 elements.\n");
 
   /* Problematic asserts to check that the imaginary part of c[0] and c[n] is 0
      Trouble is that it could be only approximately 0 (e.g. when calling 
@@ -295,12 +268,15 @@ inverse_fourier_1d_for_real_data_corrupting_input(Array<1,std::complex<T> >& c,
   */
   //assert(fabs(c[0].imag())<=.001*norm(c.begin_all(),c.end_all())/sqrt(n+1.)); // note divide by n+1 to avoid division by 0
   //assert(fabs(c[n].imag())<=.001*norm(c.begin_all(),c.end_all())/sqrt(n+1.));
+  // twiddle factors exp(i*_PI*k/n)
+  const shared_ptr<const FourierPlan> plan_sptr = get_fourier_plan(2*n);
   for (int i=1; i<=n/2; ++i)
     {
       const complex_t t1 = (c[i]+std::conj(c[n-i]));
-      // TODO could get exp() from static exparray
+      // multiply with exp(i*(-sign*i*_PI/n + _PI/2))
+      const complex_t twiddle_factor = plan_sptr->get_twiddle_factor(i);
       const complex_t t2 = 			   
-	std::exp(complex_t(0, static_cast<T>(-sign*(i*_PI)/n+_PI/2)))*
+	complex_t(0, 1) * (sign==1 ? std::conj(twiddle_factor) : twiddle_factor) *
 	(c[i]-std::conj(c[n-i]));
 
       c[i] = (t1 + t2);
@@ -523,6 +499,10 @@ template
 void 
 fourier<>(VectorWithOffset<std::complex<float> >& c, const int sign);
 
+template
+void 
+fourier_1d<>(Array<1,std::complex<float> >& c, const int sign);
+
 #define INSTANTIATE(d,type) \
  template \
  Array<d,std::complex<type> > \
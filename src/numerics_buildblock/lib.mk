@@ -4,6 +4,7 @@ dir:=numerics_buildblock
 
 $(dir)_LIB_SOURCES := \
   fourier.cxx \
+  FourierPlan.cxx \
   determinant.cxx
 
 #$(dir)_REGISTRY_SOURCES:= $(dir)_registries.cxx
@@ -34,9 +34,10 @@
 #include "stir/recon_buildblock/find_basic_vs_nums_in_subsets.h"
 #include "stir/RelatedViewgrams.h"
 #include "stir/ProjData.h"
+#include "stir/PerformanceTrace.h"
 #include <vector>
 #ifdef STIR_OPENMP
-#include "stir/is_null_ptr.h"
+#include "stir/recon_buildblock/ParallelImageAccumulator.h"
 #include "stir/DiscretisedDensity.h"
 #include <omp.h>
 #endif
@@ -53,7 +54,8 @@ BackProjectorByBin::~BackProjectorByBin()
 
 void 
 BackProjectorByBin::back_project(DiscretisedDensity<3,float>& image,
-				 const ProjData& proj_data)
+				 const ProjData& proj_data,
+                                 const int max_num_partial_images)
 {
     
   shared_ptr<DataSymmetriesForViewSegmentNumbers> 
@@ -65,15 +67,11 @@ BackProjectorByBin::back_project(DiscretisedDensity<3,float>& image,
                                          0, 1/*subset_num, num_subsets*/);
 
 #ifdef STIR_OPENMP
-  std::vector< shared_ptr<DiscretisedDensity<3,float> > > local_output_image_sptrs;
-#pragma omp parallel shared(proj_data, symmetries_sptr, local_output_image_sptrs)
+  ParallelImageAccumulator accumulator(image, max_num_partial_images);
+#pragma omp parallel shared(proj_data, symmetries_sptr, accumulator)
 #endif
   { 
 #ifdef STIR_OPENMP
-#pragma omp single
-    {
-      local_output_image_sptrs.resize(omp_get_num_threads(), shared_ptr<DiscretisedDensity<3,float> >());
-    }
 #pragma omp for schedule(runtime)  
 #endif
     // note: older versions of openmp need an int as loop
@@ -89,11 +87,9 @@ BackProjectorByBin::back_project(DiscretisedDensity<3,float>& image,
           proj_data.get_related_viewgrams(vs, symmetries_sptr);
 #endif
 #ifdef STIR_OPENMP
-        const int thread_num=omp_get_thread_num();
-        if(is_null_ptr(local_output_image_sptrs[thread_num]))
-          local_output_image_sptrs[thread_num].reset(image.get_empty_copy());
-        
-        back_project(*(local_output_image_sptrs[thread_num]), viewgrams);	  
+        const int partial_image_num = accumulator.acquire();
+        back_project(accumulator.get_partial_image(partial_image_num), viewgrams);
+        accumulator.release(partial_image_num);
 #else            
         back_project(image, viewgrams);
 #endif
@@ -101,11 +97,7 @@ BackProjectorByBin::back_project(DiscretisedDensity<3,float>& image,
   }
 #ifdef STIR_OPENMP
   // "reduce" data constructed by threads
-  {
-    for (int i=0; i<static_cast<int>(local_output_image_sptrs.size()); ++i)
-      if(!is_null_ptr(local_output_image_sptrs[i])) // only accumulate if a thread filled something in
-        image += *(local_output_image_sptrs[i]);
-  }
+  accumulator.add_to(image);
 #endif
 }
 
@@ -143,6 +135,7 @@ back_project(DiscretisedDensity<3,float>& density,
   if (viewgrams.get_num_viewgrams()==0)
     return;
 
+  PerformanceTraceScope trace_scope("back projection");
   start_timers();
 
   // first check symmetries    
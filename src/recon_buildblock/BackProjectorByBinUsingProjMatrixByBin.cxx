@@ -42,6 +42,8 @@
 #include "stir/Viewgram.h"
 #include "stir/RelatedViewgrams.h"
 #include "stir/is_null_ptr.h"
+#include <iostream>
+#include <chrono>
 
 using std::vector;
 using std::auto_ptr;
@@ -0,0 +1,138 @@
+//
+//
+/*!
+
+  \file
+  \ingroup projection
+  \brief Implementation of class stir::CPURayTracer
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/recon_buildblock/CPURayTracer.h"
+#include <cmath>
+#include <algorithm>
+
+START_NAMESPACE_STIR
+
+namespace detail
+{
+  // signed distance function of a voxel with corner at 0 and centre at (cx,cy,cz)
+  // (negative inside the voxel)
+  inline float
+  voxel_sdf(const float x, const float y, const float z,
+            const float cx, const float cy, const float cz)
+  {
+    const float tmp_x = std::fabs(x - cx) - cx;
+    const float tmp_y = std::fabs(y - cy) - cy;
+    const float tmp_z = std::fabs(z - cz) - cz;
+    return std::max(std::max(tmp_x, tmp_y), tmp_z);
+  }
+
+  // floor(x) for x in the range of int.
+  // Compilers do not vectorise std::floor unless trapping math is disabled, but they do vectorise this.
+  inline int
+  floor_to_int(const float x)
+  {
+    const int i = static_cast<int>(x);
+    return i - static_cast<int>(x < static_cast<float>(i));
+  }
+}
+
+CPURayTracer::
+CPURayTracer(const int chunk_size, const int max_num_batches_in_flight)
+  : RayTracerBackend(chunk_size, max_num_batches_in_flight)
+{}
+
+CPURayTracer::
+~CPURayTracer()
+{
+  wait_for_batches_in_flight();
+}
+
+void
+CPURayTracer::
+trace(const Points& points, std::vector<ProjMatrixElemsForOneBinValue>& retval)
+{
+  const int num_points = static_cast<int>(points.size());
+  if (num_points == 0)
+    return;
+
+  std::vector<float> lois(num_points);
+  std::vector<int> voxel_x(num_points), voxel_y(num_points), voxel_z(num_points);
+
+  // use local variables and plain pointers such that the compiler knows there is no aliasing
+  const float vs_x = voxel_size.x();
+  const float vs_y = voxel_size.y();
+  const float vs_z = voxel_size.z();
+  const float centre_x = vs_x/2;
+  const float centre_y = vs_y/2;
+  const float centre_z = vs_z/2;
+  const float * const px = &points.x[0];
+  const float * const py = &points.y[0];
+  const float * const pz = &points.z[0];
+  const float * const rx = &points.ray_x[0];
+  const float * const ry = &points.ray_y[0];
+  const float * const rz = &points.ray_z[0];
+  const float * const norm = &points.norm_const[0];
+  float * const loi = &lois[0];
+  int * const vx = &voxel_x[0];
+  int * const vy = &voxel_y[0];
+  int * const vz = &voxel_z[0];
+
+  // the arrays do not overlap, so tell the compiler it does not need to check this
+#if defined(STIR_OPENMP) && (_OPENMP >= 201307)
+#pragma omp parallel for simd schedule(static)
+#elif defined(__GNUC__)
+#pragma GCC ivdep
+#endif
+  for (int i=0; i<num_points; ++i)
+    {
+      // find the voxel, and the coordinates of the point relative to its corner
+      vx[i] = detail::floor_to_int(px[i] / vs_x);
+      vy[i] = detail::floor_to_int(py[i] / vs_y);
+      vz[i] = detail::floor_to_int(pz[i] / vs_z);
+      const float x = px[i] - static_cast<float>(vx[i]) * vs_x;
+      const float y = py[i] - static_cast<float>(vy[i]) * vs_y;
+      const float z = pz[i] - static_cast<float>(vz[i]) * vs_z;
+
+      // 2 steps of sphere tracing in forward and backward direction
+      float t_fw = 0.F;
+      float t_bw = 0.F;
+      for (int step=0; step<2; ++step)
+        {
+          const float sdf_fw =
+            detail::voxel_sdf(x + t_fw * rx[i], y + t_fw * ry[i], z + t_fw * rz[i],
+                              centre_x, centre_y, centre_z);
+          const float sdf_bw =
+            detail::voxel_sdf(x - t_bw * rx[i], y - t_bw * ry[i], z - t_bw * rz[i],
+                              centre_x, centre_y, centre_z);
+          // the SDF is negative inside the voxel, where we always are
+          t_fw -= std::min(sdf_fw, -0.0001F);
+          t_bw -= std::min(sdf_bw, -0.0001F);
+        }
+
+      loi[i] = norm[i] * (t_fw + t_bw);
+    }
+
+  retval.reserve(retval.size() + num_points);
+  for (int i=0; i<num_points; ++i)
+    retval.push_back(ProjMatrixElemsForOneBinValue(CartesianCoordinate3D<int>(vz[i], vy[i], vx[i]),
+                                                   loi[i]));
+}
+
+END_NAMESPACE_STIR
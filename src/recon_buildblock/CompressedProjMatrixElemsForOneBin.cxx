@@ -0,0 +1,171 @@
+//
+//
+/*!
+
+  \file
+  \ingroup projection
+
+  \brief Implementation of class stir::CompressedProjMatrixElemsForOneBin
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/recon_buildblock/CompressedProjMatrixElemsForOneBin.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/Coordinate3D.h"
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+START_NAMESPACE_STIR
+
+namespace detail
+{
+  // zig-zag encoding maps small negative and positive numbers to small unsigned numbers
+  inline void
+  push_back_varint(std::vector<unsigned char>& buffer, const int value)
+  {
+    unsigned int u =
+      (static_cast<unsigned int>(value) << 1) ^ static_cast<unsigned int>(value >> 31);
+    while (u >= 0x80U)
+      {
+        buffer.push_back(static_cast<unsigned char>(u | 0x80U));
+        u >>= 7;
+      }
+    buffer.push_back(static_cast<unsigned char>(u));
+  }
+
+  inline int
+  read_varint(const unsigned char *& ptr)
+  {
+    unsigned int u = 0;
+    int shift = 0;
+    while (*ptr & 0x80U)
+      {
+        u |= static_cast<unsigned int>(*ptr++ & 0x7FU) << shift;
+        shift += 7;
+      }
+    u |= static_cast<unsigned int>(*ptr++) << shift;
+    return static_cast<int>(u >> 1) ^ -static_cast<int>(u & 1U);
+  }
+}
+
+CompressedProjMatrixElemsForOneBin::
+CompressedProjMatrixElemsForOneBin(const ProjMatrixElemsForOneBin& lor,
+                                   const bool quantise_values)
+  : data(0), data_size(0), num_elements(lor.size()), value_scale(0.F)
+{
+  if (quantise_values)
+    {
+      float max_abs_value = 0.F;
+      for (ProjMatrixElemsForOneBin::const_iterator iter = lor.begin(); iter != lor.end(); ++iter)
+        max_abs_value = std::max(max_abs_value, std::fabs(iter->get_value()));
+      // a scale of 0 means 'floats', so don't quantise if all values are 0
+      if (max_abs_value > 0)
+        value_scale = max_abs_value / 32767.F;
+    }
+
+  std::vector<unsigned char> buffer;
+  buffer.reserve(lor.size() * (value_scale == 0 ? 7 : 5));
+  int previous_c1 = 0, previous_c2 = 0, previous_c3 = 0;
+  for (ProjMatrixElemsForOneBin::const_iterator iter = lor.begin(); iter != lor.end(); ++iter)
+    {
+      detail::push_back_varint(buffer, iter->coord1() - previous_c1);
+      detail::push_back_varint(buffer, iter->coord2() - previous_c2);
+      detail::push_back_varint(buffer, iter->coord3() - previous_c3);
+      previous_c1 = iter->coord1();
+      previous_c2 = iter->coord2();
+      previous_c3 = iter->coord3();
+      if (value_scale == 0)
+        {
+          const float value = iter->get_value();
+          unsigned char bytes[sizeof(float)];
+          std::memcpy(bytes, &value, sizeof(float));
+          buffer.insert(buffer.end(), bytes, bytes + sizeof(float));
+        }
+      else
+        {
+          const short value =
+            static_cast<short>(std::floor(iter->get_value() / value_scale + .5F));
+          const unsigned short u = static_cast<unsigned short>(value);
+          buffer.push_back(static_cast<unsigned char>(u & 0xFFU));
+          buffer.push_back(static_cast<unsigned char>(u >> 8));
+        }
+    }
+
+  // copy to a block of the exact size
+  data_size = buffer.size();
+  if (data_size > 0)
+    {
+      data = new unsigned char[data_size];
+      std::memcpy(data, &buffer[0], data_size);
+    }
+}
+
+CompressedProjMatrixElemsForOneBin::
+~CompressedProjMatrixElemsForOneBin()
+{
+  delete[] data;
+}
+
+void
+CompressedProjMatrixElemsForOneBin::
+decompress(ProjMatrixElemsForOneBin& lor) const
+{
+  lor.erase();
+  lor.reserve(num_elements);
+  const unsigned char * ptr = data;
+  Coordinate3D<int> coords(0,0,0);
+  for (std::size_t i=0; i<num_elements; ++i)
+    {
+      coords[1] += detail::read_varint(ptr);
+      coords[2] += detail::read_varint(ptr);
+      coords[3] += detail::read_varint(ptr);
+      float value;
+      if (value_scale == 0)
+        {
+          std::memcpy(&value, ptr, sizeof(float));
+          ptr += sizeof(float);
+        }
+      else
+        {
+          const unsigned short u =
+            static_cast<unsigned short>(ptr[0] | (static_cast<unsigned short>(ptr[1]) << 8));
+          value = static_cast<short>(u) * value_scale;
+          ptr += 2;
+        }
+      lor.push_back(ProjMatrixElemsForOneBin::value_type(coords, value));
+    }
+  assert(ptr == data + data_size);
+}
+
+std::size_t
+CompressedProjMatrixElemsForOneBin::
+size() const
+{
+  return num_elements;
+}
+
+std::size_t
+CompressedProjMatrixElemsForOneBin::
+get_memory_size() const
+{
+  return sizeof(*this) + data_size;
+}
+
+END_NAMESPACE_STIR
@@ -39,6 +39,7 @@
 #include "stir/ProjData.h"
 #include "stir/DiscretisedDensity.h"
 #include "stir/Succeeded.h"
+#include "stir/PerformanceTrace.h"
 #include "stir/info.h"
 #include "stir/error.h"
 #include <boost/format.hpp>
@@ -128,6 +129,7 @@ forward_project(RelatedViewgrams<float>& viewgrams,
   if (viewgrams.get_num_viewgrams()==0)
     return;
 
+  PerformanceTraceScope trace_scope("forward projection");
   start_timers();
 
   // first check symmetries    
@@ -49,8 +49,10 @@
 #include <complex>
 #include <boost/format.hpp>
 #include "stir/numerics/fourier.h"
-#include "stir/interpolate.h"
 #include "stir/info.h"
+#include "stir/num_threads.h"
+#include "stir/VectorWithOffset.h"
+#include <algorithm>
 
 #define POSITIVE_Z_SHIFT -1
 #define NEGATIVE_Z_SHIFT 1
@@ -124,21 +126,23 @@ rebin()
   start_timers();
   CPUTimer timer;
   timer.start();
+  set_num_threads();
   
   //CON return value 
   Succeeded success = Succeeded::yes;
     
-  //CL Find the number of views and tangential positions power of two
-  int num_views_pow2;
-  for ( num_views_pow2 = 1; num_views_pow2 < 2*proj_data_sptr->get_num_views() && num_views_pow2 < (1<<15); num_views_pow2*=2);
+  //CL Find the number of views in the extended (360 degrees) sinograms and the number of tangential positions power of two
+  //CON The FFT handles any length, so the views do not need to be interpolated to a power of 2.
+  //CON The tangential positions are still zero-padded to a power of 2, as wmin refers to that sampling.
+  const int num_views_extended = 2*proj_data_sptr->get_num_views();
   int num_tang_poss_pow2;
   for ( num_tang_poss_pow2 = 1; num_tang_poss_pow2 < proj_data_sptr->get_num_tangential_poss() && num_tang_poss_pow2 < (1<<15); num_tang_poss_pow2*=2);
   
   //CL Initialise the 2D Fourier transform of all rebinned sinograms P(w,k)=0
    const int num_planes = proj_data_sptr->get_proj_data_info_ptr()->get_scanner_ptr()->get_num_rings()*2-1;
 
-  Array<3,std::complex<float> > FT_rebinned_data(IndexRange3D(0, num_planes-1, 0, num_views_pow2-1, 0, num_tang_poss_pow2-1));
-  Array<3,float> Weights_for_FT_rebinned_data(IndexRange3D(0, num_planes-1, 0,num_views_pow2-1, 0,num_tang_poss_pow2-1));
+  Array<3,std::complex<float> > FT_rebinned_data(IndexRange3D(0, num_planes-1, 0, num_views_extended-1, 0, num_tang_poss_pow2-1));
+  Array<3,float> Weights_for_FT_rebinned_data(IndexRange3D(0, num_planes-1, 0,num_views_extended-1, 0,num_tang_poss_pow2-1));
   //CON some statistics
   PETCount_rebinned num_rebinned(0,0,0);
 
@@ -148,7 +152,7 @@ rebin()
   shared_ptr<ProjDataInfo> rebinned_proj_data_info_sptr
     ( proj_data_sptr->get_proj_data_info_ptr()->clone());
   //CON Adapt the properties that will be modified by the rebinning.
-  rebinned_proj_data_info_sptr->set_num_views(num_views_pow2/2);
+  rebinned_proj_data_info_sptr->set_num_views(num_views_extended/2);
   //CON After rebinning we have of course only "direct" sinograms left e.q only segment 0 exists 
   rebinned_proj_data_info_sptr->reduce_segment_range(0,0);
   //CON maximal ring difference a LOR in the largest segment that is going to be rebinned 
@@ -177,7 +181,7 @@ rebin()
   const float ratio_ring_spacing_to_ring_radius = scanner_space_between_rings / scanner_ring_radius;
 
   //CON Check that the user defineable FORE parameters are inside a possible range of values
-  if(fore_check_parameters(num_tang_poss_pow2,num_views_pow2,max_segment_num_to_process) != Succeeded::yes){
+  if(fore_check_parameters(num_tang_poss_pow2,num_views_extended,max_segment_num_to_process) != Succeeded::yes){
     error("FORE Rebinning :: Setup failed "); 
    };
   
@@ -236,12 +240,9 @@ rebin()
 	  display(segment, segment.find_max(), s);
 	}
 	
-    //CON the sinogramm dimensions need to have a dimension which is a power of 2 (required by the FFT algorithm) 
-    //CON for s (radial coordinate) pad the sinogramm with zeros to form a larger array. 
-    //CON the phi (azimuthal cordinate (view)) coordinate is periodic. The samples need to be interpolated to the
-    //CON to the new matrix size. Do this by linear interpolation.             
+    //CON for s (radial coordinate) the sinogram will be padded with zeros to num_tang_poss_pow2 in do_rebinning.
+    //CON the phi (azimuthal cordinate (view)) coordinate is periodic and is used as is.
     //CON -> DeFrise p. 153 Sec IV.C
-    do_adjust_nb_views_to_pow2(segment);
 
     
     //CON The sinogramm data is now in the required format and ready for rebinning.       
@@ -250,7 +251,7 @@ rebin()
     //CON Weight has the same dimensions. It stores normalisation factors (floats)
     //CON to take into account the variable number of contributions to each frequency.     
     do_rebinning(FT_rebinned_data, Weights_for_FT_rebinned_data, num_rebinned, segment,
-                 num_tang_poss_pow2, num_views_pow2, num_planes, average_ring_difference_in_segment,
+                 num_tang_poss_pow2, num_views_extended, num_planes, average_ring_difference_in_segment,
                  half_distance_between_rings, sampling_distance_in_s, radial_sampling_freq_w, R_field_of_view_mm,
 	         ratio_ring_spacing_to_ring_radius);
   
@@ -265,7 +266,10 @@ rebin()
   //CL now finally fill in the new sinogram s
   SegmentBySinogram<float> sino2D_rebinned = rebinned_proj_data_sptr->get_empty_segment_by_sinogram(0);
 
-  
+  //CON planes are independent, so can be handled in parallel (but not when displaying them)
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic) if (fore_debug_level<3)
+#endif
   for (int plane=FT_rebinned_data.get_min_index();plane <= FT_rebinned_data.get_max_index(); plane++){
    
    if(plane%10==0) info(boost::format("FORE Rebinning :: Inv FFT rebinned z-position (slice) = %1%") % plane);
@@ -277,14 +281,14 @@ rebin()
   //CON the rebinning weights
   //CON before the inv. FFT can be applied this is not much overhead and it can be left like it was done when still 
   //CON using the numerical receipies FFT code.       
-   Array<2, std::complex<float> > FT_rebinned_sinogram(IndexRange2D(0,num_tang_poss_pow2-1,0,num_views_pow2/2));
+   Array<2, std::complex<float> > FT_rebinned_sinogram(IndexRange2D(0,num_tang_poss_pow2-1,0,num_views_extended/2));
   //CON fourier_for_real_data will resize the array to its appropriate dimensions
    Array<2,float> rebinned_sinogram(IndexRange2D(0,1,0,1));
  
   //CON Normalise the rebinned sinograms by applying the weight factors
   //CON See DeFrise IV.D p154.   
  for (int j = 0; j < num_tang_poss_pow2; j++) {    
-   for (int i = 0; i <= num_views_pow2/2; i++) {   
+   for (int i = 0; i <= num_views_extended/2; i++) {   
      const float Actual_Weight = (Weights_for_FT_rebinned_data[plane][i][j] == 0) ? 0 : 
        1.F/(Weights_for_FT_rebinned_data[plane][i][j]);
      FT_rebinned_sinogram[j][i] = FT_rebinned_data[plane][i][j]* Actual_Weight;
@@ -296,12 +300,12 @@ rebin()
     {
       char s[100];
       Array<2,float> real(FT_rebinned_sinogram.get_index_range());
-      for (int i = 0; i < num_views_pow2; i++) 
+      for (int i = 0; i < num_views_extended; i++) 
 	for (int j = 0; j <= num_tang_poss_pow2/2; j++) 
           real[i][j] = FT_rebinned_sinogram[i][j].real();
       sprintf(s, "real part of FT of rebinned (extended) sinogram %d",plane);
       display(real, s, real.find_max());
-      for (int i = 0; i < num_views_pow2; i++) 
+      for (int i = 0; i < num_views_extended; i++) 
 	for (int j = 0; j <= num_tang_poss_pow2/2; j++) 
           real[i][j] = FT_rebinned_sinogram[i][j].imag();
       sprintf(s, "imag part of FT of rebinned (extended) sinogram %d",plane);
@@ -312,7 +316,7 @@ rebin()
     rebinned_sinogram = inverse_fourier_for_real_data(FT_rebinned_sinogram); 
 
    //CL Keep only one half of data [o.._PI]
-    for (int i=0;i<(int)(num_views_pow2/2);i++) 
+    for (int i=0;i<(int)(num_views_extended/2);i++) 
      for (int j=0;j<num_tang_poss_pow2;j++)
         if ((j+sino2D_rebinned.get_min_tangential_pos_num())<=sino2D_rebinned.get_max_tangential_pos_num()) 
           sino2D_rebinned[plane][i][j+sino2D_rebinned.get_min_tangential_pos_num()]=rebinned_sinogram[j][i];
@@ -349,7 +353,7 @@ FourierRebinning::
 do_rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weights_for_FT_rebinned_data,
              PETCount_rebinned &count_rebinned, 
              const SegmentBySinogram<float> &segment, const int num_tang_poss_pow2,
-             const int num_views_pow2, const int num_planes, const float average_ring_difference_in_segment,
+             const int num_views_extended, const int num_planes, const float average_ring_difference_in_segment,
              const float half_distance_between_rings, const float sampling_distance_in_s, 
              const float radial_sampling_freq_w, const float R_field_of_view_mm,
              const float ratio_ring_spacing_to_ring_radius)
@@ -360,35 +364,76 @@ do_rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &We
    const int local_miss= count_rebinned.miss;
    const int local_ssrb= count_rebinned.ssrb;
 
-//CON Loop over all slices, FFT the sinograms and call the actual rebinning kernel.
-   for (int axial_pos_num = segment.get_min_axial_pos_num(); axial_pos_num <= segment.get_max_axial_pos_num() ;axial_pos_num++)   
+   const ProjDataInfo& proj_data_info = *segment.get_proj_data_info_ptr();
+   const int max_k_index = num_views_extended/2;
+   //CON The sinograms are handled in blocks, such that we do not need to keep the FFTs of a whole segment in memory.
+   //CON A block is large enough to keep all threads busy.
+   const int num_sinograms_per_block = std::max(16, 2*get_max_num_threads());
+   //CON Each thread assigns the frequency components of all sinograms in the block for a few ranges of k.
+   const int num_k_indices_per_range = 8;
+   const int num_k_ranges = max_k_index/num_k_indices_per_range + 1;
+
+   for (int first_axial_pos_num = segment.get_min_axial_pos_num();
+        first_axial_pos_num <= segment.get_max_axial_pos_num();
+        first_axial_pos_num += num_sinograms_per_block)
      {
-
-      if(axial_pos_num%10 == 0)  info(boost::format("FORE Rebinning z (slice) = %1%") % axial_pos_num);   
-      Array<2,float> current_sinogram(IndexRange2D(0,num_tang_poss_pow2-1,0,num_views_pow2-1));
+       const int last_axial_pos_num =
+         std::min(first_axial_pos_num + num_sinograms_per_block - 1, segment.get_max_axial_pos_num());
+       VectorWithOffset<Array<2,std::complex<float> > > FT_sinograms(first_axial_pos_num, last_axial_pos_num);
+       VectorWithOffset<float> z_in_mm(first_axial_pos_num, last_axial_pos_num);
+
+//CON Loop over all slices in the block and FFT the sinograms.
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+       for (int axial_pos_num = first_axial_pos_num; axial_pos_num <= last_axial_pos_num; axial_pos_num++)
+         {
+           if(axial_pos_num%10 == 0)  info(boost::format("FORE Rebinning z (slice) = %1%") % axial_pos_num);   
+           Array<2,float> current_sinogram(IndexRange2D(0,num_tang_poss_pow2-1,0,num_views_extended-1));
   
   //CL Calculate the 2D FFT of P(w,k) of the merged segment
   //CON copy the sinogram data of slice axial_pos_num from the segment array to slicedata
   //CON the sinogram is flipped. This will taken account for in the rebinning, where the assignment of the FFT
   //CON coefficients are assigned opposite.
-     for (int j = 0; j < segment.get_num_tangential_poss(); j++) 
-      for (int i = 0; i < num_views_pow2; i++) 
-        current_sinogram[j][i] = segment[axial_pos_num][i][j + segment.get_min_tangential_pos_num()];
+           for (int j = 0; j < segment.get_num_tangential_poss(); j++) 
+             for (int i = 0; i < num_views_extended; i++) 
+               current_sinogram[j][i] = segment[axial_pos_num][i][j + segment.get_min_tangential_pos_num()];
        
   //CON FFT slicedata
-   const Array<2,std::complex<float> > FT_current_sinogram = fourier_for_real_data(current_sinogram);
+           FT_sinograms[axial_pos_num] = fourier_for_real_data(current_sinogram);
 
   //CON determine the axial position of the middle of the LOR in mm relative to Bin(segment=0,view=0,axial_pos=0,tang_pos=0)  
-    const ProjDataInfo& proj_data_info = *segment.get_proj_data_info_ptr();
-    const float z_in_mm = proj_data_info.get_m(Bin(segment.get_segment_num(),0,axial_pos_num,0)) - proj_data_info.get_m(Bin(0,0,0,0));
-
-  //CON Call the rebinning kernel.                                                             
-    rebinning(FT_rebinned_data,Weights_for_FT_rebinned_data,count_rebinned,FT_current_sinogram,
-              z_in_mm, average_ring_difference_in_segment, num_views_pow2,
-              num_tang_poss_pow2,half_distance_between_rings,sampling_distance_in_s,radial_sampling_freq_w,
-              R_field_of_view_mm,ratio_ring_spacing_to_ring_radius);
-
- }//CL End of loop of axial_pos_num
+           z_in_mm[axial_pos_num] =
+             proj_data_info.get_m(Bin(segment.get_segment_num(),0,axial_pos_num,0)) - proj_data_info.get_m(Bin(0,0,0,0));
+         }
+
+  //CON Call the rebinning kernel. Different ranges of k update different elements of FT_rebinned_data,
+  //CON and every element gets the contributions of the sinograms in the same order as in the serial version.
+#ifdef STIR_OPENMP
+#pragma omp parallel
+#endif
+       {
+         PETCount_rebinned count_this_thread(0,0,0);
+#ifdef STIR_OPENMP
+#pragma omp for schedule(static)
+#endif
+         for (int k_range = 0; k_range < num_k_ranges; k_range++)
+           {
+             const int min_k_index = k_range*num_k_indices_per_range;
+             const int max_k_index_in_range = std::min(min_k_index + num_k_indices_per_range - 1, max_k_index);
+             for (int axial_pos_num = first_axial_pos_num; axial_pos_num <= last_axial_pos_num; axial_pos_num++)
+               rebinning(FT_rebinned_data,Weights_for_FT_rebinned_data,count_this_thread,FT_sinograms[axial_pos_num],
+                         z_in_mm[axial_pos_num], average_ring_difference_in_segment, num_views_extended,
+                         num_tang_poss_pow2,half_distance_between_rings,sampling_distance_in_s,radial_sampling_freq_w,
+                         R_field_of_view_mm,ratio_ring_spacing_to_ring_radius,
+                         min_k_index, max_k_index_in_range);
+           }
+#ifdef STIR_OPENMP
+#pragma omp critical(FORE_COUNT)
+#endif
+         count_rebinned += count_this_thread;
+       }
+     }//CL End of loop over blocks of axial_pos_num
      
     if(fore_debug_level > 0){
       info(boost::format("Total rebinned: %1%\n"
@@ -407,9 +452,10 @@ FourierRebinning::
 rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weights_for_FT_rebinned_data,
           PETCount_rebinned &num_rebinned, const Array<2,std::complex<float> > &FT_current_sinogram,
 	  const float z_in_mm, const float delta, 
-          const int num_views_pow2, const int num_tang_poss_pow2, const float half_distance_between_rings, 
+          const int num_views_extended, const int num_tang_poss_pow2, const float half_distance_between_rings, 
 	  const float sampling_distance_in_s, const float radial_sampling_freq_w, const float R_field_of_view_mm, 
-          const float ratio_ring_spacing_to_ring_radius)
+          const float ratio_ring_spacing_to_ring_radius,
+          const int min_k_index, const int max_k_index)
 {
 
  
@@ -429,10 +475,10 @@ rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weigh
   //CON The integer Fourier index "k" corresponds to the azimuthal angle "view"
 
   //CON FORE regime (rebinning)
-  //CON Iterate over all frequency tuples (w,k) starting from wmin,kmin up to num_tang_poss_pow2/2,num_views_pow2/2
+  //CON Iterate over all frequency tuples (w,k) starting from wmin,kmin up to num_tang_poss_pow2/2,num_views_extended/2
 
       for (int j = wmin; j <= num_tang_poss_pow2/2;j++) {
-        for (int i = kmin; i <= num_views_pow2/2; i++) {
+        for (int i = std::max(kmin, min_k_index); i <= std::min(num_views_extended/2, max_k_index); i++) {
 
               float w = static_cast<float>(j) * radial_sampling_freq_w;
               float k = static_cast<float>(i);     
@@ -509,7 +555,7 @@ rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weigh
      //CON and therefore there will be only contributions to one direct sinogram and the weights are therefore always 1. 
     
        for (int j = 0; j < wmin; j++){
-         for (int i = 0; i <= num_views_pow2/2; i++) {
+         for (int i = std::max(0, min_k_index); i <= std::min(num_views_extended/2, max_k_index); i++) {
 	 
 	       for(int shift_direction=POSITIVE_Z_SHIFT;shift_direction<=NEGATIVE_Z_SHIFT;shift_direction+=CHANGE_Z_SHIFT){
 
@@ -535,7 +581,7 @@ rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weigh
 //CL Small k :
 //CL Next treat small k's and w=wNyq=(num_tang_poss_pow2 / 2)+1, k=1..klim :
        for (int j = wmin; j <= num_tang_poss_pow2/2; j++) {
-         for (int i = 0; i <= kmin; i++) {
+         for (int i = std::max(0, min_k_index); i <= std::min(kmin, max_k_index); i++) {
           
                for(int shift_direction=POSITIVE_Z_SHIFT;shift_direction<=NEGATIVE_Z_SHIFT;shift_direction+=CHANGE_Z_SHIFT){
 
@@ -596,41 +642,8 @@ do_display_count(PETCount_rebinned &count)
 }
 
 
-void 
-FourierRebinning::
-do_adjust_nb_views_to_pow2(SegmentBySinogram<float> &segment) 
-{
-// Adjustment of the number of views to a power of two
-//CON Use the STIR overlap_interpolate method and remove the simlar private implementation (adjust_pow2) here.      
-  const int num_views_pow2 = stir::round(pow(2.,((int)ceil(log ((float)segment.get_num_views())/log(2.)))));
-  const float offset_for_overlap_interpolate = 0.F;
-      
-    if (num_views_pow2 == segment.get_num_views()) 
-        return; 
-
-    //CON Create the projection data info ptr for the resized segment
-    shared_ptr<ProjDataInfo> out_proj_data_info_sptr(segment.get_proj_data_info_ptr()->clone());
-    out_proj_data_info_sptr->set_num_views(num_views_pow2);
-    //CON the re-dimensioned segment      
-    SegmentBySinogram<float> out_segment = 
-      out_proj_data_info_sptr->get_empty_segment_by_sinogram(segment.get_segment_num());
-
-    for (int axial_pos_num = segment.get_min_axial_pos_num(); axial_pos_num <= segment.get_max_axial_pos_num();
-             axial_pos_num++) 
-    {
-        const Sinogram<float> sino2D = segment.get_sinogram(axial_pos_num);
-        Sinogram<float> out_sino2D = out_segment.get_sinogram(axial_pos_num);
-      
-        float extension_factor = static_cast<float>(out_sino2D.get_num_views())/ static_cast<float>(sino2D.get_num_views());
-	overlap_interpolate(out_sino2D, sino2D,extension_factor,offset_for_overlap_interpolate,true);
-   
-      out_segment.set_sinogram(out_sino2D);
-    }
-    segment = out_segment;
-}
-
 Succeeded FourierRebinning::
-fore_check_parameters(int num_tang_poss_pow2, int num_views_pow2, int max_segment_num_to_process){
+fore_check_parameters(int num_tang_poss_pow2, int num_views_extended, int max_segment_num_to_process){
 
 //CON Check if the parameters given make sense.
 
@@ -648,20 +661,20 @@ fore_check_parameters(int num_tang_poss_pow2, int num_views_pow2, int max_segmen
  }
 
 
- if(wmin >= num_tang_poss_pow2/2 || kmin >= num_views_pow2/2) {
+ if(wmin >= num_tang_poss_pow2/2 || kmin >= num_views_extended/2) {
    warning(boost::format("FORE initialisation :: The parameter wmin or kmin is larger than the highest frequency component computed by the FFT algorithm\n"
                          "                       Choose an value smaller than the largest frequency\n"
                          "                       kmin must be smaller than %1% and wmin must be smaller than %2%")
-           % (num_tang_poss_pow2/2) % (num_views_pow2/2));
+           % (num_tang_poss_pow2/2) % (num_views_extended/2));
    return Succeeded::no; 
  }
 
 
- if(kc >= num_views_pow2/2) {
+ if(kc >= num_views_extended/2) {
    warning(boost::format("FORE initialisation :: Your parameter kc is larger than the highest frequency component in w (FTT of radial coordinate s)\n"
                          "                       Choose an value smaller than the largest frequency\n"
                          "                       kc must be smaller than %1%") 
-           % num_views_pow2);
+           % num_views_extended);
    return Succeeded::no; 
  } 
 
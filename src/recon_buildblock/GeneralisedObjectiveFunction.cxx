@@ -30,6 +30,7 @@
 #include "stir/DiscretisedDensity.h"
 #include "stir/is_null_ptr.h"
 #include "stir/Succeeded.h"
+#include "stir/PerformanceTrace.h"
 #include "stir/modelling/ParametricDiscretisedDensity.h"
 #include "stir/modelling/KineticParameters.h"
 
@@ -145,6 +146,7 @@ compute_sub_gradient(TargetT& gradient,
 					      subset_num); 
    if (!this->prior_is_zero())
      {
+       PerformanceTraceScope trace_scope("prior");
        shared_ptr<TargetT>  prior_gradient_sptr(gradient.get_empty_copy());
        this->prior_sptr->compute_gradient(*prior_gradient_sptr, current_estimate);
 
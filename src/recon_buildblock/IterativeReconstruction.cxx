@@ -42,6 +42,9 @@
 #include "stir/shared_ptr.h"
 #include "stir/NumericInfo.h"
 #include "stir/utilities.h"
+#include "stir/PerformanceTrace.h"
+#include "stir/info.h"
+#include <boost/format.hpp>
 #include "stir/is_null_ptr.h"
 #include "stir/modelling/ParametricDiscretisedDensity.h"
 #include "stir/modelling/KineticParameters.h"
@@ -78,6 +81,7 @@ IterativeReconstruction<TargetT>::set_defaults()
 //MJ 02/08/99 added subset randomization
   this->randomise_subset_order = false;
   this->report_objective_function_values_interval = 0;
+  this->performance_trace_filename = "";
 
 }
 
@@ -98,6 +102,8 @@ IterativeReconstruction<TargetT>::initialise_keymap()
   this->parser.add_parsing_key("inter-iteration filter type", &inter_iteration_filter_ptr);
   this->parser.add_key("report objective function values interval",
 		       &this->report_objective_function_values_interval);
+  this->parser.add_key("performance trace filename",
+		       &this->performance_trace_filename);
 }
 
 template <typename TargetT>
@@ -251,6 +257,12 @@ IterativeReconstruction<TargetT>::
 get_report_objective_function_values_interval() const
 { return this->report_objective_function_values_interval; }
 
+template <typename TargetT>
+const std::string&
+IterativeReconstruction<TargetT>::
+get_performance_trace_filename() const
+{ return this->performance_trace_filename; }
+
 //************ set_ functions ****************
 template <typename TargetT>
 void
@@ -340,6 +352,14 @@ set_report_objective_function_values_interval(const int arg)
   this->report_objective_function_values_interval = arg;
 }
 
+template <typename TargetT>
+void
+IterativeReconstruction<TargetT>::
+set_performance_trace_filename(const std::string& arg)
+{
+  this->performance_trace_filename = arg;
+}
+
 //************ other functions ****************
 template <typename TargetT>
 IterativeReconstruction<TargetT>::
@@ -426,15 +446,35 @@ reconstruct(shared_ptr<TargetT > const& target_data_sptr)
     }
 #endif
 
-  for(subiteration_num=start_subiteration_num;subiteration_num<=num_subiterations && this->terminate_iterations==false; subiteration_num++)
+  const bool record_performance_trace = !this->performance_trace_filename.empty();
+  if (record_performance_trace)
+    PerformanceTrace::clear();
+
   {
-    std::cout << "now calling update_estimate()\n";
-    this->update_estimate(*target_data_sptr);
-    std::cout << "returned from update_estimate()\n";
+    // disables the trace again at the end of this block, also if an exception is thrown
+    PerformanceTraceEnabledScope trace_enabled_scope(record_performance_trace);
 
-    this->end_of_iteration_processing(*target_data_sptr);
+    for(subiteration_num=start_subiteration_num;subiteration_num<=num_subiterations && this->terminate_iterations==false; subiteration_num++)
+    {
+      PerformanceTrace::set_subiteration_num(subiteration_num);
+      std::cout << "now calling update_estimate()\n";
+      {
+        PerformanceTraceScope trace_scope("update estimate");
+        this->update_estimate(*target_data_sptr);
+      }
+      std::cout << "returned from update_estimate()\n";
+
+      PerformanceTraceScope trace_scope("end of iteration processing");
+      this->end_of_iteration_processing(*target_data_sptr);
+    }
   }
 
+  if (record_performance_trace)
+    {
+      PerformanceTrace::write_to_file(this->performance_trace_filename);
+      info(boost::format("Performance trace written to %1%") % this->performance_trace_filename);
+    }
+
   this->stop_timers();
 
   cerr << "Total CPU Time " << this->get_CPU_timer_value() << "secs"<<endl;
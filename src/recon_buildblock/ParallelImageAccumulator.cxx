@@ -0,0 +1,111 @@
+//
+//
+/*!
+  \file
+  \ingroup projection
+
+  \brief Implementation of class stir::ParallelImageAccumulator and related functions
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/recon_buildblock/ParallelImageAccumulator.h"
+#include "stir/DiscretisedDensity.h"
+#include "stir/num_threads.h"
+#include "stir/is_null_ptr.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
+
+START_NAMESPACE_STIR
+
+ParallelImageAccumulator::
+ParallelImageAccumulator(const DiscretisedDensity<3,float>& template_image,
+                         const int max_num_partial_images_v)
+  : template_image(template_image),
+    num_allocated(0)
+{
+  const int max_num = max_num_partial_images_v > 0 ? max_num_partial_images_v : get_max_num_threads();
+  partial_image_sptrs.resize(max_num);
+  free_indices.reserve(max_num);
+}
+
+int
+ParallelImageAccumulator::
+acquire()
+{
+  int index;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [this]()
+                  { return !free_indices.empty() ||
+                      num_allocated < static_cast<int>(partial_image_sptrs.size()); });
+    if (!free_indices.empty())
+      {
+        index = free_indices.back();
+        free_indices.pop_back();
+        return index;
+      }
+    index = num_allocated++;
+  }
+  // allocate outside of the lock, as this can take a while.
+  // Nobody else uses this element of the vector, so this is safe.
+  partial_image_sptrs[index].reset(template_image.get_empty_copy());
+  return index;
+}
+
+DiscretisedDensity<3,float>&
+ParallelImageAccumulator::
+get_partial_image(const int index)
+{
+  return *partial_image_sptrs[index];
+}
+
+void
+ParallelImageAccumulator::
+release(const int index)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    free_indices.push_back(index);
+  }
+  released.notify_one();
+}
+
+int
+ParallelImageAccumulator::
+get_num_partial_images() const
+{
+  return num_allocated;
+}
+
+void
+ParallelImageAccumulator::
+add_to(DiscretisedDensity<3,float>& image) const
+{
+  if (num_allocated == 0)
+    return;
+  const int min_index = image.get_min_index();
+  const int max_index = image.get_max_index();
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int z=min_index; z<=max_index; ++z)
+    for (int i=0; i<num_allocated; ++i)
+      image[z] += (*partial_image_sptrs[i])[z];
+}
+
+END_NAMESPACE_STIR
@@ -34,7 +34,17 @@
 #include "stir/modelling/ParametricDiscretisedDensity.h"
 #include "stir/modelling/KineticParameters.h"
 #include "stir/info.h"
+#include "stir/warning.h"
+#include "stir/utilities.h"
+#include "stir/fnv1a_hash.h"
 #include "boost/format.hpp"
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <random>
 
 using std::string;
 
@@ -51,6 +61,7 @@ set_defaults()
   this->subsensitivity_filenames = "";  
   this->recompute_sensitivity = false;
   this->use_subset_sensitivities = true;
+  this->sensitivity_cache_directory = "";
   this->subsensitivity_sptrs.resize(0);
 }
 
@@ -65,6 +76,7 @@ initialise_keymap()
   this->parser.add_key("subset sensitivity filenames", &this->subsensitivity_filenames);
   this->parser.add_key("recompute sensitivity", &this->recompute_sensitivity);
   this->parser.add_key("use_subset_sensitivities", &this->use_subset_sensitivities);
+  this->parser.add_key("sensitivity cache directory", &this->sensitivity_cache_directory);
 
 }
 
@@ -95,6 +107,22 @@ get_subsensitivity_filenames() const
   return this->subsensitivity_filenames;
 }
 
+template<typename TargetT>
+std::string
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+get_sensitivity_cache_directory() const
+{
+  return this->sensitivity_cache_directory;
+}
+
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+set_sensitivity_cache_directory(const std::string& directory)
+{
+  this->sensitivity_cache_directory = directory;
+}
+
 template<typename TargetT>
 void
 PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
@@ -309,11 +337,30 @@ set_up(shared_ptr<TargetT> const& target_sptr)
 
   if(this->recompute_sensitivity)
     {
-      info("Computing sensitivity");      
-      // preallocate one such that compute_sensitivities knows the size
-      this->subsensitivity_sptrs[0].reset(target_sptr->get_empty_copy());
-      this->compute_sensitivities();
-      info("Done computing sensitivity");
+      std::string cache_key;
+      if (!this->sensitivity_cache_directory.empty())
+        {
+          cache_key = this->get_full_sensitivity_cache_key(*target_sptr);
+          if (cache_key.empty())
+            warning(boost::format("%1% does not support the sensitivity cache. Ignoring 'sensitivity cache directory'")
+                    % this->get_registered_name());
+        }
+
+      if (!cache_key.empty() &&
+          this->read_sensitivities_from_cache(*target_sptr, cache_key))
+        {
+          info("Using sensitivity from cache");
+        }
+      else
+        {
+          info("Computing sensitivity");      
+          // preallocate one such that compute_sensitivities knows the size
+          this->subsensitivity_sptrs[0].reset(target_sptr->get_empty_copy());
+          this->compute_sensitivities();
+          info("Done computing sensitivity");
+          if (!cache_key.empty())
+            this->write_sensitivities_to_cache(cache_key);
+        }
 
       // write to file
       try
@@ -476,6 +523,175 @@ set_total_or_subset_sensitivities()
 }
 
 
+template<typename TargetT>
+std::string
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+get_sensitivity_cache_key(const TargetT&)
+{
+  return "";
+}
+
+template<typename TargetT>
+std::string
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+get_full_sensitivity_cache_key(const TargetT& target)
+{
+  const std::string derived_key = this->get_sensitivity_cache_key(target);
+  if (derived_key.empty())
+    return "";
+  return
+    boost::str(boost::format("objective function type := %1%\n"
+                             "use subset sensitivities := %2%\n"
+                             "number of subsets := %3%\n")
+               % this->get_registered_name()
+               % this->get_use_subset_sensitivities()
+               % this->get_num_subsets())
+    + derived_key;
+}
+
+template<typename TargetT>
+std::string
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+get_sensitivity_cache_entry_name(const std::string& key) const
+{
+  // the hash of a string is the same on all platforms
+  const std::uint64_t hash = fnv1a_hash(key.data(), key.size());
+  return this->sensitivity_cache_directory + "/sensitivity_" + boost::str(boost::format("%016x") % hash);
+}
+
+template<typename TargetT>
+bool
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+read_sensitivities_from_cache(const TargetT& target, const std::string& key)
+{
+  const std::string entry_name = this->get_sensitivity_cache_entry_name(key);
+  const std::string manifest_filename = entry_name + ".txt";
+  std::ifstream manifest(manifest_filename.c_str());
+  if (!manifest)
+    {
+      info(boost::format("No entry '%1%' in the sensitivity cache") % manifest_filename, 2);
+      return false;
+    }
+
+  // format: number of images, filenames (one per line), key
+  int num_images = 0;
+  manifest >> num_images;
+  manifest.ignore(1);
+  const int expected_num_images = this->get_use_subset_sensitivities() ? this->get_num_subsets() : 1;
+  if (!manifest || num_images != expected_num_images)
+    {
+      warning(boost::format("Sensitivity cache entry '%1%' is corrupt. It will be overwritten.") % manifest_filename);
+      return false;
+    }
+  std::vector<std::string> filenames(num_images);
+  for (int i=0; i<num_images; ++i)
+    std::getline(manifest, filenames[i]);
+  const std::string stored_key((std::istreambuf_iterator<char>(manifest)),
+                               std::istreambuf_iterator<char>());
+  if (stored_key != key)
+    {
+      warning(boost::format("Sensitivity cache entry '%1%' is for different parameters (hash collision). "
+                            "It will be overwritten.") % manifest_filename);
+      return false;
+    }
+
+  std::vector<shared_ptr<TargetT> > images(num_images);
+  try
+    {
+      for (int i=0; i<num_images; ++i)
+        {
+          const std::string filename = this->sensitivity_cache_directory + "/" + filenames[i];
+          info(boost::format("Reading sensitivity from '%1%'") % filename);
+          images[i] = read_from_file<TargetT>(filename);
+          string explanation;
+          if (!target.has_same_characteristics(*images[i], explanation))
+            {
+              warning(boost::format("Sensitivity in cache entry '%1%' does not have the same characteristics "
+                                    "as the target.\n%2%\nIt will be overwritten.")
+                      % manifest_filename % explanation);
+              return false;
+            }
+        }
+    }
+  catch (...)
+    {
+      warning(boost::format("Error reading sensitivity cache entry '%1%'. It will be overwritten.") % manifest_filename);
+      return false;
+    }
+
+  if (this->get_use_subset_sensitivities())
+    {
+      for (int subset_num=0; subset_num<this->num_subsets; ++subset_num)
+        this->subsensitivity_sptrs[subset_num] = images[subset_num];
+    }
+  else
+    {
+      this->sensitivity_sptr = images[0];
+    }
+  this->set_total_or_subset_sensitivities();
+  return true;
+}
+
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+write_sensitivities_to_cache(const std::string& key) const
+{
+  const std::string entry_name = this->get_sensitivity_cache_entry_name(key);
+  const std::string manifest_filename = entry_name + ".txt";
+  // Images are written to names that are unique for this process, and only
+  // become part of the entry when the manifest is renamed below. Images
+  // referred to by an existing manifest are therefore never overwritten while
+  // other processes might read them. (Renaming the images themselves is not
+  // possible in general, as e.g. an Interfile header refers to its data file by name.)
+  std::random_device random_device;
+  const std::string unique_suffix = boost::str(boost::format("_%08x%08x") % random_device() % random_device());
+
+  std::vector<std::string> filenames;
+  try
+    {
+      if (this->get_use_subset_sensitivities())
+        {
+          for (int subset_num=0; subset_num<this->num_subsets; ++subset_num)
+            filenames.push_back(write_to_file(boost::str(boost::format("%1%_%2%%3%") % entry_name % subset_num % unique_suffix),
+                                              this->get_subset_sensitivity(subset_num)));
+        }
+      else
+        {
+          filenames.push_back(write_to_file(entry_name + unique_suffix, this->get_sensitivity()));
+        }
+    }
+  catch (...)
+    {
+      warning(boost::format("Error writing sensitivity to the cache in '%1%'") % this->sensitivity_cache_directory);
+      return;
+    }
+
+  // write the manifest last, and via a temporary file, such that
+  // other processes never see an incomplete entry
+  const std::string tmp_manifest_filename = manifest_filename + unique_suffix;
+  {
+    std::ofstream manifest(tmp_manifest_filename.c_str());
+    manifest << filenames.size() << '\n';
+    for (std::vector<std::string>::const_iterator iter = filenames.begin(); iter != filenames.end(); ++iter)
+      manifest << get_filename(*iter) << '\n';
+    manifest << key;
+    if (!manifest)
+      {
+        warning(boost::format("Error writing sensitivity cache entry '%1%'") % manifest_filename);
+        return;
+      }
+  }
+  // rename() does not overwrite an existing file on all systems
+  std::remove(manifest_filename.c_str());
+  if (std::rename(tmp_manifest_filename.c_str(), manifest_filename.c_str()) != 0)
+    {
+      warning(boost::format("Error writing sensitivity cache entry '%1%'") % manifest_filename);
+      return;
+    }
+  info(boost::format("Stored sensitivity in cache entry '%1%'") % manifest_filename);
+}
+
 template<typename TargetT>
 void
 PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
@@ -212,12 +212,24 @@ compute_sub_gradient_without_penalty_plus_sensitivity(TargetT& gradient,
   this->list_mode_data_sptr->reset();
   double current_time = 0.;
   ProjMatrixElemsForOneBin proj_matrix_row; 
-  shared_ptr<CListRecord> record_sptr = this->list_mode_data_sptr->get_empty_record_sptr(); 
-  CListRecord& record = *record_sptr; 
+  // read records in batches to avoid a virtual function call per record
+  std::vector<shared_ptr<CListRecord> > records(10000);
+  for (std::size_t i=0; i<records.size(); ++i)
+    records[i] = this->list_mode_data_sptr->get_empty_record_sptr();
+  std::size_t num_records_in_batch = 0;
+  std::size_t record_num = 0;
   //  int count_of_events=0;
   //int in_the_range =0;
-  while (this->list_mode_data_sptr->get_next_record(record) == Succeeded::yes) 
+  while (true)
   { 
+    if (record_num == num_records_in_batch)
+      {
+        num_records_in_batch = this->list_mode_data_sptr->get_next_records(records);
+        record_num = 0;
+        if (num_records_in_batch == 0)
+          break; // no more records
+      }
+    CListRecord& record = *records[record_num++];
     //count_of_events++;
     if(record.is_time())
       {
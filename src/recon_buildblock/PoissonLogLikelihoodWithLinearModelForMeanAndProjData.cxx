@@ -42,6 +42,7 @@
 #include "stir/recon_buildblock/DistributedCachingInformation.h"
 #endif
 #include "stir/recon_buildblock/distributable.h"
+#include "stir/recon_buildblock/ParallelImageAccumulator.h"
 // for get_symmetries_ptr()
 #include "stir/DataSymmetriesForViewSegmentNumbers.h"
 // include the following to set defaults
@@ -59,9 +60,15 @@
 #include "stir/Viewgram.h"
 #include "stir/recon_array_functions.h"
 #include "stir/is_null_ptr.h"
+#include "stir/DiscretisedDensityOnCartesianGrid.h"
+#include "stir/stream.h"
+#include "stir/fnv1a_hash.h"
 #include <iostream>
 #include <algorithm>
 #include <sstream>
+#include <vector>
+#include <cstring>
+#include <cstdint>
 #ifdef STIR_MPI
 #include "stir/recon_buildblock/distributed_functions.h"
 #endif
@@ -81,6 +88,24 @@ START_NAMESPACE_STIR
 
 const int rim_truncation_sino = 0; // TODO get rid of this
 
+namespace detail
+{
+  // hash of the values in the viewgrams
+  static std::uint64_t
+  hash_of_viewgrams(const RelatedViewgrams<float>& viewgrams)
+  {
+    std::uint64_t hash = fnv1a_hash_initial_value;
+    for (RelatedViewgrams<float>::const_iterator viewgram_iter = viewgrams.begin();
+         viewgram_iter != viewgrams.end();
+         ++viewgram_iter)
+      for (Viewgram<float>::const_full_iterator iter = viewgram_iter->begin_all_const();
+           iter != viewgram_iter->end_all_const();
+           ++iter)
+        hash = fnv1a_hash(&*iter, sizeof(float), hash);
+    return hash;
+  }
+}
+
 template<typename TargetT>
 const char * const 
 PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>::
@@ -100,6 +125,9 @@ set_defaults()
   //num_views_to_add=1;  
   this->proj_data_sptr.reset(); //MJ added
   this->zero_seg0_end_planes = 0;
+  this->prefetch_depth = 0;
+  this->num_prefetch_threads = 1;
+  this->max_num_partial_images = 0;
 
   this->additive_projection_data_filename = "0";
   this->additive_proj_data_sptr.reset();
@@ -178,6 +206,10 @@ initialise_keymap()
   this->parser.add_key("time frame number", &this->frame_num);
   this->parser.add_parsing_key("Bin Normalisation type", &this->normalisation_sptr);
 
+  this->parser.add_key("number of viewgrams to prefetch", &this->prefetch_depth);
+  this->parser.add_key("number of prefetch threads", &this->num_prefetch_threads);
+  this->parser.add_key("maximum number of partial images", &this->max_num_partial_images);
+
 #ifdef STIR_MPI
   //distributed stuff 
   this->parser.add_key("enable distributed caching", &distributed_cache_enabled);
@@ -222,6 +254,13 @@ post_processing()
   if (this->output_image_size_z!=-1 && this->output_image_size_z<1) // KT 10122001 new
   { error("output image size z must be positive (or -1 as default)"); return true; }
 
+  if (this->prefetch_depth < 0)
+  { warning("number of viewgrams to prefetch should be at least 0"); return true; }
+  if (this->num_prefetch_threads < 1)
+  { warning("number of prefetch threads should be at least 1"); return true; }
+  if (this->max_num_partial_images < 0)
+  { warning("maximum number of partial images should be at least 0"); return true; }
+
 
   if (this->additive_projection_data_filename != "0")
   {
@@ -658,7 +697,9 @@ compute_sub_gradient_without_penalty_plus_sensitivity(TargetT& gradient,
                                  this->zero_seg0_end_planes!=0, 
                                  NULL, 
                                  this->additive_proj_data_sptr 
-                                 , caching_info_ptr
+                                 , caching_info_ptr,
+                                 this->prefetch_depth, this->num_prefetch_threads,
+                                 this->max_num_partial_images
                                  );
   
 
@@ -686,7 +727,9 @@ actual_compute_objective_function_without_penalty(const TargetT& current_estimat
                                          this->normalisation_sptr, 
                                          this->get_time_frame_definitions().get_start_time(this->get_time_frame_num()),
                                          this->get_time_frame_definitions().get_end_time(this->get_time_frame_num()),
-                                         this->caching_info_ptr
+                                         this->caching_info_ptr,
+                                         this->prefetch_depth, this->num_prefetch_threads,
+                                         this->max_num_partial_images
                                          );
                 
     
@@ -741,6 +784,32 @@ add_subset_sensitivity(TargetT& sensitivity, const int subset_num) const
   const int min_segment_num = -this->max_segment_num_to_process;
   const int max_segment_num = this->max_segment_num_to_process;
 
+#ifndef STIR_MPI
+  // distributable_computation() overwrites its output, so use a separate image
+  shared_ptr<TargetT> subset_sensitivity_sptr(sensitivity.get_empty_copy());
+  distributable_compute_sensitivity(this->projector_pair_ptr->get_forward_projector_sptr(), 
+                                    this->projector_pair_ptr->get_back_projector_sptr(), 
+                                    this->symmetries_sptr,
+                                    *subset_sensitivity_sptr,
+                                    this->proj_data_sptr,
+                                    subset_num, this->num_subsets,
+                                    min_segment_num, max_segment_num,
+                                    this->zero_seg0_end_planes != 0,
+                                    this->normalisation_sptr, 
+                                    this->frame_defs.get_start_time(this->frame_num),
+                                    this->frame_defs.get_end_time(this->frame_num),
+                                    this->prefetch_depth, this->num_prefetch_threads,
+                                    this->max_num_partial_images);
+  typename TargetT::full_iterator sens_iter = sensitivity.begin_all();
+  typename TargetT::const_full_iterator subset_sens_iter = subset_sensitivity_sptr->begin_all_const();
+  while (sens_iter != sensitivity.end_all())
+    {
+      *sens_iter += *subset_sens_iter;
+      ++sens_iter; ++subset_sens_iter;
+    }
+#else
+  // the distributed workers cannot compute the sensitivity yet, so do it here
+
   // warning: has to be same as subset scheme used as in distributable_computation
   for (int segment_num = min_segment_num; segment_num <= max_segment_num; ++segment_num)
   {
@@ -759,6 +828,7 @@ add_subset_sensitivity(TargetT& sensitivity, const int subset_num) const
     }
       //    cerr<<timer.value()<<endl;
   }
+#endif
 }
 
 
@@ -795,6 +865,67 @@ add_view_seg_to_sensitivity(TargetT& sensitivity, const ViewSegmentNumbers& view
 }
 
 
+template<typename TargetT>
+std::string
+PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>::
+get_sensitivity_cache_key(const TargetT& target)
+{
+  const DiscretisedDensityOnCartesianGrid<3,float> * const target_on_grid_ptr =
+    dynamic_cast<const DiscretisedDensityOnCartesianGrid<3,float> *>(&target);
+  BasicCoordinate<3,int> min_indices, max_indices;
+  if (is_null_ptr(target_on_grid_ptr) ||
+      !target.get_regular_range(min_indices, max_indices))
+    return "";
+
+  shared_ptr<ProjDataInfo> proj_data_info_sptr(this->proj_data_sptr->get_proj_data_info_ptr()->clone());
+  proj_data_info_sptr->
+    reduce_segment_range(-this->max_segment_num_to_process,
+                         +this->max_segment_num_to_process);
+
+  std::ostringstream key;
+  key << "zero end planes of segment 0 := " << (this->zero_seg0_end_planes != 0) << '\n'
+      << "frame start time := " << this->frame_defs.get_start_time(this->frame_num) << '\n'
+      << "frame end time := " << this->frame_defs.get_end_time(this->frame_num) << '\n'
+      << "image min indices := " << min_indices << '\n'
+      << "image max indices := " << max_indices << '\n'
+      << "image origin := " << target.get_origin() << '\n'
+      << "image grid spacing := " << target_on_grid_ptr->get_grid_spacing() << '\n'
+      << proj_data_info_sptr->parameter_info() << '\n'
+      << this->projector_pair_ptr->ParsingObject::parameter_info()
+      << this->normalisation_sptr->parameter_info();
+
+  // The parameters of the normalisation refer to files (whose content might change)
+  // or are empty when the data are in memory, so they do not identify it.
+  // We therefore add a hash of the normalisation factors (including any
+  // attenuation) of all bins. This is far less work than computing the sensitivity.
+  {
+    const double start_time = this->frame_defs.get_start_time(this->frame_num);
+    const double end_time = this->frame_defs.get_end_time(this->frame_num);
+    const int min_view_num = proj_data_info_sptr->get_min_view_num();
+    const int num_views = proj_data_info_sptr->get_num_views();
+    const int num_view_segments = num_views * proj_data_info_sptr->get_num_segments();
+    std::vector<std::uint64_t> hashes(num_view_segments, 0);
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i=0; i<num_view_segments; ++i)
+      {
+        const ViewSegmentNumbers view_seg_nums(min_view_num + i%num_views,
+                                               proj_data_info_sptr->get_min_segment_num() + i/num_views);
+        if (!this->symmetries_sptr->is_basic(view_seg_nums))
+          continue;
+        RelatedViewgrams<float> viewgrams =
+          this->proj_data_sptr->get_empty_related_viewgrams(view_seg_nums, this->symmetries_sptr);
+        viewgrams.fill(1.F);
+        this->normalisation_sptr->undo(viewgrams, start_time, end_time);
+        hashes[i] = detail::hash_of_viewgrams(viewgrams);
+      }
+    const std::uint64_t hash = fnv1a_hash(&hashes[0], hashes.size()*sizeof(std::uint64_t));
+    key << "\nnormalisation factors hash := " << boost::format("%016x") % hash << '\n';
+  }
+  return key.str();
+}
+
 template<typename TargetT>
 Succeeded
 PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>::
@@ -888,6 +1019,9 @@ static RPC_process_related_viewgrams_type RPC_process_related_viewgrams_gradient
 
 //! Call-back function for accumulate_loglikelihood
 static RPC_process_related_viewgrams_type RPC_process_related_viewgrams_accumulate_loglikelihood;
+
+//! Call-back function for add_subset_sensitivity
+static RPC_process_related_viewgrams_type RPC_process_related_viewgrams_sensitivity;
 #endif
 
 void distributable_compute_gradient(const shared_ptr<ForwardProjectorByBin>& forward_projector_sptr,
@@ -901,7 +1035,9 @@ void distributable_compute_gradient(const shared_ptr<ForwardProjectorByBin>& for
                                     bool zero_seg0_end_planes,
                                     double* log_likelihood_ptr,
                                     shared_ptr<ProjData> const& additive_binwise_correction,
-                                    DistributedCachingInformation* caching_info_ptr
+                                    DistributedCachingInformation* caching_info_ptr,
+                                    const int prefetch_depth, const int num_prefetch_threads,
+                                    const int max_num_partial_images
                                     )
 {
   distributable_computation(forward_projector_sptr,
@@ -916,7 +1052,8 @@ void distributable_compute_gradient(const shared_ptr<ForwardProjectorByBin>& for
                               additive_binwise_correction,
                               /* normalisation info to be ignored */ shared_ptr<BinNormalisation>(), 0., 0.,
                               &RPC_process_related_viewgrams_gradient,
-                              caching_info_ptr
+                              caching_info_ptr,
+                              prefetch_depth, num_prefetch_threads, max_num_partial_images
                               );
 }
 
@@ -935,7 +1072,9 @@ void distributable_accumulate_loglikelihood(
                                             shared_ptr<BinNormalisation> const& normalisation_sptr,
                                             const double start_time_of_frame,
                                             const double end_time_of_frame,
-                                            DistributedCachingInformation* caching_info_ptr
+                                            DistributedCachingInformation* caching_info_ptr,
+                                            const int prefetch_depth, const int num_prefetch_threads,
+                                            const int max_num_partial_images
                                             )
                                             
 {
@@ -953,10 +1092,45 @@ void distributable_accumulate_loglikelihood(
                                     start_time_of_frame,
                                     end_time_of_frame,
                                     &RPC_process_related_viewgrams_accumulate_loglikelihood,
-                                    caching_info_ptr
+                                    caching_info_ptr,
+                                    prefetch_depth, num_prefetch_threads, max_num_partial_images
                                     );
 }
 
+#ifndef STIR_MPI
+void distributable_compute_sensitivity(const shared_ptr<ForwardProjectorByBin>& forward_projector_sptr,
+                                       const shared_ptr<BackProjectorByBin>& back_projector_sptr,
+                                       const shared_ptr<DataSymmetriesForViewSegmentNumbers>& symmetries_sptr,
+                                       DiscretisedDensity<3,float>& sensitivity,
+                                       const shared_ptr<ProjData>& proj_dat,
+                                       int subset_num, int num_subsets,
+                                       int min_segment, int max_segment,
+                                       bool zero_seg0_end_planes,
+                                       shared_ptr<BinNormalisation> const& normalisation_sptr,
+                                       const double start_time_of_frame,
+                                       const double end_time_of_frame,
+                                       const int prefetch_depth, const int num_prefetch_threads,
+                                       const int max_num_partial_images)
+{
+  distributable_computation(forward_projector_sptr,
+                            back_projector_sptr,
+                            symmetries_sptr,
+                            &sensitivity, NULL,
+                            proj_dat, false, //i.e. do not read projection data, but use 1
+                            subset_num, num_subsets,
+                            min_segment, max_segment,
+                            zero_seg0_end_planes,
+                            NULL,
+                            shared_ptr<ProjData>(),
+                            normalisation_sptr,
+                            start_time_of_frame,
+                            end_time_of_frame,
+                            &RPC_process_related_viewgrams_sensitivity,
+                            NULL,
+                            prefetch_depth, num_prefetch_threads, max_num_partial_images);
+}
+#endif
+
 //////////// RPC functions
 
 
@@ -1062,6 +1236,29 @@ void RPC_process_related_viewgrams_accumulate_loglikelihood(
 };      
 
 
+#ifndef STIR_MPI
+void RPC_process_related_viewgrams_sensitivity(
+                                               const shared_ptr<ForwardProjectorByBin>& forward_projector_sptr,
+                                               const shared_ptr<BackProjectorByBin>& back_projector_sptr,
+                                               DiscretisedDensity<3,float>* output_image_ptr,
+                                               const DiscretisedDensity<3,float>* input_image_ptr,
+                                               RelatedViewgrams<float>* measured_viewgrams_ptr,
+                                               int& count, int& count2, double* log_likelihood_ptr,
+                                               const RelatedViewgrams<float>* additive_binwise_correction_ptr,
+                                               const RelatedViewgrams<float>* mult_viewgrams_ptr)
+{
+  assert(output_image_ptr != NULL);
+  assert(measured_viewgrams_ptr != NULL);
+
+  // measured_viewgrams_ptr is filled with 1 (except for zeroed end-planes)
+  if (mult_viewgrams_ptr != NULL)
+    {
+      (*measured_viewgrams_ptr) *= (*mult_viewgrams_ptr);
+    }
+  back_projector_sptr->back_project(*output_image_ptr, *measured_viewgrams_ptr);
+}
+#endif
+
 #  ifdef _MSC_VER
 // prevent warning message on instantiation of abstract class 
 #  pragma warning(disable:4661)
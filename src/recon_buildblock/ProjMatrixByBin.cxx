@@ -32,6 +32,13 @@
 
 #include "stir/recon_buildblock/ProjMatrixByBin.h"
 #include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/recon_buildblock/CompressedProjMatrixElemsForOneBin.h"
+#include "stir/ProjDataInfo.h"
+#include <thread>
+#include <algorithm>
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
 
 // define a local preprocessor symbol to keep code relatively clean
 #ifdef STIR_NO_MUTABLE
@@ -46,6 +53,8 @@ void ProjMatrixByBin::set_defaults()
 {
   cache_disabled=false;
   cache_stores_only_basic_bins=true;
+  max_cache_size=0;
+  cache_quantises_values=false;
 }
 
 void 
@@ -53,17 +62,39 @@ ProjMatrixByBin::initialise_keymap()
 {
   parser.add_key("disable caching", &cache_disabled);
   parser.add_key("store_only_basic_bins_in_cache", &cache_stores_only_basic_bins);
+  parser.add_key("maximum cache size", &max_cache_size);
+  parser.add_key("quantise values in cache", &cache_quantises_values);
 }
 
 bool
 ProjMatrixByBin::post_processing()
 {
+  if (max_cache_size < 0)
+    {
+      warning("ProjMatrixByBin: maximum cache size should be >= 0");
+      return true;
+    }
   return false;
 }
 
 ProjMatrixByBin::ProjMatrixByBin()
+  : cache_min_view_num(0), cache_num_views(0),
+    cache_min_segment_num(0), cache_num_segments(0),
+    cache_min_tangential_pos_num(0), cache_num_tangential_poss(0),
+    cache_access_clock(0), cache_memory_size(0), cache_eviction_in_progress(false)
 { 
   set_defaults();
+#ifdef STIR_OPENMP
+  std::vector<CacheCounters> counters(omp_get_max_threads());
+#else
+  std::vector<CacheCounters> counters(1);
+#endif
+  this->cache_counters.swap(counters);
+}
+
+ProjMatrixByBin::~ProjMatrixByBin()
+{
+  this->clear_cache();
 }
  
 void 
@@ -86,6 +117,26 @@ ProjMatrixByBin::
 does_cache_store_only_basic_bins() const
 { return cache_stores_only_basic_bins; }
 
+void
+ProjMatrixByBin::
+set_maximum_cache_size(const std::size_t size)
+{ max_cache_size = static_cast<double>(size); }
+
+std::size_t
+ProjMatrixByBin::
+get_maximum_cache_size() const
+{ return static_cast<std::size_t>(max_cache_size); }
+
+void
+ProjMatrixByBin::
+quantise_values_in_cache(const bool v)
+{ cache_quantises_values = v; }
+
+std::size_t
+ProjMatrixByBin::
+get_cache_memory_size() const
+{ return cache_memory_size.load(); }
+
 void 
 ProjMatrixByBin::
 clear_cache() STIR_MUTABLE_CONST
@@ -93,19 +144,167 @@ clear_cache() STIR_MUTABLE_CONST
 #ifdef STIR_OPENMP
 #pragma omp critical(PROJMATRIXBYBINCLEARCACHE)
 #endif
-  for (int i=this->cache_collection.get_min_index();
-       i<=this->cache_collection.get_max_index();
-       ++i)
+  for (int view_num=this->cache_min_view_num;
+       view_num<this->cache_min_view_num+this->cache_num_views;
+       ++view_num)
+    this->delete_view_from_cache(view_num, /*wait_for_users=*/ false);
+}
+
+void
+ProjMatrixByBin::
+delete_view_from_cache(const int view_num, const bool wait_for_users) const
+{
+  const std::size_t first_index =
+    static_cast<std::size_t>(view_num - this->cache_min_view_num) * this->cache_num_segments;
+  // first make the slots unreachable for other threads
+  std::vector<CacheSlot *> all_slots(this->cache_num_segments);
+  for (int segment_index=0; segment_index<this->cache_num_segments; ++segment_index)
+    all_slots[segment_index] = this->cache_collection[first_index + segment_index].exchange(0);
+  // threads that started using them before can still be reading, so wait for them
+  if (wait_for_users)
+    while (this->view_cache_info[view_num - this->cache_min_view_num].num_users.load() != 0)
+      std::this_thread::yield();
+
+  std::size_t freed_memory = 0;
+  for (int segment_index=0; segment_index<this->cache_num_segments; ++segment_index)
+    {
+      CacheSlot * const slots = all_slots[segment_index];
+      if (slots == 0)
+        continue;
+      const int num_slots =
+        this->cache_num_axial_poss[this->cache_min_segment_num + segment_index] *
+        this->cache_num_tangential_poss;
+      for (int j=0; j<num_slots; ++j)
+        {
+          CompressedProjMatrixElemsForOneBin * const elems_ptr = slots[j].load();
+          if (elems_ptr != 0)
+            {
+              freed_memory += elems_ptr->get_memory_size();
+              delete elems_ptr;
+            }
+        }
+      delete[] slots;
+      freed_memory += num_slots * sizeof(CacheSlot);
+    }
+  this->cache_memory_size -= freed_memory;
+}
+
+void
+ProjMatrixByBin::
+evict_from_cache(const int view_num_to_keep) const
+{
+  bool expected = false;
+  if (!this->cache_eviction_in_progress.compare_exchange_strong(expected, true))
+    return;
+
+  // evict until we are 10% below the maximum to avoid evicting on every insertion
+  const std::size_t target_size = static_cast<std::size_t>(this->max_cache_size * .9);
+  while (this->cache_memory_size.load() > target_size)
     {
-      for (int j=this->cache_collection[i].get_min_index();
-           j<=this->cache_collection[i].get_max_index();
-           ++j)
+      // find least recently used view that has some rows cached
+      int lru_view_num = view_num_to_keep;
+      unsigned long lru_last_access = 0;
+      for (int view_num=this->cache_min_view_num;
+           view_num<this->cache_min_view_num+this->cache_num_views;
+           ++view_num)
         {
-          this->cache_collection[i][j].clear();
+          if (view_num == view_num_to_keep)
+            continue;
+          const unsigned long last_access =
+            this->view_cache_info[view_num - this->cache_min_view_num].last_access.load(std::memory_order_relaxed);
+          if (lru_view_num != view_num_to_keep && last_access >= lru_last_access)
+            continue;
+          const std::size_t first_index =
+            static_cast<std::size_t>(view_num - this->cache_min_view_num) * this->cache_num_segments;
+          for (int segment_index=0; segment_index<this->cache_num_segments; ++segment_index)
+            if (this->cache_collection[first_index + segment_index].load(std::memory_order_relaxed) != 0)
+              {
+                lru_view_num = view_num;
+                lru_last_access = last_access;
+                break;
+              }
         }
+      if (lru_view_num == view_num_to_keep)
+        break; // nothing left to evict
+      this->delete_view_from_cache(lru_view_num, /*wait_for_users=*/ true);
+    }
+
+  this->cache_eviction_in_progress = false;
+}
+
+void
+ProjMatrixByBin::
+start_using_view_cache(const int view_num) const
+{
+  ViewCacheInfo& info = this->view_cache_info[view_num - this->cache_min_view_num];
+  // Note: this has to be sequentially consistent with the exchange in delete_view_from_cache
+  info.num_users.fetch_add(1);
+  info.last_access.store(this->cache_access_clock.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+}
+
+void
+ProjMatrixByBin::
+stop_using_view_cache(const int view_num) const
+{
+  this->view_cache_info[view_num - this->cache_min_view_num].num_users.fetch_sub(1, std::memory_order_release);
+}
+
+unsigned long
+ProjMatrixByBin::
+get_num_cache_hits() const
+{
+  unsigned long sum = 0;
+  for (std::size_t i=0; i<this->cache_counters.size(); ++i)
+    sum += this->cache_counters[i].num_hits;
+  return sum;
+}
+
+unsigned long
+ProjMatrixByBin::
+get_num_cache_misses() const
+{
+  unsigned long sum = 0;
+  for (std::size_t i=0; i<this->cache_counters.size(); ++i)
+    sum += this->cache_counters[i].num_misses;
+  return sum;
+}
+
+unsigned long
+ProjMatrixByBin::
+get_num_cache_collisions() const
+{
+  unsigned long sum = 0;
+  for (std::size_t i=0; i<this->cache_counters.size(); ++i)
+    sum += this->cache_counters[i].num_collisions;
+  return sum;
+}
+
+void
+ProjMatrixByBin::
+reset_cache_counters() STIR_MUTABLE_CONST
+{
+  for (std::size_t i=0; i<this->cache_counters.size(); ++i)
+    {
+      this->cache_counters[i].num_hits = 0;
+      this->cache_counters[i].num_misses = 0;
+      this->cache_counters[i].num_collisions = 0;
     }
 }
 
+ProjMatrixByBin::CacheCounters&
+ProjMatrixByBin::
+get_cache_counters() const
+{
+#ifdef STIR_OPENMP
+  // omp_get_max_threads() might have been increased since construction. Counters are atomic,
+  // so sharing them between threads is safe (although slower).
+  return this->cache_counters[omp_get_thread_num() % this->cache_counters.size()];
+#else
+  return this->cache_counters[0];
+#endif
+}
+
 /*
 void  
 ProjMatrixByBin::
@@ -129,45 +328,101 @@ set_up(
 
   const int min_view_num = proj_data_info_sptr->get_min_view_num();
   const int max_view_num = proj_data_info_sptr->get_max_view_num();
+  // Basic bins can be outside the range of the projection data
+  // (e.g. tangential_pos_num ranging from -128 to 127). The ranges used below take into account
+  // that symmetries convert negative segment_num and tangential_pos_num to positive,
+  // and normally bring axial_pos_num back to 0 or 1.
   const int min_segment_num = proj_data_info_sptr->get_min_segment_num();
-  const int max_segment_num = proj_data_info_sptr->get_max_segment_num();
-
-  this->cache_collection.recycle();
-  this->cache_collection.resize(min_view_num, max_view_num);
-#ifdef STIR_OPENMP
-  this->cache_locks.recycle();
-  this->cache_locks.resize(min_view_num, max_view_num);
-#endif
-
-  for (int view_num=min_view_num; view_num<=max_view_num; ++view_num)
+  const int max_segment_num =
+    std::max(proj_data_info_sptr->get_max_segment_num(), -min_segment_num);
+  const int min_tangential_pos_num = proj_data_info_sptr->get_min_tangential_pos_num();
+  const int max_tangential_pos_num =
+    std::max(proj_data_info_sptr->get_max_tangential_pos_num(), -min_tangential_pos_num);
+
+  this->clear_cache();
+  this->reset_cache_counters();
+  this->cache_memory_size = 0;
+  this->cache_access_clock = 0;
+
+  this->cache_min_view_num = min_view_num;
+  this->cache_num_views = max_view_num - min_view_num + 1;
+  this->cache_min_segment_num = min_segment_num;
+  this->cache_num_segments = max_segment_num - min_segment_num + 1;
+  this->cache_min_tangential_pos_num = min_tangential_pos_num;
+  this->cache_num_tangential_poss = max_tangential_pos_num - min_tangential_pos_num + 1;
+  this->cache_min_axial_pos_num.recycle();
+  this->cache_min_axial_pos_num.resize(min_segment_num, max_segment_num);
+  this->cache_num_axial_poss.recycle();
+  this->cache_num_axial_poss.resize(min_segment_num, max_segment_num);
+  for (int segment_num=min_segment_num; segment_num<=max_segment_num; ++segment_num)
     {
-      this->cache_collection[view_num].resize(min_segment_num, max_segment_num);
-#ifdef STIR_OPENMP
-      this->cache_locks[view_num].resize(min_segment_num, max_segment_num);
-      for (int seg_num = min_segment_num; seg_num <=max_segment_num; ++seg_num)
-        omp_init_lock(&this->cache_locks[view_num][seg_num]);
-#endif
+      const int segment_num_in_data =
+        segment_num <= proj_data_info_sptr->get_max_segment_num() ? segment_num : -segment_num;
+      const int min_axial_pos_num =
+        std::min(0, proj_data_info_sptr->get_min_axial_pos_num(segment_num_in_data));
+      const int max_axial_pos_num =
+        std::max(1, proj_data_info_sptr->get_max_axial_pos_num(segment_num_in_data));
+      this->cache_min_axial_pos_num[segment_num] = min_axial_pos_num;
+      this->cache_num_axial_poss[segment_num] = max_axial_pos_num - min_axial_pos_num + 1;
     }
+
+  // slots for every view/segment combination will be allocated when first used
+  std::vector<std::atomic<CacheSlot *> >
+    cache_collection_tmp(static_cast<std::size_t>(this->cache_num_views) * this->cache_num_segments);
+  for (std::size_t i=0; i<cache_collection_tmp.size(); ++i)
+    cache_collection_tmp[i] = 0;
+  this->cache_collection.swap(cache_collection_tmp);
+  std::vector<ViewCacheInfo> view_cache_info_tmp(this->cache_num_views);
+  this->view_cache_info.swap(view_cache_info_tmp);
 }
 
 
-/*!
-    \warning Preconditions
-    <li>abs(axial_pos_num) fits in 17 bits
-    <li>abs(tangential_pos_num) fits in 11 bits   
-  */
-ProjMatrixByBin::CacheKey
-ProjMatrixByBin::cache_key(const Bin& bin) const
+ProjMatrixByBin::CacheSlot *
+ProjMatrixByBin::
+find_cache_slot(const Bin& bin, const bool allocate) const
 {
-  assert(static_cast<boost::uint32_t>(abs(bin.axial_pos_num())) < (static_cast<boost::uint32_t>(1)<<18));
-  assert(abs(bin.tangential_pos_num()) < (1<<12));
-  return (CacheKey)( 
-                    (static_cast<boost::uint32_t>(bin.axial_pos_num()>=0?0:1) << 31)
-                    | (static_cast<boost::uint32_t>(bin.axial_pos_num())<<13) 
-                    | (static_cast<boost::uint32_t>(bin.tangential_pos_num()>=0?0:1) << 12)
-                    |  static_cast<boost::uint32_t>(abs(bin.tangential_pos_num())) );    	
-} 
-
+  const int view_index = bin.view_num() - this->cache_min_view_num;
+  const int segment_index = bin.segment_num() - this->cache_min_segment_num;
+  if (view_index < 0 || view_index >= this->cache_num_views ||
+      segment_index < 0 || segment_index >= this->cache_num_segments)
+    return 0;
+  const int axial_pos_index = 
+    bin.axial_pos_num() - this->cache_min_axial_pos_num[bin.segment_num()];
+  const int tangential_pos_index = 
+    bin.tangential_pos_num() - this->cache_min_tangential_pos_num;
+  const int num_axial_poss = this->cache_num_axial_poss[bin.segment_num()];
+  if (axial_pos_index < 0 || axial_pos_index >= num_axial_poss ||
+      tangential_pos_index < 0 || tangential_pos_index >= this->cache_num_tangential_poss)
+    return 0;
+
+  std::atomic<CacheSlot *>& slots_for_view_segment = 
+    this->cache_collection[static_cast<std::size_t>(view_index) * this->cache_num_segments + segment_index];
+  // Note: sequentially consistent such that it is ordered with start_using_view_cache()
+  CacheSlot * slots = slots_for_view_segment.load();
+  if (slots == 0)
+    {
+      if (!allocate)
+        return 0;
+      const int num_slots = num_axial_poss * this->cache_num_tangential_poss;
+      CacheSlot * const new_slots = new CacheSlot[num_slots];
+      for (int i=0; i<num_slots; ++i)
+        new_slots[i].store(0, std::memory_order_relaxed);
+      if (slots_for_view_segment.compare_exchange_strong(slots, new_slots,
+                                                         std::memory_order_acq_rel,
+                                                         std::memory_order_acquire))
+        {
+          slots = new_slots;
+          this->cache_memory_size += num_slots * sizeof(CacheSlot);
+        }
+      else
+        {
+          // another thread allocated them first. slots now points to its array.
+          delete[] new_slots;
+          get_cache_counters().num_collisions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+  return slots + (axial_pos_index * this->cache_num_tangential_poss + tangential_pos_index);
+}
 
 void  
 ProjMatrixByBin::
@@ -176,17 +431,43 @@ cache_proj_matrix_elems_for_one_bin(
 { 
   if ( cache_disabled ) return;
   
-  //std::cerr << "cached lor size " << probabilities.size() << " capacity " << probabilities.capacity() << std::endl;    
-  // insert probabilities into the collection	
   const Bin bin = probabilities.get_bin();
-#ifdef STIR_OPENMP
-  omp_set_lock(&this->cache_locks[bin.view_num()][bin.segment_num()]);
-#endif
-  cache_collection[bin.view_num()][bin.segment_num()].insert(MapProjMatrixElemsForOneBin::value_type( cache_key(bin), 
-                                                                                                      probabilities));  
-#ifdef STIR_OPENMP
-  omp_unset_lock(&this->cache_locks[bin.view_num()][bin.segment_num()]);
-#endif
+  const bool has_max_size = this->max_cache_size > 0;
+  if (has_max_size)
+    {
+      if (bin.view_num() < this->cache_min_view_num ||
+          bin.view_num() >= this->cache_min_view_num + this->cache_num_views)
+        return;
+      this->cache_access_clock.fetch_add(1, std::memory_order_relaxed);
+      this->start_using_view_cache(bin.view_num());
+    }
+
+  CacheSlot * const slot_ptr = find_cache_slot(bin, /*allocate=*/ true);
+  if (slot_ptr != 0)
+    {
+      // insert probabilities into the collection, unless another thread did this already
+      CompressedProjMatrixElemsForOneBin * const new_elems =
+        new CompressedProjMatrixElemsForOneBin(probabilities, this->cache_quantises_values);
+      CompressedProjMatrixElemsForOneBin * expected = 0;
+      if (slot_ptr->compare_exchange_strong(expected, new_elems,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed))
+        {
+          this->cache_memory_size += new_elems->get_memory_size();
+        }
+      else
+        {
+          delete new_elems;
+          get_cache_counters().num_collisions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+  if (has_max_size)
+    {
+      this->stop_using_view_cache(bin.view_num());
+      if (this->cache_memory_size.load(std::memory_order_relaxed) > this->max_cache_size)
+        this->evict_from_cache(bin.view_num());
+    }
 }
 
 
@@ -210,37 +491,34 @@ get_cached_proj_matrix_elems_for_one_bin(
   }
 #endif         
   
-  bool found=false;
-#ifdef STIR_OPENMP
-  omp_set_lock(&this->cache_locks[bin.view_num()][bin.segment_num()]);
-#endif
+  const bool has_max_size = this->max_cache_size > 0;
+  if (has_max_size)
+    {
+      if (bin.view_num() < this->cache_min_view_num ||
+          bin.view_num() >= this->cache_min_view_num + this->cache_num_views)
+        return Succeeded::no;
+      this->start_using_view_cache(bin.view_num());
+    }
 
-  {
-    const_MapProjMatrixElemsForOneBinIterator pos = 
-      cache_collection[bin.view_num()][bin.segment_num()].find(cache_key( bin));
-  
-    if ( pos != cache_collection[bin.view_num()][bin.segment_num()]. end())
-      { 
-	//cout << Key << " =========>> entry found in cache " <<  endl;
-	probabilities = pos->second;
-	// note: cannot return from inside an OPENMP critical section
-	//return Succeeded::yes;	
-	found=true;
-      } 
-  }
-#ifdef STIR_OPENMP
-  omp_unset_lock(&this->cache_locks[bin.view_num()][bin.segment_num()]);
-#endif
-  if (found)
-    return Succeeded::yes;	
+  const CacheSlot * const slot_ptr = find_cache_slot(bin, /*allocate=*/ false);
+  const CompressedProjMatrixElemsForOneBin * const elems_ptr =
+    slot_ptr == 0 ? 0 : slot_ptr->load(std::memory_order_acquire);
+  if (elems_ptr != 0)
+    elems_ptr->decompress(probabilities);
+
+  if (has_max_size)
+    this->stop_using_view_cache(bin.view_num());
+
+  if (elems_ptr != 0)
+    {
+      get_cache_counters().num_hits.fetch_add(1, std::memory_order_relaxed);
+      return Succeeded::yes;
+    }
   else
     {
-      //cout << " This entry  is not in the cache :" << Key << endl;	
+      get_cache_counters().num_misses.fetch_add(1, std::memory_order_relaxed);
       return Succeeded::no;
     }
-  
-  
-  //return Succeeded::no;
 }
 
 
@@ -1,7 +1,7 @@
 /*
     Copyright (C) 2004 - 2008, Hammersmith Imanet Ltd
     Copyright (C) 2011 - 2012, Kris Thielemans
-    Copyright (C) 2014, University College London
+    Copyright (C) 2014, 2018, University College London
     This file is part of STIR.
 
     This file is free software; you can redistribute it and/or modify
@@ -45,9 +45,20 @@
 #include "boost/cstdint.hpp"
 #include "boost/scoped_ptr.hpp"
 #include <fstream>
+#include <sstream>
 #include <algorithm>
+#include <cstring>
+
+#ifdef HAVE_SYSTEM_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using std::string;
+using std::vector;
 
 START_NAMESPACE_STIR
 
@@ -58,10 +69,17 @@ ProjMatrixByBinFromFile::registered_name =
 
 ProjMatrixByBinFromFile::
 ProjMatrixByBinFromFile()
+  : mapped_data_ptr(0), mapped_size(0)
 {
   set_defaults();
 }
 
+ProjMatrixByBinFromFile::
+~ProjMatrixByBinFromFile()
+{
+  close_indexed_data();
+}
+
 void 
 ProjMatrixByBinFromFile::
 initialise_keymap()
@@ -111,9 +129,9 @@ ProjMatrixByBinFromFile::post_processing()
   if (ProjMatrixByBin::post_processing() == true)
     return true;
 
-  if (this->parsed_version != "1.0")
+  if (this->parsed_version != "1.0" && this->parsed_version != "2.0")
     { 
-      warning("version has to be 1.0");
+      warning("version has to be 1.0 or 2.0");
       return true;
     }
   this->symmetries_type = standardise_interfile_keyword(this->symmetries_type);
@@ -233,35 +251,58 @@ set_up(
   }
 
   // note: currently setting up with proj_data_info stored in the file
-  // even though it's potentially larger. This is because we currently store
+  // even though it's potentially larger. This is because for Version 1.0 we store
   // every LOR that's in the file in the cache
   ProjMatrixByBin::set_up(this->proj_data_info_ptr, density_info_ptr);
 
-  if (read_data() ==Succeeded::no)
-    error("Something wrong reading the matrix from file. Exiting.");
+  if (this->parsed_version == "1.0")
+    {
+      close_indexed_data();
+      if (read_data() ==Succeeded::no)
+        error("Something wrong reading the matrix from file. Exiting.");
+    }
+  else
+    {
+      // LORs will be read when needed
+      if (open_indexed_data() ==Succeeded::no)
+        error("Something wrong reading the index of the matrix file %s. Exiting.",
+              data_filename.c_str());
+    }
 }
 
 // anonymous namespace for local functions
 namespace {
 
-  // static (i.e. private) function to write the data
+  // layout of Version 2.0 files (see the class documentation)
+  const char indexed_file_magic[8] = { 'S', 'T', 'I', 'R', 'P', 'M', '2', '0' };
+  const boost::uint32_t byte_order_mark = 0x01020304U;
+  const std::size_t file_header_size = 32;
+  const std::size_t index_entry_size = 16;
+  const std::size_t lor_entry_size = 24;
+  const std::size_t element_size = 10;
+
+  // write the bytes of a value
+  template <class T>
+  inline void
+  write_value(std::ostream& s, const T value)
+  {
+    s.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  // read a value from (possibly unaligned) memory
+  template <class T>
+  inline T
+  read_value(const char * const ptr)
+  {
+    T value;
+    std::memcpy(&value, ptr, sizeof(T));
+    return value;
+  }
+
+  // static (i.e. private) function to write the elements of an lor (but not its bin)
   static Succeeded
-  write_lor(std::ostream&fst, const ProjMatrixElemsForOneBin& lor) 
+  write_lor_elements(std::ostream&fst, const ProjMatrixElemsForOneBin& lor) 
   {  
-    const Bin bin = lor.get_bin();
-    {
-      boost::int32_t c;
-      c = bin.segment_num(); fst.write ( (char*)&c, sizeof(boost::int32_t));
-      c = bin.view_num(); fst.write ( (char*)&c, sizeof(boost::int32_t));
-      c = bin.axial_pos_num(); fst.write ( (char*)&c, sizeof(boost::int32_t));
-      c = bin.tangential_pos_num(); fst.write ( (char*)&c, sizeof(boost::int32_t));
-    }
-    {
-      boost::uint32_t c= static_cast<boost::uint32_t>(lor.size());
-      fst.write( (char*)&c , sizeof(boost::uint32_t));  
-    }
-    if (!fst)
-      return Succeeded::no;
     ProjMatrixElemsForOneBin::const_iterator element_ptr = lor.begin();
     // todo add compression in this loop 
     while (element_ptr != lor.end())
@@ -281,8 +322,39 @@ namespace {
 	++element_ptr;
       } 
     return Succeeded::yes;
+  }
+
+  // static (i.e. private) function to write the data (Version 1.0)
+  static Succeeded
+  write_lor(std::ostream&fst, const ProjMatrixElemsForOneBin& lor) 
+  {  
+    const Bin bin = lor.get_bin();
+    {
+      boost::int32_t c;
+      c = bin.segment_num(); fst.write ( (char*)&c, sizeof(boost::int32_t));
+      c = bin.view_num(); fst.write ( (char*)&c, sizeof(boost::int32_t));
+      c = bin.axial_pos_num(); fst.write ( (char*)&c, sizeof(boost::int32_t));
+      c = bin.tangential_pos_num(); fst.write ( (char*)&c, sizeof(boost::int32_t));
+    }
+    {
+      boost::uint32_t c= static_cast<boost::uint32_t>(lor.size());
+      fst.write( (char*)&c , sizeof(boost::uint32_t));  
+    }
+    if (!fst)
+      return Succeeded::no;
+    return write_lor_elements(fst, lor);
   } 
 
+  // order in which LORs are stored in a block of a Version 2.0 file
+  static bool
+  bin_is_stored_before(const Bin& bin1, const Bin& bin2)
+  {
+    return
+      bin1.axial_pos_num() < bin2.axial_pos_num() ||
+      (bin1.axial_pos_num() == bin2.axial_pos_num() &&
+       bin1.tangential_pos_num() < bin2.tangential_pos_num());
+  }
+
   // return type for read_lor()
   class readReturnType
   {
@@ -356,8 +428,15 @@ ProjMatrixByBinFromFile::
 write_to_file(const std::string& output_filename_prefix, 
 	      const ProjMatrixByBin& proj_matrix,
 	      const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
-	      const DiscretisedDensity<3,float>& template_density)
+	      const DiscretisedDensity<3,float>& template_density,
+	      const std::string& version)
 {
+  if (version != "1.0" && version != "2.0")
+    {
+      warning("ProjMatrixByBinFromFile::write_to_file: version has to be 1.0 or 2.0");
+      return Succeeded::no;
+    }
+  const bool write_index = version == "2.0";
 
   string template_density_filename =
     output_filename_prefix + "_template_density";
@@ -378,6 +457,8 @@ write_to_file(const std::string& output_filename_prefix,
     ProjDataInterfile template_projdata(exam_info_sptr, 
 					proj_data_info_sptr,
 					template_proj_data_filename);
+    // ProjDataInterfile has added the extensions, but we need the name of the header
+    replace_extension(template_proj_data_filename, ".hs");
   }
 
   string header_filename = output_filename_prefix;
@@ -395,7 +476,7 @@ write_to_file(const std::string& output_filename_prefix,
       }
 
     header << "Projection Matrix By Bin From File Parameters:=\n"
-	   << "Version := 1.0\n";
+	   << "Version := " << version << '\n';
     // TODO symmetries should not be hard-coded
     if (!is_null_ptr(dynamic_cast<const DataSymmetriesForBins_PET_CartesianGrid * const>(proj_matrix.get_symmetries_ptr())))
       {
@@ -431,25 +512,32 @@ write_to_file(const std::string& output_filename_prefix,
     header << "End Projection Matrix By Bin From File Parameters:=";
   }
 
-  std::ofstream fst;
-  open_write_binary(fst, data_filename.c_str());
-  
-  // loop over bins
+  // loop over bins to find all basic bins, sorted per (segment,view).
   // the complication here is that we cannot just test if each bin in the range is 'basic'
   // and write only those. The reason is that symmetry operations can construct a
   // 'basic' bin outside of the input range (e.g. for tangential_pos_num ranging from -128 to 127).
   // So, we can only loop over all bins, convert to basic bins, and write those.
-  // The complication is then that we need to keep track which one we wrote already.
+  // The complication is then that we need to keep track which one we found already.
   // Originally, I did this via a std::list<Bin>. Checking if a bin was already written
   // is terribly slow however. Instead, I currently use a vector of shared_ptrs.
   // This wastes only a little bit of memory, but the bounds are difficult to 
   // determine in general.
   // A better approach (and simpler) would be to have access to the internal cache of the 
   // projection matrix.
-  {
-    // defined here to avoid reallocation for every bin
-    ProjMatrixElemsForOneBin lor;
 
+  // range of the index. upper boundary takes into account that symmetries convert negative segment_num to positive
+  const int min_segment_num = proj_data_info_sptr->get_min_segment_num();
+  const int max_segment_num = 
+    std::max(proj_data_info_sptr->get_max_segment_num(),
+             -proj_data_info_sptr->get_min_segment_num());
+  const int min_view_num = proj_data_info_sptr->get_min_view_num();
+  const int max_view_num = proj_data_info_sptr->get_max_view_num();
+  const int num_views = max_view_num - min_view_num + 1;
+  const int num_blocks = (max_segment_num - min_segment_num + 1) * num_views;
+
+  // basic bins for every (segment,view), ordered as in the index
+  vector<vector<Bin> > basic_bins(num_blocks);
+  {
 #if 0
     std::list<Bin> already_processed;
 #else
@@ -458,11 +546,8 @@ write_to_file(const std::string& output_filename_prefix,
     typedef VectorWithOffset<shared_ptr<vpos_t> > apos_t;
     typedef VectorWithOffset<shared_ptr<apos_t> > spos_t;
 
-    // vector that will contain (vectors of bools) to check if we wrote a bin already or not
-    // upper boundary takes into account that symmetries convert negative segment_num to positive
-    spos_t already_processed(proj_data_info_sptr->get_min_segment_num(), 
-			     std::max(proj_data_info_sptr->get_max_segment_num(),
-				      -proj_data_info_sptr->get_min_segment_num())); 
+    // vector that will contain (vectors of bools) to check if we found a bin already or not
+    spos_t already_processed(min_segment_num, max_segment_num);
 #endif
     for (int segment_num = proj_data_info_sptr->get_min_segment_num(); 
 	 segment_num <= proj_data_info_sptr->get_max_segment_num();
@@ -515,12 +600,110 @@ write_to_file(const std::string& output_filename_prefix,
 #endif
 	    //if (!proj_matrix.get_symmetries_ptr()->is_basic(bin))
 	    //  continue;
-	    
-	    proj_matrix.get_proj_matrix_elems_for_one_bin(lor,bin);
-	    if (write_lor(fst, lor) == Succeeded::no)
-	      return Succeeded::no;
+
+	    basic_bins[(bin.segment_num() - min_segment_num)*num_views + bin.view_num() - min_view_num].
+	      push_back(bin);
 	  }
   }
+
+  std::ofstream fst;
+  open_write_binary(fst, data_filename.c_str());
+
+  // offset in the file where the next block will be written
+  boost::uint64_t current_offset = 0;
+  vector<boost::uint64_t> block_offsets(num_blocks, 0);
+  vector<boost::uint64_t> block_num_lors(num_blocks, 0);
+  if (write_index)
+    {
+      fst.write(indexed_file_magic, sizeof(indexed_file_magic));
+      write_value(fst, byte_order_mark);
+      write_value(fst, static_cast<boost::int32_t>(min_segment_num));
+      write_value(fst, static_cast<boost::int32_t>(max_segment_num));
+      write_value(fst, static_cast<boost::int32_t>(min_view_num));
+      write_value(fst, static_cast<boost::int32_t>(max_view_num));
+      write_value(fst, static_cast<boost::uint32_t>(0));
+      // write an empty index for now, it is filled in at the end
+      const vector<char> empty_index(num_blocks*index_entry_size, 0);
+      if (num_blocks>0)
+        fst.write(&empty_index[0], empty_index.size());
+      current_offset = file_header_size + empty_index.size();
+    }
+
+  // compute the LORs for each (segment,view) in parallel and write them in order
+  bool write_ok = fst.good();
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic) ordered
+#endif
+  for (int block_num = 0; block_num < num_blocks; ++block_num)
+    {
+      vector<Bin>& bins = basic_bins[block_num];
+      std::sort(bins.begin(), bins.end(), bin_is_stored_before);
+
+      std::ostringstream block_stream(std::ios::out | std::ios::binary);
+      // write failures are only recorded here, as we cannot return from the parallel loop
+      bool block_ok = true;
+      {
+        // elements of the lors are written after a table with all lors
+        std::ostringstream elements_stream(std::ios::out | std::ios::binary);
+        boost::uint64_t elements_offset = bins.size()*lor_entry_size;
+        ProjMatrixElemsForOneBin lor;
+        for (vector<Bin>::const_iterator bin_iter = bins.begin(); bin_iter != bins.end(); ++bin_iter)
+          {
+            proj_matrix.get_proj_matrix_elems_for_one_bin(lor, *bin_iter);
+            if (!write_index)
+              {
+                if (write_lor(block_stream, lor) == Succeeded::no)
+                  block_ok = false;
+                continue;
+              }
+            write_value(block_stream, static_cast<boost::int32_t>(bin_iter->axial_pos_num()));
+            write_value(block_stream, static_cast<boost::int32_t>(bin_iter->tangential_pos_num()));
+            write_value(block_stream, static_cast<boost::uint32_t>(lor.size()));
+            write_value(block_stream, static_cast<boost::uint32_t>(0));
+            write_value(block_stream, elements_offset);
+            if (write_lor_elements(elements_stream, lor) == Succeeded::no)
+              block_ok = false;
+            elements_offset += lor.size()*element_size;
+          }
+        if (write_index)
+          block_stream << elements_stream.str();
+      }
+      const string block = block_stream.str();
+
+#ifdef STIR_OPENMP
+#pragma omp ordered
+#endif
+      {
+        if (!block_ok)
+          write_ok = false;
+        if (write_ok && !block.empty())
+          {
+            block_offsets[block_num] = current_offset;
+            block_num_lors[block_num] = bins.size();
+            fst.write(block.data(), block.size());
+            current_offset += block.size();
+            write_ok = fst.good();
+          }
+      }
+      // free memory
+      vector<Bin>().swap(bins);
+    }
+
+  if (write_ok && write_index)
+    {
+      fst.seekp(file_header_size);
+      for (int block_num = 0; block_num < num_blocks; ++block_num)
+        {
+          write_value(fst, block_offsets[block_num]);
+          write_value(fst, block_num_lors[block_num]);
+        }
+      write_ok = fst.good();
+    }
+  if (!write_ok)
+    {
+      warning("ProjMatrixByBinFromFile: error writing %s", data_filename.c_str());
+      return Succeeded::no;
+    }
   return Succeeded::yes;
 }
 
@@ -546,13 +729,194 @@ read_data()
 }
 
 
+Succeeded
+ProjMatrixByBinFromFile::
+open_indexed_data()
+{
+  close_indexed_data();
+
+#ifdef HAVE_SYSTEM_MMAP
+  {
+    const int fd = open(data_filename.c_str(), O_RDONLY);
+    if (fd >= 0)
+      {
+        struct stat file_info;
+        if (fstat(fd, &file_info) == 0 && file_info.st_size > 0)
+          {
+            void * const ptr =
+              mmap(0, static_cast<std::size_t>(file_info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED)
+              warning("ProjMatrixByBinFromFile: mmap of %s failed. Using stream access.",
+                      data_filename.c_str());
+            else
+              {
+                mapped_data_ptr = static_cast<const char *>(ptr);
+                mapped_size = static_cast<std::size_t>(file_info.st_size);
+              }
+          }
+        // the mapping stays valid after closing the file descriptor
+        close(fd);
+      }
+  }
+#endif
+  if (mapped_data_ptr == 0)
+    {
+      data_stream_sptr.reset(new std::ifstream);
+      open_read_binary(*data_stream_sptr, data_filename.c_str());
+      data_stream_sptr->seekg(0, std::ios::end);
+      mapped_size = static_cast<std::size_t>(data_stream_sptr->tellg());
+    }
+
+  if (mapped_size < file_header_size)
+    {
+      warning("ProjMatrixByBinFromFile: %s is too short", data_filename.c_str());
+      return Succeeded::no;
+    }
+  vector<char> buffer;
+  const char * ptr = get_data_ptr(0, file_header_size, buffer);
+  if (std::memcmp(ptr, indexed_file_magic, sizeof(indexed_file_magic)) != 0)
+    {
+      warning("ProjMatrixByBinFromFile: %s is not a Version 2.0 file", data_filename.c_str());
+      return Succeeded::no;
+    }
+  if (read_value<boost::uint32_t>(ptr+8) != byte_order_mark)
+    {
+      warning("ProjMatrixByBinFromFile: %s was written with a different byte order", data_filename.c_str());
+      return Succeeded::no;
+    }
+  index_min_segment_num = read_value<boost::int32_t>(ptr+12);
+  index_max_segment_num = read_value<boost::int32_t>(ptr+16);
+  index_min_view_num = read_value<boost::int32_t>(ptr+20);
+  index_max_view_num = read_value<boost::int32_t>(ptr+24);
+  if (index_max_segment_num < index_min_segment_num ||
+      index_max_view_num < index_min_view_num)
+    {
+      warning("ProjMatrixByBinFromFile: %s has an invalid index", data_filename.c_str());
+      return Succeeded::no;
+    }
+
+  const std::size_t num_blocks =
+    static_cast<std::size_t>(index_max_segment_num - index_min_segment_num + 1) *
+    static_cast<std::size_t>(index_max_view_num - index_min_view_num + 1);
+  ptr = get_data_ptr(file_header_size, num_blocks*index_entry_size, buffer);
+  block_offsets.resize(num_blocks);
+  block_num_lors.resize(num_blocks);
+  for (std::size_t block_num = 0; block_num < num_blocks; ++block_num, ptr += index_entry_size)
+    {
+      block_offsets[block_num] = read_value<boost::uint64_t>(ptr);
+      block_num_lors[block_num] = read_value<boost::uint64_t>(ptr+8);
+    }
+  return Succeeded::yes;
+}
+
+void
+ProjMatrixByBinFromFile::
+close_indexed_data()
+{
+#ifdef HAVE_SYSTEM_MMAP
+  if (mapped_data_ptr != 0)
+    munmap(const_cast<char *>(mapped_data_ptr), mapped_size);
+#endif
+  mapped_data_ptr = 0;
+  mapped_size = 0;
+  data_stream_sptr.reset();
+  block_offsets.clear();
+  block_num_lors.clear();
+}
+
+const char *
+ProjMatrixByBinFromFile::
+get_data_ptr(const boost::uint64_t offset, const std::size_t num_bytes,
+             vector<char>& buffer) const
+{
+  if (offset > mapped_size || num_bytes > mapped_size - offset)
+    error("ProjMatrixByBinFromFile: %s is too short. Corrupt file?", data_filename.c_str());
+  if (mapped_data_ptr != 0)
+    return mapped_data_ptr + offset;
+
+  buffer.resize(std::max(num_bytes, std::size_t(1)));
+  bool read_ok;
+#ifdef STIR_OPENMP
+#pragma omp critical(PROJMATRIXBYBINFROMFILE_READ)
+#endif
+  {
+    data_stream_sptr->seekg(static_cast<std::streamoff>(offset));
+    data_stream_sptr->read(&buffer[0], num_bytes);
+    read_ok = data_stream_sptr->good();
+    data_stream_sptr->clear();
+  }
+  if (!read_ok)
+    error("ProjMatrixByBinFromFile: error reading %s", data_filename.c_str());
+  return &buffer[0];
+}
+
 void 
 ProjMatrixByBinFromFile::
 calculate_proj_matrix_elems_for_one_bin(ProjMatrixElemsForOneBin& lor
 					) const
 {
-  //error("ProjMatrixByBinFromFile element not found in cache (and hence file)");
   lor.erase();
+  // for Version 1.0, all LORs are in the cache already
+  if (block_offsets.empty())
+    {
+      //error("ProjMatrixByBinFromFile element not found in cache (and hence file)");
+      return;
+    }
+
+  const Bin bin = lor.get_bin();
+  if (bin.segment_num() < index_min_segment_num || bin.segment_num() > index_max_segment_num ||
+      bin.view_num() < index_min_view_num || bin.view_num() > index_max_view_num)
+    return;
+  const std::size_t block_num =
+    static_cast<std::size_t>(bin.segment_num() - index_min_segment_num) *
+    static_cast<std::size_t>(index_max_view_num - index_min_view_num + 1) +
+    static_cast<std::size_t>(bin.view_num() - index_min_view_num);
+  const std::size_t num_lors = static_cast<std::size_t>(block_num_lors[block_num]);
+  if (num_lors == 0)
+    return;
+
+  // binary search in the (sorted) table of LORs of this (segment,view)
+  vector<char> buffer;
+  const char * const lor_table =
+    get_data_ptr(block_offsets[block_num], num_lors*lor_entry_size, buffer);
+  std::size_t low = 0;
+  std::size_t high = num_lors;
+  while (low < high)
+    {
+      const std::size_t middle = (low + high)/2;
+      const char * const entry = lor_table + middle*lor_entry_size;
+      const int axial_pos_num = read_value<boost::int32_t>(entry);
+      const int tangential_pos_num = read_value<boost::int32_t>(entry+4);
+      if (axial_pos_num < bin.axial_pos_num() ||
+          (axial_pos_num == bin.axial_pos_num() && tangential_pos_num < bin.tangential_pos_num()))
+        low = middle + 1;
+      else
+        high = middle;
+    }
+  if (low == num_lors)
+    return;
+  const char * const entry = lor_table + low*lor_entry_size;
+  if (read_value<boost::int32_t>(entry) != bin.axial_pos_num() ||
+      read_value<boost::int32_t>(entry+4) != bin.tangential_pos_num())
+    return;
+  const boost::uint32_t num_elements = read_value<boost::uint32_t>(entry+8);
+  const boost::uint64_t elements_offset = read_value<boost::uint64_t>(entry+16);
+  if (num_elements == 0)
+    return;
+
+  // decode all elements from one block of memory
+  const char * ptr =
+    get_data_ptr(block_offsets[block_num] + elements_offset, num_elements*element_size, buffer);
+  lor.reserve(num_elements);
+  for (boost::uint32_t i = 0; i < num_elements; ++i, ptr += element_size)
+    {
+      const ProjMatrixElemsForOneBin::value_type 
+        elem(Coordinate3D<int>(read_value<boost::int16_t>(ptr),
+                               read_value<boost::int16_t>(ptr+2),
+                               read_value<boost::int16_t>(ptr+4)),
+             read_value<float>(ptr+6));
+      lor.push_back(elem);
+    }
 }
 END_NAMESPACE_STIR
 
@@ -67,13 +67,6 @@ using namespace std;
 
 #include "stir/recon_buildblock/SPECTUB_Weight3d.h"
 
-/* UB-SPECT global variables */
-namespace SPECTUB {
-  wm_da_type wm;
-  wmh_type wmh; 
-  float * Rrad;
-}
-
 START_NAMESPACE_STIR
 
 
@@ -83,6 +76,7 @@ ProjMatrixByBinSPECTUB::registered_name =
 
 ProjMatrixByBinSPECTUB::
 ProjMatrixByBinSPECTUB()
+  : wmh(), wm(), Rrad(0), num_threads_for_weights(0)
 {
   set_defaults();  
 }
@@ -156,10 +150,19 @@ set_up(
 
   ProjMatrixByBin::set_up(proj_data_info_ptr_v, density_info_ptr);
 
+  // all rows of a view are computed at once, so without the cache every row would
+  // need the computation of its whole view
+  if (!this->is_cache_enabled())
+    error("ProjMatrixByBinSPECTUB needs caching. Do not set \"disable caching\"");
+
 #ifdef STIR_OPENMP
+  if (this->num_threads_for_weights == 0)
+    this->num_threads_for_weights = get_max_num_threads();
   if (!this->keep_all_views_in_cache)
     {
-      warning("SPECTUB matrix can currently only use single-threaded code unless all views are kept. Setting num_threads to 1");
+      warning(boost::format("SPECTUB matrix can currently only compute one view at a time unless all views are kept. "
+                            "Setting num_threads to 1 (but using %1% threads for the weights of a view)")
+              % this->num_threads_for_weights);
       set_num_threads(1);
     }
 #endif
@@ -202,6 +205,9 @@ set_up(
 	CPUTimer timer; 
 	timer.start();
 
+	// start from default values for flags that are not always set below
+	wmh = SPECTUB::wmh_type();
+
 	//... fill prj structure from projection data info
 
 	prj.Nbin = this->proj_data_info_ptr->get_num_tangential_poss();
@@ -405,12 +411,12 @@ set_up(
 	//... to sort angles into subsets ......................................
 
 	prj.order = new int [ prj.Nang ];
-	index_calc( prj.order );
+	index_calc( prj.order, wmh );
 
 	//... to fill ang structure ............................................
 
 	ang = new angle_type [ prj.Nang ];		
-	fill_ang( ang );			   
+	fill_ang( ang, Rrad, wmh );			   
 
 	//... to fill high resolution discrete distribution functions ..............
 
@@ -476,12 +482,12 @@ set_up(
                 // we do this to avoid using its own read_msk_file
                 wmh.do_msk_file = false;
 	        wmh.do_msk_att = true;
-                generate_msk( msk_3d, msk_2d, mask_from_file, &vol);
+                generate_msk( msk_3d, msk_2d, mask_from_file, &vol, wmh);
                 delete[] mask_from_file;
               }
             else
               {
-		generate_msk( msk_3d, msk_2d, attmap, &vol);
+		generate_msk( msk_3d, msk_2d, attmap, &vol, wmh);
               }
           }
 	else msk_2d = msk_3d = NULL;
@@ -493,78 +499,49 @@ set_up(
 
 	//... setting PSF maximum size (in bins) and memory allocation for PSF values .......
 
-	this->maxszb = max_psf_szb( ang );  // maximum PSF size (horizontal component of PSF)
+	this->maxszb = max_psf_szb( ang, wmh );  // maximum PSF size (horizontal component of PSF)
 	NITEMS = new int * [prj.NOS];
 	for (int kOS=0; kOS<prj.NOS; ++kOS) {
 	  NITEMS[kOS] = new int [ wm.NbOS ];
 	}
 
-	//... double array wm.val and wm.col .....................................................
-
-	if ( ( wm.val = new (nothrow) float * [ wm.NbOS ] ) == NULL ) 
-          {
-            //error_wm_SPECT( 200, "wm.val[]" );
-            error("Error allocating space to store values for SPECTUB matrix");
-          }
-	if ( ( wm.col = new (nothrow) int   * [ wm.NbOS ] ) == NULL ) 
-          {
-            //error_wm_SPECT( 200, "wm.col[]" );
-            error("Error allocating space to store column indices for SPECTUB matrix");
-          }
-
-	//... array wm.ne .........................................................................
-
-	if ( ( wm.ne = new (nothrow) int [ wm.NbOS + 1 ]) == 0 ) 
-          {
-            // error_wm_SPECT(200,"wm.ne[]");
-            error("Error allocating space to store number of elements for SPECTUB matrix");
-          }
-
-
-	//... STIR indices .......................................................................
+	//... STIR indices of the voxels (centered in x and y) ....................................
+	//... (the arrays for the weights and the indices of the bins are allocated for every subset,
+	//... such that several subsets can be computed at the same time, see compute_one_subset)
 
 	if ( wm.do_save_STIR ){
-		wm.ns = new int [ prj.NbOS ];
-		wm.nb = new int [ prj.NbOS ];
-		wm.na = new int [ prj.NbOS ];
-
 		wm.nx = new short int [ vol.Nvox ];
 		wm.ny = new short int [ vol.Nvox ];
 		wm.nz = new short int [ vol.Nvox ];
-	}
-
-	//... memory allocation for wmh .........................................................
 
-	wmh.index = new int [ wmh.prj.NangOS ];
-	wmh.Rrad  = new float [ wmh.prj.NangOS ];
+		for ( int iv = 0 ; iv < vol.Nvox ; iv++ ){
+			wm.nx[ iv ] = (short int)( iv % vol.Ncol - (int) floor( vol.Ncold2 ) );
+			wm.ny[ iv ] = (short int)( ( iv / vol.Ncol ) % vol.Nrow - (int) floor( vol.Nrowd2 ) );
+			wm.nz[ iv ] = (short int)( iv / vol.Npix );
+		}
+	}
 
 	//..........................................................................................
 	//... CALCULATION OF MATRICES ..............................................................
 	//..........................................................................................
 
-	//... LOOP: Subsets .................................................................
+	workspace_pool.set_up( this->maxszb, wmh );
 	subset_already_processed.assign(prj.NOS, false);
-	for ( int kOS = 0 ; kOS < prj.NOS ; kOS++ ){
-		wmh.subset_ind = kOS;
+	std::vector<std::mutex>(prj.NOS).swap(subset_mutexes);
 
-		for ( int i = 0 ; i < prj.NangOS ; i ++ ){
-
-			wmh.index[ i ] = prj.order[ i + kOS * prj.NangOS ];
-			wmh.Rrad [ i ] = Rrad[ wmh.index[ i ] ];
-		}
+	//... LOOP: Subsets (size estimations, in parallel) ....................................
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(this->num_threads_for_weights)
+#endif
+	for ( int kOS = 0 ; kOS < prj.NOS ; kOS++ ){
 
 		//... NITEMS initialization  ......................
 
 		for ( int i = 0 ; i < prj.NbOS ; i++ ) NITEMS[kOS][ i ] = 1;
 
-
 		//... size estimations ........................................................
 
-		wm_size_estimation ( kOS,  ang, vox, bin, vol, prj, msk_3d, msk_2d, maxszb, &gaussdens, NITEMS[kOS] );
-
-		//cout << "\nwm_SPECT. Size estimation done. time (s): " << double( clock()-ini )/CLOCKS_PER_SEC <<endl;
-
-	// compute_one_subset(kOS);
+		wm_size_estimation ( kOS,  ang, vox, bin, vol, prj, msk_3d, msk_2d, &gaussdens, NITEMS[kOS], wmh, workspace_pool );
 	}   // end of LOOP: Subsets
 
 	//delete_UB_SPECT_arrays();
@@ -596,10 +573,6 @@ delete_UB_SPECT_arrays()
     }
   }
 
-  delete [] wm.val;
-  delete [] wm.col;
-  delete [] wm.ne;
-
   //... freeing memory .............................................
 
   delete [] prj.order;
@@ -607,8 +580,6 @@ delete_UB_SPECT_arrays()
   for (int kOS=0; kOS<prj.NOS; ++kOS)
     delete [] NITEMS[kOS];
   delete [] NITEMS;	
-  delete [] wmh.index;
-  delete [] wmh.Rrad;
 
   if (wmh.do_psf){
     delete [] gaussdens.val;
@@ -622,9 +593,6 @@ delete_UB_SPECT_arrays()
   }
 
   if ( wm.do_save_STIR ){
-    delete [] wm.ns;
-    delete [] wm.nb;
-    delete [] wm.na;
     delete [] wm.nx;
     delete [] wm.ny;
     delete [] wm.nz;
@@ -634,7 +602,7 @@ delete_UB_SPECT_arrays()
 }
 void
 ProjMatrixByBinSPECTUB::
-compute_one_subset(const int kOS) const
+compute_one_subset(const int kOS, ProjMatrixElemsForOneBin * const lor_ptr) const
 {
   using namespace SPECTUB;
 
@@ -642,26 +610,22 @@ compute_one_subset(const int kOS) const
   timer.start();
   // cout << "\n\n--- Processing subset: " << kOS+1 << "/" << prj.NOS << " ----------------------------------------\n" << endl;
 
-  //... to fill wmh fields related to the subset ..................................
-
-  wmh.subset_ind = kOS;
-
-  for ( int i = 0 ; i < prj.NangOS ; i ++ ){
-
-    wmh.index[ i ] = prj.order[ i + kOS * prj.NangOS ];
-    wmh.Rrad [ i ] = Rrad[ wmh.index[ i ] ];
-  }
-
-  //... NITEMS initialization  ......................
-
-  // for ( int i = 0 ; i < prj.NbOS ; i++ ) NITEMS[ i ] = 1;
+  //... matrix for this subset ..................................................
+  // This is a copy of the information in this->wm, but with its own arrays for the
+  // weights and the bin indices, such that other subsets can be computed at the same time.
 
+  wm_da_type wm = this->wm;
 
-  //... size esmitations ........................................................
-
-  //wm_size_estimation ( kOS,  ang, vox, bin, vol, prj, msk_3d, msk_2d, maxszb, &gaussdens, NITEMS );
-
-  //cout << "\nwm_SPECT. Size estimation done. time (s): " << double( clock()-ini )/CLOCKS_PER_SEC <<endl;
+  std::vector<float *> wm_val( wm.NbOS );
+  std::vector<int *> wm_col( wm.NbOS );
+  std::vector<int> wm_ne( wm.NbOS + 1 );
+  std::vector<int> wm_na( wm.NbOS ), wm_nb( wm.NbOS ), wm_ns( wm.NbOS );
+  wm.val = &wm_val[ 0 ];
+  wm.col = &wm_col[ 0 ];
+  wm.ne  = &wm_ne[ 0 ];
+  wm.na  = &wm_na[ 0 ];
+  wm.nb  = &wm_nb[ 0 ];
+  wm.ns  = &wm_ns[ 0 ];
 
   int ne = 0;
 
@@ -707,7 +671,8 @@ compute_one_subset(const int kOS) const
 
   //... wm calculation for this subset ...........................
 
-  wm_calculation ( kOS, ang, vox, bin, vol, prj, attmap, msk_3d, msk_2d, maxszb, &gaussdens, NITEMS[kOS] );
+  wm_calculation ( kOS, ang, vox, bin, vol, prj, attmap, msk_3d, msk_2d, &gaussdens, NITEMS[kOS],
+                   wmh, wm, workspace_pool, this->num_threads_for_weights );
   info(boost::format("Weight matrix calculation done. time %1% (s)") % timer.value(),
        2);
 
@@ -734,6 +699,19 @@ compute_one_subset(const int kOS) const
     delete [] wm.val[ j ];
     delete [] wm.col[ j ];
 
+    if (lor_ptr != 0)
+      {
+        const Bin requested_bin = lor_ptr->get_bin();
+        if (bin.segment_num() == requested_bin.segment_num() &&
+            bin.view_num() == requested_bin.view_num() &&
+            bin.axial_pos_num() == requested_bin.axial_pos_num() &&
+            bin.tangential_pos_num() == requested_bin.tangential_pos_num())
+          {
+            *lor_ptr = lor;
+            lor_ptr->set_bin(requested_bin);
+          }
+      }
+
     this->cache_proj_matrix_elems_for_one_bin(lor);
   }
 
@@ -753,26 +731,43 @@ calculate_proj_matrix_elems_for_one_bin(ProjMatrixElemsForOneBin& lor
   int kOS=0;
   for (kOS=0; kOS<prj.NOS; ++kOS)
     {
-      // see initialisation of wmh.index
+      // see wm_calculation
       if (prj.order[kOS] == view_num)
 	break;
     }
+  // The row is taken from the cache if the view was computed before. Otherwise the
+  // view is computed, and the row is copied from the result.
+  if (!this->keep_all_views_in_cache)
+    {
 #ifdef STIR_OPENMP
 #pragma omp critical(PROJMATRIXBYBINUBONEVIEW)
 #endif
-  if (!subset_already_processed[kOS])
+      if (!subset_already_processed[kOS])
+        {
+          this->clear_cache();
+          subset_already_processed.assign(prj.NOS,false);
+          info(boost::format("Computing matrix elements for view %1%") % view_num,
+               2);
+          compute_one_subset(kOS, &lor);
+          subset_already_processed[kOS]=true;
+        }
+      else if (this->get_cached_proj_matrix_elems_for_one_bin(lor) == Succeeded::no)
+        compute_one_subset(kOS, &lor);
+    }
+  else
     {
-      if (!this->keep_all_views_in_cache)
-	{
-	  this->clear_cache();
-	  subset_already_processed.assign(prj.NOS,false);
-	}
-      info(boost::format("Computing matrix elements for view %1%") % view_num,
-        2);
-      compute_one_subset(kOS);
-      subset_already_processed[kOS]=true;
+      // other threads can compute other views at the same time
+      std::lock_guard<std::mutex> lock(subset_mutexes[kOS]);
+      if (!subset_already_processed[kOS])
+        {
+          info(boost::format("Computing matrix elements for view %1%") % view_num,
+               2);
+          compute_one_subset(kOS, &lor);
+          subset_already_processed[kOS]=true;
+        }
+      else if (this->get_cached_proj_matrix_elems_for_one_bin(lor) == Succeeded::no)
+        compute_one_subset(kOS, &lor);
     }
-  lor.erase();
 }
 
 END_NAMESPACE_STIR
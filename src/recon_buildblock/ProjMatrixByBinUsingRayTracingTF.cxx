@@ -54,9 +54,16 @@
 #include "stir/round.h"
 #include "stir/modulo.h"
 #include "stir/stream.h"
+#include "stir/info.h"
+#include "stir/HighResWallClockTimer.h"
+#include "stir/recon_buildblock/CPURayTracer.h"
+#ifdef HAVE_TENSORFLOW
+#include "stir/recon_buildblock/TFRayTracer.h"
+#endif
 #include <algorithm>
 #include <math.h>
 #include <boost/format.hpp>
+#include <iostream>
 
 #include <random>
 
@@ -72,7 +79,7 @@ ProjMatrixByBinUsingRayTracingTF::registered_name =
   "Ray Tracing TF";
 
 ProjMatrixByBinUsingRayTracingTF::
-ProjMatrixByBinUsingRayTracingTF() : rtr(26000000, 200)
+ProjMatrixByBinUsingRayTracingTF()
 {
   std::cout << "this is ProjMatrixByBinUsingRayTracing TF constructor\n";
   set_defaults();
@@ -93,6 +100,9 @@ ProjMatrixByBinUsingRayTracingTF::initialise_keymap()
   parser.add_key("do_symmetry_swap_segment", &do_symmetry_swap_segment);
   parser.add_key("do_symmetry_swap_s", &do_symmetry_swap_s);
   parser.add_key("do_symmetry_shift_z", &do_symmetry_shift_z);
+  parser.add_key("ray tracer backend", &ray_tracer_backend);
+  parser.add_key("ray tracer chunk size", &ray_tracer_chunk_size);
+  parser.add_key("number of ray tracer batches in flight", &num_ray_tracer_batches_in_flight);
   parser.add_stop_key("End Ray Tracing Matrix Parameters");
 }
 
@@ -110,6 +120,14 @@ ProjMatrixByBinUsingRayTracingTF::set_defaults()
   this->do_symmetry_swap_segment = true;
   this->do_symmetry_swap_s = true;
   this->do_symmetry_shift_z = true;
+#ifdef HAVE_TENSORFLOW
+  this->ray_tracer_backend = "TensorFlow";
+#else
+  this->ray_tracer_backend = "CPU";
+#endif
+  // number of points in the TensorFlow graph
+  this->ray_tracer_chunk_size = 26000000;
+  this->num_ray_tracer_batches_in_flight = 0;
   this->already_setup = false;
 }
 
@@ -125,6 +143,31 @@ ProjMatrixByBinUsingRayTracingTF::post_processing()
             % this->num_tangential_LORs);
     return true;
   }
+  if (this->ray_tracer_backend != "CPU" && this->ray_tracer_backend != "TensorFlow")
+  {
+    warning(boost::format("ProjMatrixByBinUsingRayTracingTF: ray tracer backend should be CPU or TensorFlow, but is %s")
+            % this->ray_tracer_backend);
+    return true;
+  }
+#ifndef HAVE_TENSORFLOW
+  if (this->ray_tracer_backend == "TensorFlow")
+  {
+    warning("ProjMatrixByBinUsingRayTracingTF: STIR was built without TensorFlow. Use the CPU ray tracer backend.");
+    return true;
+  }
+#endif
+  if (this->ray_tracer_chunk_size<1)
+  {
+    warning(boost::format("ProjMatrixByBinUsingRayTracingTF: ray tracer chunk size should be at least 1, but is %d")
+            % this->ray_tracer_chunk_size);
+    return true;
+  }
+  if (this->num_ray_tracer_batches_in_flight<0)
+  {
+    warning(boost::format("ProjMatrixByBinUsingRayTracingTF: number of ray tracer batches in flight should be at least 0, but is %d")
+            % this->num_ray_tracer_batches_in_flight);
+    return true;
+  }
   this->already_setup = false;
   return false;
 }
@@ -255,6 +298,51 @@ set_do_symmetry_shift_z(bool val)
   this->do_symmetry_shift_z = val;
 }
 
+std::string
+ProjMatrixByBinUsingRayTracingTF::
+get_ray_tracer_backend() const
+{
+  return this->ray_tracer_backend;
+}
+
+void
+ProjMatrixByBinUsingRayTracingTF::
+set_ray_tracer_backend(const std::string& val)
+{
+  this->already_setup = (this->ray_tracer_backend == val);
+  this->ray_tracer_backend = val;
+}
+
+int
+ProjMatrixByBinUsingRayTracingTF::
+get_ray_tracer_chunk_size() const
+{
+  return this->ray_tracer_chunk_size;
+}
+
+void
+ProjMatrixByBinUsingRayTracingTF::
+set_ray_tracer_chunk_size(const int val)
+{
+  this->already_setup = (this->ray_tracer_chunk_size == val);
+  this->ray_tracer_chunk_size = val;
+}
+
+int
+ProjMatrixByBinUsingRayTracingTF::
+get_num_ray_tracer_batches_in_flight() const
+{
+  return this->num_ray_tracer_batches_in_flight;
+}
+
+void
+ProjMatrixByBinUsingRayTracingTF::
+set_num_ray_tracer_batches_in_flight(const int val)
+{
+  this->already_setup = (this->num_ray_tracer_batches_in_flight == val);
+  this->num_ray_tracer_batches_in_flight = val;
+}
+
 //******************** actual implementation *************
 
 #if 0
@@ -289,8 +377,21 @@ set_up(
 
   queue.clear();
 
+  if (ray_tracer_backend == "CPU")
+    ray_tracer_sptr.reset(new CPURayTracer(ray_tracer_chunk_size, num_ray_tracer_batches_in_flight));
+  else if (ray_tracer_backend == "TensorFlow")
+    {
+#ifdef HAVE_TENSORFLOW
+      ray_tracer_sptr.reset(new TFRayTracer(ray_tracer_chunk_size, 200, num_ray_tracer_batches_in_flight));
+#else
+      error("ProjMatrixByBinUsingRayTracingTF: STIR was built without TensorFlow. Use the CPU ray tracer backend.");
+#endif
+    }
+  else
+    error("ProjMatrixByBinUsingRayTracingTF: unknown ray tracer backend " + ray_tracer_backend);
+
   // now that the voxel size is known, communicate it to the ray-tracing object
-  rtr.setVoxelSize(voxel_size);
+  ray_tracer_sptr->setVoxelSize(voxel_size);
 
   origin = image_info_ptr->get_origin();
   image_info_ptr->get_regular_range(min_index, max_index);
@@ -495,7 +596,12 @@ int ProjMatrixByBinUsingRayTracingTF::scheduleLOR(float s_in_mm, float t_in_mm,
   int number_points = 1 / increment;
   //float increment = 1 / (200.f);
 
-  float normalization_constant = 1. / (num_LORs * dist); 
+  // as in ProjMatrixByBinUsingRayTracing, LOIs are divided by voxel_size.x() and averaged over the LORs
+  float normalization_constant = 1.F / (num_LORs * voxel_size.x());
+
+  // the ray tracer backends use voxels from i*voxel_size to (i+1)*voxel_size, but
+  // voxel i is centred at i*voxel_size, so we shift all points by half a voxel
+  const CartesianCoordinate3D<float> half_voxel_size = voxel_size / 2.F;
 
   float t = 0;
   for(int i = 0; i < number_points; i++)
@@ -507,8 +613,9 @@ int ProjMatrixByBinUsingRayTracingTF::scheduleLOR(float s_in_mm, float t_in_mm,
       cur_pos.x() = t * (stop_point.x() - start_point.x()) + start_point.x();
       cur_pos.y() = t * (stop_point.y() - start_point.y()) + start_point.y();
       cur_pos.z() = t * (stop_point.z() - start_point.z()) + start_point.z();
+      cur_pos += half_voxel_size;
 
-      rtr.schedulePoint(cur_pos, ray_vec, normalization_constant);
+      ray_tracer_sptr->schedulePoint(cur_pos, ray_vec, normalization_constant);
       cur_num_points++;
       t += increment;
     }
@@ -767,11 +874,11 @@ void ProjMatrixByBinUsingRayTracingTF::schedule_basic_matrix_elems_for_calculati
 
 int ProjMatrixByBinUsingRayTracingTF::execute(std::vector<ProjMatrixElemsForOneBin>& retval) const
 {
-  //std::cout << rtr.getQueueLength() << " points waiting" << std::endl;
+  //std::cout << ray_tracer_sptr->getQueueLength() << " points waiting" << std::endl;
 
   // execute it such that get the list of all LOIs
   std::vector<ProjMatrixElemsForOneBinValue> res;
-  int num_traced = rtr.execute(res);
+  int num_traced = ray_tracer_sptr->execute(res);
 
   ProjMatrixElemsForOneBin cur;
   int cur_point = 0;
@@ -779,7 +886,8 @@ int ProjMatrixByBinUsingRayTracingTF::execute(std::vector<ProjMatrixElemsForOneB
   int read_cnt = 0;
 
   // iterate through the list of bins / num_points & append the individual LOR objects to the return value vector
-  auto started_copy = std::chrono::high_resolution_clock::now();
+  HighResWallClockTimer scatter_timer;
+  scatter_timer.start();
 
   for(int ii = 0; ii < queue.get_size(); ii++)
     {
@@ -814,10 +922,21 @@ int ProjMatrixByBinUsingRayTracingTF::execute(std::vector<ProjMatrixElemsForOneB
 	    }
 	  */
 
-	  // fill the LOR with the elements that belong to it
+	  // fill the LOR with the elements that belong to it.
+	  // Consecutive points on a LOR often lie in the same voxel, and each of them gives the
+	  // LOI of the LOR with that voxel, so we keep only one element per voxel. We use the
+	  // largest value, as the sphere tracing uses a fixed number of steps and can
+	  // therefore only underestimate the LOI.
 	  for(int jj = 0; jj < queue.get_num_points(ii) && cur_point < res.size(); jj++, cur_point++)
 	    {
-	      cur.push_back(res[cur_point]);
+	      if (jj > 0 && res[cur_point].get_coords() == res[cur_point-1].get_coords())
+		{
+		  ProjMatrixElemsForOneBin::iterator last_element = cur.end() - 1;
+		  if (res[cur_point].get_value() > last_element->get_value())
+		    *last_element = res[cur_point];
+		}
+	      else
+		cur.push_back(res[cur_point]);
 	    }
 	  
 	  cache_proj_matrix_elems_for_one_bin(cur);
@@ -838,13 +957,14 @@ int ProjMatrixByBinUsingRayTracingTF::execute(std::vector<ProjMatrixElemsForOneB
       retval.push_back(cur);
     }
   
-  auto done_copy = std::chrono::high_resolution_clock::now();
-
-  std::cout << "copyHL=" << std::chrono::duration_cast<std::chrono::milliseconds>(done_copy - started_copy).count() << std::endl;	 
+  scatter_timer.stop();
+  info(boost::format("%1%, scattering into %2% bins %3%s")
+       % ray_tracer_sptr->get_timing_report() % queue.get_size() % scatter_timer.value(),
+       2);
+  ray_tracer_sptr->reset_timers();
   
   // reset the queue
   queue.clear();
-  std::cout << "number points=" << num_traced << std::endl;
 
   return num_traced;
 }
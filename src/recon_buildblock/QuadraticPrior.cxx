@@ -35,6 +35,7 @@
 #include "stir/is_null_ptr.h"
 #include "stir/info.h"
 #include <algorithm>
+#include <vector>
 using std::min;
 using std::max;
 
@@ -206,6 +207,135 @@ compute_weights(Array<3,float>& weights, const CartesianCoordinate3D<float>& gri
         }
 }
 
+/* Classes for the term T in compute_weighted_neighbourhood_sums() below.
+   They get the row of the image at (z,y) and the row at (z+dz,y+dy), where
+   i and j are the indices of x and x+dx (relative to the start of the row).
+*/
+template <typename elemT>
+struct QuadraticPriorDifferenceTerm
+{
+  static elemT value(const elemT * const row, const elemT * const neighbour_row, const int i, const int j)
+  { return row[i] - neighbour_row[j]; }
+};
+
+template <typename elemT>
+struct QuadraticPriorNeighbourTerm
+{
+  static elemT value(const elemT * const, const elemT * const neighbour_row, const int, const int j)
+  { return neighbour_row[j]; }
+};
+
+template <typename elemT>
+struct QuadraticPriorUnitTerm
+{
+  static elemT value(const elemT * const, const elemT * const, const int, const int)
+  { return 1; }
+};
+
+/* Computes for all voxels r (with r=(z,y,x) and dr=(dz,dy,dx))
+     sum_dr weights[dr] * T(image,r,dr) * kappa[r] * kappa[r+dr]
+   where the sum is over all neighbours inside the image, T is given by the Term class
+   and the kappa factors are only used when kappa_ptr is not 0.
+   This sum is then multiplied with penalisation_factor and either stored in result, or 
+   added to it (if add_to_result is true).
+
+   The loop over x is the innermost loop, such that it can be vectorised. The image boundary
+   is handled by restricting the range of x for every dx. Every voxel gets the contributions
+   of its neighbours in the same order (dz,dy,dx) as a straightforward loop over the
+   neighbourhood. Planes are handled in parallel.
+
+   The image has to have a regular index range (all rows have the same index range),
+   otherwise error() is called. kappa has to have the same index range as the image.
+*/
+template <class Term, typename elemT>
+static void
+compute_weighted_neighbourhood_sums(DiscretisedDensity<3,elemT>& result,
+                                    const DiscretisedDensity<3,elemT>& image,
+                                    const Array<3,float>& weights,
+                                    const DiscretisedDensity<3,elemT> * const kappa_ptr,
+                                    const float penalisation_factor,
+                                    const bool add_to_result)
+{
+  // check here, as error() cannot be called inside the parallel loop
+  BasicCoordinate<3,int> min_indices, max_indices;
+  if (!image.get_regular_range(min_indices, max_indices))
+    error("QuadraticPrior: can only handle images with a regular index range (all rows of the same size)\n");
+
+  const int min_z = image.get_min_index();
+  const int max_z = image.get_max_index();
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int z=min_z; z<=max_z; z++)
+    {
+      const int min_dz = max(weights.get_min_index(), min_z-z);
+      const int max_dz = min(weights.get_max_index(), max_z-z);
+
+      const int min_y = image[z].get_min_index();
+      const int max_y = image[z].get_max_index();
+
+      std::vector<elemT> sums;
+      for (int y=min_y;y<= max_y;y++)
+        {
+          const int min_dy = max(weights[0].get_min_index(), min_y-y);
+          const int max_dy = min(weights[0].get_max_index(), max_y-y);
+
+          const int min_x = image[z][y].get_min_index();
+          const int max_x = image[z][y].get_max_index();
+          const int num_x = max_x - min_x + 1;
+          if (num_x <= 0)
+            continue;
+
+          sums.assign(num_x, 0);
+          elemT * const sums_row = &sums[0];
+          const elemT * const row = &image[z][y][min_x];
+          const elemT * const kappa_row = kappa_ptr == 0 ? 0 : &(*kappa_ptr)[z][y][min_x];
+
+          for (int dz=min_dz;dz<=max_dz;++dz)
+            for (int dy=min_dy;dy<=max_dy;++dy)
+              {
+                const elemT * const neighbour_row = &image[z+dz][y+dy][min_x];
+                const elemT * const kappa_neighbour_row =
+                  kappa_ptr == 0 ? 0 : &(*kappa_ptr)[z+dz][y+dy][min_x];
+
+                for (int dx=weights[0][0].get_min_index(); dx<=weights[0][0].get_max_index(); ++dx)
+                  {
+                    const float weight = weights[dz][dy][dx];
+                    // range of i such that x=min_x+i and x+dx are in the image
+                    const int min_i = max(0, -dx);
+                    const int max_i = min(num_x-1, num_x-1-dx);
+                    if (kappa_ptr == 0)
+                      {
+#if defined(STIR_OPENMP) && (_OPENMP >= 201307)
+#pragma omp simd
+#endif
+                        for (int i=min_i; i<=max_i; ++i)
+                          sums_row[i] += weight * Term::value(row, neighbour_row, i, i+dx);
+                      }
+                    else
+                      {
+#if defined(STIR_OPENMP) && (_OPENMP >= 201307)
+#pragma omp simd
+#endif
+                        for (int i=min_i; i<=max_i; ++i)
+                          sums_row[i] += 
+                            (weight * Term::value(row, neighbour_row, i, i+dx)) *
+                            (kappa_row[i] * kappa_neighbour_row[i+dx]);
+                      }
+                  }
+              }
+
+          elemT * const result_row = &result[z][y][min_x];
+          if (add_to_result)
+            for (int i=0; i<num_x; ++i)
+              result_row[i] += sums_row[i] * penalisation_factor;
+          else
+            for (int i=0; i<num_x; ++i)
+              result_row[i] = sums_row[i] * penalisation_factor;
+        }
+    }
+}
+
 template <typename elemT>
 double
 QuadraticPrior<elemT>::
@@ -309,101 +439,15 @@ compute_gradient(DiscretisedDensity<3,elemT>& prior_gradient,
   if (do_kappa && !kappa_ptr->has_same_characteristics(current_image_estimate))
     error("QuadraticPrior: kappa image has not the same index range as the reconstructed image\n");
 
-  const int min_z = current_image_estimate.get_min_index();  
-  const int max_z = current_image_estimate.get_max_index();  
-  for (int z=min_z; z<=max_z; z++) 
-    { 
-      const int min_dz = max(weights.get_min_index(), min_z-z); 
-      const int max_dz = min(weights.get_max_index(), max_z-z); 
-      
-      const int min_y = current_image_estimate[z].get_min_index(); 
-      const int max_y = current_image_estimate[z].get_max_index(); 
-      
-      for (int y=min_y;y<= max_y;y++) 
-        { 
-          const int min_dy = max(weights[0].get_min_index(), min_y-y); 
-          const int max_dy = min(weights[0].get_max_index(), max_y-y);             
-          
-          const int min_x = current_image_estimate[z][y].get_min_index();
-          const int max_x = current_image_estimate[z][y].get_max_index();  
-          
-          for (int x=min_x;x<= max_x;x++)
-            {
-              const int min_dx = max(weights[0][0].get_min_index(), min_x-x);
-              const int max_dx = min(weights[0][0].get_max_index(), max_x-x);
-                
-                /* formula:
-                  sum_dx,dy,dz
-                   weights[dz][dy][dx] *
-                   (current_image_estimate[z][y][x] - current_image_estimate[z+dz][y+dy][x+dx]) *
-                   (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
-                */
-#if 1
-                elemT gradient = 0;
-                for (int dz=min_dz;dz<=max_dz;++dz)
-                  for (int dy=min_dy;dy<=max_dy;++dy)
-                    for (int dx=min_dx;dx<=max_dx;++dx)
-                      {
-                        elemT current =
-                          weights[dz][dy][dx] *
-                          (current_image_estimate[z][y][x] - current_image_estimate[z+dz][y+dy][x+dx]);
-
-                        if (do_kappa)
-                          current *= 
-                            (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
-
-                        gradient += current;
-                      }
-#else
-                // attempt to speed up by precomputing the sum of weights.
-                // The current code gives identical results but is actually slower
-                // than the above, at least when kappas are present.
-
-
-                // precompute sum of weights
-                // TODO without kappas, this is just weights.sum() most of the time, 
-                // but not near edges
-                float sum_of_weights = 0;
-                {
-                  if (do_kappa)
-                    {                
-                      for (int dz=min_dz;dz<=max_dz;++dz)
-                        for (int dy=min_dy;dy<=max_dy;++dy)
-                          for (int dx=min_dx;dx<=max_dx;++dx)
-                            sum_of_weights +=  weights[dz][dy][dx]*(*kappa_ptr)[z+dz][y+dy][x+dx];
-                    }
-                  else
-                    {
-                      for (int dz=min_dz;dz<=max_dz;++dz)
-                        for (int dy=min_dy;dy<=max_dy;++dy)
-                          for (int dx=min_dx;dx<=max_dx;++dx)
-                            sum_of_weights +=  weights[dz][dy][dx];
-                    }
-                }
-                // now compute contribution of central term
-                elemT gradient = sum_of_weights * current_image_estimate[z][y][x] ;
-
-                // subtract the rest
-                for (int dz=min_dz;dz<=max_dz;++dz)
-                  for (int dy=min_dy;dy<=max_dy;++dy)
-                    for (int dx=min_dx;dx<=max_dx;++dx)
-                      {
-                        elemT current =
-                          weights[dz][dy][dx] * current_image_estimate[z+dz][y+dy][x+dx];
-
-                        if (do_kappa)
-                          current *= (*kappa_ptr)[z+dz][y+dy][x+dx];
-
-                        gradient -= current;
-                      }
-                // multiply with central kappa
-                if (do_kappa)
-                  gradient *= (*kappa_ptr)[z][y][x];
-#endif
-                prior_gradient[z][y][x]= gradient * this->penalisation_factor;
-              }              
-          }
-    }
+  /* formula:
+     sum_dx,dy,dz
+       weights[dz][dy][dx] *
+       (current_image_estimate[z][y][x] - current_image_estimate[z+dz][y+dy][x+dx]) *
+       (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
+  */
+  compute_weighted_neighbourhood_sums<QuadraticPriorDifferenceTerm<elemT> >
+    (prior_gradient, current_image_estimate, this->weights, kappa_ptr.get(),
+     this->penalisation_factor, /*add_to_result=*/ false);
 
   info(boost::format("Prior gradient max %1%, min %2%\n") % prior_gradient.find_max() % prior_gradient.find_min());
 
@@ -447,7 +491,7 @@ compute_Hessian(DiscretisedDensity<3,elemT>& prior_Hessian_for_single_densel,
    
   const bool do_kappa = !is_null_ptr(kappa_ptr);
   
-  if (do_kappa && kappa_ptr->has_same_characteristics(current_image_estimate))
+  if (do_kappa && !kappa_ptr->has_same_characteristics(current_image_estimate))
     error("QuadraticPrior: kappa image has not the same index range as the reconstructed image\n");
 
   const int z = coords[1];
@@ -509,48 +553,10 @@ QuadraticPrior<elemT>::parabolic_surrogate_curvature(DiscretisedDensity<3,elemT>
   if (do_kappa && !kappa_ptr->has_same_characteristics(current_image_estimate))
     error("QuadraticPrior: kappa image has not the same index range as the reconstructed image\n");
 
-  const int min_z = current_image_estimate.get_min_index();   
-  const int max_z = current_image_estimate.get_max_index();   
-  for (int z=min_z; z<=max_z; z++)  
-    {  
-      const int min_dz = max(weights.get_min_index(), min_z-z);  
-      const int max_dz = min(weights.get_max_index(), max_z-z);  
-       
-      const int min_y = current_image_estimate[z].get_min_index();  
-      const int max_y = current_image_estimate[z].get_max_index();  
-       
-      for (int y=min_y;y<= max_y;y++)  
-        {  
-          const int min_dy = max(weights[0].get_min_index(), min_y-y);  
-          const int max_dy = min(weights[0].get_max_index(), max_y-y);              
-           
-          const int min_x = current_image_estimate[z][y].get_min_index(); 
-          const int max_x = current_image_estimate[z][y].get_max_index();   
-          for (int x=min_x;x<= max_x;x++) 
-            { 
-              const int min_dx = max(weights[0][0].get_min_index(), min_x-x); 
-              const int max_dx = min(weights[0][0].get_max_index(), max_x-x); 
-                
-                elemT gradient = 0;
-                for (int dz=min_dz;dz<=max_dz;++dz)
-                  for (int dy=min_dy;dy<=max_dy;++dy)
-                    for (int dx=min_dx;dx<=max_dx;++dx)
-                      {
-                        // 1 comes from omega = psi'(t)/t = 2*t/2t =1                  
-                        elemT current =
-                          weights[dz][dy][dx] *1;
-
-                         if (do_kappa)
-                          current *= 
-                            (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
-
-                        gradient += current;
-                      }
-                
-                parabolic_surrogate_curvature[z][y][x]= gradient * this->penalisation_factor;
-              }              
-          }
-    }
+  // 1 comes from omega = psi'(t)/t = 2*t/2t =1
+  compute_weighted_neighbourhood_sums<QuadraticPriorUnitTerm<elemT> >
+    (parabolic_surrogate_curvature, current_image_estimate, this->weights, kappa_ptr.get(),
+     this->penalisation_factor, /*add_to_result=*/ false);
 
   info(boost::format("parabolic_surrogate_curvature max %1%, min %2%\n") % parabolic_surrogate_curvature.find_max() % parabolic_surrogate_curvature.find_min());
   /*{
@@ -590,47 +596,9 @@ add_multiplication_with_approximate_Hessian(DiscretisedDensity<3,elemT>& output,
   if (do_kappa && !kappa_ptr->has_same_characteristics(input))
     error("QuadraticPrior: kappa image has not the same index range as the reconstructed image\n");
 
-  const int min_z = output.get_min_index();   
-  const int max_z = output.get_max_index();   
-  for (int z=min_z; z<=max_z; z++)  
-    {  
-      const int min_dz = max(weights.get_min_index(), min_z-z);  
-      const int max_dz = min(weights.get_max_index(), max_z-z);  
-      
-      const int min_y = output[z].get_min_index();  
-      const int max_y = output[z].get_max_index();  
-       
-      for (int y=min_y;y<= max_y;y++)  
-        {  
-          const int min_dy = max(weights[0].get_min_index(), min_y-y);  
-          const int max_dy = min(weights[0].get_max_index(), max_y-y);              
-           
-          const int min_x = output[z][y].get_min_index(); 
-          const int max_x = output[z][y].get_max_index();   
-
-          for (int x=min_x;x<= max_x;x++) 
-            { 
-              const int min_dx = max(weights[0][0].get_min_index(), min_x-x); 
-              const int max_dx = min(weights[0][0].get_max_index(), max_x-x); 
-                
-                elemT result = 0;
-                for (int dz=min_dz;dz<=max_dz;++dz)
-                  for (int dy=min_dy;dy<=max_dy;++dy)
-                    for (int dx=min_dx;dx<=max_dx;++dx)
-                      {
-                        elemT current =
-                          weights[dz][dy][dx] * input[z+dz][y+dy][x+dx];
-
-                         if (do_kappa)
-                          current *= 
-                            (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
-                         result += current;
-                      }
-                
-                output[z][y][x] += result * this->penalisation_factor;
-            }              
-        }
-    }
+  compute_weighted_neighbourhood_sums<QuadraticPriorNeighbourTerm<elemT> >
+    (output, input, this->weights, kappa_ptr.get(),
+     this->penalisation_factor, /*add_to_result=*/ true);
   return Succeeded::yes;
 }
 
@@ -0,0 +1,289 @@
+//
+//
+/*!
+
+  \file
+  \ingroup projection
+  \brief Implementation of class stir::RayTracerBackend
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/recon_buildblock/RayTracerBackend.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
+#include <thread>
+#include <exception>
+#include <algorithm>
+
+START_NAMESPACE_STIR
+
+void
+RayTracerBackend::Points::
+reserve(const std::size_t n)
+{
+  x.reserve(n); y.reserve(n); z.reserve(n);
+  ray_x.reserve(n); ray_y.reserve(n); ray_z.reserve(n);
+  norm_const.reserve(n);
+}
+
+void
+RayTracerBackend::Points::
+clear()
+{
+  x.clear(); y.clear(); z.clear();
+  ray_x.clear(); ray_y.clear(); ray_z.clear();
+  norm_const.clear();
+}
+
+//! a batch that is traced by a separate thread
+class RayTracerBackend::Batch
+{
+public:
+  Points points;
+  std::vector<ProjMatrixElemsForOneBinValue> results;
+  //! time spent in trace()
+  double trace_time;
+  //! empty if trace() succeeded
+  std::string error_message;
+  std::thread thread;
+
+  Batch() : trace_time(0.) {}
+};
+
+RayTracerBackend::
+RayTracerBackend(const int chunk_size, const int max_num_batches_in_flight)
+  : chunk_size(chunk_size), voxel_size(0.F,0.F,0.F),
+    max_num_batches_in_flight(max_num_batches_in_flight),
+    num_points_since_execute(0),
+    trace_time(0.), num_points_traced(0), num_batches_traced(0)
+{
+  if (chunk_size < 1)
+    error(boost::format("RayTracerBackend: chunk size should be at least 1, but is %d") % chunk_size);
+  if (max_num_batches_in_flight < 0)
+    error(boost::format("RayTracerBackend: number of batches in flight should be at least 0, but is %d")
+          % max_num_batches_in_flight);
+}
+
+RayTracerBackend::
+~RayTracerBackend()
+{
+  // the results are discarded, so errors are not reported either
+  while (!batches_in_flight.empty())
+    {
+      batches_in_flight.front()->thread.join();
+      batches_in_flight.pop_front();
+    }
+  if (current_points.size() > 0)
+    fill_timer.stop();
+}
+
+int
+RayTracerBackend::
+getQueueLength()
+{
+  return num_points_since_execute;
+}
+
+void
+RayTracerBackend::
+setVoxelSize(CartesianCoordinate3D<float>& voxel_size_v)
+{
+  this->voxel_size = voxel_size_v;
+}
+
+int
+RayTracerBackend::
+get_chunk_size() const
+{
+  return this->chunk_size;
+}
+
+int
+RayTracerBackend::
+get_max_num_batches_in_flight() const
+{
+  return this->max_num_batches_in_flight;
+}
+
+void
+RayTracerBackend::
+schedulePoint(float px, float py, float pz, float rx, float ry, float rz, float norm_const)
+{
+  if (current_points.size() == 0)
+    {
+      current_points.reserve(chunk_size);
+      fill_timer.start();
+    }
+
+  current_points.x.push_back(px);
+  current_points.y.push_back(py);
+  current_points.z.push_back(pz);
+  current_points.ray_x.push_back(rx);
+  current_points.ray_y.push_back(ry);
+  current_points.ray_z.push_back(rz);
+  current_points.norm_const.push_back(norm_const);
+  ++num_points_since_execute;
+
+  if (static_cast<int>(current_points.size()) >= chunk_size)
+    submit_current_batch();
+}
+
+void
+RayTracerBackend::
+submit_current_batch()
+{
+  fill_timer.stop();
+  num_points_traced += current_points.size();
+  ++num_batches_traced;
+
+  if (max_num_batches_in_flight == 0)
+    {
+      HighResWallClockTimer timer;
+      timer.start();
+      trace(current_points, temp_storage);
+      timer.stop();
+      trace_time += timer.value();
+      current_points.clear();
+      return;
+    }
+
+  // make space for the new batch
+  while (static_cast<int>(batches_in_flight.size()) >= max_num_batches_in_flight)
+    finish_oldest_batch();
+
+  std::unique_ptr<Batch> batch_uptr(new Batch);
+  Batch& batch = *batch_uptr;
+  std::swap(batch.points, current_points);
+  batch.thread = std::thread([this, &batch]()
+    {
+      HighResWallClockTimer timer;
+      timer.start();
+      try
+        {
+          this->trace(batch.points, batch.results);
+        }
+      catch (const std::string& message)
+        {
+          batch.error_message = message;
+        }
+      catch (const std::exception& e)
+        {
+          batch.error_message = e.what();
+        }
+      timer.stop();
+      batch.trace_time = timer.value();
+      // free the memory as soon as possible
+      batch.points = Points();
+    });
+  batches_in_flight.push_back(std::move(batch_uptr));
+}
+
+void
+RayTracerBackend::
+finish_oldest_batch()
+{
+  std::unique_ptr<Batch> batch_uptr(std::move(batches_in_flight.front()));
+  batches_in_flight.pop_front();
+
+  wait_timer.start();
+  batch_uptr->thread.join();
+  wait_timer.stop();
+
+  if (!batch_uptr->error_message.empty())
+    error("RayTracerBackend: tracing a batch failed: " + batch_uptr->error_message);
+
+  trace_time += batch_uptr->trace_time;
+  if (temp_storage.empty())
+    temp_storage.swap(batch_uptr->results);
+  else
+    temp_storage.insert(temp_storage.end(),
+                        batch_uptr->results.begin(), batch_uptr->results.end());
+}
+
+void
+RayTracerBackend::
+wait_for_batches_in_flight()
+{
+  while (!batches_in_flight.empty())
+    finish_oldest_batch();
+}
+
+int
+RayTracerBackend::
+execute(std::vector<ProjMatrixElemsForOneBinValue>& retval)
+{
+  if (current_points.size() > 0)
+    submit_current_batch();
+  wait_for_batches_in_flight();
+
+  const int num_traced = static_cast<int>(temp_storage.size());
+  if (retval.empty())
+    retval.swap(temp_storage);
+  else
+    retval.insert(retval.end(), temp_storage.begin(), temp_storage.end());
+  // free memory
+  std::vector<ProjMatrixElemsForOneBinValue>().swap(temp_storage);
+  num_points_since_execute = 0;
+  return num_traced;
+}
+
+double
+RayTracerBackend::
+get_fill_time() const
+{
+  return fill_timer.value();
+}
+
+double
+RayTracerBackend::
+get_trace_time() const
+{
+  return trace_time;
+}
+
+double
+RayTracerBackend::
+get_wait_time() const
+{
+  return wait_timer.value();
+}
+
+std::string
+RayTracerBackend::
+get_timing_report() const
+{
+  return
+    boost::str(boost::format("ray tracer: %1% points in %2% batches (chunk size %3%, %4% in flight): "
+                             "filling %5%s, tracing %6%s, waiting %7%s")
+               % num_points_traced % num_batches_traced
+               % chunk_size % max_num_batches_in_flight
+               % get_fill_time() % get_trace_time() % get_wait_time());
+}
+
+void
+RayTracerBackend::
+reset_timers()
+{
+  fill_timer.reset();
+  wait_timer.reset();
+  trace_time = 0.;
+  num_points_traced = 0;
+  num_batches_traced = 0;
+}
+
+END_NAMESPACE_STIR
@@ -56,18 +56,12 @@ namespace SPECTUB {
 #define DELIMITER1 '#' //delimiter character in input parameter text file
 #define DELIMITER2 '%' //delimiter character in input parameter text file
 
-//... global variables ..............................................
-
-extern wm_da_type wm;
-extern wmh_type wmh; 
-extern float * Rrad;
-
 
 //=============================================================================
 //=== write_wm_FC =============================================================
 //=============================================================================
 
-void write_wm_FC()
+void write_wm_FC( const wm_da_type& wm )
 {
 	FILE *fid;
 	
@@ -121,7 +115,7 @@ void write_wm_FC()
 //=== write_wm_hdr ============================================================
 //=============================================================================
 
-void write_wm_hdr()
+void write_wm_hdr( const wm_da_type& wm, const wmh_type& wmh )
 {
 	ofstream stream1( wm.fn_hdr.c_str() );
 	if( !stream1 ) error_wmtools_SPECT( 31, wm.fn_hdr );  
@@ -203,7 +197,7 @@ void write_wm_hdr()
 //=== write_wm_STIR ===========================================================
 //=============================================================================
 
-void write_wm_STIR()
+void write_wm_STIR( const wm_da_type& wm )
 {
 	int seg_num = 0;             // segment number for STIR matrix (always zero)
 	FILE *fid;
@@ -239,7 +233,7 @@ void write_wm_STIR()
 //=== index_calc ==============================================================
 //=============================================================================
 
-void index_calc ( int *indexs )
+void index_calc ( int *indexs, const wmh_type& wmh )
 {
 	if ( wmh.prj.NOS == 1 ){
 		for ( int i = 0 ; i < wmh.prj.Nang ; i++ ){
@@ -343,7 +337,7 @@ void index_calc ( int *indexs )
 //=== read rotation radius ==================================================
 //=============================================================================
 
-void read_Rrad()
+void read_Rrad( float *Rrad, const wmh_type& wmh )
 {
 	string line;
 	ifstream stream1( wmh.Rrad_fn.c_str() );
@@ -558,7 +552,7 @@ float calc_sigma_v( voxel_type	vox, collim_type COL)
 //=== fill_ang ================================================================
 //=============================================================================
 
-void fill_ang ( angle_type *ang )
+void fill_ang ( angle_type *ang, const float *Rrad, const wmh_type& wmh )
 {
 	float DX    = (float) 0.5 / wmh.psfres ;
 	float dg2rd = (float)M_PI / (float)180. ;
@@ -625,7 +619,7 @@ void fill_ang ( angle_type *ang )
 //=== generate msk ============================================================
 //=============================================================================
 
-void generate_msk ( bool *msk_3d, bool *msk_2d, float *attmap, volume_type * vol )
+void generate_msk ( bool *msk_3d, bool *msk_2d, float *attmap, volume_type * vol, const wmh_type& wmh )
 {
 	//... initialzation of msk to true .........................
 	
@@ -683,7 +677,7 @@ void generate_msk ( bool *msk_3d, bool *msk_2d, float *attmap, volume_type * vol
 		else {
 			//... to read a mask from a (int) file ....................
 			
-			if ( wmh.do_msk_file ) read_msk_file( msk_3d );             
+			if ( wmh.do_msk_file ) read_msk_file( msk_3d, wmh );             
 		}
 	}
 
@@ -728,7 +722,7 @@ void generate_msk ( bool *msk_3d, bool *msk_2d, float *attmap, volume_type * vol
 //=== read_mask file ==========================================================
 //=============================================================================
 
-void read_msk_file( bool *msk )
+void read_msk_file( bool *msk, const wmh_type& wmh )
 {
 	FILE *fid;
 	int *aux;
@@ -750,7 +744,7 @@ void read_msk_file( bool *msk )
 //=== read_att_map ============================================================
 //=============================================================================
 
-void read_att_map( float *attmap )
+void read_att_map( float *attmap, const wmh_type& wmh )
 {
 	FILE *fid;
 	if ( ( fid = fopen( wmh.att_fn.c_str() , "rb") ) == NULL ) error_wmtools_SPECT ( 124, wmh.att_fn );
@@ -774,7 +768,7 @@ void read_att_map( float *attmap )
 //=== max_psf_szb ==========================================================
 //==========================================================================
 
-int max_psf_szb( angle_type *ang )
+int max_psf_szb( const angle_type *ang, const wmh_type& wmh )
 { 
 	int maxszb;
 	float Rrad_max = ang[0].Rrad;
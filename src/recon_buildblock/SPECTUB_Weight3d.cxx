@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <string>
 #include <math.h>
+#include <algorithm>
 
 namespace SPECTUB {
 
@@ -52,84 +53,264 @@ namespace SPECTUB {
 
 using namespace std;
 //==========================================================================
-//=== wm_calculation =======================================================
+//=== weight3d_workspace ===================================================
 //==========================================================================
 
-void wm_calculation( const int kOS,
-					const angle_type *const ang, 
-					voxel_type vox, 
-				        bin_type bin, 
-					const volume_type& vol, 
-					const proj_type& prj, 
-					const float *attmap,
-					const bool *msk_3d,
-					const bool *msk_2d,
-					const int maxszb,
-					const discrf_type *const gaussdens,
-		     const int *const  NITEMS)
+weight3d_workspace::weight3d_workspace( const int maxszb, const wmh_type& wmh )
+	: psf1d_h_val( maxszb ), psf1d_v_val( maxszb ),
+	  psf1d_h_ind( maxszb ), psf1d_v_ind( maxszb )
 {
+	psf1d_h.maxszb = maxszb;
+	psf1d_h.val    = &psf1d_h_val[ 0 ];
+	psf1d_h.ind    = &psf1d_h_ind[ 0 ];
 	
-	float weight;
-	float coeff_att = (float) 1.;
-	int   jp;
-	float eff;
-    
-    //... variables for geometric component ..............................................
+	psf1d_v.maxszb = maxszb;
+	psf1d_v.val    = &psf1d_v_val[ 0 ];
+	psf1d_v.ind    = &psf1d_v_ind[ 0 ];
 	
-    psf1d_type psf1d_h, psf1d_v;
-    
-    psf1d_h.maxszb = maxszb;
-    psf1d_h.val    = new float [ maxszb ];
-    psf1d_h.ind    = new int   [ maxszb ];
-    
-    if ( wmh.do_psf_3d ){
-        psf1d_v.maxszb = maxszb;
-        psf1d_v.val    = new float [ maxszb ];
-        psf1d_v.ind    = new int   [ maxszb ];
-    }
-    
-    psf2da_type psf;
-    
-    psf.maxszb_h = maxszb;
-    if ( wmh.do_psf_3d ) psf.maxszb_v = maxszb;
+	psf.maxszb_h = maxszb;
+	if ( wmh.do_psf_3d ) psf.maxszb_v = maxszb;
 	else psf.maxszb_v = 1;
 	psf.maxszb_t = psf.maxszb_h * psf.maxszb_v;
-    
-	psf.val    = new float [ psf.maxszb_t ];    // allocation for PSF values
-	psf.ib     = new int   [ psf.maxszb_t ];    // allocation for PSF indices
-	psf.jb     = new int   [ psf.maxszb_t ];    // allocation for PSF indices
-
+	
+	psf_val.resize( psf.maxszb_t );
+	psf_ib.resize( psf.maxszb_t );
+	psf_jb.resize( psf.maxszb_t );
+	psf.val = &psf_val[ 0 ];    // allocation for PSF values
+	psf.ib  = &psf_ib[ 0 ];     // allocation for PSF indices
+	psf.jb  = &psf_jb[ 0 ];     // allocation for PSF indices
+	
 	//... variables for attenuation component .............................................
-		
-	attpth_type *attpth = 0; // initialise to avoid compiler warning
-	int sizeattpth = 1; // initialise to avoid compiler warning
 	
 	if ( wmh.do_att || wmh.do_msk_att ){
+		
+		const int sizeattpth = wmh.do_full_att ? psf.maxszb_t : 1;
+		const int maxlng = wmh.vol.Ncol + wmh.vol.Nrow + wmh.vol.Nsli ; // maximum length of an attenuation path
+		
+		attpth.resize( sizeattpth );
+		attpth_dl.resize( sizeattpth, std::vector<float>( maxlng ) );
+		attpth_iv.resize( sizeattpth, std::vector<int>( maxlng ) );
+		
+		for ( int i = 0 ; i < sizeattpth ; i++ ){
+			attpth[ i ].dl     = &attpth_dl[ i ][ 0 ];
+			attpth[ i ].iv     = &attpth_iv[ i ][ 0 ];
+			attpth[ i ].maxlng = maxlng;
+		}
+	}
+}
+
+//==========================================================================
+//=== weight3d_workspace_pool ==============================================
+//==========================================================================
+
+weight3d_workspace_pool::weight3d_workspace_pool()
+	: maxszb( 0 ), wmh()
+{}
 
-		if ( !wmh.do_full_att ) sizeattpth = 1 ;
-		else sizeattpth = psf.maxszb_t ;
+void weight3d_workspace_pool::set_up( const int maxszb_v, const wmh_type& wmh_v )
+{
+	std::lock_guard<std::mutex> lock( mutex );
+	maxszb = maxszb_v;
+	wmh = wmh_v;
+	all_workspaces.clear();
+	free_workspaces.clear();
+}
+
+weight3d_workspace * weight3d_workspace_pool::get_workspace()
+{
+	std::lock_guard<std::mutex> lock( mutex );
+	if ( free_workspaces.empty() ){
+		all_workspaces.push_back( stir::shared_ptr<weight3d_workspace>( new weight3d_workspace( maxszb, wmh ) ) );
+		return all_workspaces.back().get();
+	}
+	weight3d_workspace * const workspace_ptr = free_workspaces.back();
+	free_workspaces.pop_back();
+	return workspace_ptr;
+}
+
+void weight3d_workspace_pool::release_workspace( weight3d_workspace * workspace_ptr )
+{
+	std::lock_guard<std::mutex> lock( mutex );
+	free_workspaces.push_back( workspace_ptr );
+}
+
+//==========================================================================
+//=== fill_psf =============================================================
+//==========================================================================
+
+// PSF (and voxel projection) for the current voxel and angle
+static void fill_psf( weight3d_workspace& ws,
+					  voxel_type& vox,
+					  float * eff,
+					  const angle_type& ang,
+					  const bin_type& bin,
+					  const proj_type& prj,
+					  const discrf_type *const gaussdens,
+					  const wmh_type& wmh )
+{
+	//... x coordinate in the rotated frame ..............................................
+	
+	vox.x1    = vox.x * ang.cos + vox.y * ang.sin ;		
+	
+	//... to project voxels onto the detection plane and to calculate other distances .....
 	
-		attpth = new attpth_type [ sizeattpth ] ;		
-		attpth[ 0 ].maxlng = vol.Ncol + vol.Nrow + vol.Nsli ; // maximum length of an attenuation path
+	voxel_projection( &vox , eff , prj.lngcmd2, wmh );
+	
+	//... correction for PSF ..............................
+	
+	if ( !wmh.do_psf  )	fill_psf_no ( &ws.psf, &ws.psf1d_h, vox, &ang, bin.szdx, wmh );
+	
+	else{
+		
+		if ( wmh.do_psf_3d ) fill_psf_3d ( &ws.psf, &ws.psf1d_h, &ws.psf1d_v, vox, gaussdens, bin.szdx, bin.thdx, bin.thcmd2, wmh );
+		
+		else fill_psf_2d ( &ws.psf, &ws.psf1d_h, vox, gaussdens, bin.szdx, wmh );
+	}
+}
+
+//==========================================================================
+//=== wm_calculation =======================================================
+//==========================================================================
 
-		for (int i = 0 ; i < sizeattpth ; i++ ){
+// weights for all voxels in image row vox.irow, appended to ws.elems
+static void calc_weights_for_image_row( const int kOS,
+										const angle_type *const ang, 
+										voxel_type& vox, 
+										bin_type& bin, 
+										const volume_type& vol, 
+										const proj_type& prj, 
+										const float *attmap,
+										const bool *msk_3d,
+										const bool *msk_2d,
+										const discrf_type *const gaussdens,
+										const wmh_type& wmh,
+										weight3d_workspace& ws )
+{
+	float coeff_att = (float) 1.;
+	float eff;
+	psf2da_type& psf = ws.psf;
+	attpth_type *attpth = ws.attpth.empty() ? 0 : &ws.attpth[ 0 ];
+	
+	vox.y = vol.y0 + vox.irow * vol.szcm ;       // y coordinate of the voxel (index 0->Nrow-1: irow)
+	
+	//=== LOOP2: IMAGE COLUMNS =================================================================
+	
+	for ( vox.icol = 0 ; vox.icol < vol.Ncol ; vox.icol++ ){
+		
+		vox.x  = vol.x0 + vox.icol * vol.szcm ;     // x coordinate of the voxel (index 0->Ncol-1: icol)
+		vox.ip = vox.irow * vol.Ncol + vox.icol ;	 // in-plane index of the voxel considering the slice as an array
+		
+		//... to apply mask .........................................
+		
+		if ( wmh.do_msk){
 			
-			attpth[ i ].dl = new float [ attpth[ 0 ].maxlng ];
-		    attpth[ i ].iv = new int   [ attpth[ 0 ].maxlng ];
-			attpth[ i ].maxlng = attpth[ 0 ].maxlng;
+			if ( !msk_2d[ vox.ip ] ) continue;    // to skip voxel if it is outside the 2d_mask  
 		}
-	}
-	
+		
+		//=== LOOP3: ANGLES INTO SUBSETS ========================================================
+		
+		for( int k = 0 ; k < prj.NangOS ; k++ ){
+			
+			int ka = prj.order[ k + kOS * prj.NangOS ];	// angle index of the current projection (considering the whole set of projections)
+			
+			//... perpendicular distance form voxel to detection plane ...........................
+			
+			vox.dv2dp = vox.x * ang[ ka ].sin - vox.y * ang[ ka ].cos + ang[ ka ].Rrad ;
+			
+			if ( vox.dv2dp <= 0. ) continue;	// skipping voxel if it is beyond the detection plane (corner voxels)
+			
+			fill_psf( ws, vox, &eff, ang[ ka ], bin, prj, gaussdens, wmh );
+			
+			//... correction for attenuation .................................................
+			
+			if ( wmh.do_att ){
+				
+				vox.z = (float)0. ;
+				
+				if ( !wmh.do_full_att ){    // simple correction for attenuation
+					
+					bin.x = ang[ ka ].xbin0 + vox.xd0 * ang[ ka ].cos;   // x coord of the projection of the center of the voxel in the detection line
+					bin.y = ang[ ka ].ybin0 + vox.xd0 * ang[ ka ].sin; 		
+					bin.z = (float)0. ;
+					
+					calc_att_path( bin, vox, vol, &attpth[ 0 ]);
+				}
+				else{                       // full correction for attenuation
+					
+					for ( int i = 0 ; i < psf.Nib ; i++ ){
+						
+						bin.x = ang[ ka ].xbin0 + ang[ ka ].incx * ( (float)psf.ib[ i ] + (float)0.5 );
+						bin.y = ang[ ka ].ybin0 + ang[ ka ].incy * ( (float)psf.ib[ i ] + (float)0.5 );	
+						bin.z = (float)psf.jb[ i ] * vox.thcm ;
+						
+						calc_att_path( bin, vox, vol, &attpth[ i ]);			
+					}
+				}
+			}
+			
+			//=== LOOP4: IMAGE SLICES ================================================================
+			
+			for ( vox.islc = vol.first_sl ; vox.islc < vol.last_sl ; vox.islc++ ){
+				
+				vox.iv = vox.ip + vox.islc * vol.Npix ;   // volume index of the voxel (volume as an array)
+				
+				if ( wmh.do_msk ){
+					if ( !msk_3d[ vox.iv ] ) continue;
+				}
+				
+				if ( wmh.do_att && !wmh.do_full_att ) coeff_att = calc_att( &attpth[ 0 ], attmap , vox.islc, wmh );
+				
+				//... weight matrix values calculation .......................................
+				
+				for ( int ie = 0 ; ie < psf.Nib ; ie++ ){
+					
+					if ( psf.ib[ ie ] < 0 ) continue;
+					if ( psf.ib[ ie ] >= prj.Nbin ) continue;
+					
+					int ks = ( vox.islc + psf.jb[ ie ] );
+					
+					if ( ks < 0 ) continue;
+					if ( ks >= vol.Nsli ) continue;
+					
+					if ( wmh.do_full_att ) coeff_att = calc_att( &attpth[ ie ], attmap, vox.islc, wmh );
+					
+					wm_elem_type elem;
+					elem.jp  = k * prj.Nbp + ks * prj.Nbin + psf.ib[ ie ];
+					elem.iv  = vox.iv;
+					elem.val = psf.val[ ie ] * eff * coeff_att ;
+					ws.elems.push_back( elem );
+				}   
+			}                    // end of LOOP4: image slices
+		}                        // end of LOOP3: projection angle into subset
+	}                            // end of LOOP2: image columns
+}
+
+void wm_calculation( const int kOS,
+					const angle_type *const ang, 
+					voxel_type vox, 
+				        bin_type bin, 
+					const volume_type& vol, 
+					const proj_type& prj, 
+					const float *attmap,
+					const bool *msk_3d,
+					const bool *msk_2d,
+					const discrf_type *const gaussdens,
+					const int *const  NITEMS,
+					const wmh_type& wmh,
+					wm_da_type& wm,
+					weight3d_workspace_pool& workspace_pool,
+					const int num_threads)
+{
 	//... to fill projection indices for STIR format .............................
 	
 	if ( wm.do_save_STIR ){ 
 		
-		jp = -1;											// projection index (row index of the weight matrix )
+		int jp = -1;										// projection index (row index of the weight matrix )
 		int j1;
 		
 		for ( int j = 0 ; j < prj.NangOS ; j++ ){
 			
-			j1 = wmh.index[ j ];			
+			j1 = prj.order[ j + kOS * prj.NangOS ];
 			
 			for ( int k = 0 ; k < prj.Nsli ; k++ ){
 				
@@ -144,166 +325,80 @@ void wm_calculation( const int kOS,
 		}
 	}	
 	
-	//=== LOOP1: IMAGE ROWS =======================================================================
-	
-	for ( vox.irow = 0 ; vox.irow < vol.Nrow ; vox.irow++ ){
-		
-                //cout << "weights: " << 100.*(vox.irow+1)/vol.Nrow << "%" << endl;
-		
-		vox.y = vol.y0 + vox.irow * vol.szcm ;       // y coordinate of the voxel (index 0->Nrow-1: irow)
+	//=== LOOP1: IMAGE ROWS (in parallel) =========================================================
+	
+	// The image rows are processed in blocks. The weights of a block are computed in parallel,
+	// and then copied to wm (in the same order as a sequential loop over the image rows).
+	// This way, only the weights of one block are kept in the workspaces at any time.
+	// Weights of image row irow are stored in workspace_of_row[irow]->elems, from first_elem_of_row[irow].
+	const int rows_per_block = 4 * std::max( num_threads, 1 );
+	std::vector<weight3d_workspace *> workspace_of_row( vol.Nrow );
+	std::vector<std::size_t> first_elem_of_row( vol.Nrow );
+	std::vector<std::size_t> end_elem_of_row( vol.Nrow );
+	std::vector<weight3d_workspace *> used_workspaces;
+	bool wm_too_small = false;
+	
+#ifdef STIR_OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+	{
+		weight3d_workspace * const workspace_ptr = workspace_pool.get_workspace();
+#ifdef STIR_OPENMP
+#pragma omp critical(SPECTUB_WM_CALCULATION)
+#endif
+		used_workspaces.push_back( workspace_ptr );
 		
-		//=== LOOP2: IMAGE COLUMNS =================================================================
+		voxel_type vox_of_thread = vox;
+		bin_type bin_of_thread = bin;
 		
-		for ( vox.icol = 0 ; vox.icol < vol.Ncol ; vox.icol++ ){
+		for ( int first_row = 0 ; first_row < vol.Nrow ; first_row += rows_per_block ){
 			
-			vox.x  = vol.x0 + vox.icol * vol.szcm ;     // x coordinate of the voxel (index 0->Ncol-1: icol)
-			vox.ip = vox.irow * vol.Ncol + vox.icol ;	 // in-plane index of the voxel considering the slice as an array
- 			
-			//... to apply mask .........................................
+			const int end_row = std::min( first_row + rows_per_block, vol.Nrow );
+			workspace_ptr->elems.clear();
 			
-			if ( wmh.do_msk){
+#ifdef STIR_OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+			for ( int irow = first_row ; irow < end_row ; irow++ ){
 				
-				if ( !msk_2d[ vox.ip ] ) continue;    // to skip voxel if it is outside the 2d_mask  
+				workspace_of_row[ irow ] = workspace_ptr;
+				first_elem_of_row[ irow ] = workspace_ptr->elems.size();
+				vox_of_thread.irow = irow;
+				calc_weights_for_image_row( kOS, ang, vox_of_thread, bin_of_thread, vol, prj, attmap, msk_3d, msk_2d, gaussdens, wmh, *workspace_ptr );
+				end_elem_of_row[ irow ] = workspace_ptr->elems.size();
 			}
 			
-			//=== LOOP3: ANGLES INTO SUBSETS ========================================================
+			//... fill wm values of this block (error() cannot be called inside the parallel region) ...
 			
-			for( int k = 0 ; k < prj.NangOS ; k++ ){
-				
-				int ka = wmh.index[ k ];			// angle index of the current projection (considering the whole set of projections)
-						
-				//... perpendicular distance form voxel to detection plane ...........................
-				
-				vox.dv2dp = vox.x * ang[ ka ].sin - vox.y * ang[ ka ].cos + ang[ ka ].Rrad ;
-				
-				if ( vox.dv2dp <= 0. ) continue;	// skipping voxel if it is beyond the detection plane (corner voxels)
-				
-				//... x coordinate in the rotated frame ..............................................
-				
-				vox.x1    = vox.x * ang[ ka ].cos + vox.y * ang[ ka ].sin ;		
-				
-				//... to project voxels onto the detection plane and to calculate other distances .....
-				
-                voxel_projection( &vox , &eff , prj.lngcmd2 );
-				
-				//... setting PSF to zero	.........................................	
-				
-		//		for ( int i = 0 ; i < nel ; i++ ){
-		//			
-		//			psf.val[ i ] = (float)0.;
-		//			psf.ib[ i ]  = psf.jb[ i ] = 0;
-		//		}	
-				
-				//... correction for PSF ..............................
-				
-				if ( !wmh.do_psf  )	fill_psf_no ( &psf, &psf1d_h, vox, &ang[ ka ], bin.szdx );
-				
-				else{
-					
-					if ( wmh.do_psf_3d ) fill_psf_3d ( &psf, &psf1d_h, &psf1d_v, vox, gaussdens, bin.szdx, bin.thdx, bin.thcmd2 );
-					
-					else fill_psf_2d ( &psf, &psf1d_h, vox, gaussdens, bin.szdx );
-				}
+#ifdef STIR_OPENMP
+#pragma omp single
+#endif
+			for ( int irow = first_row ; irow < end_row && !wm_too_small ; irow++ ){
 				
-				//... correction for attenuation .................................................
+				const std::vector<wm_elem_type>& elems = workspace_of_row[ irow ]->elems;
 				
-				if ( wmh.do_att ){
+				for ( std::size_t i = first_elem_of_row[ irow ] ; i < end_elem_of_row[ irow ] ; i++ ){
 					
-					vox.z = (float)0. ;
+					const int jp = elems[ i ].jp;
+					wm.col[ jp ][ wm.ne[ jp ] ] = elems[ i ].iv;
+					wm.val[ jp ][ wm.ne[ jp ] ] = elems[ i ].val;
+					wm.ne[ jp ]++;
 					
-					if ( !wmh.do_full_att ){    // simple correction for attenuation
-						
-						bin.x = ang[ ka ].xbin0 + vox.xd0 * ang[ ka ].cos;   // x coord of the projection of the center of the voxel in the detection line
-						bin.y = ang[ ka ].ybin0 + vox.xd0 * ang[ ka ].sin; 		
-						bin.z = (float)0. ;
-						
-						calc_att_path( bin, vox, vol, &attpth[ 0 ]);
-					}
-					else{                       // full correction for attenuation
-						
-						for ( int i = 0 ; i < psf.Nib ; i++ ){
-							
-							bin.x = ang[ ka ].xbin0 + ang[ ka ].incx * ( (float)psf.ib[ i ] + (float)0.5 );
-							bin.y = ang[ ka ].ybin0 + ang[ ka ].incy * ( (float)psf.ib[ i ] + (float)0.5 );	
-							bin.z = (float)psf.jb[ i ] * vox.thcm ;
-							
-							calc_att_path( bin, vox, vol, &attpth[ i ]);			
-						}
+					if ( wm.ne[ jp ] >= NITEMS[ jp ] ){
+						wm_too_small = true;
+						break;
 					}
 				}
-			
-				//=== LOOP4: IMAGE SLICES ================================================================
-				
-				for ( vox.islc = vol.first_sl ; vox.islc < vol.last_sl ; vox.islc++ ){
-					
-					vox.iv = vox.ip + vox.islc * vol.Npix ;   // volume index of the voxel (volume as an array)
-					
-					if ( wmh.do_msk ){
-						if ( !msk_3d[ vox.iv ] ) continue;
-					}
-					
-					if ( wmh.do_att && !wmh.do_full_att ) coeff_att = calc_att( &attpth[ 0 ], attmap , vox.islc );
-					
-					//... weight matrix values calculation .......................................
-					
-					for ( int ie = 0 ; ie < psf.Nib ; ie++ ){
-						
-						if ( psf.ib[ ie ] < 0 ) continue;
-						if ( psf.ib[ ie ] >= prj.Nbin ) continue;
-				
-                        int ks = ( vox.islc + psf.jb[ ie ] );
-						
-						if ( ks < 0 ) continue;
-						if ( ks >= vol.Nsli ) continue;
-
-						jp = k * prj.Nbp + ks * prj.Nbin + psf.ib[ ie ];
-						
-						if ( wmh.do_full_att ) coeff_att = calc_att( &attpth[ ie ], attmap, vox.islc );
-						
-						weight = psf.val[ ie ] * eff * coeff_att ;
-                        
-                        //... fill image STIR indices ...........................
-						
-                        if ( wm.do_save_STIR ){
-							wm.nx[ vox.iv ] = (short int)( vox.icol - (int) floor( vol.Ncold2 ) );  // centered index for STIR format
-							wm.ny[ vox.iv ] = (short int)( vox.irow - (int) floor( vol.Nrowd2 ) );  // centered index for STIR format
-							wm.nz[ vox.iv ] = (short int)  vox.islc ;                               // non-centered index for STIR format
-						}
-                        
-                        //... fill wm values .....................
-                        
-						wm.col[ jp ][ wm.ne[ jp ] ] = vox.iv;
-						wm.val[ jp ][ wm.ne[ jp ] ] = weight;
-						wm.ne[ jp ]++;
-						
-						if ( wm.ne[ jp ] >= NITEMS[ jp ] ) error_weight3d(45, "" );
-					}   
-				}                    // end of LOOP4: image slices
-			}                        // end of LOOP3: projection angle into subset
-		}                            // end of LOOP2: image rows		
-	}                                // end of LOOP1: image cols
-	
-    //... detele allocated memory ..............
-    
-    delete [] psf1d_h.val ;
-	delete [] psf1d_h.ind ;
-    
-    if ( wmh.do_psf_3d ){
-        delete [] psf1d_v.val ;
-        delete [] psf1d_v.ind ;
-	}
-
-    delete [] psf.val;
-	delete [] psf.ib;
-	delete [] psf.jb;
-	
-	if ( wmh.do_att ){
-		for ( int i = 0 ; i < sizeattpth ; i++ ){
-			delete [] attpth[ i ].dl;
-			delete [] attpth[ i ].iv;
+			}
 		}
-		delete [] attpth;
+		
+		// free the memory, such that workspaces in the pool do not keep the capacity of the largest block
+		std::vector<wm_elem_type>().swap( workspace_ptr->elems );
 	}
+	
+	for ( std::size_t i = 0 ; i < used_workspaces.size() ; i++ ) workspace_pool.release_workspace( used_workspaces[ i ] );
+	
+	if ( wm_too_small ) error_weight3d(45, "" );
 }
 
 
@@ -319,37 +414,16 @@ void wm_size_estimation (int kOS,
 						 const proj_type& prj, 
 						 const bool * const msk_3d,
 						 const bool *const msk_2d,
-						 const int maxszb,
 						 const discrf_type * const gaussdens,
-						 int *NITEMS)
+						 int *NITEMS,
+						 const wmh_type& wmh,
+						 weight3d_workspace_pool& workspace_pool)
 {
 	int   jp;
 	float eff;
 	
-    //... variables for geometric component ..............................................
-	
-    psf1d_type psf1d_h, psf1d_v;
-    
-    psf1d_h.maxszb = maxszb;
-    psf1d_h.val    = new float [ maxszb ];
-    psf1d_h.ind    = new int   [ maxszb ];
-    
-    if ( wmh.do_psf_3d ){
-        psf1d_v.maxszb = maxszb;
-        psf1d_v.val    = new float [ maxszb ];
-        psf1d_v.ind    = new int   [ maxszb ];
-    }
-    
-    psf2da_type psf;
-    
-    psf.maxszb_h = maxszb;
-    if ( wmh.do_psf_3d ) psf.maxszb_v = maxszb;
-	else psf.maxszb_v = 1;
-	psf.maxszb_t = psf.maxszb_h * psf.maxszb_v;
-    
-	psf.val    = new float [ psf.maxszb_t ];    // allocation for PSF values
-	psf.ib     = new int   [ psf.maxszb_t ];    // allocation for PSF indices
-	psf.jb     = new int   [ psf.maxszb_t ];    // allocation for PSF indices
+	weight3d_workspace& ws = *workspace_pool.get_workspace();
+	const psf2da_type& psf = ws.psf;
 	
 	//=== LOOP1: IMAGE ROWS =======================================================================
 	
@@ -375,7 +449,7 @@ void wm_size_estimation (int kOS,
 			
 			for( int k = 0 ; k < prj.NangOS ; k++ ){
 				
-				int ka = wmh.index[ k ];			// angle index of the current projection (considering the whole set of projections)
+				int ka = prj.order[ k + kOS * prj.NangOS ];	// angle index of the current projection (considering the whole set of projections)
 				
 				//... perpendicular distance form voxel to detection plane ...........................
 				
@@ -383,32 +457,7 @@ void wm_size_estimation (int kOS,
 						
 				if ( vox.dv2dp <= 0. ) continue;	// skipping voxel if it is beyond the detection plane (corner voxels)
 				
-				//... x coordinate in the rotated frame ..............................................
-				
-				vox.x1    = vox.x * ang[ ka ].cos + vox.y * ang[ ka ].sin ;		
-				
-				//... to project voxels onto the detection plane and to calculate other distances .....
-				
-                voxel_projection( &vox , &eff , prj.lngcmd2 );
-				
-				//... setting PSF to zero	.........................................	
-				
-//				for ( int i = 0 ; i < psf.maxszb ; i++ ){
-//					psf.val[ i ] = (float) 0.;
-//					psf.ib[ i ] = psf.jb[ i ] = 0;
-//				}
-				
-				//... correction for PSF ..............................	
-				
-				if ( !wmh.do_psf  )	fill_psf_no ( &psf, &psf1d_h, vox, &ang[ ka ], bin.szdx );
-				
-				else{
-					
-					if ( wmh.do_psf_3d ) fill_psf_3d ( &psf, &psf1d_h, &psf1d_v, vox, gaussdens, bin.szdx, bin.thdx, bin.thcmd2 );
-					
-					else fill_psf_2d ( &psf, &psf1d_h, vox, gaussdens, bin.szdx );
-				}
-
+				fill_psf( ws, vox, &eff, ang[ ka ], bin, prj, gaussdens, wmh );
 				
                 //=== LOOP4: IMAGE SLICES ================================================================
 				
@@ -441,19 +490,7 @@ void wm_size_estimation (int kOS,
 		}                            // end of LOOP2: image rows		
 	}                                // end of LOOP1: image cols
 
-    //... detele allocated memory ..............
-    
-    delete [] psf1d_h.val ;
-	delete [] psf1d_h.ind ;
-    
-    if ( wmh.do_psf_3d ){
-        delete [] psf1d_v.val ;
-        delete [] psf1d_v.ind ;
-	}
-    
-    delete [] psf.val;
-	delete [] psf.ib;
-	delete [] psf.jb;
+	workspace_pool.release_workspace( &ws );
 }	
 
 //==========================================================================
@@ -535,7 +572,7 @@ void calc_vxprj( angle_type *ang )
 //=== voxel_projection =====================================================
 //==========================================================================
 
-void voxel_projection ( voxel_type *vox, float * eff, float lngcmd2)
+void voxel_projection ( voxel_type *vox, float * eff, float lngcmd2, const wmh_type& wmh )
 {
 	
 	if ( wmh.COL.do_fb ){				// fan_beam
@@ -566,7 +603,7 @@ void voxel_projection ( voxel_type *vox, float * eff, float lngcmd2)
 //=== fill_psf_no ==========================================================
 //==========================================================================
 
-void fill_psf_no( psf2da_type *psf, psf1d_type * psf1d_h, const voxel_type& vox, angle_type const *const ang , float szdx )
+void fill_psf_no( psf2da_type *psf, psf1d_type * psf1d_h, const voxel_type& vox, angle_type const *const ang , float szdx, const wmh_type& wmh )
 {
 	psf1d_h->sgmcm   = vox.szcm;
 
@@ -580,7 +617,7 @@ void fill_psf_no( psf2da_type *psf, psf1d_type * psf1d_h, const voxel_type& vox,
 	psf1d_h->lngcmd2 = psf1d_h->lngcm / (float)2.;
 	psf1d_h->efres   = ang->vxprj.res * psf1d_h->sgmcm;  // to resize discretization resolution once applied sgmcm
 	
-	calc_psf_bin( vox.xd0, wmh.prj.szcm, &ang->vxprj, psf1d_h );
+	calc_psf_bin( vox.xd0, wmh.prj.szcm, &ang->vxprj, psf1d_h, wmh );
     
     for ( int ie = 0 ; ie < psf1d_h->Nib ; ie++ ){
         
@@ -595,7 +632,7 @@ void fill_psf_no( psf2da_type *psf, psf1d_type * psf1d_h, const voxel_type& vox,
 //=== fill_psf_2d ==========================================================
 //==========================================================================
 
-void fill_psf_2d( psf2da_type *psf, psf1d_type * psf1d_h, const voxel_type& vox, discrf_type const* const gaussdens, float szdx )
+void fill_psf_2d( psf2da_type *psf, psf1d_type * psf1d_h, const voxel_type& vox, discrf_type const* const gaussdens, float szdx, const wmh_type& wmh )
 {
  
     psf1d_h->sgmcm   = calc_sigma_h( vox, wmh.COL );
@@ -606,7 +643,7 @@ void fill_psf_2d( psf2da_type *psf, psf1d_type * psf1d_h, const voxel_type& vox,
 	
 	psf1d_h->efres   = gaussdens->res * psf1d_h->sgmcm ;
 	
-	calc_psf_bin( vox.xd0, wmh.prj.szcm, gaussdens, psf1d_h );
+	calc_psf_bin( vox.xd0, wmh.prj.szcm, gaussdens, psf1d_h, wmh );
     
     for ( int ie = 0 ; ie < psf1d_h->Nib ; ie++ ){
         
@@ -625,7 +662,8 @@ void fill_psf_2d( psf2da_type *psf, psf1d_type * psf1d_h, const voxel_type& vox,
 void fill_psf_3d (psf2da_type *psf,
                   psf1d_type *psf1d_h,
                   psf1d_type *psf1d_v,
-                  const voxel_type& vox, discrf_type const * const gaussdens, float szdx, float thdx, float thcmd2 )
+                  const voxel_type& vox, discrf_type const * const gaussdens, float szdx, float thdx, float thcmd2,
+                  const wmh_type& wmh )
 {
 	
 	//... horizontal component ...........................
@@ -645,7 +683,7 @@ void fill_psf_3d (psf2da_type *psf,
 	
 	//... calculation of the horizontal component of psf ...................
 	
-	calc_psf_bin( vox.xd0, wmh.prj.szcm, gaussdens, psf1d_h );
+	calc_psf_bin( vox.xd0, wmh.prj.szcm, gaussdens, psf1d_h, wmh );
 
 	//... vertical component ..............................
 	
@@ -664,7 +702,7 @@ void fill_psf_3d (psf2da_type *psf,
 	
 	//... calculation of the vertical component of psf ....................
 	
-	calc_psf_bin( thcmd2, wmh.prj.thcm, gaussdens, psf1d_v );
+	calc_psf_bin( thcmd2, wmh.prj.thcm, gaussdens, psf1d_v, wmh );
 	
     //... mixing and setting PSF area to 1 (to correct for tail truncation of Gaussian function) .....
 	
@@ -708,7 +746,8 @@ void fill_psf_3d (psf2da_type *psf,
 void calc_psf_bin (float center_psf,
 				   float binszcm,
 				   discrf_type const * const vxprj,
-				   psf1d_type *psf)
+				   psf1d_type *psf,
+				   const wmh_type& wmh)
 {
 	float weight, preval;
 
@@ -935,7 +974,7 @@ int comp_dist( float dx,
 //=== cal_att =================================================================
 //=============================================================================
 
-float calc_att( const attpth_type *const attpth, const float *const attmap , int nsli ){
+float calc_att( const attpth_type *const attpth, const float *const attmap , int nsli, const wmh_type& wmh ){
 	
 	float att_coef = (float)0.;
 	int iv;
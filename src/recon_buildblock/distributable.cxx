@@ -50,14 +50,23 @@
 #include "stir/ViewSegmentNumbers.h"
 #include "stir/CPUTimer.h"
 #include "stir/HighResWallClockTimer.h"
+#include "stir/PerformanceTrace.h"
 #include "stir/recon_buildblock/ForwardProjectorByBin.h"
 #include "stir/recon_buildblock/BackProjectorByBin.h"
 #include "stir/recon_buildblock/BinNormalisation.h"
 #include "stir/recon_buildblock/find_basic_vs_nums_in_subsets.h"
+#include "stir/recon_buildblock/ParallelImageAccumulator.h"
 #include "stir/is_null_ptr.h"
 #include "stir/info.h"
 #include <boost/format.hpp>
 #include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <string>
 //#include "stir/recon_buildblock/PoissonLogLikelihoodWithLinearModelForMeanAndProjData.h" // needed for RPC functions
 
 #ifdef STIR_MPI
@@ -73,8 +82,6 @@
 #endif
 #include "stir/num_threads.h"
 
-#include<chrono>
-
 START_NAMESPACE_STIR
 
 /* WARNING: the sequence of steps here has to match what is on the receiving end 
@@ -178,20 +185,32 @@ void get_viewgrams(shared_ptr<RelatedViewgrams<float> >& y,
                    const ViewSegmentNumbers& view_segment_num
                    )
 {
+  PerformanceTraceScope trace_scope("read data");
+  // exceptions cannot leave a critical section, so they are rethrown afterwards
+  std::exception_ptr exception_ptr;
   if (!is_null_ptr(binwise_correction))
     {
 #ifdef STIR_OPENMP
 #pragma omp critical(ADDSINO)
 #endif
+      try
+        {
 #if !defined(_MSC_VER) || _MSC_VER>1300
-      additive_binwise_correction_viewgrams.reset(
-        new RelatedViewgrams<float>
-        (binwise_correction->get_related_viewgrams(view_segment_num, symmetries_ptr)));
+          additive_binwise_correction_viewgrams.reset(
+            new RelatedViewgrams<float>
+            (binwise_correction->get_related_viewgrams(view_segment_num, symmetries_ptr)));
 #else
-      RelatedViewgrams<float> tmp(binwise_correction->
-                                  get_related_viewgrams(view_segment_num, symmetries_ptr));
-      additive_binwise_correction_viewgrams.reset(new RelatedViewgrams<float>(tmp));
+          RelatedViewgrams<float> tmp(binwise_correction->
+                                      get_related_viewgrams(view_segment_num, symmetries_ptr));
+          additive_binwise_correction_viewgrams.reset(new RelatedViewgrams<float>(tmp));
 #endif
+        }
+      catch (...)
+        {
+          exception_ptr = std::current_exception();
+        }
+      if (exception_ptr)
+        std::rethrow_exception(exception_ptr);
     }
                         
   if (read_from_proj_dat)
@@ -199,20 +218,30 @@ void get_viewgrams(shared_ptr<RelatedViewgrams<float> >& y,
 #ifdef STIR_OPENMP
 #pragma omp critical(VIEW)
 #endif
+      try
+        {
 #if !defined(_MSC_VER) || _MSC_VER>1300
-      y.reset(new RelatedViewgrams<float>
-	      (proj_dat_ptr->get_related_viewgrams(view_segment_num, symmetries_ptr)));
+          y.reset(new RelatedViewgrams<float>
+                  (proj_dat_ptr->get_related_viewgrams(view_segment_num, symmetries_ptr)));
 #else
-      // workaround VC++ 6.0 bug
-      RelatedViewgrams<float> tmp(proj_dat_ptr->
-                                  get_related_viewgrams(view_segment_num, symmetries_ptr));
-      y.reset(new RelatedViewgrams<float>(tmp));
+          // workaround VC++ 6.0 bug
+          RelatedViewgrams<float> tmp(proj_dat_ptr->
+                                      get_related_viewgrams(view_segment_num, symmetries_ptr));
+          y.reset(new RelatedViewgrams<float>(tmp));
 #endif        
+        }
+      catch (...)
+        {
+          exception_ptr = std::current_exception();
+        }
+      if (exception_ptr)
+        std::rethrow_exception(exception_ptr);
     }
   else
     {
       y.reset(new RelatedViewgrams<float>
 	      (proj_dat_ptr->get_empty_related_viewgrams(view_segment_num, symmetries_ptr)));
+      y->fill(1.F);
     }
 
   // multiplicative correction
@@ -224,7 +253,17 @@ void get_viewgrams(shared_ptr<RelatedViewgrams<float> >& y,
 #ifdef STIR_OPENMP
 #pragma omp critical(MULT)
 #endif
-      normalisation_sptr->undo(*mult_viewgrams_sptr,start_time_of_frame,end_time_of_frame);
+      try
+        {
+          PerformanceTraceScope undo_trace_scope("normalisation undo");
+          normalisation_sptr->undo(*mult_viewgrams_sptr,start_time_of_frame,end_time_of_frame);
+        }
+      catch (...)
+        {
+          exception_ptr = std::current_exception();
+        }
+      if (exception_ptr)
+        std::rethrow_exception(exception_ptr);
     }
                         
   if (view_segment_num.segment_num()==0 && zero_seg0_end_planes)
@@ -235,6 +274,174 @@ void get_viewgrams(shared_ptr<RelatedViewgrams<float> >& y,
     }
 }
 
+namespace {
+
+//! Reads RelatedViewgrams for distributable_computation() in separate threads
+/*! The elements are put in a queue of at most \c depth elements (including those
+    that are being read). With more than 1 thread, they are not necessarily in the
+    order of \c vs_nums_to_process.
+*/
+class RelatedViewgramsPrefetcher
+{
+public:
+  struct Element
+  {
+    ViewSegmentNumbers view_segment_num;
+    shared_ptr<RelatedViewgrams<float> > y;
+    shared_ptr<RelatedViewgrams<float> > additive_binwise_correction_viewgrams;
+    shared_ptr<RelatedViewgrams<float> > mult_viewgrams_sptr;
+  };
+  //! type of the function that reads the viewgrams for \c element.view_segment_num
+  typedef std::function<void (Element& element)> read_function_type;
+
+  RelatedViewgramsPrefetcher(const std::vector<ViewSegmentNumbers>& vs_nums_to_process,
+                             const int depth, const int num_threads,
+                             const read_function_type& read_function)
+    : vs_nums_to_process(vs_nums_to_process), depth(static_cast<std::size_t>(depth)),
+      read_function(read_function),
+      next_index(0), num_reserved(0), num_threads_running(num_threads), stop(false),
+      starvation_time(0.), read_time(0.), full_wait_time(0.)
+  {
+    for (int t=0; t<num_threads; ++t)
+      threads.push_back(std::thread(&RelatedViewgramsPrefetcher::read_loop, this));
+  }
+
+  ~RelatedViewgramsPrefetcher()
+  {
+    finish();
+  }
+
+  //! stops reading, and waits for the I/O threads
+  void finish()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    not_full.notify_all();
+    for (std::size_t t=0; t<threads.size(); ++t)
+      threads[t].join();
+    threads.clear();
+  }
+
+  //! waits for the next element
+  /*! Returns \c false if there are no more elements, or reading failed. */
+  bool get_next(Element& element)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queue.empty() && !stop && num_threads_running > 0)
+      {
+        PerformanceTraceScope trace_scope("wait for data");
+        HighResWallClockTimer timer;
+        timer.start();
+        not_empty.wait(lock, [this]() { return !queue.empty() || stop || num_threads_running == 0; });
+        timer.stop();
+        starvation_time += timer.value();
+      }
+    if (queue.empty() || stop)
+      return false;
+    element = queue.front();
+    queue.pop_front();
+    --num_reserved;
+    not_full.notify_one();
+    return true;
+  }
+
+  //! calls error() if reading failed
+  void check_for_errors() const
+  {
+    if (!error_message.empty())
+      error("distributable_computation: reading data failed: " + error_message);
+  }
+
+  //! \name Timing information (only reliable after finish())
+  //@{
+  //! total time that the computation threads waited for data
+  double get_starvation_time() const { return starvation_time; }
+  //! total time spent reading (summed over the I/O threads)
+  double get_read_time() const { return read_time; }
+  //! total time that the I/O threads waited for space in the queue
+  double get_full_wait_time() const { return full_wait_time; }
+  //@}
+
+private:
+  const std::vector<ViewSegmentNumbers> vs_nums_to_process;
+  const std::size_t depth;
+  const read_function_type read_function;
+
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::deque<Element> queue;
+  //! next index in vs_nums_to_process to read
+  std::size_t next_index;
+  //! elements in the queue, or being read
+  std::size_t num_reserved;
+  int num_threads_running;
+  bool stop;
+  std::string error_message;
+  double starvation_time;
+  double read_time;
+  double full_wait_time;
+
+  std::vector<std::thread> threads;
+
+  void read_loop()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stop && next_index < vs_nums_to_process.size())
+      {
+        if (num_reserved >= depth)
+          {
+            HighResWallClockTimer timer;
+            timer.start();
+            not_full.wait(lock, [this]() { return num_reserved < depth || stop; });
+            timer.stop();
+            full_wait_time += timer.value();
+            continue;
+          }
+        Element element;
+        element.view_segment_num = vs_nums_to_process[next_index++];
+        ++num_reserved;
+
+        lock.unlock();
+        HighResWallClockTimer timer;
+        timer.start();
+        std::string message;
+        try
+          {
+            read_function(element);
+          }
+        catch (const std::string& m)
+          {
+            message = m.empty() ? "unknown error" : m;
+          }
+        catch (const std::exception& e)
+          {
+            message = e.what();
+          }
+        timer.stop();
+        lock.lock();
+
+        read_time += timer.value();
+        if (!message.empty())
+          {
+            error_message = message;
+            stop = true;
+            not_empty.notify_all();
+            not_full.notify_all();
+            break;
+          }
+        queue.push_back(element);
+        not_empty.notify_one();
+      }
+    --num_threads_running;
+    not_empty.notify_all();
+  }
+};
+
+} // end of unnamed namespace
+
 #ifdef STIR_MPI
 void send_viewgrams(const shared_ptr<RelatedViewgrams<float> >& y,
                     const shared_ptr<RelatedViewgrams<float> >& additive_binwise_correction_viewgrams,
@@ -296,7 +503,10 @@ void distributable_computation(
                                const double start_time_of_frame,
                                const double end_time_of_frame,
                                RPC_process_related_viewgrams_type * RPC_process_related_viewgrams,
-                               DistributedCachingInformation* caching_info_ptr)
+                               DistributedCachingInformation* caching_info_ptr,
+                               const int prefetch_depth,
+                               const int num_prefetch_threads,
+                               const int max_num_partial_images)
 
 {
 #ifdef STIR_MPI 
@@ -380,6 +590,13 @@ void distributable_computation(
   assert(subset_num < num_subsets);
   
   assert(!is_null_ptr(proj_dat_ptr));
+
+  if (prefetch_depth < 0)
+    error(boost::format("distributable_computation: prefetch depth should be at least 0, but is %d") % prefetch_depth);
+  if (num_prefetch_threads < 1)
+    error(boost::format("distributable_computation: number of prefetch threads should be at least 1, but is %d") % num_prefetch_threads);
+  if (max_num_partial_images < 0)
+    error(boost::format("distributable_computation: maximum number of partial images should be at least 0, but is %d") % max_num_partial_images);
   
   if (output_image_ptr != NULL)
     output_image_ptr->fill(0);
@@ -407,10 +624,36 @@ void distributable_computation(
   //double total_seq_rpc_time=0.0; //sums up times used for RPC_process_related_viewgrams
 
 #ifdef STIR_OPENMP
-  std::vector< shared_ptr<DiscretisedDensity<3,float> > > local_output_image_sptrs;
+  const int num_io_threads = num_prefetch_threads;
+#else
+  // get_viewgrams() relies on OpenMP critical sections for serialising reads
+  const int num_io_threads = 1;
+#endif
+  shared_ptr<RelatedViewgramsPrefetcher> prefetcher_sptr;
+  if (prefetch_depth > 0)
+    {
+      prefetcher_sptr.reset(
+        new RelatedViewgramsPrefetcher(vs_nums_to_process, prefetch_depth, num_io_threads,
+                                       [&](RelatedViewgramsPrefetcher::Element& element)
+                                       {
+                                         get_viewgrams(element.y, element.additive_binwise_correction_viewgrams,
+                                                       element.mult_viewgrams_sptr,
+                                                       proj_dat_ptr, read_from_proj_dat,
+                                                       zero_seg0_end_planes,
+                                                       binwise_correction,
+                                                       normalisation_sptr, start_time_of_frame, end_time_of_frame,
+                                                       symmetries_ptr, element.view_segment_num);
+                                       }));
+    }
+
+#ifdef STIR_OPENMP
+  shared_ptr<ParallelImageAccumulator> accumulator_sptr;
+  if (output_image_ptr != NULL)
+    accumulator_sptr.reset(new ParallelImageAccumulator(*output_image_ptr, max_num_partial_images));
   std::vector<double> local_log_likelihoods;
   std::vector<int> local_counts, local_count2s;
-#pragma omp parallel shared(local_output_image_sptrs, local_log_likelihoods, local_counts, local_count2s)
+  std::string read_error_message;
+#pragma omp parallel shared(accumulator_sptr, local_log_likelihoods, local_counts, local_count2s, read_error_message)
 #endif
   // start of threaded section if openmp
   { 
@@ -418,7 +661,6 @@ void distributable_computation(
 #pragma omp single
     {
       std::cerr << "Starting loop with " << omp_get_num_threads() << " threads\n"; 
-      local_output_image_sptrs.resize(omp_get_max_threads(), shared_ptr<DiscretisedDensity<3,float> >());
       local_log_likelihoods.resize(omp_get_max_threads(), 0.);
       local_counts.resize(omp_get_max_threads(), 0);
       local_count2s.resize(omp_get_max_threads(), 0);
@@ -428,21 +670,56 @@ void distributable_computation(
     // note: older versions of openmp need an int as loop
     for (int i=0; i<static_cast<int>(vs_nums_to_process.size()); ++i)
       {
-	//std::cout << "viewgram iteration start" << std::endl;
-	auto start_iteration = std::chrono::high_resolution_clock::now();
-
-        const ViewSegmentNumbers view_segment_num=vs_nums_to_process[i];
+        ViewSegmentNumbers view_segment_num;
 
         shared_ptr<RelatedViewgrams<float> > y;
         shared_ptr<RelatedViewgrams<float> > additive_binwise_correction_viewgrams;
         shared_ptr<RelatedViewgrams<float> > mult_viewgrams_sptr;
 
-        get_viewgrams(y, additive_binwise_correction_viewgrams, mult_viewgrams_sptr,
-                      proj_dat_ptr, read_from_proj_dat,
-                      zero_seg0_end_planes,
-                      binwise_correction,
-                      normalisation_sptr, start_time_of_frame, end_time_of_frame,
-                      symmetries_ptr, view_segment_num);
+        if (!is_null_ptr(prefetcher_sptr))
+          {
+            // take any element that has been read (there are as many as loop iterations)
+            RelatedViewgramsPrefetcher::Element element;
+            if (!prefetcher_sptr->get_next(element))
+              continue; // reading failed, reported after the loop
+            view_segment_num = element.view_segment_num;
+            y = element.y;
+            additive_binwise_correction_viewgrams = element.additive_binwise_correction_viewgrams;
+            mult_viewgrams_sptr = element.mult_viewgrams_sptr;
+          }
+        else
+          {
+            view_segment_num = vs_nums_to_process[i];
+#ifdef STIR_OPENMP
+            // exceptions cannot leave the parallel section, so report the error after the loop
+            std::string message;
+            try
+              {
+#endif
+                get_viewgrams(y, additive_binwise_correction_viewgrams, mult_viewgrams_sptr,
+                              proj_dat_ptr, read_from_proj_dat,
+                              zero_seg0_end_planes,
+                              binwise_correction,
+                              normalisation_sptr, start_time_of_frame, end_time_of_frame,
+                              symmetries_ptr, view_segment_num);
+#ifdef STIR_OPENMP
+              }
+            catch (const std::string& m)
+              {
+                message = m.empty() ? "unknown error" : m;
+              }
+            catch (const std::exception& e)
+              {
+                message = e.what();
+              }
+            if (!message.empty())
+              {
+#pragma omp critical(DISTRIBUTABLEREADERROR)
+                read_error_message = message;
+                continue;
+              }
+#endif
+          }
 #ifdef STIR_MPI     
 
           //send viewgrams, the slave will immediatelly start calculation
@@ -478,19 +755,24 @@ void distributable_computation(
                % view_segment_num.segment_num() % view_segment_num.view_num());
 #endif
 #ifdef STIR_OPENMP
-          if (output_image_ptr != NULL)
+          DiscretisedDensity<3,float>* local_output_image_ptr = NULL;
+          int partial_image_num = -1;
+          if (!is_null_ptr(accumulator_sptr))
             {
-              if(is_null_ptr(local_output_image_sptrs[thread_num]))
-                local_output_image_sptrs[thread_num].reset(output_image_ptr->get_empty_copy());
+              partial_image_num = accumulator_sptr->acquire();
+              local_output_image_ptr = &accumulator_sptr->get_partial_image(partial_image_num);
             }
             
           RPC_process_related_viewgrams(forward_projector_ptr,
                                         back_projector_ptr,
-                                        local_output_image_sptrs[thread_num].get(), input_image_ptr, y.get(), 
+                                        local_output_image_ptr, input_image_ptr, y.get(), 
                                         local_counts[thread_num], local_count2s[thread_num], 
                                         is_null_ptr(log_likelihood_ptr)? NULL : &local_log_likelihoods[thread_num], 
                                         additive_binwise_correction_viewgrams.get(),
                                         mult_viewgrams_sptr.get());
+
+          if (partial_image_num >= 0)
+            accumulator_sptr->release(partial_image_num);
             
 #else
           RPC_process_related_viewgrams(forward_projector_ptr,
@@ -500,28 +782,39 @@ void distributable_computation(
                                         mult_viewgrams_sptr.get());
 #endif // OPENMP                                    
 #endif // MPI
-	  // std::cout << "end viewgram iteration" << std::endl;
-	  auto end_iteration = std::chrono::high_resolution_clock::now();
-	  std::cout << "viewgram=" << std::chrono::duration_cast<std::chrono::milliseconds>(end_iteration-start_iteration).count() << std::endl;	 
-
-
       } // end of for-loop 
   } // end of parallel section of openmp
+
+  if (!is_null_ptr(prefetcher_sptr))
+    {
+      prefetcher_sptr->finish();
+      prefetcher_sptr->check_for_errors();
+      info(boost::format("Prefetching with queue depth %1% and %2% I/O threads: computation threads waited %3%s for data, "
+                         "I/O threads spent %4%s reading and waited %5%s for space in the queue")
+           % prefetch_depth % num_io_threads
+           % prefetcher_sptr->get_starvation_time() % prefetcher_sptr->get_read_time()
+           % prefetcher_sptr->get_full_wait_time());
+    }
+#ifdef STIR_OPENMP
+  if (!read_error_message.empty())
+    error("distributable_computation: reading data failed: " + read_error_message);
+#endif
   
 #ifdef STIR_OPENMP
   // "reduce" data constructed by threads
   {
     if (output_image_ptr != NULL)
       {
-        for (int i=0; i<static_cast<int>(local_output_image_sptrs.size()); ++i)
-	  if(!is_null_ptr(local_output_image_sptrs[i])) // only accumulate if a thread filled something in
-	    *output_image_ptr += *(local_output_image_sptrs[i]);
+        PerformanceTraceScope trace_scope("reduction");
+        accumulator_sptr->add_to(*output_image_ptr);
+        info(boost::format("Used %1% partial images for the output image")
+             % accumulator_sptr->get_num_partial_images(), 2);
       }
     if (log_likelihood_ptr != NULL)
       {
+        // threads that did not process anything still have a value of 0
         for (int i=0; i<static_cast<int>(local_log_likelihoods.size()); ++i)
-	  if(!is_null_ptr(local_output_image_sptrs[i])) // only accumulate if a thread filled something in
-	    *log_likelihood_ptr += local_log_likelihoods[i];
+	  *log_likelihood_ptr += local_log_likelihoods[i];
       }
     count += std::accumulate(local_counts.begin(), local_counts.end(), 0);
     count2 += std::accumulate(local_count2s.begin(), local_count2s.end(), 0);
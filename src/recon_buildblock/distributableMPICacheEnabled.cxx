@@ -124,6 +124,7 @@ void get_viewgrams(shared_ptr<RelatedViewgrams<float> >& y,
     {
       y.reset(new RelatedViewgrams<float>
 	      (proj_dat_ptr->get_empty_related_viewgrams(view_segment_num, symmetries_ptr)));
+      y->fill(1.F);
     }
 
   // multiplicative correction
@@ -3,7 +3,16 @@
 dir := recon_test
 
 $(dir)_TEST_SOURCES := test_DataSymmetriesForBins_PET_CartesianGrid.cxx \
-  test_PoissonLogLikelihoodWithLinearModelForMeanAndProjData.cxx
+  test_ParallelImageAccumulator.cxx \
+  test_distributable_computation.cxx \
+  test_FourierRebinning.cxx \
+  test_ScatterEstimationByBin.cxx \
+  test_QuadraticPrior.cxx \
+  test_ProjMatrixByBin.cxx \
+  test_ProjMatrixByBinUsingRayTracingTF.cxx \
+  test_PoissonLogLikelihoodWithLinearModelForMeanAndProjData.cxx \
+  test_PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion.cxx \
+  test_PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData.cxx
 
 
 # rules that do not link with all registries to save time during linking
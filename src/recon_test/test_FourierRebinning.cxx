@@ -0,0 +1,140 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+  \ingroup recon_buildblock
+
+  \brief Test program for stir::FourierRebinning
+
+  3D projection data with a number of views that is not a power of 2 are filled
+  with the projection of a centred uniform cylinder that is longer than the
+  scanner, such that all sinograms are the same. The test checks that
+  - the rebinned data have the same number of views and tangential positions
+    as the input data (earlier versions of FORE interpolated the views to a
+    power of 2), 1 segment and 2*num_rings-1 planes;
+  - the rebinned sinograms in the central planes are close to the input sinograms.
+*/
+
+#include "stir/recon_buildblock/FourierRebinning.h"
+#include "stir/ProjDataInMemory.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/ExamInfo.h"
+#include "stir/Scanner.h"
+#include "stir/Sinogram.h"
+#include "stir/Succeeded.h"
+#include "stir/RunTests.h"
+#include "stir/shared_ptr.h"
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for FourierRebinning
+*/
+class FourierRebinningTests : public RunTests
+{
+public:
+  void run_tests();
+};
+
+void
+FourierRebinningTests::run_tests()
+{
+  std::cerr << "Tests for FourierRebinning" << std::endl;
+
+  const int num_views = 24;
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  shared_ptr<ProjDataInfo> proj_data_info_sptr(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr, /*span=*/1, /*max_delta=*/3,
+                                  num_views, /*num_tang_poss=*/32, /*arc_corrected=*/true));
+  shared_ptr<ExamInfo> exam_info_sptr(new ExamInfo);
+  shared_ptr<ProjData> proj_data_sptr(new ProjDataInMemory(exam_info_sptr, proj_data_info_sptr));
+
+  // projection of a uniform cylinder with a radius of 10 bins
+  const float radius = 10.F;
+  for (int segment_num=proj_data_sptr->get_min_segment_num();
+       segment_num<=proj_data_sptr->get_max_segment_num(); ++segment_num)
+    for (int ax_pos_num=proj_data_sptr->get_min_axial_pos_num(segment_num);
+         ax_pos_num<=proj_data_sptr->get_max_axial_pos_num(segment_num); ++ax_pos_num)
+      {
+        Sinogram<float> sinogram = proj_data_sptr->get_empty_sinogram(ax_pos_num, segment_num);
+        for (int view_num=sinogram.get_min_view_num(); view_num<=sinogram.get_max_view_num(); ++view_num)
+          for (int tang_pos_num=sinogram.get_min_tangential_pos_num();
+               tang_pos_num<=sinogram.get_max_tangential_pos_num(); ++tang_pos_num)
+            if (std::abs(tang_pos_num) < radius)
+              sinogram[view_num][tang_pos_num] =
+                2*std::sqrt(radius*radius - tang_pos_num*tang_pos_num);
+        proj_data_sptr->set_sinogram(sinogram);
+      }
+
+  FourierRebinning rebinning;
+  rebinning.set_input_proj_data_sptr(proj_data_sptr);
+  rebinning.set_output_filename_prefix("test_FourierRebinning_out");
+  rebinning.set_max_segment_num_to_process(proj_data_sptr->get_max_segment_num());
+  rebinning.set_kmin(0);
+  rebinning.set_wmin(0);
+  rebinning.set_deltamin(0);
+  rebinning.set_kc(0);
+  check(rebinning.set_up() == Succeeded::yes, "set_up");
+  check(rebinning.rebin() == Succeeded::yes, "rebin");
+
+  {
+    shared_ptr<ProjData> rebinned_proj_data_sptr =
+      ProjData::read_from_file("test_FourierRebinning_out.hs");
+    check_if_equal(rebinned_proj_data_sptr->get_num_views(), num_views,
+                   "number of views should not change");
+    check_if_equal(rebinned_proj_data_sptr->get_num_tangential_poss(),
+                   proj_data_sptr->get_num_tangential_poss(),
+                   "number of tangential positions should not change");
+    check_if_equal(rebinned_proj_data_sptr->get_num_segments(), 1,
+                   "number of segments");
+    check_if_equal(rebinned_proj_data_sptr->get_num_axial_poss(0),
+                   2*scanner_sptr->get_num_rings()-1,
+                   "number of planes");
+
+    set_tolerance(.05);
+    const int num_planes = rebinned_proj_data_sptr->get_num_axial_poss(0);
+    const Sinogram<float> input_sinogram = proj_data_sptr->get_sinogram(0, 0);
+    for (int ax_pos_num=num_planes/2-2; ax_pos_num<=num_planes/2+2; ++ax_pos_num)
+      {
+        const Sinogram<float> rebinned_sinogram =
+          rebinned_proj_data_sptr->get_sinogram(ax_pos_num, 0);
+        check_if_equal(rebinned_sinogram.sum(), input_sinogram.sum(),
+                       "sum of rebinned sinogram in central planes");
+        check_if_equal(rebinned_sinogram[num_views/2][0], input_sinogram[num_views/2][0],
+                       "central bin of rebinned sinogram");
+      }
+  }
+  std::remove("test_FourierRebinning_out.hs");
+  std::remove("test_FourierRebinning_out.s");
+  std::remove("test_FourierRebinning_out.log");
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  FourierRebinningTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
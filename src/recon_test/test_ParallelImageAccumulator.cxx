@@ -0,0 +1,172 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+  \ingroup projection
+
+  \brief Test program (and benchmark) for stir::ParallelImageAccumulator
+
+  The accumulator is compared with giving every thread its own partial image
+  (as distributable_computation() used to do) for different numbers of threads and
+  maximum numbers of partial images. The results have to be identical. Timings of
+  both schemes are written to stderr.
+
+  The image size can be passed as arguments, e.g.
+  \verbatim
+  test_ParallelImageAccumulator 64 128 128
+  \endverbatim
+  The default is a small image, such that the test runs quickly.
+*/
+
+#include "stir/recon_buildblock/ParallelImageAccumulator.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/IndexRange3D.h"
+#include "stir/HighResWallClockTimer.h"
+#include "stir/num_threads.h"
+#include "stir/RunTests.h"
+#include "stir/shared_ptr.h"
+#include "stir/is_null_ptr.h"
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+
+START_NAMESPACE_STIR
+
+/*!
+  \brief Class with tests for ParallelImageAccumulator
+  \ingroup test
+*/
+class ParallelImageAccumulatorTests : public RunTests
+{
+public:
+  ParallelImageAccumulatorTests(const int num_planes, const int num_y, const int num_x)
+    : num_planes(num_planes), num_y(num_y), num_x(num_x)
+  {}
+  void run_tests();
+
+private:
+  const int num_planes, num_y, num_x;
+};
+
+// "back project" item i, i.e. add something to some of the planes
+static void
+add_item(DiscretisedDensity<3,float>& image, const int i)
+{
+  for (int z=image.get_min_index(); z<=image.get_max_index(); ++z)
+    if ((z+i)%3 == 0)
+      image[z] += static_cast<float>(i%7 + 1);
+}
+
+void
+ParallelImageAccumulatorTests::run_tests()
+{
+  std::cerr << "Tests for ParallelImageAccumulator" << std::endl;
+
+  const VoxelsOnCartesianGrid<float>
+    template_image(IndexRange3D(0, num_planes-1, -(num_y/2), num_y-num_y/2-1, -(num_x/2), num_x-num_x/2-1),
+                   CartesianCoordinate3D<float>(0,0,0),
+                   CartesianCoordinate3D<float>(1,1,1));
+  const int num_items = 96;
+
+  std::cerr << "threads  max partial images  used  time old scheme (s)  time accumulator (s)\n";
+  for (int num_threads=1; num_threads<=8; num_threads*=2)
+    {
+      set_num_threads(num_threads);
+
+      // one partial image per thread, added serially
+      VoxelsOnCartesianGrid<float> reference(template_image);
+      reference.fill(0.F);
+      HighResWallClockTimer reference_timer;
+      reference_timer.start();
+      {
+        std::vector<shared_ptr<DiscretisedDensity<3,float> > > local_image_sptrs(get_max_num_threads());
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int i=0; i<num_items; ++i)
+          {
+#ifdef STIR_OPENMP
+            const int thread_num = omp_get_thread_num();
+#else
+            const int thread_num = 0;
+#endif
+            if (is_null_ptr(local_image_sptrs[thread_num]))
+              local_image_sptrs[thread_num].reset(template_image.get_empty_copy());
+            add_item(*local_image_sptrs[thread_num], i);
+          }
+        for (unsigned int t=0; t<local_image_sptrs.size(); ++t)
+          if (!is_null_ptr(local_image_sptrs[t]))
+            reference += *local_image_sptrs[t];
+      }
+      reference_timer.stop();
+
+      for (int max_num_partial_images=0; max_num_partial_images<=num_threads; ++max_num_partial_images)
+        {
+          VoxelsOnCartesianGrid<float> output(template_image);
+          output.fill(0.F);
+          HighResWallClockTimer timer;
+          timer.start();
+          ParallelImageAccumulator accumulator(output, max_num_partial_images);
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+          for (int i=0; i<num_items; ++i)
+            {
+              const int index = accumulator.acquire();
+              add_item(accumulator.get_partial_image(index), i);
+              accumulator.release(index);
+            }
+          accumulator.add_to(output);
+          timer.stop();
+
+          std::cerr << num_threads << "  " << max_num_partial_images
+                    << "  " << accumulator.get_num_partial_images()
+                    << "  " << reference_timer.value() << "  " << timer.value() << '\n';
+
+          check(max_num_partial_images == 0 ||
+                accumulator.get_num_partial_images() <= max_num_partial_images,
+                "number of partial images should not exceed the maximum");
+          check(accumulator.get_num_partial_images() <= get_max_num_threads(),
+                "number of partial images should not exceed the number of threads");
+          output -= reference;
+          check(output.find_max() == 0.F && output.find_min() == 0.F,
+                "result should be identical to using one image per thread");
+        }
+    }
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main(int argc, char **argv)
+{
+  if (argc != 1 && argc != 4)
+    {
+      std::cerr << "Usage: " << argv[0] << " [num_planes num_y num_x]\n";
+      return EXIT_FAILURE;
+    }
+  ParallelImageAccumulatorTests tests(argc==4 ? atoi(argv[1]) : 15,
+                                      argc==4 ? atoi(argv[2]) : 32,
+                                      argc==4 ? atoi(argv[3]) : 32);
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,291 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup recon_test
+  \ingroup modelling
+
+  \brief Test program for processing frames in parallel in
+  stir::PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData
+
+  The objective function is set up with a Patlak plot for 4 frames, of which the last 3
+  are used (with small data written to the current directory). The tests check that
+  processing the frames in parallel gives the same objective function value and gradient
+  as processing them one after the other.
+*/
+
+#include "stir/recon_buildblock/PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData.h"
+#include "stir/modelling/ParametricDiscretisedDensity.h"
+#include "stir/ProjDataInterfile.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/ExamInfo.h"
+#include "stir/TimeFrameDefinitions.h"
+#include "stir/SegmentByView.h"
+#include "stir/Scanner.h"
+#include "stir/RunTests.h"
+#include "stir/Succeeded.h"
+#include "stir/num_threads.h"
+#include "stir/shared_ptr.h"
+#include <boost/format.hpp>
+#include <boost/random/uniform_01.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for processing frames in parallel in PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData
+*/
+class PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionDataTests : public RunTests
+{
+public:
+  typedef ParametricVoxelsOnCartesianGrid target_type;
+  typedef PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData<target_type> objective_function_type;
+
+  void run_tests();
+
+private:
+  //! names of all files written by the test (such that they can be removed)
+  std::vector<std::string> filenames;
+
+  //! writes the frame definitions and the plasma data for the Patlak plot
+  void write_kinetic_model_files();
+  //! writes dynamic projection data with all frames in a single file
+  void write_dyn_proj_data(const std::string& prefix, const ProjDataInfo& proj_data_info);
+  //! parses and sets up the objective function
+  void set_up_objective_function(objective_function_type& objective_function,
+                                 const int num_frames_in_parallel,
+                                 const int num_threads_per_frame,
+                                 shared_ptr<target_type>& target_sptr);
+  //! returns the maximum absolute value of all parameters
+  static float max_abs(const target_type& image);
+  void remove_files();
+};
+
+static const int num_frames = 4;
+
+void
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionDataTests::
+write_kinetic_model_files()
+{
+  {
+    const std::string filename = "test_kinetic_frames.fdef";
+    std::ofstream fdef(filename.c_str());
+    fdef << num_frames << " 30\n";
+    this->filenames.push_back(filename);
+  }
+  {
+    // a sample every second, decreasing after an initial peak
+    const std::string filename = "test_kinetic_plasma.if";
+    std::ofstream plasma(filename.c_str());
+    const int num_samples = num_frames*30;
+    plasma << num_samples << '\n';
+    for (int sample_num=0; sample_num<num_samples; ++sample_num)
+      {
+        const double time = sample_num + .5;
+        const double value = 10*time/(1 + time*time/25) + 1;
+        plasma << time << ' ' << value << ' ' << .9*value << '\n';
+      }
+    this->filenames.push_back(filename);
+  }
+}
+
+void
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionDataTests::
+write_dyn_proj_data(const std::string& prefix, const ProjDataInfo& proj_data_info)
+{
+  shared_ptr<ExamInfo> exam_info_sptr(new ExamInfo);
+  exam_info_sptr->set_time_frame_definitions(TimeFrameDefinitions("test_kinetic_frames.fdef"));
+
+  // write every frame to its own file, and append the data of the later frames
+  // to the data of the first frame (whose header lists all frames)
+  for (int frame_num=num_frames; frame_num>=1; --frame_num)
+    {
+      const std::string filename = boost::str(boost::format("%1%_f%2%") % prefix % frame_num);
+      {
+        ProjDataInterfile proj_data(exam_info_sptr, proj_data_info.create_shared_clone(),
+                                    filename, std::ios::out);
+        for (int seg_num=proj_data.get_min_segment_num(); seg_num<=proj_data.get_max_segment_num(); ++seg_num)
+          {
+            SegmentByView<float> segment = proj_data.get_empty_segment_by_view(seg_num);
+            // fill in some crazy values
+            float value = 0;
+            for (SegmentByView<float>::full_iterator iter = segment.begin_all(); iter != segment.end_all(); ++iter)
+              {
+                value = float(fabs((seg_num+.1)*value - 5 - frame_num)); // needs to be positive for Poisson
+                *iter = value;
+              }
+            proj_data.set_segment(segment);
+          }
+      }
+      this->filenames.push_back(filename + ".hs");
+      this->filenames.push_back(filename + ".s");
+    }
+  std::ofstream data((prefix + "_f1.s").c_str(), std::ios::out | std::ios::app | std::ios::binary);
+  for (int frame_num=2; frame_num<=num_frames; ++frame_num)
+    {
+      std::ifstream frame_data(boost::str(boost::format("%1%_f%2%.s") % prefix % frame_num).c_str(),
+                               std::ios::in | std::ios::binary);
+      data << frame_data.rdbuf();
+    }
+}
+
+void
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionDataTests::
+set_up_objective_function(objective_function_type& objective_function,
+                          const int num_frames_in_parallel,
+                          const int num_threads_per_frame,
+                          shared_ptr<target_type>& target_sptr)
+{
+  std::stringstream parameters;
+  parameters << "PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData Parameters:=\n"
+             << "input file := test_kinetic_proj_data_f1.hs\n"
+             << "number of frames to process in parallel := " << num_frames_in_parallel << "\n"
+             << "number of threads per frame := " << num_threads_per_frame << "\n"
+             << "recompute sensitivity := 1\n"
+             << "Kinetic Model type := Patlak Plot\n"
+             << "Patlak Plot Parameters :=\n"
+             << "time frame definition filename := test_kinetic_frames.fdef\n"
+             << "starting frame := 2\n"
+             << "calibration factor := 1\n"
+             << "blood data filename := test_kinetic_plasma.if\n"
+             << "Time Shift := 0\n"
+             << "In total counts := 1\n"
+             << "end Patlak Plot Parameters :=\n"
+             << "end PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData Parameters:=\n";
+  if (!check(objective_function.parse(parameters), "parsing of objective function"))
+    return;
+  objective_function.set_num_subsets(2);
+
+  if (is_null_ptr(target_sptr))
+    {
+      target_sptr.reset(objective_function.construct_target_ptr());
+      // fill with random numbers between 0 and 1 (plus a constant to avoid zero model estimates)
+      boost::mt19937 generator(boost::uint32_t(42));
+      boost::uniform_01<boost::mt19937> random01(generator);
+      for (target_type::full_iterator iter=target_sptr->begin_all(); iter!=target_sptr->end_all(); ++iter)
+        *iter = static_cast<float>(random01()) + 1.F;
+    }
+  check(objective_function.set_up(target_sptr)==Succeeded::yes, "set-up of objective function");
+}
+
+float
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionDataTests::
+max_abs(const target_type& image)
+{
+  float result = 0.F;
+  for (target_type::const_full_iterator iter=image.begin_all(); iter!=image.end_all(); ++iter)
+    result = std::max(result, static_cast<float>(fabs(*iter)));
+  return result;
+}
+
+void
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionDataTests::
+remove_files()
+{
+  for (std::vector<std::string>::const_iterator iter=this->filenames.begin(); iter!=this->filenames.end(); ++iter)
+    std::remove(iter->c_str());
+}
+
+void
+PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionDataTests::
+run_tests()
+{
+  std::cerr << "Tests for processing frames in parallel in PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionData\n";
+
+  // construct a small scanner and sinogram
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  scanner_sptr->set_num_rings(5);
+  shared_ptr<ProjDataInfo> proj_data_info_sptr(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                  /*span=*/3,
+                                  /*max_delta=*/4,
+                                  /*num_views=*/16,
+                                  /*num_tang_poss=*/16));
+
+  write_kinetic_model_files();
+  write_dyn_proj_data("test_kinetic_proj_data", *proj_data_info_sptr);
+
+  const int subset_num = 0;
+  shared_ptr<target_type> target_sptr;
+
+  // frames one after the other
+  objective_function_type serial_objective_function;
+  set_up_objective_function(serial_objective_function, 1, 0, target_sptr);
+  if (!is_everything_ok())
+    {
+      remove_files();
+      return;
+    }
+  const double serial_value =
+    serial_objective_function.compute_objective_function(*target_sptr, subset_num);
+  shared_ptr<target_type> serial_gradient_sptr(serial_objective_function.construct_target_ptr());
+  serial_objective_function.compute_sub_gradient(*serial_gradient_sptr, *target_sptr, subset_num);
+  const float max_abs_gradient = max_abs(*serial_gradient_sptr);
+  check(max_abs_gradient > 0, "gradient should not be zero");
+
+  // frames in parallel, with a single thread and with an automatic number of threads per frame
+  for (int num_threads_per_frame=1; num_threads_per_frame>=0; --num_threads_per_frame)
+    {
+      const std::string str =
+        boost::str(boost::format("3 frames in parallel, %1% threads per frame") % num_threads_per_frame);
+      objective_function_type parallel_objective_function;
+      set_up_objective_function(parallel_objective_function, 3, num_threads_per_frame, target_sptr);
+      if (!is_everything_ok())
+        break;
+
+      const double parallel_value =
+        parallel_objective_function.compute_objective_function(*target_sptr, subset_num);
+      check_if_equal(parallel_value, serial_value, str + ": objective function value");
+
+      shared_ptr<target_type> parallel_gradient_sptr(parallel_objective_function.construct_target_ptr());
+      parallel_objective_function.compute_sub_gradient(*parallel_gradient_sptr, *target_sptr, subset_num);
+      float max_abs_difference = 0.F;
+      target_type::const_full_iterator serial_iter = serial_gradient_sptr->begin_all();
+      for (target_type::const_full_iterator iter=parallel_gradient_sptr->begin_all();
+           iter!=parallel_gradient_sptr->end_all();
+           ++iter, ++serial_iter)
+        max_abs_difference = std::max(max_abs_difference, static_cast<float>(fabs(*iter - *serial_iter)));
+      check(max_abs_difference <= get_tolerance()*max_abs_gradient,
+            boost::str(boost::format("%1%: gradient (maximum difference %2%, maximum gradient %3%)")
+                       % str % max_abs_difference % max_abs_gradient));
+    }
+
+  remove_files();
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  set_default_num_threads();
+
+  PoissonLogLikelihoodWithLinearKineticModelAndDynamicProjectionDataTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,299 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup recon_test
+
+  \brief Test program for processing gates in parallel in
+  stir::PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion
+
+  The objective function is set up with 2 gates (with small data written to the current
+  directory). The tests check that processing the gates in parallel gives the same
+  objective function value and gradient as processing them one after the other, and that
+  an error in one gate reaches the caller.
+*/
+
+#include "stir/recon_buildblock/PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/GatedDiscretisedDensity.h"
+#include "stir/TimeGateDefinitions.h"
+#include "stir/ProjDataInterfile.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/ExamInfo.h"
+#include "stir/SegmentByView.h"
+#include "stir/Scanner.h"
+#include "stir/IndexRange3D.h"
+#include "stir/RunTests.h"
+#include "stir/Succeeded.h"
+#include "stir/num_threads.h"
+#include "stir/shared_ptr.h"
+#include <boost/format.hpp>
+#include <boost/random/uniform_01.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for processing gates in parallel in PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion
+*/
+class PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotionTests : public RunTests
+{
+public:
+  typedef DiscretisedDensity<3,float> target_type;
+  typedef PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion<target_type> objective_function_type;
+
+  void run_tests();
+
+private:
+  //! names of all files written by the test (such that they can be removed)
+  std::vector<std::string> filenames;
+
+  void write_gate_definitions(const std::string& prefix);
+  void write_proj_data(const std::string& prefix, const ProjDataInfo& proj_data_info);
+  //! writes motion vectors for 2 gates (gate 1 is not moved, gate 2 is shifted by \a shift_x mm)
+  /*! If \a wrong_size_for_gate_2 is \c true, the images of gate 2 are one voxel smaller than \a image_template. */
+  void write_motion_vectors(const std::string& prefix, const VoxelsOnCartesianGrid<float>& image_template,
+                            const float shift_x, const bool wrong_size_for_gate_2);
+  //! parses and sets up the objective function
+  void set_up_objective_function(objective_function_type& objective_function,
+                                 const std::string& motion_vectors_prefix,
+                                 const int num_gates_in_parallel,
+                                 shared_ptr<target_type>& target_sptr);
+  void remove_files();
+};
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotionTests::
+write_gate_definitions(const std::string& prefix)
+{
+  const std::string filename = prefix + ".gdef";
+  std::ofstream gdef(filename.c_str());
+  gdef << "1 1\n2 1\n";
+  this->filenames.push_back(filename);
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotionTests::
+write_proj_data(const std::string& prefix, const ProjDataInfo& proj_data_info)
+{
+  this->write_gate_definitions(prefix);
+  for (int gate_num=1; gate_num<=2; ++gate_num)
+    {
+      const std::string filename = boost::str(boost::format("%1%_g%2%") % prefix % gate_num);
+      ProjDataInterfile proj_data(shared_ptr<ExamInfo>(new ExamInfo), proj_data_info.create_shared_clone(),
+                                  filename, std::ios::out);
+      for (int seg_num=proj_data.get_min_segment_num(); seg_num<=proj_data.get_max_segment_num(); ++seg_num)
+        {
+          SegmentByView<float> segment = proj_data.get_empty_segment_by_view(seg_num);
+          // fill in some crazy values
+          float value = 0;
+          for (SegmentByView<float>::full_iterator iter = segment.begin_all(); iter != segment.end_all(); ++iter)
+            {
+              value = float(fabs((seg_num+.1)*value - 5 - gate_num)); // needs to be positive for Poisson
+              *iter = value;
+            }
+          proj_data.set_segment(segment);
+        }
+      this->filenames.push_back(filename + ".hs");
+      this->filenames.push_back(filename + ".s");
+    }
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotionTests::
+write_motion_vectors(const std::string& prefix, const VoxelsOnCartesianGrid<float>& image_template,
+                     const float shift_x, const bool wrong_size_for_gate_2)
+{
+  this->write_gate_definitions(prefix);
+  std::vector<std::pair<unsigned int, double> > gate_sequence;
+  gate_sequence.push_back(std::make_pair(1U, 1.));
+  gate_sequence.push_back(std::make_pair(2U, 1.));
+  const TimeGateDefinitions gate_defs(gate_sequence);
+  const shared_ptr<DiscretisedDensity<3,float> > gate_1_sptr(image_template.get_empty_copy());
+  shared_ptr<DiscretisedDensity<3,float> > gate_2_sptr(image_template.get_empty_copy());
+  if (wrong_size_for_gate_2)
+    {
+      const int min_z = image_template.get_min_z();
+      const int min_y = image_template.get_min_y();
+      const int min_x = image_template.get_min_x();
+      gate_2_sptr.reset(new VoxelsOnCartesianGrid<float>(IndexRange3D(min_z, image_template.get_max_z(),
+                                                                       min_y, image_template.get_max_y(),
+                                                                       min_x, image_template.get_max_x()-1),
+                                                         image_template.get_origin(),
+                                                         image_template.get_grid_spacing()));
+    }
+
+  const char * const suffixes[3] = { "d1", "d2", "d3" }; // z, y, x
+  for (int d=0; d<3; ++d)
+    {
+      GatedDiscretisedDensity motion(gate_defs, gate_1_sptr);
+      shared_ptr<DiscretisedDensity<3,float> > motion_gate_2_sptr(gate_2_sptr->get_empty_copy());
+      if (d == 2)
+        motion_gate_2_sptr->fill(shift_x);
+      motion.set_density_sptr(motion_gate_2_sptr, 2);
+      motion.write_to_files(prefix, suffixes[d]);
+      for (int gate_num=1; gate_num<=2; ++gate_num)
+        {
+          const std::string filename = boost::str(boost::format("%1%_g%2%%3%") % prefix % gate_num % suffixes[d]);
+          this->filenames.push_back(filename + ".hv");
+          this->filenames.push_back(filename + ".ahv");
+          this->filenames.push_back(filename + ".v");
+        }
+    }
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotionTests::
+set_up_objective_function(objective_function_type& objective_function,
+                          const std::string& motion_vectors_prefix,
+                          const int num_gates_in_parallel,
+                          shared_ptr<target_type>& target_sptr)
+{
+  std::stringstream parameters;
+  parameters << "PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion Parameters:=\n"
+             << "input filename := test_gated_proj_data\n"
+             << "gate definitions filename := test_gated_proj_data.gdef\n"
+             << "motion vectors filename prefix := " << motion_vectors_prefix << "\n"
+             << "reverse motion vectors filename prefix := test_gated_reverse_motion\n"
+             << "number of gates to process in parallel := " << num_gates_in_parallel << "\n"
+             << "recompute sensitivity := 1\n"
+             << "End PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion Parameters:=\n";
+  if (!check(objective_function.parse(parameters), "parsing of objective function"))
+    return;
+  objective_function.set_num_subsets(2);
+
+  if (is_null_ptr(target_sptr))
+    {
+      target_sptr.reset(objective_function.construct_target_ptr());
+      // fill with random numbers between 0 and 1 (plus a constant to avoid zero model estimates)
+      boost::mt19937 generator(boost::uint32_t(42));
+      boost::uniform_01<boost::mt19937> random01(generator);
+      for (target_type::full_iterator iter=target_sptr->begin_all(); iter!=target_sptr->end_all(); ++iter)
+        *iter = static_cast<float>(random01()) + 1.F;
+    }
+  check(objective_function.set_up(target_sptr)==Succeeded::yes, "set-up of objective function");
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotionTests::
+remove_files()
+{
+  for (std::vector<std::string>::const_iterator iter=this->filenames.begin(); iter!=this->filenames.end(); ++iter)
+    std::remove(iter->c_str());
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotionTests::
+run_tests()
+{
+  std::cerr << "Tests for processing gates in parallel in PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotion\n";
+
+  // construct a small scanner and sinogram
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  scanner_sptr->set_num_rings(5);
+  shared_ptr<ProjDataInfo> proj_data_info_sptr(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                  /*span=*/3,
+                                  /*max_delta=*/4,
+                                  /*num_views=*/16,
+                                  /*num_tang_poss=*/16));
+  const VoxelsOnCartesianGrid<float> image_template(*proj_data_info_sptr);
+  // shift by a fraction of a voxel, such that the images are interpolated
+  const float shift_x = image_template.get_voxel_size().x()/3;
+
+  write_proj_data("test_gated_proj_data", *proj_data_info_sptr);
+  write_motion_vectors("test_gated_motion", image_template, shift_x, false);
+  write_motion_vectors("test_gated_reverse_motion", image_template, -shift_x, false);
+  write_motion_vectors("test_gated_wrong_motion", image_template, shift_x, true);
+
+  const int subset_num = 0;
+  shared_ptr<target_type> target_sptr;
+
+  // gates one after the other
+  objective_function_type serial_objective_function;
+  set_up_objective_function(serial_objective_function, "test_gated_motion", 1, target_sptr);
+  // gates in parallel
+  objective_function_type parallel_objective_function;
+  set_up_objective_function(parallel_objective_function, "test_gated_motion", 2, target_sptr);
+
+  if (is_everything_ok())
+    {
+      const double serial_value =
+        serial_objective_function.compute_objective_function(*target_sptr, subset_num);
+      const double parallel_value =
+        parallel_objective_function.compute_objective_function(*target_sptr, subset_num);
+      check_if_equal(parallel_value, serial_value, "objective function value with gates in parallel");
+
+      shared_ptr<target_type> serial_gradient_sptr(target_sptr->get_empty_copy());
+      shared_ptr<target_type> parallel_gradient_sptr(target_sptr->get_empty_copy());
+      serial_objective_function.compute_sub_gradient(*serial_gradient_sptr, *target_sptr, subset_num);
+      parallel_objective_function.compute_sub_gradient(*parallel_gradient_sptr, *target_sptr, subset_num);
+      const float max_abs_gradient =
+        std::max(fabs(serial_gradient_sptr->find_min()), fabs(serial_gradient_sptr->find_max()));
+      check(max_abs_gradient > 0, "gradient should not be zero");
+      *parallel_gradient_sptr -= *serial_gradient_sptr;
+      const float max_abs_difference =
+        std::max(fabs(parallel_gradient_sptr->find_min()), fabs(parallel_gradient_sptr->find_max()));
+      check(max_abs_difference <= get_tolerance()*max_abs_gradient,
+            boost::str(boost::format("gradient with gates in parallel (maximum difference %1%, maximum gradient %2%)")
+                       % max_abs_difference % max_abs_gradient));
+    }
+
+  // the motion vectors of gate 2 do not match the image, so warping it calls error()
+  if (is_everything_ok())
+    {
+      objective_function_type failing_objective_function;
+      set_up_objective_function(failing_objective_function, "test_gated_wrong_motion", 2, target_sptr);
+      bool caught = false;
+      try
+        {
+          failing_objective_function.compute_objective_function(*target_sptr, subset_num);
+        }
+      catch (const std::string& message)
+        {
+          caught = true;
+          check(message.find("motion vectors") != std::string::npos,
+                "message of the error in the gate should be passed on");
+        }
+      check(caught, "error in one gate should reach the caller when processing gates in parallel");
+    }
+
+  remove_files();
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  set_default_num_threads();
+
+  PoissonLogLikelihoodWithLinearModelForMeanAndGatedProjDataWithMotionTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
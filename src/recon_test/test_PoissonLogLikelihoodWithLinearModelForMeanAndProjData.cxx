@@ -37,6 +37,7 @@
 #include "stir/ExamInfo.h"
 #include "stir/ProjDataInfo.h"
 #include "stir/ProjDataInMemory.h"
+#include "stir/ProjDataInterfile.h"
 #include "stir/SegmentByView.h"
 #include "stir/Scanner.h"
 #include "stir/DataSymmetriesForViewSegmentNumbers.h"
@@ -45,6 +46,9 @@
 #include "stir/recon_buildblock/ProjectorByBinPairUsingProjMatrixByBin.h"
 #include "stir/recon_buildblock/BinNormalisationFromProjData.h"
 #include "stir/recon_buildblock/TrivialBinNormalisation.h"
+#include "stir/recon_buildblock/BackProjectorByBin.h"
+#include "stir/recon_buildblock/find_basic_vs_nums_in_subsets.h"
+#include "stir/RelatedViewgrams.h"
 //#include "stir/OSMAPOSL/OSMAPOSLReconstruction.h"
 #include "stir/recon_buildblock/distributable_main.h"
 #include "stir/RunTests.h"
@@ -53,8 +57,14 @@
 #include "stir/info.h"
 #include "stir/Succeeded.h"
 #include "stir/num_threads.h"
+#include "stir/utilities.h"
 #include <iostream>
+#include <fstream>
 #include <memory>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdio>
 #include <boost/random/uniform_01.hpp>
 #include <boost/random/normal_distribution.hpp>
 #include <boost/random/mersenne_twister.hpp>
@@ -64,6 +74,16 @@
 #include "stir/recon_buildblock/distributable_main.h"
 START_NAMESPACE_STIR
 
+//! Derived class that gives access to the key and entry name of the sensitivity cache
+template <typename TargetT>
+class PoissonLogLikelihoodWithLinearModelForMeanAndProjDataWithCacheKey
+  : public PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>
+{
+public:
+  using PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>::get_sensitivity_cache_key;
+  using PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>::get_full_sensitivity_cache_key;
+  using PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>::get_sensitivity_cache_entry_name;
+};
 
 /*!
   \ingroup test
@@ -112,6 +132,13 @@ protected:
   /*! Note that this function is not specific to PoissonLogLikelihoodWithLinearModelForMeanAndProjData */
   void run_tests_for_objective_function(GeneralisedObjectiveFunction<target_type>& objective_function,
                                         target_type& target);
+
+  //! check that the key for the sensitivity cache changes when the normalisation file changes
+  void run_tests_for_sensitivity_cache_key(const shared_ptr<target_type>& target_sptr);
+  //! check that sensitivities stored in the cache are read back
+  void run_tests_for_sensitivity_cache(const shared_ptr<target_type>& target_sptr);
+  //! compare the (parallel) subset sensitivities with a serial back projection
+  void run_tests_for_subset_sensitivities(const shared_ptr<target_type>& target_sptr);
 };
 
 PoissonLogLikelihoodWithLinearModelForMeanAndProjDataTests::
@@ -292,7 +319,7 @@ proj_data_sptr->get_proj_data_info_ptr()->create_shared_clone()));
       }
   }
 
-  objective_function_sptr.reset(new PoissonLogLikelihoodWithLinearModelForMeanAndProjData<target_type>);
+  objective_function_sptr.reset(new PoissonLogLikelihoodWithLinearModelForMeanAndProjDataWithCacheKey<target_type>);
   PoissonLogLikelihoodWithLinearModelForMeanAndProjData<target_type>& objective_function =
     reinterpret_cast<  PoissonLogLikelihoodWithLinearModelForMeanAndProjData<target_type>& >(*objective_function_sptr);
   objective_function.set_proj_data_sptr(proj_data_sptr);
@@ -311,6 +338,170 @@ proj_data_sptr->get_proj_data_info_ptr()->create_shared_clone()));
     return;
 }
 
+// write projection data with a value depending on the bin and \a scale_factor
+static void
+write_normalisation_file(const std::string& filename, const ProjData& template_proj_data,
+                         const float scale_factor)
+{
+  ProjDataInterfile proj_data(template_proj_data.get_exam_info_sptr(),
+                              template_proj_data.get_proj_data_info_ptr()->create_shared_clone(),
+                              filename, std::ios::out);
+  for (int seg_num=proj_data.get_min_segment_num(); seg_num<=proj_data.get_max_segment_num(); ++seg_num)
+    {
+      SegmentByView<float> segment = proj_data.get_empty_segment_by_view(seg_num);
+      float value = 0;
+      for (SegmentByView<float>::full_iterator iter = segment.begin_all(); iter != segment.end_all(); ++iter)
+        {
+          value = float(fabs(seg_num*value - .2));
+          *iter = scale_factor*value + 1;
+        }
+      proj_data.set_segment(segment);
+    }
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndProjDataTests::
+run_tests_for_sensitivity_cache_key(const shared_ptr<target_type>& target_sptr)
+{
+  PoissonLogLikelihoodWithLinearModelForMeanAndProjDataWithCacheKey<target_type>& objective_function =
+    dynamic_cast<PoissonLogLikelihoodWithLinearModelForMeanAndProjDataWithCacheKey<target_type>& >(*objective_function_sptr);
+  const shared_ptr<BinNormalisation> org_normalisation_sptr = objective_function.get_normalisation_sptr();
+  const std::string filename = "test_sensitivity_cache_key_norm";
+
+  // the normalisation is read from file every time, such that only its content can differ
+  std::string keys[3];
+  const float scale_factors[3] = { 1.F, 1.F, 2.F };
+  for (int i=0; i<3; ++i)
+    {
+      write_normalisation_file(filename, objective_function.get_proj_data(), scale_factors[i]);
+      objective_function.set_normalisation_sptr(shared_ptr<BinNormalisation>(new BinNormalisationFromProjData(filename + ".hs")));
+      if (!check(objective_function.set_up(target_sptr)==Succeeded::yes, "set-up of objective function for cache key"))
+        break;
+      keys[i] = objective_function.get_sensitivity_cache_key(*target_sptr);
+    }
+  check(!keys[0].empty(), "sensitivity cache key should not be empty");
+  check(keys[0] == keys[1], "sensitivity cache key should be the same for an unchanged normalisation file");
+  check(keys[0] != keys[2], "sensitivity cache key should differ when the normalisation file changes");
+
+  objective_function.set_normalisation_sptr(org_normalisation_sptr);
+  std::remove((filename + ".hs").c_str());
+  std::remove((filename + ".s").c_str());
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndProjDataTests::
+run_tests_for_sensitivity_cache(const shared_ptr<target_type>& target_sptr)
+{
+  PoissonLogLikelihoodWithLinearModelForMeanAndProjDataWithCacheKey<target_type>& objective_function =
+    dynamic_cast<PoissonLogLikelihoodWithLinearModelForMeanAndProjDataWithCacheKey<target_type>& >(*objective_function_sptr);
+  const int num_subsets = objective_function.get_num_subsets();
+  this->set_tolerance(1E-4);
+  objective_function.set_recompute_sensitivity(true);
+  if (!check(objective_function.set_up(target_sptr)==Succeeded::yes, "set-up of objective function without cache"))
+    return;
+  std::vector<shared_ptr<target_type> > org_subsensitivity_sptrs(num_subsets);
+  for (int subset_num=0; subset_num<num_subsets; ++subset_num)
+    org_subsensitivity_sptrs[subset_num].reset(objective_function.get_subset_sensitivity(subset_num).clone());
+
+  // store the sensitivities in the cache
+  objective_function.set_sensitivity_cache_directory(".");
+  if (!check(objective_function.set_up(target_sptr)==Succeeded::yes, "set-up of objective function with cache"))
+    return;
+  const std::string entry_name =
+    objective_function.get_sensitivity_cache_entry_name(objective_function.get_full_sensitivity_cache_key(*target_sptr));
+  std::vector<std::string> filenames(num_subsets);
+  {
+    std::ifstream manifest((entry_name + ".txt").c_str());
+    int num_images = 0;
+    manifest >> num_images;
+    manifest.ignore(1);
+    if (!check(manifest && num_images == num_subsets, "manifest of the sensitivity cache entry"))
+      return;
+    for (int subset_num=0; subset_num<num_subsets; ++subset_num)
+      std::getline(manifest, filenames[subset_num]);
+  }
+
+  // modify a cached image, such that we can see that the cache is used
+  {
+    shared_ptr<target_type> image_sptr(read_from_file<target_type>(filenames[1]));
+    *image_sptr *= 2.F;
+    write_to_file(filenames[1], *image_sptr);
+  }
+  if (!check(objective_function.set_up(target_sptr)==Succeeded::yes, "set-up of objective function reading from cache"))
+    return;
+  for (int subset_num=0; subset_num<num_subsets; ++subset_num)
+    {
+      shared_ptr<target_type> expected_sptr(org_subsensitivity_sptrs[subset_num]->clone());
+      if (subset_num == 1)
+        *expected_sptr *= 2.F;
+      check_if_equal(objective_function.get_subset_sensitivity(subset_num), *expected_sptr,
+                     "subset sensitivity read from the cache");
+    }
+
+  objective_function.set_sensitivity_cache_directory("");
+  if (!check(objective_function.set_up(target_sptr)==Succeeded::yes, "set-up of objective function without cache"))
+    return;
+  for (int subset_num=0; subset_num<num_subsets; ++subset_num)
+    check_if_equal(objective_function.get_subset_sensitivity(subset_num), *org_subsensitivity_sptrs[subset_num],
+                   "subset sensitivity after disabling the cache");
+
+  std::remove((entry_name + ".txt").c_str());
+  for (int subset_num=0; subset_num<num_subsets; ++subset_num)
+    {
+      // remove the Interfile header and data file, and the header written for Analyze
+      std::string filename = filenames[subset_num];
+      std::remove(filename.c_str());
+      replace_extension(filename, ".v");
+      std::remove(filename.c_str());
+      replace_extension(filename, ".ahv");
+      std::remove(filename.c_str());
+    }
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndProjDataTests::
+run_tests_for_subset_sensitivities(const shared_ptr<target_type>& target_sptr)
+{
+  PoissonLogLikelihoodWithLinearModelForMeanAndProjData<target_type>& objective_function =
+    dynamic_cast<PoissonLogLikelihoodWithLinearModelForMeanAndProjData<target_type>& >(*objective_function_sptr);
+  const ProjData& proj_data = objective_function.get_proj_data();
+  const shared_ptr<BackProjectorByBin> back_projector_sptr =
+    objective_function.get_projector_pair_sptr()->get_back_projector_sptr();
+  const shared_ptr<DataSymmetriesForViewSegmentNumbers>
+    symmetries_sptr(back_projector_sptr->get_symmetries_used()->clone());
+  const double start_time =
+    objective_function.get_time_frame_definitions().get_start_time(objective_function.get_time_frame_num());
+  const double end_time =
+    objective_function.get_time_frame_definitions().get_end_time(objective_function.get_time_frame_num());
+  const int max_segment_num = objective_function.get_max_segment_num_to_process();
+  this->set_tolerance(1E-4);
+  objective_function.set_recompute_sensitivity(true);
+  if (!check(objective_function.set_up(target_sptr)==Succeeded::yes, "set-up of objective function"))
+    return;
+
+  for (int subset_num=0; subset_num<objective_function.get_num_subsets(); ++subset_num)
+    {
+      shared_ptr<target_type> serial_sensitivity_sptr(target_sptr->get_empty_copy());
+      const std::vector<ViewSegmentNumbers> vs_nums =
+        detail::find_basic_vs_nums_in_subset(*proj_data.get_proj_data_info_ptr(), *symmetries_sptr,
+                                             -max_segment_num, max_segment_num,
+                                             subset_num, objective_function.get_num_subsets());
+      for (std::vector<ViewSegmentNumbers>::const_iterator iter = vs_nums.begin(); iter != vs_nums.end(); ++iter)
+        {
+          RelatedViewgrams<float> viewgrams = proj_data.get_empty_related_viewgrams(*iter, symmetries_sptr);
+          viewgrams.fill(1.F);
+          objective_function.get_normalisation_sptr()->undo(viewgrams, start_time, end_time);
+          const int range_to_zero =
+            iter->segment_num() == 0 && objective_function.get_zero_seg0_end_planes() ? 1 : 0;
+          back_projector_sptr->back_project(*serial_sensitivity_sptr, viewgrams,
+                                            viewgrams.get_min_axial_pos_num() + range_to_zero,
+                                            viewgrams.get_max_axial_pos_num() - range_to_zero);
+        }
+      check_if_equal(objective_function.get_subset_sensitivity(subset_num), *serial_sensitivity_sptr,
+                     "subset sensitivity computed in parallel and serially");
+    }
+}
+
 void
 PoissonLogLikelihoodWithLinearModelForMeanAndProjDataTests::
 run_tests()
@@ -321,6 +512,9 @@ run_tests()
   shared_ptr<target_type> density_sptr;
   construct_input_data(density_sptr);
   this->run_tests_for_objective_function(*this->objective_function_sptr, *density_sptr);
+  this->run_tests_for_sensitivity_cache_key(density_sptr);
+  this->run_tests_for_subset_sensitivities(density_sptr);
+  this->run_tests_for_sensitivity_cache(density_sptr);
 #else
   // alternative that gets the objective function from an OSMAPOSL .par file
   // currently disabled
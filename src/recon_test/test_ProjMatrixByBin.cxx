@@ -0,0 +1,362 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+  \ingroup projection
+
+  \brief Test program for the cache of stir::ProjMatrixByBin
+
+  Uses stir::ProjMatrixByBinUsingRayTracing. Rows are obtained from many threads
+  at the same time, and every row is compared with the one computed by a
+  single thread without cache. This is done with and without quantisation of
+  the values and a maximum cache size.
+
+  Also checks that stir::CompressedProjMatrixElemsForOneBin gives back the
+  original row, and that a matrix written by stir::ProjMatrixByBinFromFile
+  (Version 1.0 and the indexed Version 2.0) gives back the same rows.
+*/
+
+#include "stir/recon_buildblock/ProjMatrixByBinUsingRayTracing.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/recon_buildblock/CompressedProjMatrixElemsForOneBin.h"
+#include "stir/recon_buildblock/ProjMatrixByBinFromFile.h"
+#include "stir/ProjData.h"
+#include "stir/IO/read_from_file.h"
+#include "stir/Succeeded.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/Scanner.h"
+#include "stir/Bin.h"
+#include "stir/Coordinate3D.h"
+#include "stir/num_threads.h"
+#include "stir/RunTests.h"
+#include "stir/shared_ptr.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+START_NAMESPACE_STIR
+
+/*!
+  \brief Class with tests for the cache of ProjMatrixByBin
+  \ingroup test
+*/
+class ProjMatrixByBinTests : public RunTests
+{
+public:
+  void run_tests();
+
+private:
+  shared_ptr<ProjDataInfo> proj_data_info_sptr;
+  shared_ptr<DiscretisedDensity<3,float> > density_sptr;
+  //! all bins in the projection data, ordered by segment and view
+  std::vector<Bin> bins;
+  //! rows computed by a single thread without cache, in the same order as \c bins
+  std::vector<ProjMatrixElemsForOneBin> reference_rows;
+
+  void compute_reference();
+  //! get all rows with many threads at once, return number of different rows
+  int get_rows_in_parallel(const ProjMatrixByBin& proj_matrix);
+  void run_tests_for_concurrent_access();
+  //! compress and decompress \a row, check that values are within \a tolerance times the maximum
+  void run_tests_for_compression(const ProjMatrixElemsForOneBin& row,
+                                 const bool quantise_values, const float tolerance);
+  void run_tests_for_compression();
+  void run_tests_for_quantised_values();
+  void run_tests_for_maximum_cache_size();
+  //! write the matrix to file in the given version and read it back
+  void run_tests_for_file(const std::string& version);
+};
+
+void
+ProjMatrixByBinTests::compute_reference()
+{
+  ProjMatrixByBinUsingRayTracing proj_matrix;
+  proj_matrix.enable_cache(false);
+  proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+
+  bins.clear();
+  for (int segment_num=proj_data_info_sptr->get_min_segment_num();
+       segment_num<=proj_data_info_sptr->get_max_segment_num(); ++segment_num)
+    for (int view_num=proj_data_info_sptr->get_min_view_num();
+         view_num<=proj_data_info_sptr->get_max_view_num(); ++view_num)
+      for (int axial_pos_num=proj_data_info_sptr->get_min_axial_pos_num(segment_num);
+           axial_pos_num<=proj_data_info_sptr->get_max_axial_pos_num(segment_num); ++axial_pos_num)
+        for (int tangential_pos_num=proj_data_info_sptr->get_min_tangential_pos_num();
+             tangential_pos_num<=proj_data_info_sptr->get_max_tangential_pos_num(); ++tangential_pos_num)
+          bins.push_back(Bin(segment_num, view_num, axial_pos_num, tangential_pos_num));
+
+  reference_rows.resize(bins.size());
+  for (unsigned int i=0; i<bins.size(); ++i)
+    {
+      proj_matrix.get_proj_matrix_elems_for_one_bin(reference_rows[i], bins[i]);
+      reference_rows[i].sort();
+    }
+}
+
+int
+ProjMatrixByBinTests::get_rows_in_parallel(const ProjMatrixByBin& proj_matrix)
+{
+  const int num_bins = static_cast<int>(bins.size());
+  std::vector<ProjMatrixElemsForOneBin> rows(bins.size());
+  // neighbouring bins are handled by different threads, such that threads ask for
+  // rows in the same view (and therefore related by symmetry) at the same time
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static,1)
+#endif
+  for (int i=0; i<num_bins; ++i)
+    proj_matrix.get_proj_matrix_elems_for_one_bin(rows[i], bins[i]);
+
+  int num_different = 0;
+  for (int i=0; i<num_bins; ++i)
+    {
+      rows[i].sort();
+      if (rows[i] != reference_rows[i])
+        {
+          if (num_different == 0)
+            std::cerr << "First different row for bin: segment = " << bins[i].segment_num()
+                      << ", axial pos " << bins[i].axial_pos_num()
+                      << ", view = " << bins[i].view_num()
+                      << ", tangential_pos_num = " << bins[i].tangential_pos_num() << '\n';
+          ++num_different;
+        }
+    }
+  return num_different;
+}
+
+void
+ProjMatrixByBinTests::run_tests_for_concurrent_access()
+{
+  for (int store_only_basic_bins=1; store_only_basic_bins>=0; --store_only_basic_bins)
+    {
+      std::cerr << "\tconcurrent access with store only basic bins in cache := "
+                << store_only_basic_bins << '\n';
+      ProjMatrixByBinUsingRayTracing proj_matrix;
+      proj_matrix.store_only_basic_bins_in_cache(store_only_basic_bins != 0);
+      proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+
+      // first pass fills the cache, second pass reads from it
+      check_if_equal(get_rows_in_parallel(proj_matrix), 0,
+                     "number of different rows when filling the cache");
+      proj_matrix.reset_cache_counters();
+      check_if_equal(get_rows_in_parallel(proj_matrix), 0,
+                     "number of different rows when reading from the cache");
+      check_if_equal(proj_matrix.get_num_cache_misses(), 0UL,
+                     "all rows should be in the cache after the first pass");
+    }
+}
+
+void
+ProjMatrixByBinTests::
+run_tests_for_compression(const ProjMatrixElemsForOneBin& row,
+                          const bool quantise_values, const float tolerance)
+{
+  float max_abs_value = 0.F;
+  for (ProjMatrixElemsForOneBin::const_iterator iter=row.begin(); iter!=row.end(); ++iter)
+    max_abs_value = std::max(max_abs_value, std::fabs(iter->get_value()));
+
+  const CompressedProjMatrixElemsForOneBin compressed(row, quantise_values);
+  check_if_equal(compressed.size(), row.size(), "number of elements in compressed row");
+  ProjMatrixElemsForOneBin decompressed(row.get_bin());
+  compressed.decompress(decompressed);
+  if (!check_if_equal(decompressed.size(), row.size(), "number of elements in decompressed row"))
+    return;
+  ProjMatrixElemsForOneBin::const_iterator decompressed_iter = decompressed.begin();
+  for (ProjMatrixElemsForOneBin::const_iterator iter=row.begin(); iter!=row.end(); ++iter, ++decompressed_iter)
+    {
+      if (!check_if_equal(decompressed_iter->get_coords(), iter->get_coords(),
+                          "coordinates in decompressed row"))
+        return;
+      if (!check(std::fabs(decompressed_iter->get_value() - iter->get_value()) <= tolerance*max_abs_value,
+                 "value in decompressed row"))
+        {
+          std::cerr << "original " << iter->get_value()
+                    << ", decompressed " << decompressed_iter->get_value() << '\n';
+          return;
+        }
+    }
+}
+
+void
+ProjMatrixByBinTests::run_tests_for_compression()
+{
+  std::cerr << "\tcompressing rows\n";
+  // rows of the ray tracer
+  for (unsigned int i=0; i<reference_rows.size(); i+=97)
+    {
+      run_tests_for_compression(reference_rows[i], /*quantise_values=*/ false, 0.F);
+      run_tests_for_compression(reference_rows[i], /*quantise_values=*/ true, 1.F/65534);
+    }
+  // a row that is not sorted, with large coordinates and negative values
+  {
+    ProjMatrixElemsForOneBin row(Bin(0,0,0,0));
+    row.push_back(ProjMatrixElemsForOneBinValue(Coordinate3D<int>(3,-200,100000), 1.F));
+    row.push_back(ProjMatrixElemsForOneBinValue(Coordinate3D<int>(-70000,5,-100000), -.3F));
+    row.push_back(ProjMatrixElemsForOneBinValue(Coordinate3D<int>(-70000,5,-99999), 1.E-7F));
+    row.push_back(ProjMatrixElemsForOneBinValue(Coordinate3D<int>(0,0,0), 0.F));
+    row.push_back(ProjMatrixElemsForOneBinValue(Coordinate3D<int>(2,-1,-1), 123.F));
+    run_tests_for_compression(row, /*quantise_values=*/ false, 0.F);
+    run_tests_for_compression(row, /*quantise_values=*/ true, 1.F/65534);
+  }
+  // an empty row
+  run_tests_for_compression(ProjMatrixElemsForOneBin(Bin(0,0,0,0)), /*quantise_values=*/ true, 0.F);
+}
+
+void
+ProjMatrixByBinTests::run_tests_for_quantised_values()
+{
+  std::cerr << "\tconcurrent access with quantise values in cache := 1\n";
+  ProjMatrixByBinUsingRayTracing proj_matrix;
+  proj_matrix.quantise_values_in_cache(true);
+  proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+  check_if_equal(get_rows_in_parallel(proj_matrix), 0,
+                 "number of different rows when filling the cache");
+  check_if_equal(get_rows_in_parallel(proj_matrix), 0,
+                 "number of different rows when reading from the cache");
+}
+
+void
+ProjMatrixByBinTests::run_tests_for_maximum_cache_size()
+{
+  std::size_t full_cache_size;
+  {
+    ProjMatrixByBinUsingRayTracing proj_matrix;
+    proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+    get_rows_in_parallel(proj_matrix);
+    full_cache_size = proj_matrix.get_cache_memory_size();
+  }
+  const std::size_t max_cache_size = full_cache_size/4;
+  std::cerr << "\tmaximum cache size := " << max_cache_size
+            << " (full cache takes " << full_cache_size << " bytes)\n";
+
+  ProjMatrixByBinUsingRayTracing proj_matrix;
+  proj_matrix.set_maximum_cache_size(max_cache_size);
+  proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+
+  // a single thread, such that the size can be checked after every row
+  ProjMatrixElemsForOneBin row;
+  std::size_t largest_cache_size = 0;
+  int num_different = 0;
+  for (int pass=0; pass<2; ++pass)
+    {
+      proj_matrix.reset_cache_counters();
+      for (unsigned int i=0; i<bins.size(); ++i)
+        {
+          proj_matrix.get_proj_matrix_elems_for_one_bin(row, bins[i]);
+          largest_cache_size = std::max(largest_cache_size, proj_matrix.get_cache_memory_size());
+          row.sort();
+          if (row != reference_rows[i])
+            ++num_different;
+        }
+    }
+  check(proj_matrix.get_num_cache_misses() > 0, "rows should have been evicted from the cache");
+  check(largest_cache_size <= max_cache_size, "cache size should stay below the maximum");
+  check(largest_cache_size > max_cache_size/2, "cache should be used up to about the maximum");
+  check_if_equal(num_different, 0, "number of different rows with a maximum cache size");
+
+  // many threads
+  proj_matrix.clear_cache();
+  check_if_equal(get_rows_in_parallel(proj_matrix), 0,
+                 "number of different rows with a maximum cache size and many threads");
+  check_if_equal(get_rows_in_parallel(proj_matrix), 0,
+                 "number of different rows with a maximum cache size and many threads (2nd pass)");
+}
+
+void
+ProjMatrixByBinTests::run_tests_for_file(const std::string& version)
+{
+  std::cerr << "\twriting and reading Version " << version << " file\n";
+  // avoid a '.' in the name, as that would be seen as an extension
+  const std::string prefix = "test_ProjMatrixByBin_v" + version.substr(0,1);
+  {
+    ProjMatrixByBinUsingRayTracing proj_matrix;
+    proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+    if (!check(ProjMatrixByBinFromFile::write_to_file(prefix, proj_matrix, proj_data_info_sptr,
+                                                      *density_sptr, version) == Succeeded::yes,
+               "writing matrix to file"))
+      return;
+  }
+
+  {
+    // set up with the templates as written, such that they are identical to the ones in the file
+    shared_ptr<ProjDataInfo> file_proj_data_info_sptr(
+      ProjData::read_from_file(prefix + "_template_proj_data.hs")->get_proj_data_info_ptr()->create_shared_clone());
+    shared_ptr<DiscretisedDensity<3,float> > file_density_sptr(
+      read_from_file<DiscretisedDensity<3,float> >(prefix + "_template_density.hv"));
+    ProjMatrixByBinFromFile proj_matrix;
+    if (!check(proj_matrix.parse((prefix + ".hpm").c_str()), "parsing matrix header"))
+      return;
+    proj_matrix.set_up(file_proj_data_info_sptr, file_density_sptr);
+    if (version == "2.0")
+      check_if_equal(proj_matrix.get_cache_memory_size(), std::size_t(0),
+                     "Version 2.0 file should not be read by set_up");
+    else
+      check(proj_matrix.get_cache_memory_size() > 0,
+            "Version 1.0 file should be read by set_up");
+
+    check_if_equal(get_rows_in_parallel(proj_matrix), 0,
+                   "number of different rows read from file");
+  }
+
+  const char * const extensions[] =
+    { ".hpm", ".pm", "_template_density.hv", "_template_density.ahv", "_template_density.v",
+      "_template_proj_data.hs", "_template_proj_data.s" };
+  for (unsigned int i=0; i<sizeof(extensions)/sizeof(extensions[0]); ++i)
+    std::remove((prefix + extensions[i]).c_str());
+}
+
+void
+ProjMatrixByBinTests::run_tests()
+{
+  std::cerr << "Tests for ProjMatrixByBin" << std::endl;
+  // make sure there are several threads, even on a machine with 1 core
+  set_num_threads(std::max(get_max_num_threads(), 4));
+
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  // an even number of tangential positions such that basic bins can be outside
+  // the range in the projection data
+  proj_data_info_sptr.reset(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                  /*span=*/3,
+                                  /*max_delta=*/4,
+                                  /*num_views=*/16,
+                                  /*num_tang_poss=*/16));
+  density_sptr.reset(new VoxelsOnCartesianGrid<float>(*proj_data_info_sptr));
+
+  compute_reference();
+  run_tests_for_concurrent_access();
+  run_tests_for_compression();
+  run_tests_for_quantised_values();
+  run_tests_for_maximum_cache_size();
+  run_tests_for_file("1.0");
+  run_tests_for_file("2.0");
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  ProjMatrixByBinTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
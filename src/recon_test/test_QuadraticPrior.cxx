@@ -0,0 +1,234 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+  \ingroup priors
+
+  \brief Test program for stir::QuadraticPrior
+
+  The gradient, parabolic_surrogate_curvature(), add_multiplication_with_approximate_Hessian()
+  and compute_Hessian() are compared with a straightforward loop over the neighbourhood
+  of every voxel, using non-uniform (and non-symmetric) weights, with and without a
+  \f$\kappa\f$ image, and for different numbers of threads. The test also checks that
+  error() is called for an image with an irregular index range.
+*/
+
+#include "stir/recon_buildblock/QuadraticPrior.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/IndexRange3D.h"
+#include "stir/IndexRange.h"
+#include "stir/Succeeded.h"
+#include "stir/num_threads.h"
+#include "stir/is_null_ptr.h"
+#include "stir/RunTests.h"
+#include "stir/shared_ptr.h"
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for QuadraticPrior
+*/
+class QuadraticPriorTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  typedef VoxelsOnCartesianGrid<float> image_type;
+
+  shared_ptr<image_type> image_sptr;
+  Array<3,float> weights;
+
+  /*! computes for all voxels r
+        penalisation_factor * sum_dr weights[dr] * term * kappa[r] * kappa[r+dr]
+      over all r+dr in the image, where term is
+      image[r]-image[r+dr] for \\a type 0, 1 for \\a type 1 and image[r+dr] for \\a type 2
+  */
+  void compute_reference(image_type& result, const image_type& image,
+                         const image_type * const kappa_ptr, const float penalisation_factor,
+                         const int type);
+  void run_tests_for_kappa(const shared_ptr<image_type>& kappa_sptr);
+  void run_tests_for_irregular_range();
+};
+
+void
+QuadraticPriorTests::compute_reference(image_type& result, const image_type& image,
+                                       const image_type * const kappa_ptr,
+                                       const float penalisation_factor, const int type)
+{
+  for (int z=image.get_min_z(); z<=image.get_max_z(); ++z)
+    for (int y=image.get_min_y(); y<=image.get_max_y(); ++y)
+      for (int x=image.get_min_x(); x<=image.get_max_x(); ++x)
+        {
+          double sum = 0;
+          for (int dz=weights.get_min_index(); dz<=weights.get_max_index(); ++dz)
+            for (int dy=weights[0].get_min_index(); dy<=weights[0].get_max_index(); ++dy)
+              for (int dx=weights[0][0].get_min_index(); dx<=weights[0][0].get_max_index(); ++dx)
+                {
+                  if (z+dz < image.get_min_z() || z+dz > image.get_max_z() ||
+                      y+dy < image.get_min_y() || y+dy > image.get_max_y() ||
+                      x+dx < image.get_min_x() || x+dx > image.get_max_x())
+                    continue;
+                  const float neighbour = image[z+dz][y+dy][x+dx];
+                  const double term =
+                    type == 0 ? image[z][y][x] - neighbour : (type == 1 ? 1. : neighbour);
+                  double current = weights[dz][dy][dx] * term;
+                  if (kappa_ptr != 0)
+                    current *= (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
+                  sum += current;
+                }
+          result[z][y][x] = static_cast<float>(sum * penalisation_factor);
+        }
+}
+
+void
+QuadraticPriorTests::run_tests_for_kappa(const shared_ptr<image_type>& kappa_sptr)
+{
+  const float penalisation_factor = 1.3F;
+  QuadraticPrior<float> prior(/*only_2D=*/false, penalisation_factor);
+  prior.set_weights(weights);
+  if (!is_null_ptr(kappa_sptr))
+    prior.set_kappa_sptr(kappa_sptr);
+  const image_type& image = *image_sptr;
+
+  for (int num_threads=1; num_threads<=4; num_threads*=4)
+    {
+      set_num_threads(num_threads);
+      std::cerr << "\t" << num_threads << " threads\n";
+
+      shared_ptr<image_type> reference_sptr(image.get_empty_voxels_on_cartesian_grid());
+      shared_ptr<image_type> output_sptr(image.get_empty_voxels_on_cartesian_grid());
+      compute_reference(*reference_sptr, image, kappa_sptr.get(), penalisation_factor, 0);
+      prior.compute_gradient(*output_sptr, image);
+      check_if_equal(*output_sptr, *reference_sptr, "gradient");
+
+      compute_reference(*reference_sptr, image, kappa_sptr.get(), penalisation_factor, 1);
+      prior.parabolic_surrogate_curvature(*output_sptr, image);
+      check_if_equal(*output_sptr, *reference_sptr, "parabolic_surrogate_curvature");
+
+      // add_multiplication_with_approximate_Hessian adds to the output
+      compute_reference(*reference_sptr, image, kappa_sptr.get(), penalisation_factor, 2);
+      *reference_sptr += image;
+      *output_sptr = image;
+      check(prior.add_multiplication_with_approximate_Hessian(*output_sptr, image) == Succeeded::yes,
+            "add_multiplication_with_approximate_Hessian return value");
+      check_if_equal(*output_sptr, *reference_sptr, "add_multiplication_with_approximate_Hessian");
+    }
+
+  // Hessian for a voxel at the edge and one in the middle of the image
+  const BasicCoordinate<3,int> min_indices = make_coordinate(image.get_min_z(), image.get_min_y(), image.get_min_x());
+  const BasicCoordinate<3,int> middle_indices = make_coordinate(2, 0, -1);
+  for (int i=0; i<2; ++i)
+    {
+      const BasicCoordinate<3,int> coords = i==0 ? min_indices : middle_indices;
+      shared_ptr<image_type> Hessian_sptr(image.get_empty_voxels_on_cartesian_grid());
+      prior.compute_Hessian(*Hessian_sptr, coords, image);
+      // the row of the Hessian is the gradient of the gradient at coords
+      shared_ptr<image_type> reference_sptr(image.get_empty_voxels_on_cartesian_grid());
+      float diagonal = 0;
+      for (int dz=weights.get_min_index(); dz<=weights.get_max_index(); ++dz)
+        for (int dy=weights[0].get_min_index(); dy<=weights[0].get_max_index(); ++dy)
+          for (int dx=weights[0][0].get_min_index(); dx<=weights[0][0].get_max_index(); ++dx)
+            {
+              const int z = coords[1]+dz, y = coords[2]+dy, x = coords[3]+dx;
+              if (z < image.get_min_z() || z > image.get_max_z() ||
+                  y < image.get_min_y() || y > image.get_max_y() ||
+                  x < image.get_min_x() || x > image.get_max_x())
+                continue;
+              float current = weights[dz][dy][dx];
+              if (!is_null_ptr(kappa_sptr))
+                current *= (*kappa_sptr)[coords] * (*kappa_sptr)[z][y][x];
+              diagonal += current;
+              (*reference_sptr)[z][y][x] = -current*penalisation_factor;
+            }
+      (*reference_sptr)[coords] = diagonal*penalisation_factor;
+      check_if_equal(*Hessian_sptr, *reference_sptr, "compute_Hessian");
+    }
+}
+
+void
+QuadraticPriorTests::run_tests_for_irregular_range()
+{
+  std::cerr << "\tchecking that an irregular index range is rejected\n";
+  // 2 planes with 3 rows, where the middle row is longer
+  VectorWithOffset<IndexRange<1> > plane_range(-1,1);
+  for (int y=-1; y<=1; ++y)
+    plane_range[y] = y==0 ? IndexRange<1>(-2,2) : IndexRange<1>(-1,1);
+  VectorWithOffset<IndexRange<2> > range(0,1);
+  for (int z=0; z<=1; ++z)
+    range[z] = IndexRange<2>(plane_range);
+  image_type image(IndexRange<3>(range), CartesianCoordinate3D<float>(0,0,0), CartesianCoordinate3D<float>(2,2,2));
+  image.fill(1.F);
+  shared_ptr<image_type> gradient_sptr(image.get_empty_voxels_on_cartesian_grid());
+  QuadraticPrior<float> prior(/*only_2D=*/false, 1.F);
+  bool caught_error = false;
+  try
+    {
+      prior.compute_gradient(*gradient_sptr, image);
+    }
+  catch (const std::string&)
+    {
+      caught_error = true;
+    }
+  check(caught_error, "compute_gradient should call error() for an irregular index range");
+}
+
+void
+QuadraticPriorTests::run_tests()
+{
+  std::cerr << "Tests for QuadraticPrior" << std::endl;
+
+  image_sptr.reset(new image_type(IndexRange3D(0,4,-3,4,-5,3),
+                                  CartesianCoordinate3D<float>(0,0,0),
+                                  CartesianCoordinate3D<float>(2.F,3.F,3.5F)));
+  shared_ptr<image_type> kappa_sptr(image_sptr->get_empty_voxels_on_cartesian_grid());
+  for (int z=image_sptr->get_min_z(); z<=image_sptr->get_max_z(); ++z)
+    for (int y=image_sptr->get_min_y(); y<=image_sptr->get_max_y(); ++y)
+      for (int x=image_sptr->get_min_x(); x<=image_sptr->get_max_x(); ++x)
+        {
+          (*image_sptr)[z][y][x] = static_cast<float>((7*z + 3*y + 11*x + 100) % 13 + 1)/10;
+          (*kappa_sptr)[z][y][x] = static_cast<float>((5*z + 2*y + 3*x + 100) % 7 + 1)/4;
+        }
+  // non-uniform weights, which are not symmetric, such that swapping dr and -dr would be noticed
+  weights.grow(IndexRange3D(-1,1,-1,1,-2,2));
+  for (int dz=-1; dz<=1; ++dz)
+    for (int dy=-1; dy<=1; ++dy)
+      for (int dx=-2; dx<=2; ++dx)
+        weights[dz][dy][dx] = 1.F + .5F*dz + 2.F*dy*dy + .25F*dx + (dz==0 && dy==0 && dx==0 ? -1.F : 0.F);
+
+  set_tolerance(1E-4);
+  std::cerr << "\twithout kappa\n";
+  run_tests_for_kappa(shared_ptr<image_type>());
+  std::cerr << "\twith kappa\n";
+  run_tests_for_kappa(kappa_sptr);
+  run_tests_for_irregular_range();
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  QuadraticPriorTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,215 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+  \ingroup scatter
+
+  \brief Test program for the cached integrals in stir::ScatterEstimationByBin
+
+  The single scatter estimate for a small scanner and a uniform attenuating cylinder
+  is computed with the cached integrals (and the vectorised loop over scatter points)
+  and without cache (using single_scatter_estimate_for_one_scatter_point()).
+  The test checks that
+  - both estimates are the same (up to rounding errors);
+  - after changing the activity image, the estimate with the incrementally updated
+    cache is the same as the estimate without cache.
+*/
+
+#include "stir/scatter/ScatterEstimationByBin.h"
+#include "stir/ProjDataInMemory.h"
+#include "stir/ProjDataInfoCylindricalNoArcCorr.h"
+#include "stir/ExamInfo.h"
+#include "stir/Scanner.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/IndexRange3D.h"
+#include "stir/SegmentBySinogram.h"
+#include "stir/Succeeded.h"
+#include "stir/RunTests.h"
+#include "stir/shared_ptr.h"
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cmath>
+
+START_NAMESPACE_STIR
+
+//! ScatterEstimationByBin that can switch the cache on and off
+class ScatterEstimationByBinForTests : public ScatterEstimationByBin
+{
+public:
+  ScatterEstimationByBinForTests(const bool use_cache)
+  {
+    this->use_cache = use_cache;
+    // use the voxel centres as scatter points, such that both objects have the same ones
+    this->random = false;
+  }
+  //! store the estimate in memory (the log file is still written)
+  void set_output_proj_data_in_memory(const std::string& filename)
+  {
+    this->output_proj_data_filename = filename;
+    this->output_proj_data_sptr.reset(new ProjDataInMemory(shared_ptr<ExamInfo>(new ExamInfo),
+                                                           this->proj_data_info_ptr->create_shared_clone()));
+  }
+  shared_ptr<ProjData> get_output_proj_data_sptr() const
+  { return this->output_proj_data_sptr; }
+};
+
+/*!
+  \ingroup test
+  \brief Test class for the cached integrals in ScatterEstimationByBin
+*/
+class ScatterEstimationByBinTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  shared_ptr<ProjDataInfo> proj_data_info_sptr;
+  shared_ptr<VoxelsOnCartesianGrid<float> > density_image_sptr;
+  shared_ptr<VoxelsOnCartesianGrid<float> > density_image_for_scatter_points_sptr;
+
+  //! sets images and template, with the log file \a output_filename.log
+  void set_up(ScatterEstimationByBinForTests& scatter_estimation,
+              const shared_ptr<DiscretisedDensity<3,float> >& activity_image_sptr,
+              const std::string& output_filename);
+  //! compare all segments, relative to the maximum
+  void compare(const ProjData& proj_data, const ProjData& reference_proj_data, const std::string& str);
+  void remove_log(const std::string& output_filename);
+};
+
+void
+ScatterEstimationByBinTests::set_up(ScatterEstimationByBinForTests& scatter_estimation,
+                                    const shared_ptr<DiscretisedDensity<3,float> >& activity_image_sptr,
+                                    const std::string& output_filename)
+{
+  scatter_estimation.set_template_proj_data_info_sptr(proj_data_info_sptr);
+  scatter_estimation.set_density_image_sptr(density_image_sptr);
+  scatter_estimation.set_density_image_for_scatter_points_sptr(density_image_for_scatter_points_sptr);
+  scatter_estimation.set_activity_image_sptr(activity_image_sptr);
+  scatter_estimation.set_output_proj_data_in_memory(output_filename);
+}
+
+void
+ScatterEstimationByBinTests::compare(const ProjData& proj_data, const ProjData& reference_proj_data,
+                                     const std::string& str)
+{
+  for (int segment_num=reference_proj_data.get_min_segment_num();
+       segment_num<=reference_proj_data.get_max_segment_num(); ++segment_num)
+    {
+      const SegmentBySinogram<float> reference = reference_proj_data.get_segment_by_sinogram(segment_num);
+      SegmentBySinogram<float> difference = proj_data.get_segment_by_sinogram(segment_num);
+      difference -= reference;
+      const float max_reference = reference.find_max();
+      check(max_reference > 0, "scatter estimate should be positive");
+      const float max_difference =
+        std::max(difference.find_max(), -difference.find_min());
+      check(max_difference <= 1E-4F*max_reference,
+            str + ": estimates with and without cache should be equal");
+      if (!is_everything_ok())
+        std::cerr << "Segment " << segment_num << ": maximum difference " << max_difference
+                  << " for maximum " << max_reference << '\n';
+    }
+}
+
+void
+ScatterEstimationByBinTests::remove_log(const std::string& output_filename)
+{
+  std::remove((output_filename + ".log").c_str());
+}
+
+void
+ScatterEstimationByBinTests::run_tests()
+{
+  std::cerr << "Tests for ScatterEstimationByBin with and without cache" << std::endl;
+
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  proj_data_info_sptr.reset(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr, /*span=*/1, /*max_delta=*/1,
+                                  /*num_views=*/scanner_sptr->get_num_detectors_per_ring()/16,
+                                  /*num_tang_poss=*/16, /*arc_corrected=*/false));
+
+  // attenuation image: uniform water cylinder with a radius of 60 mm
+  density_image_sptr.reset(
+    new VoxelsOnCartesianGrid<float>(*proj_data_info_sptr, /*zoom=*/.25F,
+                                     CartesianCoordinate3D<float>(0,0,0),
+                                     CartesianCoordinate3D<int>(-1,21,21)));
+  // coarse image for the scatter points, with the same cylinder
+  density_image_for_scatter_points_sptr.reset(
+    new VoxelsOnCartesianGrid<float>(IndexRange3D(0,4,-3,3,-3,3),
+                                     CartesianCoordinate3D<float>(0,0,0),
+                                     CartesianCoordinate3D<float>(20.F,25.F,25.F)));
+  shared_ptr<VoxelsOnCartesianGrid<float> >
+    activity_image_sptr(density_image_sptr->get_empty_voxels_on_cartesian_grid());
+  {
+    VoxelsOnCartesianGrid<float>* images[] =
+      { density_image_sptr.get(), density_image_for_scatter_points_sptr.get(), activity_image_sptr.get() };
+    const float radii[] = { 60.F, 60.F, 40.F };
+    const float values[] = { .096F, .096F, 1.F };
+    for (int i=0; i<3; ++i)
+      {
+        VoxelsOnCartesianGrid<float>& image = *images[i];
+        const CartesianCoordinate3D<float> voxel_size = image.get_voxel_size();
+        for (int z=image.get_min_z(); z<=image.get_max_z(); ++z)
+          for (int y=image.get_min_y(); y<=image.get_max_y(); ++y)
+            for (int x=image.get_min_x(); x<=image.get_max_x(); ++x)
+              if (std::sqrt(square(x*voxel_size.x()) + square(y*voxel_size.y())) < radii[i])
+                image[z][y][x] = values[i];
+      }
+  }
+  // add an off-centre hot spot to break the symmetry
+  (*activity_image_sptr)[10][1][2] = 5.F;
+
+  ScatterEstimationByBinForTests scatter_estimation_with_cache(true);
+  ScatterEstimationByBinForTests scatter_estimation_without_cache(false);
+  {
+    std::cerr << "\tcomparing estimates with and without cache\n";
+    set_up(scatter_estimation_with_cache, activity_image_sptr, "test_ScatterEstimationByBin_cache");
+    set_up(scatter_estimation_without_cache, activity_image_sptr, "test_ScatterEstimationByBin_no_cache");
+    check(scatter_estimation_with_cache.process_data() == Succeeded::yes, "process_data with cache");
+    check(scatter_estimation_without_cache.process_data() == Succeeded::yes, "process_data without cache");
+    compare(*scatter_estimation_with_cache.get_output_proj_data_sptr(),
+            *scatter_estimation_without_cache.get_output_proj_data_sptr(),
+            "first activity image");
+  }
+  {
+    std::cerr << "\tcomparing estimates after changing the activity image\n";
+    shared_ptr<VoxelsOnCartesianGrid<float> > new_activity_image_sptr(activity_image_sptr->clone());
+    (*new_activity_image_sptr)[5][-3][-1] += 10.F;
+    (*new_activity_image_sptr)[10][1][2] = 0.F;
+    // this updates the cache incrementally
+    scatter_estimation_with_cache.set_activity_image_sptr(new_activity_image_sptr);
+    scatter_estimation_without_cache.set_activity_image_sptr(new_activity_image_sptr);
+    check(scatter_estimation_with_cache.process_data() == Succeeded::yes, "process_data with cache");
+    check(scatter_estimation_without_cache.process_data() == Succeeded::yes, "process_data without cache");
+    compare(*scatter_estimation_with_cache.get_output_proj_data_sptr(),
+            *scatter_estimation_without_cache.get_output_proj_data_sptr(),
+            "changed activity image");
+  }
+  remove_log("test_ScatterEstimationByBin_cache");
+  remove_log("test_ScatterEstimationByBin_no_cache");
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  ScatterEstimationByBinTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,267 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+  \ingroup distributable
+
+  \brief Test program for prefetching in stir::distributable_computation()
+
+  distributable_computation() is called with a call-back function that adds a
+  weighted sum of the measured viewgrams to the output image, the double output
+  and the counters. The data are integers, such that all sums are exact and the
+  outputs do not depend on the order in which the viewgrams are processed.
+  The test checks that
+  - the outputs are the same with and without prefetching (for different
+    queue depths and numbers of I/O threads), for different numbers of threads
+    and for different maximum numbers of partial images;
+  - an error while reading the data is thrown from distributable_computation(),
+    also when prefetching.
+*/
+
+#include "stir/recon_buildblock/distributable.h"
+#include "stir/recon_buildblock/TrivialDataSymmetriesForBins.h"
+#include "stir/recon_buildblock/ForwardProjectorByBin.h"
+#include "stir/recon_buildblock/BackProjectorByBin.h"
+#include "stir/recon_buildblock/BinNormalisation.h"
+#include "stir/ProjDataInMemory.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/ExamInfo.h"
+#include "stir/Scanner.h"
+#include "stir/RelatedViewgrams.h"
+#include "stir/Viewgram.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/IndexRange3D.h"
+#include "stir/num_threads.h"
+#include "stir/RunTests.h"
+#include "stir/error.h"
+#include "stir/shared_ptr.h"
+#include <iostream>
+#include <string>
+
+START_NAMESPACE_STIR
+
+//! ProjData that throws when reading a particular view
+class ProjDataWithReadError : public ProjDataInMemory
+{
+public:
+  ProjDataWithReadError(const ProjData& proj_data, const int failing_view_num)
+    : ProjDataInMemory(proj_data), failing_view_num(failing_view_num)
+  {}
+
+  Viewgram<float> get_viewgram(const int view_num, const int segment_num,
+                               const bool make_num_tangential_poss_odd = false) const
+  {
+    if (view_num == failing_view_num)
+      error("ProjDataWithReadError: cannot read view %d", view_num);
+    return ProjDataInMemory::get_viewgram(view_num, segment_num, make_num_tangential_poss_odd);
+  }
+
+private:
+  const int failing_view_num;
+};
+
+// adds a weighted sum of the measured viewgrams to all outputs
+static void
+RPC_process_related_viewgrams_weighted_sum(const shared_ptr<ForwardProjectorByBin>&,
+                                           const shared_ptr<BackProjectorByBin>&,
+                                           DiscretisedDensity<3,float>* output_image_ptr,
+                                           const DiscretisedDensity<3,float>*,
+                                           RelatedViewgrams<float>* measured_viewgrams_ptr,
+                                           int& count, int& count2, double* double_out_ptr,
+                                           const RelatedViewgrams<float>*,
+                                           const RelatedViewgrams<float>*)
+{
+  float weighted_sum = 0.F;
+  for (RelatedViewgrams<float>::const_iterator iter = measured_viewgrams_ptr->begin();
+       iter != measured_viewgrams_ptr->end();
+       ++iter)
+    weighted_sum += iter->sum() * (1 + iter->get_view_num() + 10*(iter->get_segment_num()+2));
+  if (output_image_ptr != NULL)
+    (*output_image_ptr)[0][0][0] += weighted_sum;
+  if (double_out_ptr != NULL)
+    *double_out_ptr += weighted_sum;
+  ++count;
+  count2 += measured_viewgrams_ptr->get_num_viewgrams();
+}
+
+/*!
+  \ingroup test
+  \brief Test class for distributable_computation()
+*/
+class DistributableComputationTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  shared_ptr<ProjData> proj_data_sptr;
+  shared_ptr<DataSymmetriesForViewSegmentNumbers> symmetries_sptr;
+  shared_ptr<VoxelsOnCartesianGrid<float> > template_image_sptr;
+
+  //! calls distributable_computation() and returns the outputs
+  void compute(float& image_output, double& double_output,
+               const shared_ptr<ProjData>& proj_data_sptr,
+               const int subset_num, const int num_subsets,
+               const int prefetch_depth, const int num_prefetch_threads,
+               const int max_num_partial_images = 0);
+  void run_tests_for_prefetching();
+  void run_tests_for_read_error();
+};
+
+void
+DistributableComputationTests::compute(float& image_output, double& double_output,
+                                       const shared_ptr<ProjData>& proj_data_sptr,
+                                       const int subset_num, const int num_subsets,
+                                       const int prefetch_depth, const int num_prefetch_threads,
+                                       const int max_num_partial_images)
+{
+  VoxelsOnCartesianGrid<float> output_image(*template_image_sptr);
+  double_output = 0.;
+  distributable_computation(shared_ptr<ForwardProjectorByBin>(), shared_ptr<BackProjectorByBin>(),
+                            symmetries_sptr,
+                            &output_image, NULL,
+                            proj_data_sptr, /*read_from_proj_data=*/true,
+                            subset_num, num_subsets,
+                            proj_data_sptr->get_min_segment_num(), proj_data_sptr->get_max_segment_num(),
+                            /*zero_seg0_end_planes=*/false,
+                            &double_output,
+                            shared_ptr<ProjData>(),
+                            shared_ptr<BinNormalisation>(), 0., 0.,
+                            &RPC_process_related_viewgrams_weighted_sum,
+                            NULL,
+                            prefetch_depth, num_prefetch_threads, max_num_partial_images);
+  image_output = output_image[0][0][0];
+}
+
+void
+DistributableComputationTests::run_tests_for_prefetching()
+{
+  std::cerr << "\tcomparing output with and without prefetching\n";
+  for (int num_subsets=1; num_subsets<=2; ++num_subsets)
+    for (int subset_num=0; subset_num<num_subsets; ++subset_num)
+      {
+        set_num_threads(1);
+        float reference_image_output;
+        double reference_double_output;
+        compute(reference_image_output, reference_double_output, proj_data_sptr,
+                subset_num, num_subsets, 0, 1);
+        check(reference_double_output > 0, "output should be positive");
+        check_if_equal(static_cast<double>(reference_image_output), reference_double_output,
+                       "image and double output should be equal");
+
+        for (int num_threads=1; num_threads<=4; num_threads*=2)
+          {
+            set_num_threads(num_threads);
+            for (int prefetch_depth=0; prefetch_depth<=3; prefetch_depth+=3)
+              for (int num_prefetch_threads=1; num_prefetch_threads<=2; ++num_prefetch_threads)
+                {
+                  float image_output;
+                  double double_output;
+                  compute(image_output, double_output, proj_data_sptr,
+                          subset_num, num_subsets, prefetch_depth, num_prefetch_threads);
+                  check_if_equal(image_output, reference_image_output,
+                                 "image output with and without prefetching");
+                  check_if_equal(double_output, reference_double_output,
+                                 "double output with and without prefetching");
+                  if (!is_everything_ok())
+                    {
+                      std::cerr << "Failed for subset " << subset_num << " of " << num_subsets
+                                << ", " << num_threads << " threads, prefetch depth " << prefetch_depth
+                                << " and " << num_prefetch_threads << " prefetch threads\n";
+                      return;
+                    }
+                }
+            for (int max_num_partial_images=1; max_num_partial_images<=2; ++max_num_partial_images)
+              {
+                float image_output;
+                double double_output;
+                compute(image_output, double_output, proj_data_sptr,
+                        subset_num, num_subsets, 3, 2, max_num_partial_images);
+                check_if_equal(image_output, reference_image_output,
+                               "image output with a maximum number of partial images");
+              }
+          }
+      }
+}
+
+void
+DistributableComputationTests::run_tests_for_read_error()
+{
+  std::cerr << "\tchecking that a read error is passed on\n";
+  shared_ptr<ProjData> failing_proj_data_sptr(new ProjDataWithReadError(*proj_data_sptr, 2));
+  for (int prefetch_depth=0; prefetch_depth<=3; prefetch_depth+=3)
+    {
+      set_num_threads(prefetch_depth == 0 ? 1 : 2);
+      bool caught_error = false;
+      try
+        {
+          float image_output;
+          double double_output;
+          compute(image_output, double_output, failing_proj_data_sptr, 0, 1, prefetch_depth, 2);
+        }
+      catch (const std::string& message)
+        {
+          caught_error = message.find("cannot read view 2") != std::string::npos;
+        }
+      check(caught_error,
+            prefetch_depth == 0 ? "read error without prefetching should be thrown"
+            : "read error when prefetching should be thrown");
+    }
+}
+
+void
+DistributableComputationTests::run_tests()
+{
+  std::cerr << "Tests for distributable_computation" << std::endl;
+
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  shared_ptr<ProjDataInfo> proj_data_info_sptr(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr, /*span=*/1, /*max_delta=*/1,
+                                  /*num_views=*/8, /*num_tang_poss=*/16, /*arc_corrected=*/true));
+  shared_ptr<ExamInfo> exam_info_sptr(new ExamInfo);
+  proj_data_sptr.reset(new ProjDataInMemory(exam_info_sptr, proj_data_info_sptr));
+  for (int segment_num=proj_data_sptr->get_min_segment_num();
+       segment_num<=proj_data_sptr->get_max_segment_num(); ++segment_num)
+    for (int view_num=proj_data_sptr->get_min_view_num();
+         view_num<=proj_data_sptr->get_max_view_num(); ++view_num)
+      {
+        Viewgram<float> viewgram = proj_data_sptr->get_empty_viewgram(view_num, segment_num);
+        for (int ax_pos_num=viewgram.get_min_axial_pos_num(); ax_pos_num<=viewgram.get_max_axial_pos_num(); ++ax_pos_num)
+          for (int tang_pos_num=viewgram.get_min_tangential_pos_num(); tang_pos_num<=viewgram.get_max_tangential_pos_num(); ++tang_pos_num)
+            viewgram[ax_pos_num][tang_pos_num] =
+              static_cast<float>((ax_pos_num + 2*tang_pos_num + 3*view_num + 5*segment_num + 100) % 4);
+        proj_data_sptr->set_viewgram(viewgram);
+      }
+  symmetries_sptr.reset(new TrivialDataSymmetriesForBins(proj_data_info_sptr));
+  template_image_sptr.reset(new VoxelsOnCartesianGrid<float>(IndexRange3D(0,0,0,0,0,0),
+                                                             CartesianCoordinate3D<float>(0,0,0),
+                                                             CartesianCoordinate3D<float>(1,1,1)));
+
+  run_tests_for_prefetching();
+  run_tests_for_read_error();
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  DistributableComputationTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
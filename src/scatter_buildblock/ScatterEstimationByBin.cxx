@@ -117,8 +117,9 @@ void
 ScatterEstimationByBin::
 set_activity_image_sptr(const shared_ptr<DiscretisedDensity<3,float> >& new_sptr)
 {
+  // note: cached activity integrals will be updated by process_data()
   this->activity_image_sptr=new_sptr;
-  this->remove_cache_for_integrals_over_activity();
+  this->cached_integrals_are_up_to_date = false;
 }
 
 void
@@ -199,12 +200,10 @@ set_template_proj_data_info_sptr(const shared_ptr<ProjDataInfo>& new_sptr)
       error("ScatterEstimationByBin can only handle non-arccorrected data");
     }
       
-  // find final size of detection_points_vector
   this->total_detectors = 
     this->proj_data_info_ptr->get_scanner_ptr()->get_num_rings()*
     this->proj_data_info_ptr->get_scanner_ptr()->get_num_detectors_per_ring ();
-  // reserve space to avoid reallocation, but the actual size will grow dynamically
-  this->detection_points_vector.reserve(total_detectors);
+  this->initialise_detection_points();
 
   // remove any cached values as they'd be incorrect if the sizes changes
   this->remove_cache_for_integrals_over_attenuation();
@@ -251,6 +250,7 @@ process_data()
 {               
   this->initialise_cache_for_scattpoint_det_integrals_over_attenuation();
   this->initialise_cache_for_scattpoint_det_integrals_over_activity();
+  this->cached_integrals_are_up_to_date = true;
  
   ViewSegmentNumbers vs_num;
         
@@ -277,13 +277,7 @@ process_data()
   /* ////////////////// end SCATTER ESTIMATION TIME ////////////////
    */
         
-  /* Currently, proj_data_info.find_cartesian_coordinates_of_detection() returns
-     coordinate in a coordinate system where z=0 in the first ring of the scanner.
-     We want to shift this to a coordinate system where z=0 in the middle 
-     of the scanner.
-     We can use get_m() as that uses the 'middle of the scanner' system.
-     (sorry)
-  */
+  /* Check the assumptions made by initialise_detection_points() */
 #ifndef NDEBUG
   {
     CartesianCoordinate3D<float> detector_coord_A, detector_coord_B;
@@ -300,8 +294,6 @@ process_data()
     assert(fabs(m_last + m_first)<m_last*10E-4);
   }
 #endif
-  this->shift_detector_coordinates_to_origin =
-    CartesianCoordinate3D<float>(this->proj_data_info_ptr->get_m(Bin(0,0,0,0)),0, 0);
 
   float total_scatter = 0 ;
 
@@ -343,13 +335,6 @@ process_data()
   wall_clock_timer.stop();
   this->write_log(wall_clock_timer.value(), total_scatter);
 
-  if (detection_points_vector.size() != static_cast<unsigned int>(total_detectors))
-    {
-      warning("Expected num detectors: %d, but found %d\n",
-              total_detectors, detection_points_vector.size());
-      return Succeeded::no;
-    }
-
   return Succeeded::yes;
 }
 
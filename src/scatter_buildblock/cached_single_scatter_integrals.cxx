@@ -27,18 +27,100 @@
   \author Kris Thielemans
 */
 #include "stir/scatter/ScatterEstimationByBin.h"
+#include "stir/VoxelsOnCartesianGrid.h"
 #include "stir/IndexRange.h" 
 #include "stir/Coordinate2D.h"
+#include "stir/is_null_ptr.h"
+#include "stir/info.h"
+#include "stir/error.h"
+#include <algorithm>
 
 START_NAMESPACE_STIR
 
-const float cache_init_value = -1234567.89E10F; // an arbitrary value that should never occur
+/* Find a box (in the coordinate system used by integral_between_2_points) that contains all
+   non-zero voxels of the image. The box is enlarged by a voxel in every direction, such that
+   lines that do not intersect the box do not pass through any of those voxels.
+   Returns false if all voxels are zero.
+*/
+static bool
+find_bounding_box_of_non_zeros(CartesianCoordinate3D<float>& min_coord,
+                               CartesianCoordinate3D<float>& max_coord,
+                               const DiscretisedDensity<3,float>& density)
+{
+  const VoxelsOnCartesianGrid<float>& image =
+    dynamic_cast<const VoxelsOnCartesianGrid<float>& >(density);
+  BasicCoordinate<3,int> min_index, max_index;
+  if (!image.get_regular_range(min_index, max_index))
+    error("ScatterEstimationByBin: works only on images with regular ranges");
+
+  BasicCoordinate<3,int> min_non_zero = max_index;
+  BasicCoordinate<3,int> max_non_zero = min_index;
+  bool found_non_zero = false;
+  BasicCoordinate<3,int> c;
+  for (c[1]=min_index[1]; c[1]<=max_index[1]; ++c[1])
+    for (c[2]=min_index[2]; c[2]<=max_index[2]; ++c[2])
+      for (c[3]=min_index[3]; c[3]<=max_index[3]; ++c[3])
+        if (image[c] != 0)
+          {
+            found_non_zero = true;
+            for (int d=1; d<=3; ++d)
+              {
+                min_non_zero[d] = std::min(min_non_zero[d], c[d]);
+                max_non_zero[d] = std::max(max_non_zero[d], c[d]);
+              }
+          }
+  if (!found_non_zero)
+    return false;
+
+  // use same conventions as integral_between_2_points
+  const CartesianCoordinate3D<float> voxel_size = image.get_grid_spacing();
+  CartesianCoordinate3D<float> origin = image.get_origin();
+  origin.z() -= (image.get_max_index() + image.get_min_index())*voxel_size.z()/2.F;
+  min_coord = voxel_size*convert_int_to_float(min_non_zero - 1) + origin;
+  max_coord = voxel_size*convert_int_to_float(max_non_zero + 1) + origin;
+  return true;
+}
+
+/* Check if the line segment between 2 points intersects the box
+   (which has to have min_coord <= max_coord). */
+static bool
+line_segment_intersects_box(const CartesianCoordinate3D<float>& point1,
+                            const CartesianCoordinate3D<float>& point2,
+                            const CartesianCoordinate3D<float>& min_coord,
+                            const CartesianCoordinate3D<float>& max_coord)
+{
+  // the segment is point1 + t*(point2-point1) with t in [0,1]. Clip t for every dimension.
+  float t_min = 0.F;
+  float t_max = 1.F;
+  for (int d=1; d<=3; ++d)
+    {
+      const float diff = point2[d] - point1[d];
+      if (diff == 0)
+        {
+          if (point1[d] < min_coord[d] || point1[d] > max_coord[d])
+            return false;
+        }
+      else
+        {
+          float t1 = (min_coord[d] - point1[d])/diff;
+          float t2 = (max_coord[d] - point1[d])/diff;
+          if (t1 > t2)
+            std::swap(t1, t2);
+          t_min = std::max(t_min, t1);
+          t_max = std::min(t_max, t2);
+          if (t_min > t_max)
+            return false;
+        }
+    }
+  return true;
+}
 
 void
 ScatterEstimationByBin::
 remove_cache_for_integrals_over_attenuation()
 {
   this->cached_attenuation_integral_scattpoint_det.recycle();
+  this->cached_integrals_are_up_to_date = false;
 }
 
 void
@@ -46,6 +128,17 @@ ScatterEstimationByBin::
 remove_cache_for_integrals_over_activity()
 {
   this->cached_activity_integral_scattpoint_det.recycle();
+  this->activity_image_for_cache_sptr.reset();
+  this->cached_integrals_are_up_to_date = false;
+}
+
+void
+ScatterEstimationByBin::
+check_cached_integrals_are_up_to_date() const
+{
+  if (this->use_cache && !this->cached_integrals_are_up_to_date)
+    error("ScatterEstimationByBin: the cached integrals have not been computed for the current images.\n"
+          "This is done by process_data().");
 }
 
 
@@ -56,14 +149,36 @@ initialise_cache_for_scattpoint_det_integrals_over_attenuation()
   if (!this->use_cache)
     return;
 
+  const int num_scatter_points = static_cast<int>(this->scatt_points_vector.size());
   const IndexRange<2> range (Coordinate2D<int> (0,0), 
-                             Coordinate2D<int> (static_cast<int>(this->scatt_points_vector.size()-1),
-                                                this->total_detectors-1));
+                             Coordinate2D<int> (this->total_detectors-1,
+                                                num_scatter_points-1));
   if (this->cached_attenuation_integral_scattpoint_det.get_index_range() == range)
     return;  // keep cache if correct size
 
+  info("ScatterEstimationByBin: computing integrals over the attenuation image");
   this->cached_attenuation_integral_scattpoint_det.resize(range);
-  this->cached_attenuation_integral_scattpoint_det.fill(cache_init_value);
+  // lines that do not intersect the object have zero attenuation
+  this->cached_attenuation_integral_scattpoint_det.fill(1.F);
+  CartesianCoordinate3D<float> min_coord, max_coord;
+  if (!find_bounding_box_of_non_zeros(min_coord, max_coord, *this->density_image_sptr))
+    return;
+
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int det_num=0; det_num<this->total_detectors; ++det_num)
+    {
+      const CartesianCoordinate3D<float>& detector_coord = this->detection_points_vector[det_num];
+      Array<1,float>& cache_for_this_det = this->cached_attenuation_integral_scattpoint_det[det_num];
+      for (int scatter_point_num=0; scatter_point_num<num_scatter_points; ++scatter_point_num)
+        {
+          const CartesianCoordinate3D<float>& scatter_point = this->scatt_points_vector[scatter_point_num].coord;
+          if (line_segment_intersects_box(scatter_point, detector_coord, min_coord, max_coord))
+            cache_for_this_det[scatter_point_num] =
+              exp_integral_over_attenuation_image_between_scattpoint_det(scatter_point, detector_coord);
+        }
+    }
 }
 
 void
@@ -73,125 +188,90 @@ initialise_cache_for_scattpoint_det_integrals_over_activity()
   if (!this->use_cache)
     return;
 
+  const int num_scatter_points = static_cast<int>(this->scatt_points_vector.size());
   const IndexRange<2> range (Coordinate2D<int> (0,0), 
-                             Coordinate2D<int> (static_cast<int>(this->scatt_points_vector.size()-1),
-                                                this->total_detectors-1));
-
-  if (this->cached_activity_integral_scattpoint_det.get_index_range() == range)
-    return; // keep cache if correct size
-
-  this->cached_activity_integral_scattpoint_det.resize(range);
-  this->cached_activity_integral_scattpoint_det.fill(cache_init_value);
-}
+                             Coordinate2D<int> (this->total_detectors-1,
+                                                num_scatter_points-1));
 
-float 
-ScatterEstimationByBin::
-cached_integral_over_activity_image_between_scattpoint_det(const unsigned scatter_point_num, 
-                                                           const unsigned det_num)
-{                
-  float * location_in_cache = 
-    this->use_cache
-    ? &cached_activity_integral_scattpoint_det[scatter_point_num][det_num]
-    : 0;
-
-  /* OPENMP note:
-     We use atomic read/write to get at the cache. This should ensure validity.
-     Probably we could have 2 threads computing the same value that will be
-     cached later, but this might be better than locking (and it's simpler to write).
-     Sadly, this is only supported from OpenMP 3.1, so we need to add some extra checks.
+  /* As the integrals are linear in the image, we can update the cache by adding the integrals
+     over the difference between the current image and the one used to compute the cache.
+     Otherwise, we start from zero and add the integrals over the current image.
   */
-  float value;
-#if defined(STIR_OPENMP)
-# if _OPENMP >=201012
-#  pragma omp atomic read
-# else
-#  pragma omp critical(STIRSCATTERESTIMATIONREADCACHE)
-  {
-# endif
-#endif
-  value = *location_in_cache;
-#if defined(STIR_OPENMP) && (_OPENMP <201012)
-  }
-#endif
-
-  if (this->use_cache && value!=cache_init_value)
+  shared_ptr<const DiscretisedDensity<3,float> > image_to_integrate_sptr;
+  if (this->cached_activity_integral_scattpoint_det.get_index_range() == range &&
+      !is_null_ptr(this->activity_image_for_cache_sptr) &&
+      this->activity_image_for_cache_sptr->has_same_characteristics(*this->activity_image_sptr))
     {
-      return value;
+      info("ScatterEstimationByBin: updating integrals over the activity image");
+      shared_ptr<DiscretisedDensity<3,float> > diff_image_sptr(this->activity_image_sptr->clone());
+      *diff_image_sptr -= *this->activity_image_for_cache_sptr;
+      image_to_integrate_sptr = diff_image_sptr;
     }
   else
     {
-      const float result =
-        integral_over_activity_image_between_scattpoint_det
-        (scatt_points_vector[scatter_point_num].coord,
-         detection_points_vector[det_num]
-         );
-      if (this->use_cache)
+      info("ScatterEstimationByBin: computing integrals over the activity image");
+      this->cached_activity_integral_scattpoint_det.resize(range);
+      this->cached_activity_integral_scattpoint_det.fill(0.F);
+      image_to_integrate_sptr = this->activity_image_sptr;
+    }
+  // keep a copy, as the caller might modify the current image
+  this->activity_image_for_cache_sptr.reset(this->activity_image_sptr->clone());
+
+  // only lines that pass through non-zero voxels need to be ray-traced
+  CartesianCoordinate3D<float> min_coord, max_coord;
+  if (!find_bounding_box_of_non_zeros(min_coord, max_coord, *image_to_integrate_sptr))
+    return;
+
 #ifdef STIR_OPENMP
-# if _OPENMP >=201012
-#  pragma omp atomic write
-# else
-#  pragma omp critical(STIRSCATTERESTIMATIONWRITECACHE)
-        {
-# endif
+#pragma omp parallel for schedule(dynamic)
 #endif
-        *location_in_cache=result;
-#if defined(STIR_OPENMP) && (_OPENMP <201012)
+  for (int det_num=0; det_num<this->total_detectors; ++det_num)
+    {
+      const CartesianCoordinate3D<float>& detector_coord = this->detection_points_vector[det_num];
+      Array<1,float>& cache_for_this_det = this->cached_activity_integral_scattpoint_det[det_num];
+      for (int scatter_point_num=0; scatter_point_num<num_scatter_points; ++scatter_point_num)
+        {
+          const CartesianCoordinate3D<float>& scatter_point = this->scatt_points_vector[scatter_point_num].coord;
+          if (line_segment_intersects_box(scatter_point, detector_coord, min_coord, max_coord))
+            cache_for_this_det[scatter_point_num] +=
+              integral_over_activity_image_between_scattpoint_det(*image_to_integrate_sptr,
+                                                                  scatter_point, detector_coord);
         }
-#endif
-      return result;
     }
 }
 
+float 
+ScatterEstimationByBin::
+cached_integral_over_activity_image_between_scattpoint_det(const unsigned scatter_point_num, 
+                                                           const unsigned det_num)
+{
+  // the cache is filled by initialise_cache_for_scattpoint_det_integrals_over_activity()
+  this->check_cached_integrals_are_up_to_date();
+  if (this->use_cache)
+    return this->cached_activity_integral_scattpoint_det[det_num][scatter_point_num];
+  else
+    return
+      integral_over_activity_image_between_scattpoint_det
+      (scatt_points_vector[scatter_point_num].coord,
+       detection_points_vector[det_num]
+       );
+}
+
 float 
 ScatterEstimationByBin::
 cached_exp_integral_over_attenuation_image_between_scattpoint_det(const unsigned scatter_point_num, 
                                                                   const unsigned det_num)
 {
-  float * location_in_cache = 
-    this->use_cache
-    ? &cached_attenuation_integral_scattpoint_det[scatter_point_num][det_num]
-    : 0;
-
-  float value;
-#if defined(STIR_OPENMP)
-# if _OPENMP >=201012
-#  pragma omp atomic read
-# else
-#  pragma omp critical(STIRSCATTERESTIMATIONREADCACHEATTENINT)
-  {
-# endif
-#endif
-  value = *location_in_cache;
-#if defined(STIR_OPENMP) && (_OPENMP <201012)
-  }
-#endif
-
-  if (this->use_cache && value!=cache_init_value)
-    {
-      return *location_in_cache;
-    }
+  // the cache is filled by initialise_cache_for_scattpoint_det_integrals_over_attenuation()
+  this->check_cached_integrals_are_up_to_date();
+  if (this->use_cache)
+    return this->cached_attenuation_integral_scattpoint_det[det_num][scatter_point_num];
   else
-    {
-      const float result =
-        exp_integral_over_attenuation_image_between_scattpoint_det
-        (scatt_points_vector[scatter_point_num].coord,
-         detection_points_vector[det_num]
-         );
-      if (this->use_cache)
-#ifdef STIR_OPENMP
-# if _OPENMP >=201012
-#  pragma omp atomic write
-# else
-#  pragma omp critical(STIRSCATTERESTIMATIONREADCACHEATTENINT)
-        {
-# endif
-#endif
-        *location_in_cache=result;
-#if defined(STIR_OPENMP) && (_OPENMP <201012)
-        }
-#endif
-      return result;
-    }
+    return
+      exp_integral_over_attenuation_image_between_scattpoint_det
+      (scatt_points_vector[scatter_point_num].coord,
+       detection_points_vector[det_num]
+       );
 }
         
 END_NAMESPACE_STIR
@@ -93,6 +93,20 @@ sample_scatter_points()
             scatter_point.mu_value = attenuation_map[coord];
             this->scatt_points_vector.push_back(scatter_point);
           }
+
+  // copy to separate arrays for single_scatter_estimate()
+  const std::size_t num_scatter_points = this->scatt_points_vector.size();
+  this->scatt_points_x.resize(num_scatter_points);
+  this->scatt_points_y.resize(num_scatter_points);
+  this->scatt_points_z.resize(num_scatter_points);
+  this->scatt_points_mu.resize(num_scatter_points);
+  for (std::size_t i=0; i<num_scatter_points; ++i)
+    {
+      this->scatt_points_x[i] = this->scatt_points_vector[i].coord.x();
+      this->scatt_points_y[i] = this->scatt_points_vector[i].coord.y();
+      this->scatt_points_z[i] = this->scatt_points_vector[i].coord.z();
+      this->scatt_points_mu[i] = this->scatt_points_vector[i].mu_value;
+    }
   this->remove_cache_for_integrals_over_activity();
   this->remove_cache_for_integrals_over_attenuation();
 }
@@ -30,52 +30,53 @@
 
 #include "stir/scatter/ScatterEstimationByBin.h"
 #include "stir/ProjDataInfoCylindricalNoArcCorr.h"
-#include "stir/numerics/erf.h"
 #include "stir/info.h"
 #include <iostream>
 
 START_NAMESPACE_STIR
-unsigned 
+void
 ScatterEstimationByBin::
-find_in_detection_points_vector(const CartesianCoordinate3D<float>& coord) const
+initialise_detection_points()
 {
-  unsigned int ret_value = 0;
-#pragma omp critical(SCATTERESTIMATIONFINDDETECTIONPOINTS)
-  {
-  std::vector<CartesianCoordinate3D<float> >::const_iterator iter=
-    std::find(detection_points_vector.begin(),
-              detection_points_vector.end(),
-              coord);
-  if (iter != detection_points_vector.end())
-    {
-      ret_value = iter-detection_points_vector.begin();
-    }
-  else
-    {
-      if (detection_points_vector.size()==static_cast<std::size_t>(this->total_detectors))
-        error("More detection points than we think there are!\n");
-
-      detection_points_vector.push_back(coord);
-      ret_value = detection_points_vector.size()-1;
-    }
-  }
-  return ret_value;
+  /* Currently, proj_data_info.find_cartesian_coordinates_given_scanner_coordinates() returns
+     coordinate in a coordinate system where z=0 in the first ring of the scanner.
+     We want to shift this to a coordinate system where z=0 in the middle 
+     of the scanner.
+     We can use get_m() as that uses the 'middle of the scanner' system.
+     (sorry)
+  */
+  this->shift_detector_coordinates_to_origin =
+    CartesianCoordinate3D<float>(this->proj_data_info_ptr->get_m(Bin(0,0,0,0)),0, 0);
+
+  const int num_rings =
+    this->proj_data_info_ptr->get_scanner_ptr()->get_num_rings();
+  const int num_detectors_per_ring =
+    this->proj_data_info_ptr->get_scanner_ptr()->get_num_detectors_per_ring();
+  this->detection_points_vector.resize(num_rings*num_detectors_per_ring);
+  for (int ring=0; ring<num_rings; ++ring)
+    for (int det=0; det<num_detectors_per_ring; ++det)
+      {
+        // we only need the first point, so just use the same detector for the second
+        CartesianCoordinate3D<float> detector_coord, unused_coord;
+        this->proj_data_info_ptr->
+          find_cartesian_coordinates_given_scanner_coordinates(detector_coord, unused_coord,
+                                                               ring, ring, det, det);
+        this->detection_points_vector[ring*num_detectors_per_ring + det] =
+          detector_coord + this->shift_detector_coordinates_to_origin;
+      }
 }
 
 void
 ScatterEstimationByBin::
 find_detectors(unsigned& det_num_A, unsigned& det_num_B, const Bin& bin) const
 {
-  CartesianCoordinate3D<float> detector_coord_A, detector_coord_B;
+  int det_A, ring_A, det_B, ring_B;
   this->proj_data_info_ptr->
-    find_cartesian_coordinates_of_detection(
-                                            detector_coord_A,detector_coord_B,bin);
-  det_num_A =
-    this->find_in_detection_points_vector(detector_coord_A + 
-                                          this->shift_detector_coordinates_to_origin);
-  det_num_B =
-    this->find_in_detection_points_vector(detector_coord_B + 
-                                          this->shift_detector_coordinates_to_origin);
+    get_det_pair_for_bin(det_A, ring_A, det_B, ring_B, bin);
+  const int num_detectors_per_ring =
+    this->proj_data_info_ptr->get_scanner_ptr()->get_num_detectors_per_ring();
+  det_num_A = static_cast<unsigned>(ring_A*num_detectors_per_ring + det_A);
+  det_num_B = static_cast<unsigned>(ring_B*num_detectors_per_ring + det_B);
 }
 
 float
@@ -97,19 +98,21 @@ compute_emis_to_det_points_solid_angle_factor(
 
 float
 ScatterEstimationByBin::
-detection_efficiency(const float energy) const
+get_detection_efficiency_sigma_times_sqrt2_factor() const
 {
   // factor 2.35482 is used to convert FWHM to sigma
-  const float sigma_times_sqrt2= 
-    sqrt(2.*energy*this->reference_energy)*this->energy_resolution/2.35482;  // 2.35482=2 * sqrt( 2 * ( log(2) )
-  
   // sigma_times_sqrt2= sqrt(2) * sigma   // resolution proportional to FWHM    
-  
-  const float efficiency =
-    0.5*( erf((this->upper_energy_threshold-energy)/sigma_times_sqrt2) 
-          - erf((this->lower_energy_threshold-energy)/sigma_times_sqrt2 ));     
-  /* Maximum efficiency is 1.*/
-  return efficiency;
+  return
+    static_cast<float>(sqrt(2.*this->reference_energy)*this->energy_resolution/2.35482);  // 2.35482=2 * sqrt( 2 * ( log(2) )
+}
+
+float
+ScatterEstimationByBin::
+detection_efficiency(const float energy) const
+{
+  return
+    detection_efficiency(energy, this->lower_energy_threshold, this->upper_energy_threshold,
+                         this->get_detection_efficiency_sigma_times_sqrt2_factor());
 }
 
 float
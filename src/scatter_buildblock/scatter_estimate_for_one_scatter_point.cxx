@@ -96,7 +96,7 @@ ScatterEstimationByBin::
      det_num_B);
 
   const float dif_Compton_cross_section_value =
-    dif_Compton_cross_section(costheta, 511.F); 
+    dif_Compton_cross_section_without_constant_factor(costheta, 511.F);
         
   const float rA_squared=norm_squared(scatter_point-detector_coord_A);
   const float rB_squared=norm_squared(scatter_point-detector_coord_B);
@@ -28,6 +28,7 @@
 */
 
 #include "stir/scatter/ScatterEstimationByBin.h"
+#include <cmath>
 using namespace std;
 START_NAMESPACE_STIR
 static const float total_Compton_cross_section_511keV = 
@@ -57,17 +58,98 @@ single_scatter_estimate(double& scatter_ratio_singles,
 {
 
   scatter_ratio_singles = 0;
-		
-  for(std::size_t scatter_point_num =0;
-      scatter_point_num < scatt_points_vector.size();
-      ++scatter_point_num)
-    {	
-	scatter_ratio_singles +=
-	  single_scatter_estimate_for_one_scatter_point(
-							scatter_point_num,
-							det_num_A, det_num_B);	
-
-    }	
+
+  if (this->use_cache && !this->scatt_points_vector.empty())
+    {
+      this->check_cached_integrals_are_up_to_date();
+      /* This computes the same as single_scatter_estimate_for_one_scatter_point() (aside from 
+         rounding errors), but using the cached integrals and the scatter point arrays directly.
+         Both use the same inline functions for the detection efficiency and cross sections.
+         There are no branches in the loop, such that the compiler can vectorise it.
+      */
+      const float max_single_scatter_cos_angle =
+        max_cos_angle(lower_energy_threshold,2.,energy_resolution);
+      // constants for detection_efficiency()
+      const float sigma_times_sqrt2_factor =
+        this->get_detection_efficiency_sigma_times_sqrt2_factor();
+      const float upper_energy_threshold = this->upper_energy_threshold;
+      const float lower_energy_threshold = this->lower_energy_threshold;
+
+      const CartesianCoordinate3D<float>& detector_coord_A =
+        detection_points_vector[det_num_A];
+      const CartesianCoordinate3D<float>& detector_coord_B =
+        detection_points_vector[det_num_B];
+      const float xA = detector_coord_A.x(), yA = detector_coord_A.y(), zA = detector_coord_A.z();
+      const float xB = detector_coord_B.x(), yB = detector_coord_B.y(), zB = detector_coord_B.z();
+      // distance of the detectors to the scanner axis (for the incident angles)
+      const float norm_A_to_ring_center = std::sqrt(xA*xA + yA*yA);
+      const float norm_B_to_ring_center = std::sqrt(xB*xB + yB*yB);
+
+      const float * const x = &scatt_points_x[0];
+      const float * const y = &scatt_points_y[0];
+      const float * const z = &scatt_points_z[0];
+      const float * const mu = &scatt_points_mu[0];
+      const float * const emiss_to_detA = &cached_activity_integral_scattpoint_det[det_num_A][0];
+      const float * const emiss_to_detB = &cached_activity_integral_scattpoint_det[det_num_B][0];
+      const float * const atten_to_detA = &cached_attenuation_integral_scattpoint_det[det_num_A][0];
+      const float * const atten_to_detB = &cached_attenuation_integral_scattpoint_det[det_num_B][0];
+      const int num_scatter_points = static_cast<int>(scatt_points_vector.size());
+
+      double sum = 0;
+#if defined(STIR_OPENMP) && (_OPENMP >= 201307)
+#pragma omp simd reduction(+:sum)
+#endif
+      for (int i=0; i<num_scatter_points; ++i)
+        {
+          // vectors from scatter point to detectors
+          const float xSA = xA - x[i], ySA = yA - y[i], zSA = zA - z[i];
+          const float xSB = xB - x[i], ySB = yB - y[i], zSB = zB - z[i];
+          const float rA_squared = xSA*xSA + ySA*ySA + zSA*zSA;
+          const float rB_squared = xSB*xSB + ySB*ySB + zSB*zSB;
+          const float costheta =
+            -(xSA*xSB + ySA*ySB + zSA*zSB)/std::sqrt(rA_squared*rB_squared);
+          const float new_energy = photon_energy_after_Compton_scatter_511keV(costheta);
+
+          const float detection_efficiency_scatter =
+            detection_efficiency(new_energy, lower_energy_threshold, upper_energy_threshold,
+                                 sigma_times_sqrt2_factor);
+          const float total_Compton_cross_section_relative =
+            total_Compton_cross_section_relative_to_511keV(new_energy);
+          const float dif_Compton_cross_section_value =
+            dif_Compton_cross_section_without_constant_factor(costheta, 511.F);
+
+          const float scatter_ratio =
+            (emiss_to_detA[i]/rB_squared*std::pow(atten_to_detB[i], total_Compton_cross_section_relative - 1)
+             + emiss_to_detB[i]/rA_squared*std::pow(atten_to_detA[i], total_Compton_cross_section_relative - 1))
+            *atten_to_detB[i]
+            *atten_to_detA[i]
+            *mu[i]
+            *detection_efficiency_scatter;
+
+          const float cos_incident_angle_AS =
+            (xSA*xA + ySA*yA)/(std::sqrt(rA_squared)*norm_A_to_ring_center);
+          const float cos_incident_angle_BS =
+            (xSB*xB + ySB*yB)/(std::sqrt(rB_squared)*norm_B_to_ring_center);
+
+          const float value =
+            scatter_ratio*cos_incident_angle_AS*cos_incident_angle_BS*dif_Compton_cross_section_value;
+          sum += costheta < max_single_scatter_cos_angle ? 0.F : value;
+        }
+      scatter_ratio_singles = sum * dif_Compton_cross_section_constant_factor();
+    }
+  else
+    {
+      for(std::size_t scatter_point_num =0;
+          scatter_point_num < scatt_points_vector.size();
+          ++scatter_point_num)
+        {	
+          scatter_ratio_singles +=
+            single_scatter_estimate_for_one_scatter_point(
+                                                          scatter_point_num,
+                                                          det_num_A, det_num_B);	
+        }
+      scatter_ratio_singles *= dif_Compton_cross_section_constant_factor();
+    }
 
   // we will divide by the effiency of the detector pair for unscattered photons
   // (computed with the same detection model as used in the scatter code)
@@ -64,6 +64,18 @@ float
 ScatterEstimationByBin::
 integral_over_activity_image_between_scattpoint_det (const CartesianCoordinate3D<float>& scatter_point, 
                                                      const CartesianCoordinate3D<float>& detector_coord)
+{
+  return
+    integral_over_activity_image_between_scattpoint_det(*activity_image_sptr,
+                                                        scatter_point,
+                                                        detector_coord);
+}
+
+float
+ScatterEstimationByBin::
+integral_over_activity_image_between_scattpoint_det (const DiscretisedDensity<3,float>& activity_image,
+                                                     const CartesianCoordinate3D<float>& scatter_point, 
+                                                     const CartesianCoordinate3D<float>& detector_coord)
 {
   {
     const CartesianCoordinate3D<float> dist_vector = scatter_point - detector_coord ;
@@ -75,7 +87,7 @@ integral_over_activity_image_between_scattpoint_det (const CartesianCoordinate3D
  
     return
       solid_angle_factor *
-      integral_between_2_points(*activity_image_sptr,
+      integral_between_2_points(activity_image,
                                 scatter_point,
                                 detector_coord);
   }
@@ -27,6 +27,7 @@
 #include "stir/spatial_transformation/GatedSpatialTransformation.h"
 #include "stir/spatial_transformation/warp_image.h"
 #include "stir/info.h"
+#include "stir/is_null_ptr.h"
 #include <boost/format.hpp>
 
 START_NAMESPACE_STIR
@@ -38,6 +39,8 @@ set_defaults()
   base_type::set_defaults();
   this->_transformation_filename_prefix="";
   this->_spline_type=static_cast<BSpline::BSplineType> (1);;
+  this->_cache_interpolation_weights=false;
+  this->_warp_stencils.clear();
 }
 
 const char * const 
@@ -74,6 +77,7 @@ initialise_keymap()
   base_type::initialise_keymap();
   this->parser.add_start_key("Gated Spatial Transformation Parameters");
   this->parser.add_key("Gated Spatial Transformation Filenames Prefix", &this->_transformation_filename_prefix);
+  this->parser.add_key("cache interpolation weights", &this->_cache_interpolation_weights);
   this->parser.add_stop_key("end Gated Spatial Transformation Parameters");
 }
 
@@ -123,6 +127,7 @@ GatedSpatialTransformation::read_from_files(const std::string input_string)
 	
   this->_spatial_transformation_z= spatial_transformation_z; this->_spatial_transformation_y= spatial_transformation_y; this->_spatial_transformation_x= spatial_transformation_x; 
   this->_spatial_transformations_are_stored=true;
+  this->_warp_stencils.clear();
 }     
 
 //! Implementation to write the transformation vectors
@@ -148,11 +153,7 @@ GatedSpatialTransformation::warp_image(GatedDiscretisedDensity & new_gated_image
   new_gated_image.fill_with_zero();
   if (this->_spatial_transformations_are_stored)
     for(unsigned int gate_num=1 ; gate_num<=gated_image.get_time_gate_definitions().get_num_gates() ; ++gate_num)
-      new_gated_image[gate_num]=stir::warp_image((gated_image.get_densities())[gate_num-1],
-                                                 (this->_spatial_transformation_x.get_densities())[gate_num-1],
-                                                 (this->_spatial_transformation_y.get_densities())[gate_num-1],
-                                                 (this->_spatial_transformation_z.get_densities())[gate_num-1], 
-                                                 BSpline::linear, false);
+      new_gated_image[gate_num]=this->warp_image((gated_image.get_densities())[gate_num-1], gate_num);
   else
     error("The transformation fields haven't been set properly yet.\n");
 }
@@ -196,11 +197,7 @@ GatedSpatialTransformation::warp_image(GatedDiscretisedDensity & gated_image,
   if (this->_spatial_transformations_are_stored)
     for(unsigned int gate_num = 1 ; gate_num<=gated_image.get_time_gate_definitions().get_num_gates() ; ++gate_num)
       {
-        const VoxelsOnCartesianGrid<float> density = stir::warp_image(reference_image_sptr,
-                                                                      (this->_spatial_transformation_x.get_densities())[gate_num-1],
-                                                                      (this->_spatial_transformation_y.get_densities())[gate_num-1],
-                                                                      (this->_spatial_transformation_z.get_densities())[gate_num-1], 
-                                                                      BSpline::linear, false);
+        const VoxelsOnCartesianGrid<float> density = this->warp_image(reference_image_sptr, gate_num);
         const shared_ptr<DiscretisedDensity<3,float> >  density_sptr(density.clone());
         gated_image.set_density_sptr(density_sptr,gate_num);
       }
@@ -208,6 +205,63 @@ GatedSpatialTransformation::warp_image(GatedDiscretisedDensity & gated_image,
     error("The transformation fields haven't been set properly yet.");	
 }
 
+VoxelsOnCartesianGrid<float>
+GatedSpatialTransformation::warp_image(const shared_ptr<DiscretisedDensity<3, float> > & density_sptr,
+                          const unsigned int gate_num) const
+{
+  if (!this->_spatial_transformations_are_stored)
+    error("The transformation fields haven't been set properly yet.");
+  if (gate_num<1 || gate_num>this->_spatial_transformation_x.get_densities().size())
+    error(boost::format("GatedSpatialTransformation::warp_image: gate %1% does not exist") % gate_num);
+  if (density_sptr->size_all()!=(this->_spatial_transformation_x.get_densities())[gate_num-1]->size_all())
+    error("GatedSpatialTransformation::warp_image needs the same sizes for motion vectors and input/output images.");
+
+  const DiscretisedDensityOnCartesianGrid<3,float>* const cartesian_density_ptr =
+    dynamic_cast<const DiscretisedDensityOnCartesianGrid<3,float>*>(density_sptr.get());
+  if (this->_cache_interpolation_weights && cartesian_density_ptr != 0)
+    {
+      // gates can be warped in parallel, so only access the cache in a critical section
+      shared_ptr<WarpImageStencil> stencil_sptr;
+#ifdef STIR_OPENMP
+#pragma omp critical(GATEDSPATIALTRANSFORMATION_STENCILS)
+#endif
+      {
+        if (this->_warp_stencils.size() != this->_spatial_transformation_x.get_densities().size())
+          this->_warp_stencils.resize(this->_spatial_transformation_x.get_densities().size());
+        stencil_sptr = this->_warp_stencils[gate_num-1];
+      }
+      if (is_null_ptr(stencil_sptr))
+        {
+          stencil_sptr.reset(new WarpImageStencil(*cartesian_density_ptr,
+                                                  *(this->_spatial_transformation_x.get_densities())[gate_num-1],
+                                                  *(this->_spatial_transformation_y.get_densities())[gate_num-1],
+                                                  *(this->_spatial_transformation_z.get_densities())[gate_num-1],
+                                                  BSpline::linear));
+#ifdef STIR_OPENMP
+#pragma omp critical(GATEDSPATIALTRANSFORMATION_STENCILS)
+#endif
+          {
+            if (is_null_ptr(this->_warp_stencils[gate_num-1]))
+              this->_warp_stencils[gate_num-1] = stencil_sptr;
+          }
+        }
+      // images with other characteristics are warped without the cache
+      if (stencil_sptr->is_compatible(*density_sptr))
+        {
+          VoxelsOnCartesianGrid<float> out_density(density_sptr->get_index_range(),
+                                                   cartesian_density_ptr->get_origin(),
+                                                   cartesian_density_ptr->get_grid_spacing());
+          stencil_sptr->apply(out_density, *density_sptr);
+          return out_density;
+        }
+    }
+  return stir::warp_image(density_sptr,
+                          (this->_spatial_transformation_x.get_densities())[gate_num-1],
+                          (this->_spatial_transformation_y.get_densities())[gate_num-1],
+                          (this->_spatial_transformation_z.get_densities())[gate_num-1], 
+                          BSpline::linear, false);
+}
+
 void
 GatedSpatialTransformation::
 set_spatial_transformations(const GatedDiscretisedDensity & transformation_z, 
@@ -218,11 +272,24 @@ set_spatial_transformations(const GatedDiscretisedDensity & transformation_z,
   this->_spatial_transformation_y=transformation_y;
   this->_spatial_transformation_x=transformation_x;
   this->_spatial_transformations_are_stored=true;
+  this->_warp_stencils.clear();
 }
 
 void 
 GatedSpatialTransformation::set_gate_defs(const TimeGateDefinitions & gate_defs)
 { this->_gate_defs=gate_defs; }
+
+void
+GatedSpatialTransformation::set_cache_interpolation_weights(const bool arg)
+{
+  this->_cache_interpolation_weights=arg;
+  if (!arg)
+    this->_warp_stencils.clear();
+}
+
+bool
+GatedSpatialTransformation::get_cache_interpolation_weights() const
+{ return this->_cache_interpolation_weights; }
  
 GatedDiscretisedDensity GatedSpatialTransformation::get_spatial_transformation_z() const
 { return this->_spatial_transformation_z; }
@@ -0,0 +1,309 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup spatial_transformation
+  \brief Implementation of class stir::WarpImageStencil
+*/
+
+#include "stir/spatial_transformation/WarpImageStencil.h"
+#include "stir/IndexRange.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+START_NAMESPACE_STIR
+
+WarpImageStencil::
+WarpImageStencil(const DiscretisedDensityOnCartesianGrid<3,float>& density_template,
+                 const DiscretisedDensity<3,float>& motion_x,
+                 const DiscretisedDensity<3,float>& motion_y,
+                 const DiscretisedDensity<3,float>& motion_z,
+                 const BSpline::BSplineType spline_type)
+{
+  if (spline_type!=BSpline::near_n && spline_type!=BSpline::linear)
+    error("WarpImageStencil: only nearest neighbour and linear interpolation are supported");
+  if (!density_template.get_index_range().get_regular_range(_min_indices, _max_indices))
+    error("WarpImageStencil: image is not in regular grid.");
+  if (get_num_voxels() > static_cast<std::size_t>(std::numeric_limits<int>::max()))
+    error("WarpImageStencil: image is too large");
+  if (!has_same_index_range(motion_x) || !has_same_index_range(motion_y) || !has_same_index_range(motion_z))
+    error("WarpImageStencil: the motion images need to have the same index range as the image");
+
+  const BSpline::PieceWiseFunction<BSpline::pos_type>& bspline =
+    BSpline::bspline_function(spline_type);
+  _kernel_length = bspline.kernel_total_length();
+  _first_offsets.resize(get_num_voxels());
+  _weights.resize(get_num_voxels()*3*_kernel_length, 0.);
+
+  _grid_spacing = density_template.get_grid_spacing();
+  const int num_planes = _max_indices[1] - _min_indices[1] + 1;
+  const int num_rows = _max_indices[2] - _min_indices[2] + 1;
+  const int num_columns = _max_indices[3] - _min_indices[3] + 1;
+
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int plane=0; plane<num_planes; ++plane)
+    {
+      BasicCoordinate<3,int> c;
+      c[1] = _min_indices[1] + plane;
+      std::size_t voxel_num = static_cast<std::size_t>(plane)*num_rows*num_columns;
+      for (c[2]=_min_indices[2]; c[2]<=_max_indices[2]; ++c[2])
+        for (c[3]=_min_indices[3]; c[3]<=_max_indices[3]; ++c[3], ++voxel_num)
+          {
+            // same computation as warp_image()
+            BasicCoordinate<3,double> d;
+            d[1] = static_cast<double>(c[1]) + static_cast<double>(motion_z[c]/_grid_spacing[1]);
+            d[2] = static_cast<double>(c[2]) + static_cast<double>(motion_y[c]/_grid_spacing[2]);
+            d[3] = static_cast<double>(c[3]) + static_cast<double>(motion_x[c]/_grid_spacing[3]);
+            bool is_inside = true;
+            for (int dim=1; dim<=3; ++dim)
+              if (d[dim]<=static_cast<double>(_min_indices[dim]) || d[dim]>=static_cast<double>(_max_indices[dim]))
+                is_inside = false;
+            if (!is_inside)
+              {
+                _first_offsets[voxel_num] = -1;
+                continue;
+              }
+            // weights as computed by BSplinesRegularGrid (see spline_convolution in BSplinesDetail.inl)
+            BasicCoordinate<3,int> kmin;
+            double * weights_ptr = &_weights[voxel_num*3*_kernel_length];
+            for (int dim=1; dim<=3; ++dim)
+              {
+                kmin[dim] = static_cast<int>(std::ceil(d[dim]-bspline.kernel_length_right()));
+                assert(kmin[dim]>=_min_indices[dim] && kmin[dim]+_kernel_length-1<=_max_indices[dim]);
+                BSpline::pos_type current_pos = d[dim]-kmin[dim];
+                int p = bspline.find_piece(current_pos);
+                for (int k=0; k<_kernel_length; ++k, --current_pos, --p)
+                  *weights_ptr++ = bspline.function_piece(current_pos, p);
+              }
+            _first_offsets[voxel_num] =
+              ((kmin[1]-_min_indices[1])*num_rows + (kmin[2]-_min_indices[2]))*num_columns
+              + (kmin[3]-_min_indices[3]);
+          }
+    }
+}
+
+std::size_t
+WarpImageStencil::
+get_num_voxels() const
+{
+  std::size_t num_voxels = 1;
+  for (int dim=1; dim<=3; ++dim)
+    num_voxels *= static_cast<std::size_t>(_max_indices[dim] - _min_indices[dim] + 1);
+  return num_voxels;
+}
+
+bool
+WarpImageStencil::
+has_same_index_range(const DiscretisedDensity<3,float>& density) const
+{
+  BasicCoordinate<3,int> min_indices, max_indices;
+  return
+    density.get_index_range().get_regular_range(min_indices, max_indices) &&
+    min_indices == _min_indices && max_indices == _max_indices;
+}
+
+bool
+WarpImageStencil::
+is_compatible(const DiscretisedDensity<3,float>& density) const
+{
+  if (!has_same_index_range(density))
+    return false;
+  const DiscretisedDensityOnCartesianGrid<3,float>* const cartesian_density_ptr =
+    dynamic_cast<const DiscretisedDensityOnCartesianGrid<3,float>*>(&density);
+  return
+    cartesian_density_ptr == 0 ||
+    cartesian_density_ptr->get_grid_spacing() == _grid_spacing;
+}
+
+void
+WarpImageStencil::
+check_compatible(const DiscretisedDensity<3,float>& density) const
+{
+  if (!is_compatible(density))
+    error(boost::format("WarpImageStencil: image needs to have index range (%1%,%2%,%3%)-(%4%,%5%,%6%) "
+                        "and voxel sizes (%7%,%8%,%9%)")
+          % _min_indices[1] % _min_indices[2] % _min_indices[3]
+          % _max_indices[1] % _max_indices[2] % _max_indices[3]
+          % _grid_spacing[1] % _grid_spacing[2] % _grid_spacing[3]);
+}
+
+void
+WarpImageStencil::
+apply(DiscretisedDensity<3,float>& out_density,
+      const DiscretisedDensity<3,float>& in_density) const
+{
+  check_compatible(out_density);
+  check_compatible(in_density);
+
+  // copy to a single vector such that the offsets can be used
+  std::vector<float> in_values(get_num_voxels());
+  std::copy(in_density.begin_all_const(), in_density.end_all_const(), in_values.begin());
+
+  const int num_planes = _max_indices[1] - _min_indices[1] + 1;
+  const int num_rows = _max_indices[2] - _min_indices[2] + 1;
+  const int num_columns = _max_indices[3] - _min_indices[3] + 1;
+  const std::size_t plane_size = static_cast<std::size_t>(num_rows)*num_columns;
+  const int kernel_length = _kernel_length;
+
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int plane=0; plane<num_planes; ++plane)
+    {
+      std::size_t voxel_num = plane*plane_size;
+      for (int row=0; row<num_rows; ++row)
+        {
+          Array<1,float>& out_row = out_density[_min_indices[1]+plane][_min_indices[2]+row];
+          for (int column=0; column<num_columns; ++column, ++voxel_num)
+            {
+              const int first_offset = _first_offsets[voxel_num];
+              if (first_offset<0)
+                {
+                  out_row[_min_indices[3]+column] = 0.F;
+                  continue;
+                }
+              const double * const weights_z = &_weights[voxel_num*3*kernel_length];
+              const double * const weights_y = weights_z + kernel_length;
+              const double * const weights_x = weights_y + kernel_length;
+              // sum in the same order (and with the same conversions to float) as BSplinesRegularGrid
+              float value = 0.F;
+              for (int a=0; a<kernel_length; ++a)
+                {
+                  float value_z = 0.F;
+                  for (int b=0; b<kernel_length; ++b)
+                    {
+                      const float * const in_ptr = &in_values[first_offset + a*plane_size + b*num_columns];
+                      float value_y = 0.F;
+                      for (int c=0; c<kernel_length; ++c)
+                        value_y += static_cast<float>(in_ptr[c] * weights_x[c]);
+                      value_z += static_cast<float>(value_y * weights_y[b]);
+                    }
+                  value += static_cast<float>(value_z * weights_z[a]);
+                }
+              out_row[_min_indices[3]+column] = value;
+            }
+        }
+    }
+}
+
+void
+WarpImageStencil::
+set_up_transpose() const
+{
+  const std::size_t num_voxels = get_num_voxels();
+  const int num_rows = _max_indices[2] - _min_indices[2] + 1;
+  const int num_columns = _max_indices[3] - _min_indices[3] + 1;
+  const std::size_t plane_size = static_cast<std::size_t>(num_rows)*num_columns;
+  const int kernel_length = _kernel_length;
+
+  // first count the number of elements in every row of the transpose
+  _transpose_row_starts.assign(num_voxels+1, 0);
+  for (std::size_t voxel_num=0; voxel_num<num_voxels; ++voxel_num)
+    {
+      const int first_offset = _first_offsets[voxel_num];
+      if (first_offset<0)
+        continue;
+      const double * const weights_z = &_weights[voxel_num*3*kernel_length];
+      const double * const weights_y = weights_z + kernel_length;
+      const double * const weights_x = weights_y + kernel_length;
+      for (int a=0; a<kernel_length; ++a)
+        for (int b=0; b<kernel_length; ++b)
+          for (int c=0; c<kernel_length; ++c)
+            if (weights_z[a]*weights_y[b]*weights_x[c] != 0)
+              ++_transpose_row_starts[first_offset + a*plane_size + b*num_columns + c + 1];
+    }
+  for (std::size_t row=0; row<num_voxels; ++row)
+    _transpose_row_starts[row+1] += _transpose_row_starts[row];
+
+  // now fill in. Columns in every row end up sorted, such that the result of apply_transpose
+  // does not depend on the number of threads
+  _transpose_columns.resize(_transpose_row_starts[num_voxels]);
+  _transpose_values.resize(_transpose_row_starts[num_voxels]);
+  std::vector<std::size_t> next_element(_transpose_row_starts.begin(), _transpose_row_starts.end()-1);
+  for (std::size_t voxel_num=0; voxel_num<num_voxels; ++voxel_num)
+    {
+      const int first_offset = _first_offsets[voxel_num];
+      if (first_offset<0)
+        continue;
+      const double * const weights_z = &_weights[voxel_num*3*kernel_length];
+      const double * const weights_y = weights_z + kernel_length;
+      const double * const weights_x = weights_y + kernel_length;
+      for (int a=0; a<kernel_length; ++a)
+        for (int b=0; b<kernel_length; ++b)
+          for (int c=0; c<kernel_length; ++c)
+            {
+              const double weight = weights_z[a]*weights_y[b]*weights_x[c];
+              if (weight == 0)
+                continue;
+              const std::size_t element_num =
+                next_element[first_offset + a*plane_size + b*num_columns + c]++;
+              _transpose_columns[element_num] = static_cast<int>(voxel_num);
+              _transpose_values[element_num] = weight;
+            }
+    }
+}
+
+void
+WarpImageStencil::
+apply_transpose(DiscretisedDensity<3,float>& out_density,
+                const DiscretisedDensity<3,float>& in_density) const
+{
+  check_compatible(out_density);
+  check_compatible(in_density);
+
+#ifdef STIR_OPENMP
+#pragma omp critical(WARPIMAGESTENCIL_SET_UP_TRANSPOSE)
+#endif
+  if (_transpose_row_starts.empty())
+    set_up_transpose();
+
+  std::vector<float> in_values(get_num_voxels());
+  std::copy(in_density.begin_all_const(), in_density.end_all_const(), in_values.begin());
+
+  const int num_planes = _max_indices[1] - _min_indices[1] + 1;
+  const int num_rows = _max_indices[2] - _min_indices[2] + 1;
+  const int num_columns = _max_indices[3] - _min_indices[3] + 1;
+  const std::size_t plane_size = static_cast<std::size_t>(num_rows)*num_columns;
+
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int plane=0; plane<num_planes; ++plane)
+    {
+      std::size_t voxel_num = plane*plane_size;
+      for (int row=0; row<num_rows; ++row)
+        {
+          Array<1,float>& out_row = out_density[_min_indices[1]+plane][_min_indices[2]+row];
+          for (int column=0; column<num_columns; ++column, ++voxel_num)
+            {
+              double value = 0.;
+              for (std::size_t element_num=_transpose_row_starts[voxel_num];
+                   element_num<_transpose_row_starts[voxel_num+1];
+                   ++element_num)
+                value += _transpose_values[element_num] * in_values[_transpose_columns[element_num]];
+              out_row[_min_indices[3]+column] = static_cast<float>(value);
+            }
+        }
+    }
+}
+
+END_NAMESPACE_STIR
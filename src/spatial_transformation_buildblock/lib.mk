@@ -4,7 +4,8 @@
 dir := spatial_transformation_buildblock
 $(dir)_LIB_SOURCES:= SpatialTransformation.cxx \
 		     GatedSpatialTransformation.cxx \
-                     warp_image.cxx
+                     warp_image.cxx \
+                     WarpImageStencil.cxx
 
 $(dir)_REGISTRY_SOURCES:= spatial_transformation_registries.cxx
 
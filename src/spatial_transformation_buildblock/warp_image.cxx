@@ -59,9 +59,15 @@ warp_image(const shared_ptr<DiscretisedDensity<3,float> > & density_sptr,
   const IndexRange<3> out_range(out_min,out_max);
   VoxelsOnCartesianGrid<float> out_density(out_range,origin,grid_spacing);
 
-  BasicCoordinate<3,int> c;
-  BasicCoordinate<3,double> d, l;
-  for (c[1]=min[1]; c[1]<=max[1]; ++c[1])
+  // planes are independent, and the interpolator is only read
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int plane=min[1]; plane<=max[1]; ++plane)
+    {
+    BasicCoordinate<3,int> c;
+    BasicCoordinate<3,double> d, l;
+    c[1]=plane;
     for (c[2]=min[2]; c[2]<=max[2]; ++c[2])
       for (c[3]=min[3]; c[3]<=max[3]; ++c[3])
 	{
@@ -80,6 +86,7 @@ warp_image(const shared_ptr<DiscretisedDensity<3,float> > & density_sptr,
           else
             out_density[c] = density_interpolation(d);
 	}
+    }
   return out_density;
 }
 
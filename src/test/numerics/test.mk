@@ -5,6 +5,7 @@ dir := test/numerics
 $(dir)_TEST_SOURCES := \
 	test_matrices.cxx \
 	test_overlap_interpolate.cxx \
+	test_fourier.cxx \
 	test_integrate_discrete_function.cxx \
 	test_IR_filters.cxx \
 	test_BSplines.cxx \
@@ -27,6 +28,9 @@ ${DEST}$(dir)/test_overlap_interpolate: ${DEST}$(dir)/test_overlap_interpolate${
 ${DEST}$(dir)/test_integrate_discrete_function: ${DEST}$(dir)/test_integrate_discrete_function${O_SUFFIX} $(STIR_LIB) 
 	$(LINK) $(EXE_OUTFLAG)$(@)$(EXE_SUFFIX) $< $(STIR_LIB)  $(LINKFLAGS) $(SYS_LIBS)
 
+${DEST}$(dir)/test_fourier: ${DEST}$(dir)/test_fourier${O_SUFFIX} $(STIR_LIB) 
+	$(LINK) $(EXE_OUTFLAG)$(@)$(EXE_SUFFIX) $< $(STIR_LIB)  $(LINKFLAGS) $(SYS_LIBS)
+
 ifeq ("$(FAST_test)","")
 
 ${DEST}$(dir)/test_BSplinesRegularGrid: ${DEST}$(dir)/test_BSplinesRegularGrid$(O_SUFFIX) $(STIR_LIB) 
@@ -0,0 +1,245 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+   See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup numerics_test
+
+  \brief Test program for stir::fourier and stir::FourierPlan
+*/
+#include "stir/Array.h"
+#include "stir/IndexRange3D.h"
+#include "stir/RunTests.h"
+#include "stir/numerics/fourier.h"
+#include "stir/numerics/FourierPlan.h"
+#include "stir/numerics/norm.h"
+#include "stir/common.h"
+#include <boost/format.hpp>
+#include <complex>
+#include <cmath>
+#include <cstdlib>
+
+START_NAMESPACE_STIR
+
+/*!
+  \brief Test class for stir::fourier and stir::FourierPlan
+  \ingroup numerics_test
+
+  Results are compared with a straightforward implementation of the DFT,
+  for lengths with different prime factors.
+*/
+class FourierTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  typedef std::complex<float> complex_t;
+
+  //! straightforward DFT, computed in double precision
+  static Array<1,complex_t>
+  naive_dft(const Array<1,complex_t>& c, const int sign);
+
+  //! fills with random numbers in [-1,1]
+  static void
+  fill_random(Array<1,complex_t>& c);
+
+  //! checks if the norm of the difference is small compared to the norm of \a expected
+  bool
+  check_if_close(const Array<1,complex_t>& result, const Array<1,complex_t>& expected,
+                 const std::string& str);
+
+  void test_1d(const int length);
+  void test_3d();
+  void test_real_data(const int length);
+};
+
+Array<1,std::complex<float> >
+FourierTests::
+naive_dft(const Array<1,complex_t>& c, const int sign)
+{
+  const int n = c.get_length();
+  Array<1,complex_t> result(n);
+  for (int s=0; s<n; ++s)
+    {
+      std::complex<double> sum = 0;
+      for (int r=0; r<n; ++r)
+        {
+          const double angle = sign*2*_PI*((static_cast<long>(r)*s) % n)/n;
+          sum += std::complex<double>(c[r]) * std::complex<double>(std::cos(angle), std::sin(angle));
+        }
+      result[s] = complex_t(static_cast<float>(sum.real()), static_cast<float>(sum.imag()));
+    }
+  return result;
+}
+
+void
+FourierTests::
+fill_random(Array<1,complex_t>& c)
+{
+  for (int i=c.get_min_index(); i<=c.get_max_index(); ++i)
+    c[i] = complex_t(2.F*std::rand()/RAND_MAX - 1, 2.F*std::rand()/RAND_MAX - 1);
+}
+
+bool
+FourierTests::
+check_if_close(const Array<1,complex_t>& result, const Array<1,complex_t>& expected,
+               const std::string& str)
+{
+  if (!check_if_equal(result.get_length(), expected.get_length(), str + ": length"))
+    return false;
+  Array<1,complex_t> diff = result;
+  diff -= expected;
+  const double diff_norm = norm(diff.begin(), diff.end());
+  const double expected_norm = norm(expected.begin(), expected.end());
+  return
+    check(diff_norm <= get_tolerance()*(expected_norm + 1),
+          str + boost::str(boost::format(" (relative difference %1%)") % (diff_norm/(expected_norm+1))));
+}
+
+void
+FourierTests::
+test_1d(const int length)
+{
+  const std::string length_str = boost::str(boost::format(" for length %1%") % length);
+  Array<1,complex_t> c(length);
+  fill_random(c);
+  for (int sign=-1; sign<=1; sign+=2)
+    {
+      Array<1,complex_t> result = c;
+      fourier_1d(result, sign);
+      check_if_close(result, naive_dft(c, sign), "fourier_1d" + length_str);
+
+      inverse_fourier_1d(result, sign);
+      check_if_close(result, c, "inverse_fourier_1d" + length_str);
+    }
+  // check that a plan gives the same result as fourier_1d
+  {
+    const FourierPlan plan(length);
+    check_if_equal(plan.get_length(), length, "FourierPlan::get_length");
+    Array<1,complex_t> result = c;
+    plan.transform(&result[0], 1);
+    check_if_close(result, naive_dft(c, 1), "FourierPlan::transform" + length_str);
+  }
+}
+
+void
+FourierTests::
+test_3d()
+{
+  // use lengths with different prime factors
+  const IndexRange3D range(6,5,12);
+  Array<3,complex_t> c(range);
+  for (int i=0; i<6; ++i)
+    for (int j=0; j<5; ++j)
+      fill_random(c[i][j]);
+
+  Array<3,complex_t> result = c;
+  fourier(result);
+
+  // compute DFT along each dimension with naive_dft
+  Array<3,complex_t> expected = c;
+  for (int i=0; i<6; ++i)
+    for (int j=0; j<5; ++j)
+      expected[i][j] = naive_dft(expected[i][j], 1);
+  for (int i=0; i<6; ++i)
+    for (int k=0; k<12; ++k)
+      {
+        Array<1,complex_t> column(5);
+        for (int j=0; j<5; ++j)
+          column[j] = expected[i][j][k];
+        column = naive_dft(column, 1);
+        for (int j=0; j<5; ++j)
+          expected[i][j][k] = column[j];
+      }
+  for (int j=0; j<5; ++j)
+    for (int k=0; k<12; ++k)
+      {
+        Array<1,complex_t> column(6);
+        for (int i=0; i<6; ++i)
+          column[i] = expected[i][j][k];
+        column = naive_dft(column, 1);
+        for (int i=0; i<6; ++i)
+          expected[i][j][k] = column[i];
+      }
+  for (int i=0; i<6; ++i)
+    for (int j=0; j<5; ++j)
+      check_if_close(result[i][j], expected[i][j], "fourier 3D");
+
+  inverse_fourier(result);
+  for (int i=0; i<6; ++i)
+    for (int j=0; j<5; ++j)
+      check_if_close(result[i][j], c[i][j], "inverse_fourier 3D");
+}
+
+void
+FourierTests::
+test_real_data(const int length)
+{
+  const std::string length_str = boost::str(boost::format(" for length %1%") % length);
+  Array<1,float> v(length);
+  Array<1,complex_t> c(length);
+  for (int i=0; i<length; ++i)
+    {
+      v[i] = 2.F*std::rand()/RAND_MAX - 1;
+      c[i] = v[i];
+    }
+  for (int sign=-1; sign<=1; sign+=2)
+    {
+      const Array<1,complex_t> pos_frequencies =
+        fourier_for_real_data(v, sign);
+      check_if_close(pos_frequencies_to_all(pos_frequencies), naive_dft(c, sign),
+                     "fourier_for_real_data" + length_str);
+      const Array<1,float> v_again =
+        inverse_fourier_for_real_data(pos_frequencies, sign);
+      Array<1,float> diff = v_again;
+      diff -= v;
+      check(norm(diff.begin(), diff.end()) <= get_tolerance()*norm(v.begin(), v.end()),
+            "inverse_fourier_for_real_data" + length_str);
+    }
+}
+
+void
+FourierTests::
+run_tests()
+{
+  std::cerr << "Testing fourier functions..." << std::endl;
+  set_tolerance(.0001);
+
+  {
+    const int lengths[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 15, 16, 17, 25, 30, 49, 64, 96, 97, 100, 128, 180, 256, 343, 1000, 1024 };
+    for (unsigned int i=0; i<sizeof(lengths)/sizeof(lengths[0]); ++i)
+      test_1d(lengths[i]);
+  }
+  test_3d();
+  {
+    const int lengths[] = { 2, 4, 6, 10, 14, 16, 30, 64, 96, 192, 250, 256 };
+    for (unsigned int i=0; i<sizeof(lengths)/sizeof(lengths[0]); ++i)
+      test_real_data(lengths[i]);
+  }
+  // plans should be shared
+  check(get_fourier_plan(60) == get_fourier_plan(60), "get_fourier_plan should return the same plan");
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  FourierTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
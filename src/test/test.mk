@@ -22,7 +22,12 @@ $(dir)_TEST_SOURCES := test_Array.cxx test_NestedIterator.cxx \
 	test_ArcCorrection.cxx \
 	test_DynamicDiscretisedDensity.cxx   \
 	test_find_fwhm_in_image.cxx \
-        test_warp_image.cxx
+        test_warp_image.cxx \
+	test_PerformanceTrace.cxx \
+	test_nested_parallel_for.cxx \
+	test_CListModeData.cxx \
+	test_LmToProjData.cxx \
+	test_ProjDataHistogramLUT.cxx
 
 (dir)_INTERACTIVE_TEST_SOURCES := \
 	test_display.cxx \
@@ -41,6 +41,7 @@
 #include "stir/Coordinate2D.h"
 #include "stir/Coordinate3D.h"
 #include "stir/Coordinate4D.h"
+#include "stir/IndexRange2D.h"
 #include "stir/convert_array.h"
 #include "stir/Succeeded.h"
 #include "stir/IO/write_data.h"
@@ -51,6 +52,8 @@
 #include "stir/ArrayFunction.h"
 #include "stir/array_index_functions.h"
 #include <functional>
+#include <vector>
+#include <complex>
 
 // for open_read/write_binary
 #include "stir/utilities.h"
@@ -623,6 +626,69 @@ ArrayTests::run_tests()
         Array<3,float>::const_full_iterator ctiter= titer; // this should compile
       }
     }
+    // contiguous storage
+    {
+      IndexRange<3> range(Coordinate3D<int>(0,-1,1),Coordinate3D<int>(3,3,3));
+      Array<3,float> test(range);
+      check(test.is_contiguous(), "test is_contiguous() after construction");
+      {
+        float * ptr = test.get_full_data_ptr();
+        check(reinterpret_cast<size_t>(ptr) % 64 == 0, "test alignment of get_full_data_ptr()");
+        for (size_t i=0; i<test.size_all(); ++i)
+          ptr[i] = static_cast<float>(i);
+        test.release_full_data_ptr();
+      }
+      check_if_equal(test[0][-1][1], 0.F, "test get_full_data_ptr() first element");
+      check_if_equal(test[1][0][2], 3*5.F+3+1, "test get_full_data_ptr() element order");
+      check_if_equal(test[3][3][3], test.size_all()-1.F, "test get_full_data_ptr() last element");
+
+      const Array<3,float> copy(test);
+      check(copy.is_contiguous(), "test is_contiguous() after copy constructor");
+      check_if_equal(copy, test, "test copy constructor with contiguous array");
+      // const access does not modify the object, so can be nested (or used by several threads)
+      {
+        const float * ptr = copy.get_const_full_data_ptr();
+        const float * ptr2 = copy.get_const_full_data_ptr();
+        check(ptr == ptr2, "test nested get_const_full_data_ptr()");
+        check_if_equal(ptr2[3*5+3+1], 3*5.F+3+1, "test get_const_full_data_ptr() element order");
+        copy.release_const_full_data_ptr();
+        copy.release_const_full_data_ptr();
+      }
+
+      // use existing memory
+      {
+        std::vector<float> mem(test.size_all());
+        Array<3,float> view(range, &mem[0], false);
+        check(view.is_contiguous(), "test is_contiguous() with existing memory");
+        view = test;
+        check_if_equal(mem[3*5+3+1], 3*5.F+3+1, "test assignment with existing memory");
+        mem[1] = 42.F;
+        check_if_equal(view[0][-1][2], 42.F, "test indexing with existing memory");
+        Array<3,float> copy_of_mem(range, &mem[0], true);
+        mem[1] = 1.F;
+        check_if_equal(copy_of_mem[0][-1][2], 42.F, "test copying from existing memory");
+      }
+
+      // resizing an element breaks contiguity, but should keep values
+      test[1][2].resize(0,4);
+      check(!test.is_contiguous(), "test is_contiguous() after resizing an element");
+      check_if_equal(test[1][0][2], 3*5.F+3+1, "test value after resizing an element");
+      // resizing the whole array makes it contiguous again
+      const IndexRange<3> larger_range(Coordinate3D<int>(-1,-1,0),Coordinate3D<int>(3,4,3));
+      test.resize(larger_range);
+      check(test.is_contiguous(), "test is_contiguous() after resize");
+      check_if_equal(test.get_index_range(), larger_range, "test index range after resize");
+      check_if_equal(test[1][0][2], 3*5.F+3+1, "test value after resize");
+      check_if_equal(test[-1][4][0], 0.F, "test new value after resize");
+    }
+    // assignment with a different range (uses swap()) for elements in namespace std
+    {
+      Array<2,std::complex<float> > test(IndexRange2D(4,3));
+      const Array<2,std::complex<float> > other(IndexRange2D(3,5));
+      test = other;
+      check(test.is_contiguous(), "test is_contiguous() after assignment of complex array");
+      check(&test[1][0] == &test[0][0] + 5, "test memory layout after assignment of complex array");
+    }
   }
 
 
@@ -0,0 +1,305 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+  \ingroup listmode
+
+  \brief Test program for reading records with stir::CListModeData and
+  stir::InputStreamWithRecords
+
+  A small list mode file for the Siemens mMR (ECAT8 32bit format) is written
+  with random events and time records. The test then checks that
+  - CListModeData::get_next_record() gives the records that were written;
+  - CListModeData::get_next_records() gives the same sequence for different
+    batch sizes, and that a batch only ends before it is full after a time record;
+  - set_get_position() goes back to a position saved by save_get_position(),
+    also when the position was saved after a batch, and after reading past the
+    end of the file;
+  - reset() goes back to the first record;
+  - InputStreamWithRecords gives the same sequence for buffers that are
+    (much) smaller than the file, such that records are decoded across refills.
+*/
+
+#include "stir/listmode/CListModeData.h"
+#include "stir/listmode/CListRecord.h"
+#include "stir/listmode/CListRecordECAT8_32bit.h"
+#include "stir/IO/InputStreamWithRecords.h"
+#include "stir/IO/read_from_file.h"
+#include "stir/ByteOrder.h"
+#include "stir/RunTests.h"
+#include "stir/Succeeded.h"
+#include "stir/shared_ptr.h"
+#include "boost/cstdint.hpp"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for reading list mode records in batches
+*/
+class CListModeDataTests : public RunTests
+{
+public:
+  CListModeDataTests();
+  void run_tests();
+private:
+  const std::string header_filename;
+  const std::string data_filename;
+  shared_ptr<CListModeData> lm_data_sptr;
+  //! all records written to the file
+  std::vector<boost::uint32_t> words;
+  //! record used to decode \c words
+  shared_ptr<CListRecord> reference_record_sptr;
+
+  void write_list_mode_file();
+  //! check if \a record is equal to record \a i in the file
+  bool is_equal_to_reference(const CListRecord& record, const std::size_t i);
+  //! check that the next records are equal to the ones in the file starting at \a first
+  bool check_next_records(const std::size_t first, const std::size_t num_records,
+                          const std::string& str);
+  void run_tests_for_single_records();
+  void run_tests_for_batches(const std::size_t batch_size);
+  void run_tests_for_positions();
+  void run_tests_for_buffer_size(const std::size_t buffer_size);
+};
+
+CListModeDataTests::CListModeDataTests()
+  : header_filename("test_CListModeData.l.hdr"),
+    data_filename("test_CListModeData.l")
+{}
+
+void
+CListModeDataTests::write_list_mode_file()
+{
+  {
+    std::ofstream header(header_filename.c_str());
+    header << "!INTERFILE:=\n"
+           << "number of bytes per pixel:=4\n"
+           << "!originating system:=Siemens mMR\n"
+           << "name of data file:=" << data_filename << '\n'
+           << "%axial_compression:=1\n"
+           << "%maximum_ring_difference:=60\n"
+           << "%number_of_projections:=344\n"
+           << "%number_of_views:=252\n"
+           << "%number_of_segments:=121\n"
+           << "!END OF INTERFILE:=\n";
+  }
+  std::ofstream data(data_filename.c_str(), std::ios::out | std::ios::binary);
+  // more than the default buffer size of InputStreamWithRecords (1 MB)
+  words.resize(300000);
+  const boost::uint32_t num_bins = 344u*252u*4084u;
+  std::srand(1);
+  boost::uint32_t time_in_millisecs = 0;
+  for (std::size_t i=0; i<words.size(); ++i)
+    {
+      if (std::rand()%50 == 0)
+        words[i] = (1u<<31) | ++time_in_millisecs;
+      else
+        words[i] = static_cast<boost::uint32_t>(std::rand()) % num_bins | (std::rand()%4 != 0 ? (1u<<30) : 0u);
+      // the file is in little endian byte order
+      boost::uint32_t word = words[i];
+      if (ByteOrder::get_native_order() != ByteOrder::little_endian)
+        ByteOrder::swap_order(word);
+      data.write(reinterpret_cast<const char *>(&word), sizeof(word));
+    }
+}
+
+bool
+CListModeDataTests::is_equal_to_reference(const CListRecord& record, const std::size_t i)
+{
+  if (!check(i < words.size(), "there should be no more records than in the file"))
+    return false;
+  dynamic_cast<ecat::CListRecordECAT8_32bit&>(*reference_record_sptr).
+    init_from_data_ptr(reinterpret_cast<const char *>(&words[i]), 4, /*do_byte_swap=*/ false);
+  if (!check(record == *reference_record_sptr, "comparing record"))
+    {
+      std::cerr << "Record " << i << " is different\n";
+      return false;
+    }
+  return true;
+}
+
+bool
+CListModeDataTests::check_next_records(const std::size_t first, const std::size_t num_records,
+                                       const std::string& str)
+{
+  shared_ptr<CListRecord> record_sptr = lm_data_sptr->get_empty_record_sptr();
+  for (std::size_t i=first; i<first+num_records; ++i)
+    {
+      if (!check(lm_data_sptr->get_next_record(*record_sptr) == Succeeded::yes, str + ": reading record"))
+        return false;
+      if (!is_equal_to_reference(*record_sptr, i))
+        return false;
+    }
+  return true;
+}
+
+void
+CListModeDataTests::run_tests_for_single_records()
+{
+  std::cerr << "\tget_next_record\n";
+  shared_ptr<CListRecord> record_sptr = lm_data_sptr->get_empty_record_sptr();
+  std::size_t num_records_read = 0;
+  while (lm_data_sptr->get_next_record(*record_sptr) == Succeeded::yes)
+    {
+      if (!is_equal_to_reference(*record_sptr, num_records_read))
+        return;
+      ++num_records_read;
+    }
+  check_if_equal(num_records_read, words.size(), "number of records read one by one");
+}
+
+void
+CListModeDataTests::run_tests_for_batches(const std::size_t batch_size)
+{
+  std::cerr << "\tget_next_records with batches of " << batch_size << " records\n";
+  std::vector<shared_ptr<CListRecord> > records(batch_size);
+  for (std::size_t i=0; i<records.size(); ++i)
+    records[i] = lm_data_sptr->get_empty_record_sptr();
+
+  lm_data_sptr->reset();
+  std::size_t num_records_read = 0;
+  std::size_t num_records;
+  while ((num_records = lm_data_sptr->get_next_records(records)) > 0)
+    {
+      for (std::size_t i=0; i<num_records; ++i)
+        {
+          if (!is_equal_to_reference(*records[i], num_records_read + i))
+            return;
+          if (i+1 < num_records && !check(!records[i]->is_time(), "a time record should end the batch"))
+            return;
+        }
+      num_records_read += num_records;
+      if (num_records < batch_size && num_records_read < words.size() &&
+          !check(records[num_records-1]->is_time(), "a batch should only end early after a time record"))
+        return;
+    }
+  check_if_equal(num_records_read, words.size(), "number of records read in batches");
+}
+
+void
+CListModeDataTests::run_tests_for_positions()
+{
+  std::cerr << "\tsave_get_position, set_get_position and reset\n";
+  lm_data_sptr->reset();
+  check_next_records(0, 1000, "first records");
+  const CListModeData::SavedPosition pos_1000 = lm_data_sptr->save_get_position();
+
+  // go to the end of a batch with a time record
+  std::vector<shared_ptr<CListRecord> > records(10000);
+  for (std::size_t i=0; i<records.size(); ++i)
+    records[i] = lm_data_sptr->get_empty_record_sptr();
+  const std::size_t num_records = lm_data_sptr->get_next_records(records);
+  check(num_records > 0 && records[num_records-1]->is_time(), "batch should end with a time record");
+  const CListModeData::SavedPosition pos_after_batch = lm_data_sptr->save_get_position();
+  const std::size_t first_after_batch = 1000 + num_records;
+
+  // read past the end of the file
+  {
+    shared_ptr<CListRecord> record_sptr = lm_data_sptr->get_empty_record_sptr();
+    std::size_t num_remaining_records = 0;
+    while (lm_data_sptr->get_next_record(*record_sptr) == Succeeded::yes)
+      ++num_remaining_records;
+    check_if_equal(first_after_batch + num_remaining_records, words.size(),
+                   "number of records after the batch");
+  }
+  const CListModeData::SavedPosition pos_end = lm_data_sptr->save_get_position();
+
+  check(lm_data_sptr->set_get_position(pos_1000) == Succeeded::yes, "going back after the end of the file");
+  check_next_records(1000, 10, "records after going back after the end of the file");
+  check(lm_data_sptr->set_get_position(pos_after_batch) == Succeeded::yes, "going to the end of the batch");
+  check_next_records(first_after_batch, 10, "records after the batch");
+  check(lm_data_sptr->set_get_position(pos_end) == Succeeded::yes, "going to the end of the file");
+  {
+    shared_ptr<CListRecord> record_sptr = lm_data_sptr->get_empty_record_sptr();
+    check(lm_data_sptr->get_next_record(*record_sptr) == Succeeded::no,
+          "there should be no records at the saved end of the file");
+  }
+  check(lm_data_sptr->reset() == Succeeded::yes, "reset");
+  check_next_records(0, 10, "records after reset");
+}
+
+void
+CListModeDataTests::run_tests_for_buffer_size(const std::size_t buffer_size)
+{
+  std::cerr << "\tInputStreamWithRecords with a buffer of " << buffer_size << " bytes\n";
+  shared_ptr<std::istream> stream_sptr(new std::ifstream(data_filename.c_str(), std::ios::in | std::ios::binary));
+  InputStreamWithRecords<ecat::CListRecordECAT8_32bit, bool>
+    input(stream_sptr, 4, 4, ByteOrder::little_endian != ByteOrder::get_native_order());
+  if (!check(input.set_buffer_size(buffer_size) == Succeeded::yes, "setting buffer size"))
+    return;
+
+  std::vector<shared_ptr<CListRecord> > records(777);
+  for (std::size_t i=0; i<records.size(); ++i)
+    records[i] = lm_data_sptr->get_empty_record_sptr();
+  std::size_t num_records_read = 0;
+  std::size_t num_records;
+  while ((num_records = input.get_next_records(records)) > 0)
+    {
+      for (std::size_t i=0; i<num_records; ++i)
+        if (!is_equal_to_reference(*records[i], num_records_read + i))
+          return;
+      num_records_read += num_records;
+    }
+  check_if_equal(num_records_read, words.size(), "number of records read from stream");
+}
+
+void
+CListModeDataTests::run_tests()
+{
+  std::cerr << "Tests for reading list mode records" << std::endl;
+  write_list_mode_file();
+  lm_data_sptr = read_from_file<CListModeData>(header_filename);
+  reference_record_sptr = lm_data_sptr->get_empty_record_sptr();
+
+  run_tests_for_single_records();
+  run_tests_for_batches(1);
+  run_tests_for_batches(7);
+  run_tests_for_batches(10000);
+  run_tests_for_positions();
+  // smaller than a record
+  {
+    shared_ptr<std::istream> stream_sptr(new std::ifstream(data_filename.c_str(), std::ios::in | std::ios::binary));
+    InputStreamWithRecords<ecat::CListRecordECAT8_32bit, bool> input(stream_sptr, 4, 4, false);
+    check(input.set_buffer_size(3) == Succeeded::no, "buffer should not be smaller than a record");
+  }
+  run_tests_for_buffer_size(4);
+  run_tests_for_buffer_size(4*1001+2);
+  run_tests_for_buffer_size(1024*1024);
+
+  lm_data_sptr.reset();
+  std::remove(header_filename.c_str());
+  std::remove(data_filename.c_str());
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  CListModeDataTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,282 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+  \ingroup listmode
+
+  \brief Test program for multi-threading and the memory budget in stir::LmToProjData
+
+  A small list mode file for the Siemens mMR is written with random events and
+  time records, and binned into projection data with view mashing and a reduced
+  segment and tangential range. This is done with 1 and 4 threads, with the
+  look-up table for discrete detectors (see stir::ProjDataHistogramLUT) and without
+  (by using a class derived from LmToProjData), and both for time frames and for
+  a number of events to store. This is also done with a memory budget that is too
+  small for a frame, such that events are stored in temporary files for the
+  segments that are not in memory. There is no normalisation, such that all
+  outputs have to be identical.
+*/
+
+#include "stir/listmode/LmToProjData.h"
+#include "stir/ProjDataInterfile.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/ExamInfo.h"
+#include "stir/Scanner.h"
+#include "stir/SegmentBySinogram.h"
+#include "stir/ByteOrder.h"
+#include "stir/RunTests.h"
+#include "stir/shared_ptr.h"
+#include "boost/cstdint.hpp"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+START_NAMESPACE_STIR
+
+//! A class that does not use the look-up table, as LmToProjData only uses it for itself
+class LmToProjDataWithoutLUT : public LmToProjData
+{
+public:
+  LmToProjDataWithoutLUT(const char * const par_filename)
+    : LmToProjData(par_filename)
+  {}
+};
+
+/*!
+  \ingroup test
+  \brief Test class for LmToProjData with multiple threads and a memory budget
+*/
+class LmToProjDataTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  //! write list mode file, template projection data and frame definitions
+  void write_input_files();
+  //! run LmToProjData and return the output filename prefix
+  std::string bin_list_mode_data(const bool use_lut, const int num_threads, const bool use_frames,
+                                 const int max_memory_in_MB = 0);
+  //! compare all segments, return \c true if they are identical
+  bool is_identical(const std::string& filename1, const std::string& filename2);
+  void remove_output(const std::string& prefix);
+  void run_tests_for_1_case(const bool use_lut, const bool use_frames);
+};
+
+void
+LmToProjDataTests::write_input_files()
+{
+  {
+    std::ofstream header("test_LmToProjData.l.hdr");
+    header << "!INTERFILE:=\n"
+           << "number of bytes per pixel:=4\n"
+           << "!originating system:=Siemens mMR\n"
+           << "name of data file:=test_LmToProjData.l\n"
+           << "%axial_compression:=1\n"
+           << "%maximum_ring_difference:=60\n"
+           << "%number_of_projections:=344\n"
+           << "%number_of_views:=252\n"
+           << "%number_of_segments:=121\n"
+           << "!END OF INTERFILE:=\n";
+  }
+  {
+    std::ofstream data("test_LmToProjData.l", std::ios::out | std::ios::binary);
+    // events are mostly in the lower segments, such that many of them are stored
+    const boost::uint32_t num_bins = 344u*252u*200u;
+    std::srand(1);
+    boost::uint32_t time_in_millisecs = 0;
+    for (int i=0; i<400000; ++i)
+      {
+        boost::uint32_t word;
+        if (std::rand()%50 == 0)
+          word = (1u<<31) | ++time_in_millisecs;
+        else
+          word = static_cast<boost::uint32_t>(std::rand()) % num_bins | (std::rand()%4 != 0 ? (1u<<30) : 0u);
+        if (ByteOrder::get_native_order() != ByteOrder::little_endian)
+          ByteOrder::swap_order(word);
+        data.write(reinterpret_cast<const char *>(&word), sizeof(word));
+      }
+  }
+  {
+    // 2 frames of 3 seconds (the file has about 8 seconds of data)
+    std::ofstream frames("test_LmToProjData.fdef");
+    frames << "2 3\n";
+  }
+  {
+    shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::Siemens_mMR));
+    shared_ptr<ProjDataInfo> proj_data_info_sptr(
+      ProjDataInfo::ProjDataInfoCTI(scanner_sptr, /*span=*/1, /*max_delta=*/2,
+                                    /*num_views=*/scanner_sptr->get_num_detectors_per_ring()/8,
+                                    /*num_tang_poss=*/128, /*arc_corrected=*/false));
+    shared_ptr<ExamInfo> exam_info_sptr(new ExamInfo);
+    ProjDataInterfile template_proj_data(exam_info_sptr, proj_data_info_sptr,
+                                         "test_LmToProjData_template.hs", std::ios::out);
+  }
+}
+
+std::string
+LmToProjDataTests::bin_list_mode_data(const bool use_lut, const int num_threads, const bool use_frames,
+                                      const int max_memory_in_MB)
+{
+  std::string prefix = "test_LmToProjData_out";
+  prefix += use_lut ? "_lut" : "_nolut";
+  prefix += num_threads == 1 ? "_t1" : "_t4";
+  if (max_memory_in_MB > 0)
+    prefix += "_budget";
+  prefix += use_frames ? "_frames" : "_events";
+  const std::string par_filename = prefix + ".par";
+  {
+    std::ofstream par(par_filename.c_str());
+    par << "lm_to_projdata Parameters:=\n"
+        << "input file := test_LmToProjData.l.hdr\n"
+        << "template_projdata := test_LmToProjData_template.hs\n";
+    if (use_frames)
+      par << "frame_definition file := test_LmToProjData.fdef\n";
+    else
+      par << "num_events_to_store := 20000\n";
+    par << "output filename prefix := " << prefix << '\n'
+        << "number of threads := " << num_threads << '\n'
+        << "maximum memory in MB for projection data := " << max_memory_in_MB << '\n'
+        << "END:=\n";
+  }
+  if (use_lut)
+    {
+      LmToProjData application(par_filename.c_str());
+      application.process_data();
+    }
+  else
+    {
+      LmToProjDataWithoutLUT application(par_filename.c_str());
+      application.process_data();
+    }
+  std::remove(par_filename.c_str());
+  return prefix;
+}
+
+bool
+LmToProjDataTests::is_identical(const std::string& filename1, const std::string& filename2)
+{
+  shared_ptr<ProjData> proj_data1_sptr = ProjData::read_from_file(filename1);
+  shared_ptr<ProjData> proj_data2_sptr = ProjData::read_from_file(filename2);
+  float total_counts = 0;
+  for (int segment_num=proj_data1_sptr->get_min_segment_num();
+       segment_num<=proj_data1_sptr->get_max_segment_num(); ++segment_num)
+    {
+      SegmentBySinogram<float> difference = proj_data1_sptr->get_segment_by_sinogram(segment_num);
+      total_counts += difference.sum();
+      difference -= proj_data2_sptr->get_segment_by_sinogram(segment_num);
+      if (difference.find_max() != 0 || difference.find_min() != 0)
+        {
+          std::cerr << filename1 << " and " << filename2
+                    << " are different in segment " << segment_num << '\n';
+          return false;
+        }
+    }
+  check(total_counts > 1000, "a reasonable number of events should have been stored in " + filename1);
+  return true;
+}
+
+void
+LmToProjDataTests::remove_output(const std::string& prefix)
+{
+  for (int frame_num=1; frame_num<=2; ++frame_num)
+    {
+      char rest[50];
+      sprintf(rest, "_f%dg1d0b0", frame_num);
+      std::remove((prefix + rest + ".hs").c_str());
+      std::remove((prefix + rest + ".s").c_str());
+    }
+}
+
+void
+LmToProjDataTests::run_tests_for_1_case(const bool use_lut, const bool use_frames)
+{
+  std::cerr << "\tbinning " << (use_frames ? "time frames" : "a number of events")
+            << (use_lut ? " with" : " without") << " look-up table\n";
+  const std::string prefix_1_thread = bin_list_mode_data(use_lut, 1, use_frames);
+  const std::string prefix_4_threads = bin_list_mode_data(use_lut, 4, use_frames);
+  const int num_frames = use_frames ? 2 : 1;
+  for (int frame_num=1; frame_num<=num_frames; ++frame_num)
+    {
+      char rest[50];
+      sprintf(rest, "_f%dg1d0b0.hs", frame_num);
+      check(is_identical(prefix_1_thread + rest, prefix_4_threads + rest),
+            "output with 1 and 4 threads should be identical");
+      // compare with the look-up table
+      if (!use_lut)
+        check(is_identical(prefix_1_thread + rest,
+                           "test_LmToProjData_out_lut_t1" + std::string(use_frames ? "_frames" : "_events") + rest),
+              "output with and without look-up table should be identical");
+    }
+  remove_output(prefix_4_threads);
+
+  // a frame needs about 10 MB (5 segments of about 2 MB), so this keeps 2 segments in memory
+  for (int num_threads=1; num_threads<=4; num_threads+=3)
+    {
+      const std::string prefix_budget = bin_list_mode_data(use_lut, num_threads, use_frames, 5);
+      for (int frame_num=1; frame_num<=num_frames; ++frame_num)
+        {
+          char rest[50];
+          sprintf(rest, "_f%dg1d0b0", frame_num);
+          check(is_identical(prefix_1_thread + rest + ".hs", prefix_budget + rest + ".hs"),
+                "output with and without memory budget should be identical");
+          // temporary files should have been removed
+          for (int batch_num=1; batch_num<=2; ++batch_num)
+            {
+              char spilled[50];
+              sprintf(spilled, "_spilled_events_%d.tmp", batch_num);
+              std::ifstream file((prefix_budget + rest + spilled).c_str());
+              check(!file, "temporary file " + prefix_budget + rest + spilled + " should have been removed");
+            }
+        }
+      remove_output(prefix_budget);
+    }
+}
+
+void
+LmToProjDataTests::run_tests()
+{
+  std::cerr << "Tests for LmToProjData with multiple threads" << std::endl;
+  write_input_files();
+
+  for (int use_frames=1; use_frames>=0; --use_frames)
+    {
+      run_tests_for_1_case(/*use_lut=*/ true, use_frames != 0);
+      run_tests_for_1_case(/*use_lut=*/ false, use_frames != 0);
+      remove_output(std::string("test_LmToProjData_out_lut_t1") + (use_frames ? "_frames" : "_events"));
+      remove_output(std::string("test_LmToProjData_out_nolut_t1") + (use_frames ? "_frames" : "_events"));
+    }
+
+  std::remove("test_LmToProjData.l.hdr");
+  std::remove("test_LmToProjData.l");
+  std::remove("test_LmToProjData.fdef");
+  std::remove("test_LmToProjData_template.hs");
+  std::remove("test_LmToProjData_template.s");
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  LmToProjDataTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
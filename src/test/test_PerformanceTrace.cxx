@@ -0,0 +1,155 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+   See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+
+  \brief Test program for stir::PerformanceTrace
+*/
+#include "stir/PerformanceTrace.h"
+#include "stir/RunTests.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <cstdio>
+
+START_NAMESPACE_STIR
+
+/*!
+  \brief Test class for stir::PerformanceTrace
+  \ingroup test
+
+  Events are recorded from several threads and written in CSV format, which is
+  then read back. The test also checks that the buffers of finished threads are
+  freed, and that PerformanceTraceEnabledScope restores the state.
+*/
+class PerformanceTraceTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  //! reads the CSV file, skipping the header line
+  static std::vector<std::string> read_lines(const std::string& filename);
+};
+
+std::vector<std::string>
+PerformanceTraceTests::
+read_lines(const std::string& filename)
+{
+  std::vector<std::string> lines;
+  std::ifstream s(filename.c_str());
+  std::string line;
+  std::getline(s, line);
+  while (std::getline(s, line))
+    if (!line.empty())
+      lines.push_back(line);
+  return lines;
+}
+
+void
+PerformanceTraceTests::
+run_tests()
+{
+  std::cerr << "Testing PerformanceTrace..." << std::endl;
+  const std::string filename = "test_PerformanceTrace.csv";
+
+  PerformanceTrace::clear();
+  PerformanceTrace::set_enabled(false);
+  {
+    PerformanceTraceScope scope("disabled");
+  }
+  PerformanceTrace::write_to_file(filename);
+  check_if_equal(read_lines(filename).size(), std::size_t(0),
+                 "no events should be recorded when disabled");
+
+  const std::size_t num_thread_buffers = PerformanceTrace::get_num_thread_buffers();
+  PerformanceTrace::set_enabled(true);
+  PerformanceTrace::set_subiteration_num(3);
+  const int num_threads = 4;
+  const int num_events_per_thread = 5;
+  {
+    std::vector<std::thread> threads;
+    for (int t=0; t<num_threads; ++t)
+      threads.push_back(std::thread([]()
+                                    {
+                                      for (int i=0; i<num_events_per_thread; ++i)
+                                        PerformanceTraceScope scope("stage");
+                                    }));
+    for (int t=0; t<num_threads; ++t)
+      threads[t].join();
+  }
+  PerformanceTrace::set_enabled(false);
+  check_if_equal(PerformanceTrace::get_num_thread_buffers(), num_thread_buffers,
+                 "buffers of finished threads should have been freed");
+  PerformanceTrace::write_to_file(filename);
+
+  const std::vector<std::string> lines = read_lines(filename);
+  check_if_equal(lines.size(), std::size_t(num_threads*num_events_per_thread),
+                 "number of recorded events");
+  std::set<int> thread_nums;
+  for (std::size_t i=0; i<lines.size(); ++i)
+    {
+      std::istringstream line(lines[i]);
+      int thread_num, subiteration_num;
+      char comma;
+      std::string rest;
+      line >> thread_num >> comma >> subiteration_num >> comma;
+      std::getline(line, rest);
+      thread_nums.insert(thread_num);
+      check_if_equal(subiteration_num, 3, "subiteration number of event");
+      check(rest.substr(0, 6) == "stage,", "stage name of event");
+    }
+  check_if_equal(thread_nums.size(), std::size_t(num_threads),
+                 "every thread should have its own number");
+
+  PerformanceTrace::clear();
+  PerformanceTrace::write_to_file(filename);
+  check_if_equal(read_lines(filename).size(), std::size_t(0),
+                 "no events should be left after clear()");
+
+  // PerformanceTraceEnabledScope
+  {
+    PerformanceTraceEnabledScope enabled_scope(false);
+    check(!PerformanceTrace::is_enabled(), "PerformanceTraceEnabledScope(false) should not enable");
+  }
+  try
+    {
+      PerformanceTraceEnabledScope enabled_scope;
+      check(PerformanceTrace::is_enabled(), "PerformanceTraceEnabledScope should enable");
+      throw std::string("test exception");
+    }
+  catch (const std::string&)
+    {}
+  check(!PerformanceTrace::is_enabled(),
+        "PerformanceTraceEnabledScope should disable again when an exception is thrown");
+
+  std::remove(filename.c_str());
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  PerformanceTraceTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,174 @@
+/*!
+
+  \file
+  \ingroup test
+
+  \brief Test program for stir::ProjDataFromMemoryMappedFile
+*/
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/ProjDataFromMemoryMappedFile.h"
+#include "stir/ProjDataInterfile.h"
+#include "stir/ExamInfo.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/Sinogram.h"
+#include "stir/Viewgram.h"
+#include "stir/SegmentBySinogram.h"
+#include "stir/SegmentByView.h"
+#include "stir/Succeeded.h"
+#include "stir/RunTests.h"
+#include "stir/Scanner.h"
+#include <fstream>
+#include <cstdio>
+
+START_NAMESPACE_STIR
+
+
+/*!
+  \ingroup test
+  \brief Test class for ProjDataFromMemoryMappedFile
+
+  Data are written with ProjDataInterfile, and then read back with
+  ProjDataFromStream and ProjDataFromMemoryMappedFile. Results should be identical.
+*/
+class ProjDataFromMemoryMappedFileTests: public RunTests
+{
+public:
+  void run_tests();
+private:
+  void run_tests_for_storage_order(const ProjDataFromStream::StorageOrder);
+};
+
+void
+ProjDataFromMemoryMappedFileTests::
+run_tests_for_storage_order(const ProjDataFromStream::StorageOrder storage_order)
+{
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  shared_ptr<ProjDataInfo> proj_data_info_sptr
+    (ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                   /*span*/1, 4,/*views*/ 24, /*tang_pos*/32, /*arc_corrected*/ true)
+     );
+  shared_ptr<ExamInfo> exam_info_sptr(new ExamInfo);
+  const float scale_factor = 2.F;
+
+  std::vector<int> segment_sequence;
+  // write some data, different for each bin
+  {
+    ProjDataInterfile proj_data(exam_info_sptr, proj_data_info_sptr,
+                                "STIRtmp_mmap", std::ios::out,
+                                storage_order);
+    segment_sequence = proj_data.get_segment_sequence_in_stream();
+    for (int segment_num = proj_data.get_min_segment_num();
+         segment_num <= proj_data.get_max_segment_num();
+         ++segment_num)
+      {
+        SegmentByView<float> segment = proj_data.get_empty_segment_by_view(segment_num);
+        float value = 1000.F*segment_num;
+        for (SegmentByView<float>::full_iterator iter = segment.begin_all();
+             iter != segment.end_all();
+             ++iter)
+          *iter = value++;
+        check(proj_data.set_segment(segment) == Succeeded::yes,
+              "test writing data");
+      }
+  }
+
+  shared_ptr<std::iostream>
+    stream_sptr(new std::fstream("STIRtmp_mmap.s", std::ios::in | std::ios::binary));
+  ProjDataFromStream proj_data_stream(exam_info_sptr, proj_data_info_sptr,
+                                      stream_sptr, 0, segment_sequence,
+                                      storage_order, NumericType::FLOAT,
+                                      ByteOrder::native, scale_factor);
+  shared_ptr<std::iostream>
+    mmap_stream_sptr(new std::fstream("STIRtmp_mmap.s", std::ios::in | std::ios::out | std::ios::binary));
+  ProjDataFromMemoryMappedFile proj_data_mmap(exam_info_sptr, proj_data_info_sptr,
+                                              "STIRtmp_mmap.s",
+                                              mmap_stream_sptr, 0, segment_sequence,
+                                              storage_order, NumericType::FLOAT,
+                                              ByteOrder::native, scale_factor);
+#ifdef HAVE_SYSTEM_MMAP
+  check(proj_data_mmap.is_memory_mapped(), "test if file is memory mapped");
+#endif
+
+  for (int segment_num = proj_data_mmap.get_min_segment_num();
+       segment_num <= proj_data_mmap.get_max_segment_num();
+       ++segment_num)
+    {
+      check_if_equal(proj_data_mmap.get_viewgram(2, segment_num),
+                     proj_data_stream.get_viewgram(2, segment_num),
+                     "test get_viewgram");
+      check_if_equal(proj_data_mmap.get_viewgram(3, segment_num, true),
+                     proj_data_stream.get_viewgram(3, segment_num, true),
+                     "test get_viewgram with make_num_tangential_poss_odd");
+      const int ax_pos_num = proj_data_mmap.get_max_axial_pos_num(segment_num);
+      check_if_equal(proj_data_mmap.get_sinogram(ax_pos_num, segment_num),
+                     proj_data_stream.get_sinogram(ax_pos_num, segment_num),
+                     "test get_sinogram");
+      check_if_equal(proj_data_mmap.get_segment_by_view(segment_num),
+                     proj_data_stream.get_segment_by_view(segment_num),
+                     "test get_segment_by_view");
+      check_if_equal(proj_data_mmap.get_segment_by_sinogram(segment_num),
+                     proj_data_stream.get_segment_by_sinogram(segment_num),
+                     "test get_segment_by_sinogram");
+    }
+
+  // test that data written via the stream are seen via the mapping
+  // (use a scale factor of 1 as ProjDataFromStream cannot write float data with another scale factor)
+  {
+    ProjDataFromMemoryMappedFile proj_data(exam_info_sptr, proj_data_info_sptr,
+                                           "STIRtmp_mmap.s",
+                                           mmap_stream_sptr, 0, segment_sequence,
+                                           storage_order);
+    Viewgram<float> viewgram = proj_data.get_empty_viewgram(1,1);
+    viewgram.fill(5.F);
+    check(proj_data.set_viewgram(viewgram) == Succeeded::yes,
+          "test set_viewgram succeeded");
+    check_if_equal(proj_data.get_viewgram(1,1), viewgram,
+                   "test set/get_viewgram");
+    check_if_equal(proj_data_mmap.get_viewgram(1,1).find_max(), 5.F*scale_factor,
+                   "test get_viewgram from other object after set_viewgram");
+    check_if_equal(proj_data_mmap.get_viewgram(2,1),
+                   proj_data_stream.get_viewgram(2,1),
+                   "test get_viewgram after set_viewgram");
+  }
+}
+
+void
+ProjDataFromMemoryMappedFileTests::
+run_tests()
+{
+  std::cerr << "-------- Testing ProjDataFromMemoryMappedFile --------\n";
+  std::cerr << "Storage order Segment_View_AxialPos_TangPos\n";
+  run_tests_for_storage_order(ProjDataFromStream::Segment_View_AxialPos_TangPos);
+  std::cerr << "Storage order Segment_AxialPos_View_TangPos\n";
+  run_tests_for_storage_order(ProjDataFromStream::Segment_AxialPos_View_TangPos);
+  std::remove("STIRtmp_mmap.s");
+  std::remove("STIRtmp_mmap.hs");
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  ProjDataFromMemoryMappedFileTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
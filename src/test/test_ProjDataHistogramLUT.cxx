@@ -0,0 +1,153 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+  \ingroup listmode
+
+  \brief Test program for stir::ProjDataHistogramLUT
+
+  For all detector pairs of a small scanner, the offset found with
+  ProjDataHistogramLUT::get_offset_for_det_pair() is compared with the offset
+  of the bin found with ProjDataInfoCylindricalNoArcCorr::get_bin_for_det_pair()
+  (or -1 if that bin is not in the range of the projection data). This is done
+  for projection data with view mashing, a reduced segment range and a reduced
+  number of tangential positions, both without and with axial compression.
+*/
+
+#include "stir/listmode/ProjDataHistogramLUT.h"
+#include "stir/ProjDataInfoCylindricalNoArcCorr.h"
+#include "stir/Scanner.h"
+#include "stir/Bin.h"
+#include "stir/Succeeded.h"
+#include "stir/RunTests.h"
+#include "stir/shared_ptr.h"
+#include <iostream>
+#include <sstream>
+#include <cstddef>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for ProjDataHistogramLUT
+*/
+class ProjDataHistogramLUTTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  void run_tests_for_1_proj_data_info(const ProjDataInfoCylindricalNoArcCorr& proj_data_info);
+};
+
+void
+ProjDataHistogramLUTTests::
+run_tests_for_1_proj_data_info(const ProjDataInfoCylindricalNoArcCorr& proj_data_info)
+{
+  std::cerr << "\tspan " << proj_data_info.get_max_ring_difference(0) - proj_data_info.get_min_ring_difference(0) + 1
+            << ", max segment " << proj_data_info.get_max_segment_num()
+            << ", " << proj_data_info.get_num_views() << " views, "
+            << proj_data_info.get_num_tangential_poss() << " tangential positions\n";
+
+  const ProjDataHistogramLUT lut(proj_data_info);
+  const int num_detectors_per_ring = proj_data_info.get_scanner_ptr()->get_num_detectors_per_ring();
+  const int num_rings = proj_data_info.get_scanner_ptr()->get_num_rings();
+  int num_bins_in_range = 0;
+  for (int ring1_num=0; ring1_num<num_rings; ++ring1_num)
+    for (int ring2_num=0; ring2_num<num_rings; ++ring2_num)
+      for (int det1_num=0; det1_num<num_detectors_per_ring; ++det1_num)
+        for (int det2_num=0; det2_num<num_detectors_per_ring; ++det2_num)
+          {
+            int segment_num = 0;
+            const std::ptrdiff_t offset =
+              lut.get_offset_for_det_pair(segment_num, det1_num, ring1_num, det2_num, ring2_num);
+
+            std::ptrdiff_t expected_offset = -1;
+            Bin bin;
+            if (det1_num != det2_num &&
+                proj_data_info.get_bin_for_det_pair(bin, det1_num, ring1_num, det2_num, ring2_num) == Succeeded::yes &&
+                bin.segment_num() >= proj_data_info.get_min_segment_num() &&
+                bin.segment_num() <= proj_data_info.get_max_segment_num() &&
+                bin.axial_pos_num() >= proj_data_info.get_min_axial_pos_num(bin.segment_num()) &&
+                bin.axial_pos_num() <= proj_data_info.get_max_axial_pos_num(bin.segment_num()) &&
+                bin.tangential_pos_num() >= proj_data_info.get_min_tangential_pos_num() &&
+                bin.tangential_pos_num() <= proj_data_info.get_max_tangential_pos_num())
+              {
+                // bins are stored by view, axial position and tangential position
+                expected_offset =
+                  (static_cast<std::ptrdiff_t>(bin.view_num() - proj_data_info.get_min_view_num()) *
+                   proj_data_info.get_num_axial_poss(bin.segment_num()) +
+                   (bin.axial_pos_num() - proj_data_info.get_min_axial_pos_num(bin.segment_num()))) *
+                  proj_data_info.get_num_tangential_poss() +
+                  (bin.tangential_pos_num() - proj_data_info.get_min_tangential_pos_num());
+                ++num_bins_in_range;
+              }
+
+            if (offset != expected_offset ||
+                (expected_offset >= 0 && segment_num != bin.segment_num()))
+              {
+                std::ostringstream str;
+                str << "offset for detectors " << det1_num << ", " << det2_num
+                    << " and rings " << ring1_num << ", " << ring2_num
+                    << " is " << offset << " in segment " << segment_num
+                    << " but should be " << expected_offset;
+                if (expected_offset >= 0)
+                  str << " in segment " << bin.segment_num();
+                check(false, str.str());
+                return;
+              }
+          }
+  // every bin corresponds to at least 1 detector pair
+  check(num_bins_in_range >= proj_data_info.get_num_views()*proj_data_info.get_num_tangential_poss(),
+        "a reasonable number of detector pairs should be in range");
+}
+
+void
+ProjDataHistogramLUTTests::run_tests()
+{
+  std::cerr << "Tests for ProjDataHistogramLUT" << std::endl;
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  const int num_detectors_per_ring = scanner_sptr->get_num_detectors_per_ring();
+
+  // no axial compression, view mashing 2, reduced segment and tangential range
+  {
+    shared_ptr<ProjDataInfo> proj_data_info_sptr(
+      ProjDataInfo::ProjDataInfoCTI(scanner_sptr, /*span=*/1, /*max_delta=*/5,
+                                    /*num_views=*/num_detectors_per_ring/4,
+                                    /*num_tang_poss=*/64, /*arc_corrected=*/false));
+    run_tests_for_1_proj_data_info(dynamic_cast<const ProjDataInfoCylindricalNoArcCorr&>(*proj_data_info_sptr));
+  }
+  // axial compression, view mashing 4, odd number of tangential positions
+  {
+    shared_ptr<ProjDataInfo> proj_data_info_sptr(
+      ProjDataInfo::ProjDataInfoCTI(scanner_sptr, /*span=*/3, /*max_delta=*/7,
+                                    /*num_views=*/num_detectors_per_ring/8,
+                                    /*num_tang_poss=*/101, /*arc_corrected=*/false));
+    run_tests_for_1_proj_data_info(dynamic_cast<const ProjDataInfoCylindricalNoArcCorr&>(*proj_data_info_sptr));
+  }
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  ProjDataHistogramLUTTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
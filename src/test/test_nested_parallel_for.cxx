@@ -0,0 +1,193 @@
+/*
+    Copyright (C) 2018, University College London
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+   See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+
+  \brief Test program for stir::nested_parallel_for()
+*/
+#include "stir/nested_parallel_for.h"
+#include "stir/RunTests.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+START_NAMESPACE_STIR
+
+/*!
+  \brief Test class for stir::nested_parallel_for()
+  \ingroup test
+
+  Every call computes a sum with OpenMP (as the objective functions do for a single frame
+  or gate). The tests check that every index is processed once, and that an exception
+  thrown for one index (e.g. by error() in the objective function of one frame) reaches the
+  caller when several indices are processed in parallel.
+*/
+class NestedParallelForTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  enum ExceptionType { no_exception, error_exception, std_exception, other_exception };
+  //! calls nested_parallel_for() where the call for \a failing_index throws an exception of type \a exception_type
+  /*! \a num_calls is set to the number of times the call for every index was made,
+      \a sums to the sums computed in these calls. */
+  void run(const int num_in_parallel, const int num_threads_per_call,
+           const int failing_index, const ExceptionType exception_type,
+           std::vector<int>& num_calls, std::vector<double>& sums);
+  void check_all_indices_processed(const std::vector<int>& num_calls, const std::vector<double>& sums,
+                                   const int failing_index, const std::string& str);
+};
+
+static const int min_index = 1;
+static const int max_index = 6;
+static const int num_terms = 1000;
+
+void
+NestedParallelForTests::
+run(const int num_in_parallel, const int num_threads_per_call,
+    const int failing_index, const ExceptionType exception_type,
+    std::vector<int>& num_calls, std::vector<double>& sums)
+{
+  num_calls.assign(max_index+1, 0);
+  sums.assign(max_index+1, 0.);
+  nested_parallel_for(min_index, max_index, num_in_parallel, num_threads_per_call,
+                      [&](const int i)
+                      {
+                        ++num_calls[i];
+                        if (i == failing_index)
+                          {
+                            switch (exception_type)
+                              {
+                              case error_exception:
+                                error(boost::format("objective function for frame %1% failed") % i);
+                                break;
+                              case std_exception:
+                                throw std::runtime_error("runtime error in frame");
+                              case other_exception:
+                                throw 1;
+                              case no_exception:
+                                break;
+                              }
+                          }
+                        double sum = 0.;
+#ifdef STIR_OPENMP
+#pragma omp parallel for reduction(+:sum)
+#endif
+                        for (int t=1; t<=num_terms; ++t)
+                          sum += t*i;
+                        sums[i] = sum;
+                      },
+                      "frames");
+}
+
+void
+NestedParallelForTests::
+check_all_indices_processed(const std::vector<int>& num_calls, const std::vector<double>& sums,
+                            const int failing_index, const std::string& str)
+{
+  for (int i=min_index; i<=max_index; ++i)
+    {
+      check_if_equal(num_calls[i], 1, str + ": every index should be processed once");
+      if (i != failing_index)
+        check_if_equal(sums[i], static_cast<double>(i)*num_terms*(num_terms+1)/2,
+                       str + ": sum for every index");
+    }
+}
+
+void
+NestedParallelForTests::
+run_tests()
+{
+  std::cerr << "Tests for nested_parallel_for\n";
+  std::vector<int> num_calls;
+  std::vector<double> sums;
+
+  for (int num_in_parallel=1; num_in_parallel<=4; ++num_in_parallel)
+    for (int num_threads_per_call=0; num_threads_per_call<=2; ++num_threads_per_call)
+      {
+        const std::string str =
+          boost::str(boost::format("%1% in parallel, %2% threads per call") % num_in_parallel % num_threads_per_call);
+
+        run(num_in_parallel, num_threads_per_call, -1, no_exception, num_calls, sums);
+        check_all_indices_processed(num_calls, sums, -1, str);
+
+        const int failing_index = 3;
+        {
+          bool caught = false;
+          try
+            {
+              run(num_in_parallel, num_threads_per_call, failing_index, error_exception, num_calls, sums);
+            }
+          catch (const std::string& message)
+            {
+              caught = true;
+              check(message.find("objective function for frame 3 failed") != std::string::npos,
+                    str + ": message of error() should be passed on");
+            }
+          check(caught, str + ": error() for one index should reach the caller");
+          // without OpenMP or in a serial loop, the remaining indices are not processed
+          if (num_calls[max_index] == 1)
+            check_all_indices_processed(num_calls, sums, failing_index, str + " after error()");
+        }
+        {
+          bool caught = false;
+          try
+            {
+              run(num_in_parallel, num_threads_per_call, failing_index, std_exception, num_calls, sums);
+            }
+          catch (const std::string& message)
+            {
+              caught = true;
+              check(message.find("runtime error in frame") != std::string::npos,
+                    str + ": message of std::exception should be passed on");
+            }
+          catch (const std::exception&)
+            {
+              // serial loop
+              caught = true;
+            }
+          check(caught, str + ": std::exception for one index should reach the caller");
+        }
+        {
+          bool caught = false;
+          try
+            {
+              run(num_in_parallel, num_threads_per_call, failing_index, other_exception, num_calls, sums);
+            }
+          catch (...)
+            {
+              caught = true;
+            }
+          check(caught, str + ": other exceptions for one index should reach the caller");
+        }
+      }
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  NestedParallelForTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
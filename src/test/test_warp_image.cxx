@@ -32,8 +32,10 @@
 #include "stir/spatial_transformation/warp_image.h"
 #include "stir/RunTests.h"
 #include "stir/spatial_transformation/GatedSpatialTransformation.h"
+#include "stir/spatial_transformation/WarpImageStencil.h"
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 
 #ifndef STIR_NO_NAMESPACES
 using std::cerr;
@@ -168,6 +170,63 @@ warp_imageTests::run_tests()
     check_if_equal(accumulated_image[indices], 2.F, "testing the accumulated image at the original location of non-zero point");
     check_if_equal(accumulated_image[new_indices], 0.F, "testing the accumulated image at the location where the non-zero point had moved");
   }
+  {
+    VoxelsOnCartesianGrid<float> cached_accumulated_image(range, origin, grid_spacing);
+    mvtest.set_cache_interpolation_weights(true);
+    mvtest.warp_image(cached_accumulated_image,gated_image);
+    // do it again to use the cache
+    mvtest.warp_image(cached_accumulated_image,gated_image);
+    check(cached_accumulated_image == accumulated_image, "testing accumulate_warp_image with cached interpolation weights");
+  }
+
+  std::cerr << "Tests for class WarpImageStencil" << std::endl;
+  {
+    // non-integer motion such that interpolation is needed
+    VoxelsOnCartesianGrid<float> test_image(range, origin, grid_spacing);
+    VoxelsOnCartesianGrid<float> other_image(range, origin, grid_spacing);
+    BasicCoordinate<3,int> c;
+    for (c[1]=range.get_min_index(); c[1]<=range.get_max_index(); ++c[1])
+      for (c[2]=range[c[1]].get_min_index(); c[2]<=range[c[1]].get_max_index(); ++c[2])
+        for (c[3]=range[c[1]][c[2]].get_min_index(); c[3]<=range[c[1]][c[2]].get_max_index(); ++c[3])
+          {
+            test_image[c] = 1.F + std::sin(.3F*c[1]) * std::cos(.2F*c[2] - .1F*c[3]);
+            other_image[c] = 2.F + std::cos(.1F*c[1] + .4F*c[3]);
+            motion_x[c] = grid_spacing[3] * 2.3F * std::sin(.1F*c[1] + .05F*c[2]);
+            motion_y[c] = grid_spacing[2] * (-1.7F + .04F*c[3]);
+            motion_z[c] = grid_spacing[1] * 1.4F * std::cos(.15F*c[3]);
+          }
+    const shared_ptr<VoxelsOnCartesianGrid<float> > test_image_sptr(test_image.clone());
+    const shared_ptr<VoxelsOnCartesianGrid<float> > non_integer_motion_x_sptr(motion_x.clone());
+    const shared_ptr<VoxelsOnCartesianGrid<float> > non_integer_motion_y_sptr(motion_y.clone());
+    const shared_ptr<VoxelsOnCartesianGrid<float> > non_integer_motion_z_sptr(motion_z.clone());
+
+    for (int spline_type=BSpline::near_n; spline_type<=BSpline::linear; ++spline_type)
+      {
+        const VoxelsOnCartesianGrid<float> warped_image =
+          warp_image(test_image_sptr, non_integer_motion_x_sptr, non_integer_motion_y_sptr, non_integer_motion_z_sptr,
+                     BSpline::BSplineType(spline_type), 0);
+        const WarpImageStencil stencil(test_image, motion_x, motion_y, motion_z, BSpline::BSplineType(spline_type));
+        check(stencil.is_compatible(test_image), "testing WarpImageStencil::is_compatible");
+
+        VoxelsOnCartesianGrid<float> stencil_warped_image(range, origin, grid_spacing);
+        stencil.apply(stencil_warped_image, test_image);
+        check(stencil_warped_image == warped_image, "testing WarpImageStencil::apply gives the same result as warp_image");
+
+        // check <W x, y> == <x, W^T y>
+        VoxelsOnCartesianGrid<float> transposed_image(range, origin, grid_spacing);
+        stencil.apply_transpose(transposed_image, other_image);
+        double inner_product_forward = 0.;
+        double inner_product_transpose = 0.;
+        for (c[1]=range.get_min_index(); c[1]<=range.get_max_index(); ++c[1])
+          for (c[2]=range[c[1]].get_min_index(); c[2]<=range[c[1]].get_max_index(); ++c[2])
+            for (c[3]=range[c[1]][c[2]].get_min_index(); c[3]<=range[c[1]][c[2]].get_max_index(); ++c[3])
+              {
+                inner_product_forward += static_cast<double>(stencil_warped_image[c]) * other_image[c];
+                inner_product_transpose += static_cast<double>(test_image[c]) * transposed_image[c];
+              }
+        check_if_equal(inner_product_forward, inner_product_transpose, "testing WarpImageStencil::apply_transpose is the adjoint of apply");
+      }
+  }
 }
 END_NAMESPACE_STIR
 
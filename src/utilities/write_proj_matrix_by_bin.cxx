@@ -7,6 +7,11 @@
 
   \brief Program that writes a projection matrix by bin to file
 
+  The matrix is written in the Version 1.0 format of
+  stir::ProjMatrixByBinFromFile, or with the option <tt>--version 2.0</tt> in
+  the indexed format that can be read lazily (but not by older versions of STIR).
+  Rows are computed in parallel when STIR is compiled with OpenMP.
+
   \author Kris Thielemans
   
 */
@@ -38,6 +43,7 @@
 #include "stir/is_null_ptr.h"
 #include "stir/Coordinate3D.h"
 #include "stir/IO/read_from_file.h"
+#include <string>
 
 #ifndef STIR_NO_NAMESPACES
 using std::endl;
@@ -50,10 +56,16 @@ int
 main(int argc, char **argv)
 {  
   USING_NAMESPACE_STIR
+  std::string version = "1.0";
+  if (argc>2 && std::string(argv[1]) == "--version")
+    {
+      version = argv[2];
+      argc -= 2; argv += 2;
+    }
   if (argc==1 || argc>5)
   {
     cerr <<"Usage: " << argv[0] << " \\\n"
-	 << "\toutput-filename [proj_data_file [projmatrixbybin-parfile [template-image]]]\n";
+	 << "\t[--version 1.0|2.0] output-filename [proj_data_file [projmatrixbybin-parfile [template-image]]]\n";
     exit(EXIT_FAILURE);
   }
   const std::string output_filename_prefix=
@@ -122,7 +134,8 @@ main(int argc, char **argv)
     write_to_file(output_filename_prefix, 
 		  *proj_matrix_sptr, 
 		  proj_data_info_sptr,
-		  *image_sptr) == Succeeded::yes ?
+		  *image_sptr,
+		  version) == Succeeded::yes ?
     EXIT_SUCCESS : EXIT_FAILURE;
 }
 